@@ -0,0 +1,421 @@
+"""
+End-to-end MCP load generator for the Cortex transports.
+
+Starts a Cortex server in a child process with transport="all" against a
+freshly seeded .ctx file, then drives N concurrent local clients over
+stdio, HTTP+SSE and WebSocket with a configurable mix of tool calls.
+Everything runs on localhost, no network access needed.
+
+    python benchmarks/mcp_load.py --clients 8 --requests 200 \
+        --mix query:6,scan:1,execute:2,tables:1 --json report.json
+
+Per transport it reports throughput, latency percentiles, a latency
+histogram and the server CPU time spent per request.
+"""
+import argparse
+import asyncio
+import itertools
+import json
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+import httpx
+import websockets
+
+SEED_TABLE = "bench_items"
+HISTOGRAM_BOUNDS_MS = [0.25, 0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000]
+TRANSPORTS = ("stdio", "sse", "websocket")
+
+
+# ── Server side ────────────────────────────
+
+def serve(db_path: str, port: int, rows: int):
+    """Runs in the child process: open, seed, then serve until killed."""
+    import cortex
+
+    db = cortex.connect(db_path, transport="all", port=port)
+    db.execute(
+        f"CREATE TABLE IF NOT EXISTS {SEED_TABLE} "
+        "(id INTEGER PRIMARY KEY, agent TEXT, body TEXT, score REAL)"
+    )
+    db.execute(f"CREATE INDEX IF NOT EXISTS {SEED_TABLE}_score ON {SEED_TABLE}(score)")
+    rng = random.Random(42)
+    values = ", ".join(
+        f"({i}, 'agent-{i % 16}', 'memory note {i} {'x' * 64}', {rng.random():.6f})"
+        for i in range(1, rows + 1)
+    )
+    db.execute(f"BEGIN; INSERT INTO {SEED_TABLE} VALUES {values}; COMMIT;")
+
+    time.sleep(1.0)  # let uvicorn bind both ports
+    print("CORTEX-BENCH-READY", file=sys.stderr, flush=True)
+    while True:
+        time.sleep(1)
+
+
+def server_cpu_seconds(pid: int):
+    """utime + stime of the server process, or None off Linux."""
+    try:
+        with open(f"/proc/{pid}/stat") as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+    except (OSError, IndexError, ValueError):
+        return None
+
+
+# ── Clients ────────────────────────────────
+
+class _RpcClient:
+    """Matches JSON-RPC responses to pending requests by id."""
+
+    def __init__(self):
+        self._ids = itertools.count(1)
+        self._pending = {}
+
+    def _dispatch(self, message: dict):
+        future = self._pending.pop(message.get("id"), None)
+        if future is not None and not future.done():
+            future.set_result(message)
+
+    def _fail_pending(self, exc: Exception):
+        for future in self._pending.values():
+            if not future.done():
+                future.set_exception(exc)
+        self._pending.clear()
+
+    async def call(self, method: str, params: dict) -> dict:
+        request_id = next(self._ids)
+        future = asyncio.get_running_loop().create_future()
+        self._pending[request_id] = future
+        await self._send({"jsonrpc": "2.0", "id": request_id, "method": method, "params": params})
+        return await future
+
+    async def notify(self, method: str):
+        await self._send({"jsonrpc": "2.0", "method": method})
+
+    async def initialize(self):
+        await self.call("initialize", {
+            "protocolVersion": "2024-11-05",
+            "capabilities": {},
+            "clientInfo": {"name": "cortex-bench", "version": "1.0"},
+        })
+        await self.notify("notifications/initialized")
+
+
+class StdioClient(_RpcClient):
+    """All stdio clients share the child's single stdin/stdout pipe."""
+
+    def __init__(self, proc):
+        super().__init__()
+        self._proc = proc
+        self._reader = asyncio.create_task(self._read_loop())
+
+    async def _read_loop(self):
+        while True:
+            line = await self._proc.stdout.readline()
+            if not line:
+                self._fail_pending(ConnectionError("stdio closed"))
+                return
+            try:
+                message = json.loads(line)
+            except json.JSONDecodeError:
+                continue  # banner / debug output shares stdout
+            if isinstance(message, dict):
+                self._dispatch(message)
+
+    async def _send(self, payload: dict):
+        self._proc.stdin.write(json.dumps(payload).encode() + b"\n")
+        await self._proc.stdin.drain()
+
+    async def close(self):
+        self._reader.cancel()
+
+
+class SSEClient(_RpcClient):
+    def __init__(self, port: int):
+        super().__init__()
+        self._http = httpx.AsyncClient(base_url=f"http://localhost:{port}", timeout=None)
+        self._endpoint = asyncio.get_running_loop().create_future()
+        self._reader = None
+
+    async def connect(self):
+        self._reader = asyncio.create_task(self._read_loop())
+        await asyncio.wait_for(asyncio.shield(self._endpoint), timeout=10)
+        await self.initialize()
+
+    async def _read_loop(self):
+        try:
+            async with self._http.stream("GET", "/sse") as response:
+                event = None
+                async for line in response.aiter_lines():
+                    if line.startswith("event:"):
+                        event = line[6:].strip()
+                    elif line.startswith("data:"):
+                        data = line[5:].strip()
+                        if event == "endpoint" and not self._endpoint.done():
+                            self._endpoint.set_result(data)
+                        elif event == "message":
+                            self._dispatch(json.loads(data))
+        except Exception as exc:
+            self._fail_pending(ConnectionError(str(exc)))
+            if not self._endpoint.done():
+                self._endpoint.set_exception(exc)
+
+    async def _send(self, payload: dict):
+        endpoint = await self._endpoint
+        response = await self._http.post(endpoint, json=payload)
+        response.raise_for_status()
+
+    async def close(self):
+        if self._reader:
+            self._reader.cancel()
+        await self._http.aclose()
+
+
+class WebSocketClient(_RpcClient):
+    def __init__(self, port: int):
+        super().__init__()
+        self._url = f"ws://localhost:{port}/ws"
+        self._ws = None
+        self._reader = None
+
+    async def connect(self):
+        self._ws = await websockets.connect(self._url, max_size=None)
+        await self._ws.recv()  # "connected" event
+        self._reader = asyncio.create_task(self._read_loop())
+
+    async def _read_loop(self):
+        try:
+            async for raw in self._ws:
+                self._dispatch(json.loads(raw))
+        except Exception as exc:
+            self._fail_pending(ConnectionError(str(exc)))
+        else:
+            self._fail_pending(ConnectionError("websocket closed"))
+
+    async def _send(self, payload: dict):
+        await self._ws.send(json.dumps(payload))
+
+    async def close(self):
+        if self._reader:
+            self._reader.cancel()
+        await self._ws.close()
+
+
+# ── Workload ───────────────────────────────
+
+def parse_mix(spec: str) -> list:
+    weights = []
+    for part in spec.split(","):
+        name, _, weight = part.partition(":")
+        name = name.strip()
+        if name not in TOOL_CALLS:
+            raise argparse.ArgumentTypeError(f"unknown tool in mix: {name}")
+        weights.append((name, int(weight or 1)))
+    return weights
+
+
+TOOL_CALLS = {
+    "query": lambda rng, rows: ("cortex_query", {
+        "sql": f"SELECT * FROM {SEED_TABLE} WHERE id = {rng.randint(1, rows)}"
+    }),
+    "scan": lambda rng, rows: ("cortex_query", {
+        "sql": f"SELECT id, agent, score FROM {SEED_TABLE} ORDER BY score DESC LIMIT 50"
+    }),
+    "execute": lambda rng, rows: ("cortex_execute", {
+        "sql": f"INSERT INTO {SEED_TABLE}(agent, body, score) "
+               f"VALUES ('bench', 'load note', {rng.random():.6f})"
+    }),
+    "tables": lambda rng, rows: ("cortex_tables", {}),
+    "schema": lambda rng, rows: ("cortex_schema", {"table": SEED_TABLE}),
+}
+
+
+async def run_client(client, client_no: int, args, latencies: list, errors: list):
+    rng = random.Random(args.seed + client_no)
+    names = [name for name, _ in args.mix]
+    weights = [weight for _, weight in args.mix]
+    for _ in range(args.requests):
+        tool, arguments = TOOL_CALLS[rng.choices(names, weights)[0]](rng, args.rows)
+        start = time.perf_counter()
+        try:
+            response = await asyncio.wait_for(
+                client.call("tools/call", {"name": tool, "arguments": arguments}),
+                timeout=args.timeout,
+            )
+        except Exception as exc:
+            errors.append(f"{tool}: {exc!r}")
+            continue
+        latencies.append((time.perf_counter() - start) * 1000.0)
+        result = response.get("result") or {}
+        text = "".join(c.get("text", "") for c in result.get("content", []))
+        if "error" in response or result.get("isError") or text.startswith("Error"):
+            errors.append(f"{tool}: {response.get('error') or text}")
+
+
+async def bench_transport(transport: str, proc, args) -> dict:
+    if transport == "stdio":
+        shared = StdioClient(proc)
+        await shared.initialize()
+        clients = [shared] * args.clients
+    else:
+        clients = [
+            SSEClient(args.port) if transport == "sse" else WebSocketClient(args.port + 1)
+            for _ in range(args.clients)
+        ]
+        await asyncio.gather(*(c.connect() for c in clients))
+
+    latencies, errors = [], []
+    cpu_before = server_cpu_seconds(proc.pid)
+    started = time.perf_counter()
+    await asyncio.gather(*(
+        run_client(client, n, args, latencies, errors) for n, client in enumerate(clients)
+    ))
+    wall = time.perf_counter() - started
+    cpu_after = server_cpu_seconds(proc.pid)
+
+    for client in set(clients):
+        await client.close()
+    return summarize(transport, latencies, errors, wall, cpu_before, cpu_after)
+
+
+def summarize(transport, latencies, errors, wall, cpu_before, cpu_after) -> dict:
+    latencies.sort()
+
+    def pct(p):
+        if not latencies:
+            return None
+        return round(latencies[min(len(latencies) - 1, int(p * (len(latencies) - 1) + 0.5))], 3)
+
+    histogram, remaining = [], list(latencies)
+    for bound in HISTOGRAM_BOUNDS_MS + [float("inf")]:
+        count = sum(1 for v in remaining if v <= bound)
+        remaining = remaining[count:]
+        histogram.append({"le_ms": bound if bound != float("inf") else "+Inf", "count": count})
+
+    completed = len(latencies)
+    cpu_ms = None
+    if cpu_before is not None and cpu_after is not None and completed:
+        cpu_ms = round((cpu_after - cpu_before) * 1000.0 / completed, 4)
+
+    return {
+        "transport": transport,
+        "requests": completed,
+        "errors": len(errors),
+        "error_samples": errors[:5],
+        "seconds": round(wall, 4),
+        "throughput_rps": round(completed / wall, 1) if wall > 0 else None,
+        "latency_ms": {
+            "p50": pct(0.50), "p90": pct(0.90), "p99": pct(0.99), "p999": pct(0.999),
+            "max": round(latencies[-1], 3) if latencies else None,
+        },
+        "histogram": histogram,
+        "server_cpu_ms_per_request": cpu_ms,
+    }
+
+
+async def run(args) -> dict:
+    workdir = tempfile.mkdtemp(prefix="cortex-bench-")
+    try:
+        return await _run(args, workdir)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+async def _run(args, workdir: str) -> dict:
+    # a --db that exists is only replaced with --overwrite (checked in main)
+    db_path = args.db or os.path.join(workdir, "bench.ctx")
+    if args.db:
+        for suffix in ("", "-wal", "-shm", "-journal"):
+            if os.path.exists(db_path + suffix):
+                os.remove(db_path + suffix)
+
+    proc = await asyncio.create_subprocess_exec(
+        sys.executable, os.path.abspath(__file__), "--serve",
+        "--db", db_path, "--port", str(args.port), "--rows", str(args.rows),
+        stdin=asyncio.subprocess.PIPE,
+        stdout=asyncio.subprocess.PIPE,
+        stderr=asyncio.subprocess.PIPE,
+        limit=64 * 1024 * 1024,
+    )
+    try:
+        while True:
+            line = await asyncio.wait_for(proc.stderr.readline(), timeout=60)
+            if not line:
+                raise RuntimeError("benchmark server exited during startup")
+            if b"CORTEX-BENCH-READY" in line:
+                break
+        drain = asyncio.create_task(_drain(proc.stderr))
+
+        results = []
+        for transport in args.transports:
+            results.append(await bench_transport(transport, proc, args))
+        drain.cancel()
+    finally:
+        proc.kill()
+        await proc.wait()
+
+    return {
+        "clients": args.clients,
+        "requests_per_client": args.requests,
+        "mix": dict(args.mix),
+        "seed_rows": args.rows,
+        "transports": results,
+    }
+
+
+async def _drain(stream):
+    while await stream.readline():
+        pass
+
+
+def print_table(report: dict):
+    print(f"{'transport':<10} {'reqs':>7} {'errs':>5} {'req/s':>9} "
+          f"{'p50ms':>8} {'p99ms':>8} {'p999ms':>8} {'cpu ms/req':>10}")
+    for r in report["transports"]:
+        lat = r["latency_ms"]
+        print(f"{r['transport']:<10} {r['requests']:>7} {r['errors']:>5} "
+              f"{r['throughput_rps'] or 0:>9} {lat['p50'] or 0:>8} {lat['p99'] or 0:>8} "
+              f"{lat['p999'] or 0:>8} {r['server_cpu_ms_per_request'] or '-':>10}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--requests", type=int, default=200, help="tool calls per client")
+    parser.add_argument("--mix", type=parse_mix, default=parse_mix("query:6,scan:1,execute:2,tables:1"))
+    parser.add_argument("--transports", default=",".join(TRANSPORTS))
+    parser.add_argument("--rows", type=int, default=10000, help="rows seeded before the run")
+    parser.add_argument("--port", type=int, default=5190, help="SSE port; WebSocket uses port + 1")
+    parser.add_argument("--db", default=None,
+                        help="path of the seeded .ctx file (default: a temporary directory)")
+    parser.add_argument("--overwrite", action="store_true", help="replace --db if it exists")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=30.0, help="per-call timeout in seconds")
+    parser.add_argument("--json", default=None, help="also write the report to this file")
+    parser.add_argument("--serve", action="store_true", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.serve:
+        serve(args.db, args.port, args.rows)
+        return
+
+    if args.db and os.path.exists(args.db) and not args.overwrite:
+        parser.error(f"{args.db} exists; pass --overwrite to replace it")
+    args.transports = [t.strip() for t in args.transports.split(",") if t.strip()]
+    for transport in args.transports:
+        if transport not in TRANSPORTS:
+            parser.error(f"unknown transport: {transport}")
+
+    report = asyncio.run(run(args))
+    print_table(report)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+#ifndef CORTEX_BENCH_UTIL_H
+#define CORTEX_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Helpers shared by the benchmarks: a monotonic clock, a seeded PRNG
+    and clustered test vectors. Each benchmark is one translation unit,
+    so the state here is per program.
+*/
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_state;
+
+/* xorshift64* — fast and deterministic for a given seed */
+static inline uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+/* Uniform in [-1, 1) */
+static inline float rng_unit(void) {
+    return (float)(rng_next() >> 40) / (float)(1 << 24) * 2.0f - 1.0f;
+}
+
+static inline void remove_db(const char *path) {
+    char buf[1024];
+    unlink(path);
+    snprintf(buf, sizeof(buf), "%s-wal", path);
+    unlink(buf);
+    snprintf(buf, sizeof(buf), "%s-shm", path);
+    unlink(buf);
+    snprintf(buf, sizeof(buf), "%s-journal", path);
+    unlink(buf);
+}
+
+/*
+    Real embeddings cluster; uniform noise would understate how well
+    quantized codes keep neighbourhoods apart. Points are cluster
+    centres plus noise.
+*/
+static inline float *make_points(int n, int dim, const float *centers, int n_centers) {
+    float *p = malloc((size_t)n * dim * sizeof(float));
+    int i, d;
+
+    if (!p) return NULL;
+    for (i = 0; i < n; i++) {
+        const float *c = centers + (size_t)(rng_next() % (uint64_t)n_centers) * dim;
+        for (d = 0; d < dim; d++) p[(size_t)i * dim + d] = c[d] + 0.3f * rng_unit();
+    }
+    return p;
+}
+
+#endif
@@ -0,0 +1,721 @@
+#include "libcortex.h"
+#include "cortex_vec.h"
+#include "cortex_vfs.h"
+#include "bench_util.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Cortex native microbenchmarks.
+
+    Every benchmark runs against a freshly created database so runs are
+    repeatable, and all random keys come from a fixed-seed generator.
+    Results are written to stdout as a single JSON document:
+
+        cortex_bench [--db PATH] [--rows N] [--ops N] [--seed S]
+                     [--vfs NAME] [--only NAME]
+
+    The built-in VFS layers (cortex_vfs.h) are registered up front, so
+    comparing paths is two runs, e.g. --only wal_commit without and with
+    --vfs io_uring, or --only cold_scan without and with --vfs prefetch.
+    db_kb is the database's logical size and file_kb what it takes on
+    disk, so --vfs compress --only doc_insert gives the compression ratio.
+    With --vfs checksum each database gets the reserved bytes for its
+    page checksums, so cold_scan with and without it is the cost of
+    checking every page read.
+
+    seconds is the sum of the timed operations, so seeding a fixture
+    does not count against ops_per_sec. Where the operations run inside
+    explicit transactions, the COMMITs that close them (and their syncs)
+    are in seconds too, and on their own in commit_us; the percentiles
+    are of the operations alone. rss_kb and peak_rss_kb are what
+    the case added over the resident size it started from (the peak is
+    reset per case where /proc/self/clear_refs allows it).
+*/
+
+typedef struct bench_config {
+    const char *db_path;
+    const char *vfs;
+    const char *only;
+    int rows;
+    int ops;
+    uint64_t seed;
+} bench_config;
+
+typedef struct bench_result {
+    const char *name;
+    int64_t ops;
+    double seconds;         /* sum of lat_ns, plus commit_ns */
+    uint64_t *lat_ns;       /* one sample per timed operation */
+    uint64_t commit_ns;     /* COMMITs closing the timed operations */
+    int64_t n_lat;
+    int64_t cap_lat;
+    long db_kb;             /* page_count * page_size at the end */
+    long file_kb;           /* size of the database file at the end */
+} bench_result;
+
+typedef int (*bench_fn)(const bench_config *cfg, cortex *db, bench_result *res);
+
+/*
+    Helpers: PRNG ranges, memory
+*/
+static int64_t rng_range(int64_t n) {
+    return (int64_t)(rng_next() % (uint64_t)n);
+}
+
+static long read_status_kb(const char *key) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    size_t klen = strlen(key);
+    long value = -1;
+
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, klen) == 0 && line[klen] == ':') {
+            value = strtol(line + klen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+/* Restart VmHWM from the current resident size (Linux 4.0 and later) */
+static void reset_peak_rss(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return;
+    fputs("5", f);
+    fclose(f);
+}
+
+static void record(bench_result *res, uint64_t ns) {
+    if (res->n_lat == res->cap_lat) {
+        int64_t cap = res->cap_lat ? res->cap_lat * 2 : 4096;
+        uint64_t *p = realloc(res->lat_ns, (size_t)cap * sizeof(uint64_t));
+        if (!p) return;
+        res->lat_ns = p;
+        res->cap_lat = cap;
+    }
+    res->lat_ns[res->n_lat++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const bench_result *res, double p) {
+    int64_t idx;
+    if (res->n_lat == 0) return 0.0;
+    idx = (int64_t)(p * (double)(res->n_lat - 1) + 0.5);
+    return (double)res->lat_ns[idx] / 1000.0;
+}
+
+static int exec_or_die(cortex *db, const char *sql) {
+    char *err = NULL;
+    int rc = cortex_exec(db, sql, 0, 0, &err);
+    if (rc != CORTEX_OK) {
+        fprintf(stderr, "cortex_bench: %s: %s\n", sql, err ? err : "error");
+        cortex_free(err);
+    }
+    return rc;
+}
+
+static int prepare_or_die(cortex *db, const char *sql, cortex_stmt **stmt) {
+    int rc = cortex_prepare_v2(db, sql, -1, stmt, NULL);
+    if (rc != CORTEX_OK) {
+        fprintf(stderr, "cortex_bench: prepare %s: %s\n", sql, cortex_errmsg(db));
+    }
+    return rc;
+}
+
+/*
+    Step a statement to completion, timing it as one operation.
+*/
+static int step_timed(cortex_stmt *stmt, bench_result *res) {
+    uint64_t t0 = now_ns();
+    int rc;
+    while ((rc = cortex_step(stmt)) == CORTEX_ROW) {
+    }
+    record(res, now_ns() - t0);
+    cortex_reset(stmt);
+    return rc == CORTEX_DONE ? CORTEX_OK : rc;
+}
+
+/*
+    COMMIT of a transaction the timed operations ran in. Its time (the
+    journal or WAL write and its sync) belongs to them, so it counts in
+    seconds, but not in the per-operation percentiles.
+*/
+static int commit_timed(cortex *db, bench_result *res) {
+    uint64_t t0 = now_ns();
+    int rc = exec_or_die(db, "COMMIT");
+    if (res) res->commit_ns += now_ns() - t0;
+    return rc;
+}
+
+/*
+    Shared fixture: table `kv` with an index on `k`, filled with cfg->rows rows.
+*/
+static int seed_table(const bench_config *cfg, cortex *db) {
+    cortex_stmt *ins;
+    int i, rc;
+
+    if (exec_or_die(db, "CREATE TABLE IF NOT EXISTS kv("
+                        "id INTEGER PRIMARY KEY, k INTEGER, v TEXT)")) return 1;
+    if (exec_or_die(db, "CREATE INDEX IF NOT EXISTS kv_k ON kv(k)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO kv(id, k, v) VALUES(?1, ?2, ?3)", &ins)) return 1;
+
+    exec_or_die(db, "BEGIN");
+    for (i = 1; i <= cfg->rows; i++) {
+        cortex_bind_int64(ins, 1, i);
+        cortex_bind_int64(ins, 2, rng_range((int64_t)cfg->rows * 4));
+        cortex_bind_text(ins, 3, "cortex-benchmark-payload-0123456789", -1, CORTEX_STATIC);
+        rc = cortex_step(ins);
+        cortex_reset(ins);
+        if (rc != CORTEX_DONE) break;
+    }
+    exec_or_die(db, "COMMIT");
+    cortex_finalize(ins);
+    return rc == CORTEX_DONE ? 0 : 1;
+}
+
+/*
+    Benchmarks
+*/
+static int bench_insert_autocommit(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *ins;
+    int i, n = cfg->ops < 2000 ? cfg->ops : 2000;  /* every row pays a sync */
+
+    if (exec_or_die(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, k INTEGER, v TEXT)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO t(k, v) VALUES(?1, ?2)", &ins)) return 1;
+    for (i = 0; i < n; i++) {
+        cortex_bind_int64(ins, 1, rng_range(1000000));
+        cortex_bind_text(ins, 2, "payload", -1, CORTEX_STATIC);
+        if (step_timed(ins, res)) break;
+    }
+    cortex_finalize(ins);
+    res->ops = i;
+    return i == n ? 0 : 1;
+}
+
+static int bench_insert_txn(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *ins;
+    int i;
+
+    if (exec_or_die(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, k INTEGER, v TEXT)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO t(k, v) VALUES(?1, ?2)", &ins)) return 1;
+    exec_or_die(db, "BEGIN");
+    for (i = 0; i < cfg->rows; i++) {
+        cortex_bind_int64(ins, 1, rng_range(1000000));
+        cortex_bind_text(ins, 2, "payload", -1, CORTEX_STATIC);
+        if (step_timed(ins, res)) break;
+    }
+    commit_timed(db, res);
+    cortex_finalize(ins);
+    res->ops = i;
+    return i == cfg->rows ? 0 : 1;
+}
+
+static int bench_select_rowid(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *sel;
+    int i;
+
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "SELECT k, v FROM kv WHERE id = ?1", &sel)) return 1;
+    for (i = 0; i < cfg->ops; i++) {
+        cortex_bind_int64(sel, 1, 1 + rng_range(cfg->rows));
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == cfg->ops ? 0 : 1;
+}
+
+static int bench_select_index(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *sel;
+    int i;
+
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "SELECT id, v FROM kv WHERE k = ?1", &sel)) return 1;
+    for (i = 0; i < cfg->ops; i++) {
+        cortex_bind_int64(sel, 1, rng_range((int64_t)cfg->rows * 4));
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == cfg->ops ? 0 : 1;
+}
+
+static int bench_range_scan(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *sel;
+    int i, n = cfg->ops / 10 ? cfg->ops / 10 : 1;
+
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "SELECT count(*), sum(length(v)) FROM kv "
+                           "WHERE k BETWEEN ?1 AND ?1 + 400", &sel)) return 1;
+    for (i = 0; i < n; i++) {
+        cortex_bind_int64(sel, 1, rng_range((int64_t)cfg->rows * 4));
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == n ? 0 : 1;
+}
+
+static int bench_update_churn(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *upd;
+    int i;
+
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "UPDATE kv SET k = ?2, v = ?3 WHERE id = ?1", &upd)) return 1;
+    exec_or_die(db, "BEGIN");
+    for (i = 0; i < cfg->ops; i++) {
+        cortex_bind_int64(upd, 1, 1 + rng_range(cfg->rows));
+        cortex_bind_int64(upd, 2, rng_range((int64_t)cfg->rows * 4));
+        cortex_bind_text(upd, 3, (i & 1) ? "churned-payload" : "payload-churned!", -1,
+                         CORTEX_STATIC);
+        if (step_timed(upd, res)) break;
+        if (i % 1000 == 999) {
+            commit_timed(db, res);
+            exec_or_die(db, "BEGIN");
+        }
+    }
+    commit_timed(db, res);
+    cortex_finalize(upd);
+    res->ops = i;
+    return i == cfg->ops ? 0 : 1;
+}
+
+static int bench_wal_checkpoint(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *upd;
+    int round, i, rc = CORTEX_OK;
+    int rounds = 20, per_round = cfg->rows / 20 ? cfg->rows / 20 : 1;
+
+    if (exec_or_die(db, "PRAGMA journal_mode=WAL")) return 1;
+    if (exec_or_die(db, "PRAGMA wal_autocheckpoint=0")) return 1;
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "UPDATE kv SET v = ?2 WHERE id = ?1", &upd)) return 1;
+
+    /* Dirty a batch of pages, then time only the checkpoint itself */
+    for (round = 0; round < rounds && rc == CORTEX_OK; round++) {
+        uint64_t t0;
+        exec_or_die(db, "BEGIN");
+        for (i = 0; i < per_round; i++) {
+            cortex_bind_int64(upd, 1, 1 + rng_range(cfg->rows));
+            cortex_bind_text(upd, 2, "checkpointed-payload", -1, CORTEX_STATIC);
+            cortex_step(upd);
+            cortex_reset(upd);
+        }
+        exec_or_die(db, "COMMIT");
+
+        t0 = now_ns();
+        rc = cortex_wal_checkpoint_v2(db, NULL, CORTEX_CHECKPOINT_TRUNCATE, NULL, NULL);
+        record(res, now_ns() - t0);
+    }
+    cortex_finalize(upd);
+    res->ops = round;
+    return rc == CORTEX_OK ? 0 : 1;
+}
+
+/*
+    Durable commits in WAL mode: every operation is one synchronous=FULL
+    commit, of one row (wal_commit) or of 100 rows scattered over the
+    table, so many pages (wal_commit_pages).
+*/
+static int wal_commits(const bench_config *cfg, cortex *db, bench_result *res, int rows_per_commit) {
+    cortex_stmt *upd;
+    int i, j, n = cfg->ops < 5000 ? cfg->ops : 5000;
+    uint64_t t0;
+
+    if (exec_or_die(db, "PRAGMA journal_mode=WAL")) return 1;
+    if (exec_or_die(db, "PRAGMA synchronous=FULL")) return 1;
+    if (seed_table(cfg, db)) return 1;
+    if (prepare_or_die(db, "UPDATE kv SET v = ?2 WHERE id = ?1", &upd)) return 1;
+    for (i = 0; i < n; i++) {
+        t0 = now_ns();
+        if (rows_per_commit > 1 && exec_or_die(db, "BEGIN")) break;
+        for (j = 0; j < rows_per_commit; j++) {
+            cortex_bind_int64(upd, 1, 1 + rng_range(cfg->rows));
+            cortex_bind_text(upd, 2, (i & 1) ? "committed-payload" : "payload-committed", -1,
+                             CORTEX_STATIC);
+            cortex_step(upd);
+            if (cortex_reset(upd) != CORTEX_OK) break;
+        }
+        if (j < rows_per_commit || (rows_per_commit > 1 && exec_or_die(db, "COMMIT"))) break;
+        record(res, now_ns() - t0);
+    }
+    cortex_finalize(upd);
+    res->ops = i;
+    return i == n ? 0 : 1;
+}
+
+static int bench_wal_commit(const bench_config *cfg, cortex *db, bench_result *res) {
+    return wal_commits(cfg, db, res, 1);
+}
+
+static int bench_wal_commit_pages(const bench_config *cfg, cortex *db, bench_result *res) {
+    return wal_commits(cfg, db, res, 100);
+}
+
+/*
+    Full table scans with the OS page cache dropped before each one and
+    a pager cache too small to help, so every page comes from the disk.
+    Rows are ~1 KiB blobs; each operation is one scan of cfg->rows rows.
+*/
+static int bench_cold_scan(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *ins, *sel;
+    int i, rc = CORTEX_OK, n = cfg->ops < 5 ? cfg->ops : 5;
+
+    if (exec_or_die(db, "CREATE TABLE scan(id INTEGER PRIMARY KEY, body BLOB)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO scan(body) VALUES(randomblob(1000))", &ins)) return 1;
+    exec_or_die(db, "BEGIN");
+    for (i = 0; i < cfg->rows && rc == CORTEX_OK; i++) {
+        rc = cortex_step(ins) == CORTEX_DONE ? CORTEX_OK : CORTEX_ERROR;
+        cortex_reset(ins);
+    }
+    exec_or_die(db, "COMMIT");
+    cortex_finalize(ins);
+    if (rc != CORTEX_OK) return 1;
+    if (exec_or_die(db, "PRAGMA cache_size=-256")) return 1;
+    if (prepare_or_die(db, "SELECT count(*), sum(length(body)) FROM scan", &sel)) return 1;
+
+    for (i = 0; i < n; i++) {
+        /* No transaction is open here, so a second descriptor cannot
+           cost the connection any of its POSIX locks */
+        int fd = open(cfg->db_path, O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == n ? 0 : 1;
+}
+
+static int bench_prepare_finalize(const bench_config *cfg, cortex *db, bench_result *res) {
+    int i;
+
+    if (seed_table(cfg, db)) return 1;
+    for (i = 0; i < cfg->ops; i++) {
+        cortex_stmt *stmt;
+        uint64_t t0 = now_ns();
+        if (cortex_prepare_v2(db, "SELECT v FROM kv WHERE id = 1", -1, &stmt, NULL)) break;
+        while (cortex_step(stmt) == CORTEX_ROW) {
+        }
+        cortex_finalize(stmt);
+        record(res, now_ns() - t0);
+    }
+    res->ops = i;
+    return i == cfg->ops ? 0 : 1;
+}
+
+/*
+    Vector fixture: vec_hnsw table `vecs` of 128-d vectors in [-1, 1).
+*/
+#define BENCH_DIM 128
+
+static void random_vector(float *v) {
+    int i;
+    for (i = 0; i < BENCH_DIM; i++) {
+        v[i] = (float)rng_range(2000000) / 1e6f - 1.0f;
+    }
+}
+
+static int seed_vectors(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *ins;
+    float v[BENCH_DIM];
+    int i, rc = CORTEX_OK;
+
+    if (exec_or_die(db, "CREATE VIRTUAL TABLE vecs USING vec_hnsw(dim=128, metric=l2)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO vecs(rowid, embedding) VALUES(?1, ?2)", &ins)) return 1;
+    exec_or_die(db, "BEGIN");
+    for (i = 1; i <= cfg->rows; i++) {
+        random_vector(v);
+        cortex_bind_int64(ins, 1, i);
+        cortex_bind_blob(ins, 2, v, sizeof(v), CORTEX_STATIC);
+        if (res) {
+            if ((rc = step_timed(ins, res)) != CORTEX_OK) break;
+        } else {
+            rc = cortex_step(ins);
+            cortex_reset(ins);
+            if (rc != CORTEX_DONE) break;
+            rc = CORTEX_OK;
+        }
+    }
+    commit_timed(db, res);
+    cortex_finalize(ins);
+    if (res) res->ops = i - 1;
+    return rc == CORTEX_OK ? 0 : 1;
+}
+
+/*
+    Document fixture: table `docs` of agent-log-like JSON, ~200 B to 3 KiB
+    each, drawn from a small vocabulary so it compresses like real logs.
+*/
+static const char *const DOC_WORDS[] = {
+    "agent", "tool_call", "result", "user", "assistant", "memory", "recall",
+    "search", "error", "retry", "plan", "step", "observation", "summary",
+    "context", "embedding", "query", "answer", "the", "a", "of", "to", "and",
+};
+
+static int random_doc(char *buf, int cap) {
+    int n = snprintf(buf, (size_t)cap, "{\"agent\":\"agent-%d\",\"turn\":%d,\"role\":\"%s\","
+                     "\"content\":\"", (int)rng_range(16), (int)rng_range(10000),
+                     rng_range(2) ? "assistant" : "user");
+    int words = 30 + (int)rng_range(400);
+
+    while (words-- > 0 && n < cap - 32) {
+        n += snprintf(buf + n, (size_t)(cap - n), "%s ",
+                      DOC_WORDS[rng_range(sizeof(DOC_WORDS) / sizeof(DOC_WORDS[0]))]);
+    }
+    n += snprintf(buf + n, (size_t)(cap - n), "\"}");
+    return n;
+}
+
+static int seed_docs(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *ins;
+    char doc[4096];
+    int i, rc = CORTEX_OK;
+
+    if (exec_or_die(db, "CREATE TABLE docs(id INTEGER PRIMARY KEY, body TEXT)")) return 1;
+    if (prepare_or_die(db, "INSERT INTO docs(id, body) VALUES(?1, ?2)", &ins)) return 1;
+    exec_or_die(db, "BEGIN");
+    for (i = 1; i <= cfg->rows && rc == CORTEX_OK; i++) {
+        cortex_bind_int64(ins, 1, i);
+        cortex_bind_text(ins, 2, doc, random_doc(doc, sizeof(doc)), CORTEX_STATIC);
+        if (res) {
+            rc = step_timed(ins, res);
+        } else {
+            rc = cortex_step(ins) == CORTEX_DONE ? CORTEX_OK : CORTEX_ERROR;
+            cortex_reset(ins);
+        }
+        if (i % 1000 == 0) {
+            commit_timed(db, res);
+            exec_or_die(db, "BEGIN");
+        }
+    }
+    commit_timed(db, res);
+    cortex_finalize(ins);
+    if (res) res->ops = i - 1;
+    return rc == CORTEX_OK ? 0 : 1;
+}
+
+static int bench_doc_insert(const bench_config *cfg, cortex *db, bench_result *res) {
+    return seed_docs(cfg, db, res);
+}
+
+static int bench_doc_read(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *sel;
+    int i;
+
+    if (seed_docs(cfg, db, NULL)) return 1;
+    if (prepare_or_die(db, "SELECT body FROM docs WHERE id = ?1", &sel)) return 1;
+    for (i = 0; i < cfg->ops; i++) {
+        cortex_bind_int64(sel, 1, 1 + rng_range(cfg->rows));
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == cfg->ops ? 0 : 1;
+}
+
+static int bench_hnsw_build(const bench_config *cfg, cortex *db, bench_result *res) {
+    return seed_vectors(cfg, db, res);
+}
+
+static int bench_hnsw_knn(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *sel;
+    float q[BENCH_DIM];
+    int i, n = cfg->ops / 10 ? cfg->ops / 10 : 1;
+
+    if (seed_vectors(cfg, db, NULL)) return 1;
+    if (prepare_or_die(db, "SELECT rowid, distance FROM vecs "
+                           "WHERE embedding MATCH ?1 AND k = 10", &sel)) return 1;
+    for (i = 0; i < n; i++) {
+        random_vector(q);
+        cortex_bind_blob(sel, 1, q, sizeof(q), CORTEX_STATIC);
+        if (step_timed(sel, res)) break;
+    }
+    cortex_finalize(sel);
+    res->ops = i;
+    return i == n ? 0 : 1;
+}
+
+typedef struct bench_case {
+    const char *name;
+    bench_fn fn;
+} bench_case;
+
+static const bench_case BENCHMARKS[] = {
+    { "insert_autocommit", bench_insert_autocommit },
+    { "insert_txn",        bench_insert_txn },
+    { "select_rowid",      bench_select_rowid },
+    { "select_index",      bench_select_index },
+    { "range_scan",        bench_range_scan },
+    { "update_churn",      bench_update_churn },
+    { "wal_checkpoint",    bench_wal_checkpoint },
+    { "wal_commit",        bench_wal_commit },
+    { "wal_commit_pages",  bench_wal_commit_pages },
+    { "cold_scan",         bench_cold_scan },
+    { "doc_insert",        bench_doc_insert },
+    { "doc_read",          bench_doc_read },
+    { "prepare_finalize",  bench_prepare_finalize },
+    { "hnsw_build",        bench_hnsw_build },
+    { "hnsw_knn",          bench_hnsw_knn },
+};
+
+/*
+    Runner
+*/
+static void measure_size(const bench_config *cfg, cortex *db, bench_result *res) {
+    cortex_stmt *stmt;
+    struct stat st;
+
+    if (cortex_prepare_v2(db, "SELECT page_count * page_size FROM pragma_page_count, pragma_page_size",
+                          -1, &stmt, NULL) == CORTEX_OK) {
+        if (cortex_step(stmt) == CORTEX_ROW) res->db_kb = (long)(cortex_column_int64(stmt, 0) / 1024);
+        cortex_finalize(stmt);
+    }
+    if (stat(cfg->db_path, &st) == 0) res->file_kb = (long)(st.st_size / 1024);
+}
+
+static int run_case(const bench_config *cfg, const bench_case *bc, int first) {
+    bench_result res;
+    cortex *db = NULL;
+    long rss_base, rss_kb, peak_kb;
+    int64_t i;
+    int rc;
+
+    memset(&res, 0, sizeof(res));
+    res.name = bc->name;
+    remove_db(cfg->db_path);
+    rng_state = cfg->seed ? cfg->seed : 1;
+    reset_peak_rss();
+    rss_base = read_status_kb("VmRSS");
+
+    rc = cortex_open_v2(cfg->db_path, &db,
+                        CORTEX_OPEN_READWRITE | CORTEX_OPEN_CREATE | CORTEX_OPEN_URI,
+                        cfg->vfs);
+    if (rc != CORTEX_OK) {
+        fprintf(stderr, "cortex_bench: cannot open %s: %s\n",
+                cfg->db_path, db ? cortex_errmsg(db) : "out of memory");
+        cortex_close(db);
+        return 1;
+    }
+    if (cfg->vfs && strcmp(cfg->vfs, "checksum") == 0) {
+        int reserve = 4;
+        cortex_file_control(db, "main", CORTEX_FCNTL_RESERVE_BYTES, &reserve);
+    }
+    cortex_vec_init(db);
+
+    rc = bc->fn(cfg, db, &res);
+    for (i = 0; i < res.n_lat; i++) res.seconds += (double)res.lat_ns[i] / 1e9;
+    res.seconds += (double)res.commit_ns / 1e9;
+    rss_kb = read_status_kb("VmRSS") - rss_base;
+    peak_kb = read_status_kb("VmHWM") - rss_base;
+    measure_size(cfg, db, &res);
+    cortex_close(db);
+    remove_db(cfg->db_path);
+
+    qsort(res.lat_ns, (size_t)res.n_lat, sizeof(uint64_t), cmp_u64);
+    printf("%s    {\"name\": \"%s\", \"ok\": %s, \"ops\": %lld, \"seconds\": %.6f, "
+           "\"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+           "\"p999_us\": %.3f, \"commit_us\": %.3f, \"db_kb\": %ld, \"file_kb\": %ld, "
+           "\"rss_kb\": %ld, \"peak_rss_kb\": %ld}",
+           first ? "" : ",\n",
+           res.name, rc ? "false" : "true", (long long)res.ops, res.seconds,
+           res.seconds > 0 ? (double)res.ops / res.seconds : 0.0,
+           percentile_us(&res, 0.50), percentile_us(&res, 0.99),
+           percentile_us(&res, 0.999), (double)res.commit_ns / 1000.0, res.db_kb, res.file_kb, rss_kb, peak_kb);
+    fflush(stdout);
+    free(res.lat_ns);
+    return rc;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--db PATH] [--rows N] [--ops N] [--seed S] "
+            "[--vfs NAME] [--only NAME]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg = { "cortex_bench.ctx", NULL, NULL, 100000, 100000, 42 };
+    size_t i;
+    int failed = 0, first = 1;
+
+    for (i = 1; i < (size_t)argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < (size_t)argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(arg, "--db") == 0) cfg.db_path = val;
+        else if (strcmp(arg, "--rows") == 0) cfg.rows = atoi(val);
+        else if (strcmp(arg, "--ops") == 0) cfg.ops = atoi(val);
+        else if (strcmp(arg, "--seed") == 0) cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(arg, "--vfs") == 0) cfg.vfs = val;
+        else if (strcmp(arg, "--only") == 0) cfg.only = val;
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.rows < 1 || cfg.ops < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (cfg.only) {
+        for (i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+            if (strcmp(cfg.only, BENCHMARKS[i].name) == 0) break;
+        }
+        if (i == sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0])) {
+            fprintf(stderr, "cortex_bench: no benchmark named %s; one of:\n", cfg.only);
+            for (i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+                fprintf(stderr, "  %s\n", BENCHMARKS[i].name);
+            }
+            return 2;
+        }
+    }
+    if (cortex_vfs_uring_register(0) != CORTEX_OK && cfg.vfs && strcmp(cfg.vfs, "io_uring") == 0) {
+        fprintf(stderr, "cortex_bench: io_uring is not available here\n");
+        return 1;
+    }
+    if (cortex_vfs_prefetch_register(0) != CORTEX_OK && cfg.vfs && strcmp(cfg.vfs, "prefetch") == 0) {
+        fprintf(stderr, "cortex_bench: prefetch is not available here\n");
+        return 1;
+    }
+    if (cortex_vfs_compress_register(0) != CORTEX_OK && cfg.vfs && strcmp(cfg.vfs, "compress") == 0) {
+        fprintf(stderr, "cortex_bench: compress is not available in this build\n");
+        return 1;
+    }
+    if (cortex_vfs_checksum_register(0) != CORTEX_OK && cfg.vfs && strcmp(cfg.vfs, "checksum") == 0) {
+        fprintf(stderr, "cortex_bench: checksum is not available here\n");
+        return 1;
+    }
+
+    printf("{\n  \"library\": \"%s\",\n  \"vfs\": \"%s\",\n  \"rows\": %d,\n"
+           "  \"ops\": %d,\n  \"seed\": %llu,\n  \"benchmarks\": [\n",
+           cortex_libversion(), cfg.vfs ? cfg.vfs : "default", cfg.rows, cfg.ops,
+           (unsigned long long)cfg.seed);
+
+    for (i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+        if (cfg.only && strcmp(cfg.only, BENCHMARKS[i].name) != 0) continue;
+        failed |= run_case(&cfg, &BENCHMARKS[i], first);
+        first = 0;
+    }
+
+    printf("\n  ]\n}\n");
+    return failed ? 1 : 0;
+}
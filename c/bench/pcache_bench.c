@@ -0,0 +1,284 @@
+#include "libcortex.h"
+#include "cortex_pcache.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    The default page cache against the sharded one (cortex_pcache.h).
+
+    Seeds a database with a table of point-read rows and a larger log
+    table, then runs each page cache (the library is shut down and
+    re-initialised in between) through:
+
+      threads   point reads from 1, 2, 4, ... threads, one read-only
+                connection each, every connection's cache warm and big
+                enough for the table; aggregate reads per second.
+      polluted  one connection with a cache of --cache pages; reads
+                skewed 90/10 towards a hot tenth of the table, with a
+                full scan of the log table every --ops / 20 reads. The
+                cache hit ratio of the reads (scans not counted) shows
+                whether the scans pushed the hot pages out.
+
+    Results are written to stdout as a single JSON document:
+
+        pcache_bench [--db PATH] [--rows N] [--ops N] [--threads 1,2,4,8]
+                     [--cache PAGES] [--hugepages 0|1] [--seed S]
+*/
+
+#define MAX_THREADS 64
+#define MAX_COUNTS 16
+
+typedef struct bench_config {
+    const char *db_path;
+    int rows;
+    int ops;
+    int threads[MAX_COUNTS];
+    int n_threads;
+    int cache;
+    int hugepages;
+    uint64_t seed;
+} bench_config;
+
+typedef struct reader {
+    const bench_config *cfg;
+    pthread_barrier_t *start;
+    uint64_t rng;
+    int failed;
+} reader;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static void remove_db(const char *path) {
+    char buf[1024];
+    unlink(path);
+    snprintf(buf, sizeof(buf), "%s-wal", path);
+    unlink(buf);
+    snprintf(buf, sizeof(buf), "%s-journal", path);
+    unlink(buf);
+}
+
+/* hot(id, body) with rows rows, logs(id, body) with twice as many, larger */
+static int seed(const bench_config *cfg) {
+    cortex *db = NULL;
+    char sql[512];
+    int rc;
+
+    remove_db(cfg->db_path);
+    if (cortex_open(cfg->db_path, &db) != CORTEX_OK) {
+        cortex_close(db);
+        return 1;
+    }
+    snprintf(sql, sizeof(sql),
+             "CREATE TABLE hot (id INTEGER PRIMARY KEY, body BLOB);"
+             "CREATE TABLE logs (id INTEGER PRIMARY KEY, body BLOB);"
+             "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d)"
+             " INSERT INTO hot SELECT i, randomblob(200) FROM n;"
+             "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d)"
+             " INSERT INTO logs SELECT i, randomblob(400) FROM n;",
+             cfg->rows, 2 * cfg->rows);
+    rc = cortex_exec(db, sql, 0, 0, NULL);
+    if (rc != CORTEX_OK) fprintf(stderr, "pcache_bench: seed: %s\n", cortex_errmsg(db));
+    cortex_close(db);
+    return rc != CORTEX_OK;
+}
+
+static int point_read(cortex_stmt *stmt, int64_t id) {
+    int rc;
+
+    cortex_bind_int64(stmt, 1, id);
+    rc = cortex_step(stmt);
+    if (rc == CORTEX_ROW) cortex_column_bytes(stmt, 0);
+    cortex_reset(stmt);
+    return rc == CORTEX_ROW ? 0 : 1;
+}
+
+static void *reader_main(void *arg) {
+    reader *r = arg;
+    const bench_config *cfg = r->cfg;
+    cortex *db = NULL;
+    cortex_stmt *stmt = NULL;
+    int i;
+
+    r->failed = cortex_open_v2(cfg->db_path, &db, CORTEX_OPEN_READONLY | CORTEX_OPEN_NOMUTEX, NULL) != CORTEX_OK
+        || cortex_exec(db, "PRAGMA cache_size=-262144", 0, 0, NULL) != CORTEX_OK
+        || cortex_prepare_v2(db, "SELECT body FROM hot WHERE id = ?1", -1, &stmt, NULL) != CORTEX_OK;
+    for (i = 1; !r->failed && i <= cfg->rows; i++) r->failed |= point_read(stmt, i);
+    pthread_barrier_wait(r->start);
+    for (i = 0; !r->failed && i < cfg->ops; i++) {
+        r->failed |= point_read(stmt, 1 + (int64_t)(rng_next(&r->rng) % (uint64_t)cfg->rows));
+    }
+    cortex_finalize(stmt);
+    cortex_close(db);
+    return NULL;
+}
+
+/* Reads per second from n threads together; negative on failure */
+static double run_threads(const bench_config *cfg, int n) {
+    pthread_t threads[MAX_THREADS];
+    reader readers[MAX_THREADS];
+    pthread_barrier_t start;
+    uint64_t t0;
+    int i, failed = 0;
+
+    pthread_barrier_init(&start, NULL, (unsigned)n + 1);
+    for (i = 0; i < n; i++) {
+        readers[i].cfg = cfg;
+        readers[i].start = &start;
+        readers[i].rng = (cfg->seed ? cfg->seed : 1) + (uint64_t)i * 7919;
+        readers[i].failed = 0;
+        pthread_create(&threads[i], NULL, reader_main, &readers[i]);
+    }
+    pthread_barrier_wait(&start);
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= readers[i].failed;
+    }
+    pthread_barrier_destroy(&start);
+    return failed ? -1.0 : (double)n * cfg->ops / ((double)(now_ns() - t0) / 1e9);
+}
+
+/* Skewed reads between scans; hit ratio of the reads and their rate */
+static int run_polluted(const bench_config *cfg, double *hit_ratio, double *reads_per_sec) {
+    cortex *db = NULL;
+    cortex_stmt *stmt = NULL;
+    char sql[64];
+    uint64_t rng = cfg->seed ? cfg->seed : 1, busy = 0, t0;
+    int64_t hits = 0, misses = 0, hot = cfg->rows / 10 > 0 ? cfg->rows / 10 : 1;
+    int i, cur, hw, failed;
+
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size=%d", cfg->cache);
+    failed = cortex_open_v2(cfg->db_path, &db, CORTEX_OPEN_READONLY, NULL) != CORTEX_OK
+        || cortex_exec(db, sql, 0, 0, NULL) != CORTEX_OK
+        || cortex_prepare_v2(db, "SELECT body FROM hot WHERE id = ?1", -1, &stmt, NULL) != CORTEX_OK;
+    for (i = 0; !failed && i < cfg->ops; i++) {
+        int64_t id;
+        if (i % (cfg->ops / 20 > 0 ? cfg->ops / 20 : 1) == 0) {
+            failed |= cortex_exec(db, "SELECT sum(length(body)) FROM logs", 0, 0, NULL) != CORTEX_OK;
+            cortex_db_status(db, CORTEX_DBSTATUS_CACHE_HIT, &cur, &hw, 1);
+            cortex_db_status(db, CORTEX_DBSTATUS_CACHE_MISS, &cur, &hw, 1);
+        }
+        id = rng_next(&rng) % 10 ? 1 + (int64_t)(rng_next(&rng) % (uint64_t)hot)
+                                 : 1 + (int64_t)(rng_next(&rng) % (uint64_t)cfg->rows);
+        t0 = now_ns();
+        failed |= point_read(stmt, id);
+        busy += now_ns() - t0;
+        if (i + 1 == cfg->ops || (i + 1) % (cfg->ops / 20 > 0 ? cfg->ops / 20 : 1) == 0) {
+            cortex_db_status(db, CORTEX_DBSTATUS_CACHE_HIT, &cur, &hw, 0);
+            hits += cur;
+            cortex_db_status(db, CORTEX_DBSTATUS_CACHE_MISS, &cur, &hw, 0);
+            misses += cur;
+        }
+    }
+    cortex_finalize(stmt);
+    cortex_close(db);
+    *hit_ratio = hits + misses ? (double)hits / (double)(hits + misses) : 0.0;
+    *reads_per_sec = busy ? cfg->ops / ((double)busy / 1e9) : 0.0;
+    return failed;
+}
+
+static int run_pcache(const bench_config *cfg, const char *name, int first) {
+    double hit_ratio, reads_per_sec;
+    int i, failed = 0;
+
+    printf("%s    {\"pcache\": \"%s\", \"threads\": [", first ? "" : ",\n", name);
+    for (i = 0; i < cfg->n_threads && !failed; i++) {
+        double rate = run_threads(cfg, cfg->threads[i]);
+        failed = rate < 0;
+        printf("%s{\"threads\": %d, \"reads_per_sec\": %.0f}", i ? ", " : "", cfg->threads[i], rate);
+        fflush(stdout);
+    }
+    if (!failed) failed = run_polluted(cfg, &hit_ratio, &reads_per_sec);
+    printf("],\n     \"polluted\": {\"hit_ratio\": %.4f, \"reads_per_sec\": %.0f}}",
+           failed ? 0.0 : hit_ratio, failed ? 0.0 : reads_per_sec);
+    fflush(stdout);
+    return failed;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--db PATH] [--rows N] [--ops N] [--threads 1,2,4,8] [--cache PAGES] "
+            "[--hugepages 0|1] [--seed S]\n", argv0);
+}
+
+static int parse_counts(bench_config *cfg, const char *list) {
+    char *end;
+
+    cfg->n_threads = 0;
+    while (*list && cfg->n_threads < MAX_COUNTS) {
+        long n = strtol(list, &end, 10);
+        if (end == list || n < 1 || n > MAX_THREADS) return 1;
+        cfg->threads[cfg->n_threads++] = (int)n;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return cfg->n_threads == 0;
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg = { "pcache_bench.ctx", 100000, 200000, {1, 2, 4, 8}, 4, 2000, 0, 42 };
+    int i, failed;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--db") == 0) cfg.db_path = val;
+        else if (strcmp(argv[i], "--rows") == 0) cfg.rows = atoi(val);
+        else if (strcmp(argv[i], "--ops") == 0) cfg.ops = atoi(val);
+        else if (strcmp(argv[i], "--cache") == 0) cfg.cache = atoi(val);
+        else if (strcmp(argv[i], "--hugepages") == 0) cfg.hugepages = atoi(val);
+        else if (strcmp(argv[i], "--seed") == 0) cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(argv[i], "--threads") == 0) {
+            if (parse_counts(&cfg, val)) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.rows < 10 || cfg.ops < 1 || cfg.cache < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (seed(&cfg) != 0) {
+        remove_db(cfg.db_path);
+        return 1;
+    }
+
+    printf("{\n  \"library\": \"%s\",\n  \"cpus\": %ld,\n  \"rows\": %d,\n  \"ops\": %d,\n"
+           "  \"cache\": %d,\n  \"hugepages\": %d,\n  \"seed\": %llu,\n  \"results\": [\n",
+           cortex_libversion(), sysconf(_SC_NPROCESSORS_ONLN), cfg.rows, cfg.ops, cfg.cache,
+           cfg.hugepages, (unsigned long long)cfg.seed);
+    failed = run_pcache(&cfg, "default", 1);
+    cortex_shutdown();
+    if (!failed && cortex_pcache_sharded_install(cfg.hugepages) != CORTEX_OK) {
+        fprintf(stderr, "pcache_bench: cannot install the sharded page cache\n");
+        failed = 1;
+    }
+    if (!failed) failed = run_pcache(&cfg, "sharded", 0);
+    printf("\n  ]\n}\n");
+
+    remove_db(cfg.db_path);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+#include "libcortex.h"
+#include "cortex_vec.h"
+#include "bench_util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Batched search throughput of vec_hnsw.
+
+    Builds one index over clustered rows, then answers the same queries
+    one statement per query (the baseline) and in batches of each size
+    through the queries column, reporting queries per second, the
+    speedup over the baseline, and how many result rows match it (the
+    batch plan should return exactly the single-query results). --filter
+    restricts every search to that percentage of rows through a metadata
+    column, so small values exercise the blocked exact scan. Results are
+    written to stdout as a single JSON document:
+
+        vec_batch [--db PATH] [--rows N] [--dim D] [--queries N] [--k K]
+                  [--batch 1,8,64,512] [--threads T] [--quantize none|int8|binary]
+                  [--filter PCT] [--seed S]
+*/
+
+#define MAX_SIZES 16
+
+typedef struct bench_config {
+    const char *db_path;
+    int rows;
+    int dim;
+    int queries;
+    int k;
+    int batch[MAX_SIZES];
+    int n_batch;
+    int threads;
+    const char *quantize;
+    int filter;
+    uint64_t seed;
+} bench_config;
+
+/* base(id, embedding, tag) then a vec_hnsw index idx over it; 0 on success */
+static int load(const bench_config *cfg, cortex *db, const float *data) {
+    cortex_stmt *stmt = NULL;
+    char options[256], *err = NULL;
+    int i, rc = CORTEX_DONE;
+
+    if (cortex_exec(db, "CREATE TABLE base(id INTEGER PRIMARY KEY, embedding BLOB, tag INTEGER)", 0, 0, NULL)
+        || cortex_prepare_v2(db, "INSERT INTO base VALUES (?1, ?2, ?3)", -1, &stmt, NULL) != CORTEX_OK) {
+        return 1;
+    }
+    cortex_exec(db, "BEGIN", 0, 0, NULL);
+    for (i = 0; i < cfg->rows && rc == CORTEX_DONE; i++) {
+        cortex_bind_int64(stmt, 1, i + 1);
+        cortex_bind_blob(stmt, 2, data + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float), CORTEX_STATIC);
+        cortex_bind_int(stmt, 3, i % 100);
+        rc = cortex_step(stmt);
+        cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_DONE || cortex_exec(db, "COMMIT", 0, 0, NULL) != CORTEX_OK) return 1;
+    snprintf(options, sizeof(options), "name=idx, dim=%d, quantize=%s, threads=%d, tag INTEGER",
+             cfg->dim, cfg->quantize, cfg->threads);
+    if (vec_index_build(db, "base", "embedding", options, NULL, NULL, &err) != CORTEX_OK) {
+        fprintf(stderr, "vec_batch: build: %s\n", err ? err : cortex_errmsg(db));
+        cortex_free(err);
+        return 1;
+    }
+    return 0;
+}
+
+/* One statement per query; ids gets k rowids per query (0 past the end) */
+static double run_single(const bench_config *cfg, cortex *db, const float *queries, int64_t *ids) {
+    cortex_stmt *stmt = NULL;
+    char sql[256];
+    uint64_t t0;
+    int i;
+
+    snprintf(sql, sizeof(sql), "SELECT rowid FROM idx WHERE embedding MATCH ?1 AND k = %d%s", cfg->k,
+             cfg->filter < 100 ? " AND tag < ?2" : "");
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) return -1.0;
+    memset(ids, 0, (size_t)cfg->queries * cfg->k * sizeof(int64_t));
+    t0 = now_ns();
+    for (i = 0; i < cfg->queries; i++) {
+        int j = 0;
+        cortex_bind_blob(stmt, 1, queries + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float),
+                         CORTEX_STATIC);
+        cortex_bind_int(stmt, 2, cfg->filter);
+        while (cortex_step(stmt) == CORTEX_ROW && j < cfg->k) {
+            ids[(size_t)i * cfg->k + j++] = cortex_column_int64(stmt, 0);
+        }
+        cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    return (double)(now_ns() - t0) / 1e9;
+}
+
+/* Batches of size queries; *same counts rows equal to the single-query run */
+static double run_batch(const bench_config *cfg, cortex *db, const float *queries, int size,
+                        const int64_t *want, long long *same) {
+    cortex_stmt *stmt = NULL;
+    char sql[256];
+    uint64_t t0;
+    int i, rc = CORTEX_ROW;
+
+    snprintf(sql, sizeof(sql),
+             "SELECT query, rowid FROM idx WHERE queries MATCH ?1 AND k = %d%s", cfg->k,
+             cfg->filter < 100 ? " AND tag < ?2" : "");
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) return -1.0;
+    *same = 0;
+    t0 = now_ns();
+    for (i = 0; i < cfg->queries; i += size) {
+        int n = cfg->queries - i < size ? cfg->queries - i : size, last = -1, j = 0;
+        cortex_bind_blob(stmt, 1, queries + (size_t)i * cfg->dim, n * cfg->dim * (int)sizeof(float),
+                         CORTEX_STATIC);
+        cortex_bind_int(stmt, 2, cfg->filter);
+        while ((rc = cortex_step(stmt)) == CORTEX_ROW) {
+            int q = cortex_column_int(stmt, 0);
+            j = q == last ? j + 1 : 0;
+            last = q;
+            if (j < cfg->k && want[(size_t)(i + q) * cfg->k + j] == cortex_column_int64(stmt, 1)) (*same)++;
+        }
+        cortex_reset(stmt);
+        if (rc != CORTEX_DONE) break;
+    }
+    cortex_finalize(stmt);
+    return rc == CORTEX_DONE ? (double)(now_ns() - t0) / 1e9 : -1.0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--db PATH] [--rows N] [--dim D] [--queries N] [--k K] [--batch 1,8,64,512] "
+            "[--threads T] [--quantize none|int8|binary] [--filter PCT] [--seed S]\n", argv0);
+}
+
+static int parse_sizes(bench_config *cfg, const char *list) {
+    char *end;
+
+    cfg->n_batch = 0;
+    while (*list && cfg->n_batch < MAX_SIZES) {
+        long n = strtol(list, &end, 10);
+        if (end == list || n < 1 || n > 100000) return 1;
+        cfg->batch[cfg->n_batch++] = (int)n;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return cfg->n_batch == 0;
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg = { "vec_batch.ctx", 100000, 128, 1000, 10, {1, 8, 64, 512}, 4, 0, "none", 100, 42 };
+    cortex *db = NULL;
+    float *centers, *data, *queries;
+    int64_t *want;
+    double single_s;
+    int i, n_centers, failed = 0;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--db") == 0) cfg.db_path = val;
+        else if (strcmp(argv[i], "--rows") == 0) cfg.rows = atoi(val);
+        else if (strcmp(argv[i], "--dim") == 0) cfg.dim = atoi(val);
+        else if (strcmp(argv[i], "--queries") == 0) cfg.queries = atoi(val);
+        else if (strcmp(argv[i], "--k") == 0) cfg.k = atoi(val);
+        else if (strcmp(argv[i], "--threads") == 0) cfg.threads = atoi(val);
+        else if (strcmp(argv[i], "--quantize") == 0) cfg.quantize = val;
+        else if (strcmp(argv[i], "--filter") == 0) cfg.filter = atoi(val);
+        else if (strcmp(argv[i], "--seed") == 0) cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(argv[i], "--batch") == 0) {
+            if (parse_sizes(&cfg, val)) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.threads == 0) cfg.threads = vec_default_threads();
+    if (cfg.rows < 1 || cfg.dim < 1 || cfg.dim > VEC_MAX_DIM || cfg.queries < 1 || cfg.k < 1
+        || cfg.threads < 1 || cfg.threads > 64 || cfg.filter < 1 || cfg.filter > 100) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    rng_state = cfg.seed ? cfg.seed : 1;
+    vec_kernels_select();
+    n_centers = cfg.rows / 100 > 1 ? cfg.rows / 100 : 1;
+    centers = malloc((size_t)n_centers * cfg.dim * sizeof(float));
+    want = malloc((size_t)cfg.queries * cfg.k * sizeof(int64_t));
+    if (!centers || !want) return 1;
+    for (i = 0; i < n_centers * cfg.dim; i++) centers[i] = rng_unit();
+    data = make_points(cfg.rows, cfg.dim, centers, n_centers);
+    queries = make_points(cfg.queries, cfg.dim, centers, n_centers);
+    if (!data || !queries) return 1;
+
+    remove_db(cfg.db_path);
+    if (cortex_open(cfg.db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK
+        || load(&cfg, db, data) != 0 || (single_s = run_single(&cfg, db, queries, want)) < 0) {
+        fprintf(stderr, "vec_batch: setup: %s\n", db ? cortex_errmsg(db) : "cannot open database");
+        cortex_close(db);
+        remove_db(cfg.db_path);
+        return 1;
+    }
+
+    printf("{\n  \"library\": \"%s\",\n  \"kernels\": \"%s\",\n  \"cpus\": %d,\n  \"rows\": %d,\n"
+           "  \"dim\": %d,\n  \"queries\": %d,\n  \"k\": %d,\n  \"threads\": %d,\n"
+           "  \"quantize\": \"%s\",\n  \"filter_percent\": %d,\n  \"seed\": %llu,\n"
+           "  \"single\": {\"seconds\": %.3f, \"queries_per_second\": %.0f},\n  \"batches\": [\n",
+           cortex_libversion(), vec_kern->isa, vec_default_threads(), cfg.rows, cfg.dim, cfg.queries,
+           cfg.k, cfg.threads, cfg.quantize, cfg.filter, (unsigned long long)cfg.seed, single_s,
+           cfg.queries / single_s);
+    fflush(stdout);
+    for (i = 0; i < cfg.n_batch; i++) {
+        long long same;
+        double s = run_batch(&cfg, db, queries, cfg.batch[i], want, &same);
+        if (s < 0) {
+            fprintf(stderr, "vec_batch: batch of %d: %s\n", cfg.batch[i], cortex_errmsg(db));
+            failed = 1;
+            break;
+        }
+        printf("%s    {\"size\": %d, \"seconds\": %.3f, \"queries_per_second\": %.0f, "
+               "\"speedup\": %.2f, \"same_as_single\": %.4f}",
+               i == 0 ? "" : ",\n", cfg.batch[i], s, cfg.queries / s, single_s / s,
+               (double)same / ((double)cfg.queries * cfg.k));
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+
+    cortex_close(db);
+    remove_db(cfg.db_path);
+    free(centers);
+    free(data);
+    free(queries);
+    free(want);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#include "libcortex.h"
+#include "cortex_vec.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    Distance kernel microbenchmark.
+
+    Times every kernel of every instruction set the CPU supports against
+    the scalar fallback, over a pool of vectors large enough to miss L1.
+    Each result also reports the largest relative difference from the
+    scalar kernel. Results are written to stdout as a single JSON document:
+
+        vec_bench [--dims 128,768,1536] [--calls N] [--seed S]
+*/
+
+#define POOL 256            /* vectors per operand pool */
+
+typedef struct bench_config {
+    int dims[16];
+    int n_dims;
+    long calls;
+    uint64_t seed;
+} bench_config;
+
+typedef struct operands {
+    float *f32;
+    int8_t *i8;
+    uint8_t *bits;
+    int dim;
+} operands;
+
+/* Offset by one element so the kernels see unaligned BLOB-like input */
+static int make_operands(operands *op, int dim) {
+    int i, n = POOL * dim;
+
+    op->dim = dim;
+    op->f32 = malloc(((size_t)n + 1) * sizeof(float));
+    op->i8 = malloc((size_t)n + 1);
+    op->bits = malloc((size_t)n + 1);
+    if (!op->f32 || !op->i8 || !op->bits) return 1;
+    for (i = 0; i <= n; i++) {
+        uint64_t r = rng_next();
+        op->f32[i] = (float)(r % 2000000) / 1e6f - 1.0f;
+        op->i8[i] = (int8_t)(r >> 32);
+        op->bits[i] = (uint8_t)(r >> 40);
+    }
+    op->f32++;
+    op->i8++;
+    op->bits++;
+    return 0;
+}
+
+static void free_operands(operands *op) {
+    free(op->f32 - 1);
+    free(op->i8 - 1);
+    free(op->bits - 1);
+}
+
+enum { K_DOT_F32, K_L2SQ_F32, K_DOT_I8, K_L2SQ_I8, K_HAMMING, K_COUNT };
+
+static const char *KERNEL_NAMES[K_COUNT] = {
+    "dot_f32", "l2sq_f32", "dot_i8", "l2sq_i8", "hamming"
+};
+
+static double call_kernel(const vec_kernels *k, int kernel, const operands *op, int x, int y) {
+    int d = op->dim;
+    switch (kernel) {
+        case K_DOT_F32:  return k->dot_f32(op->f32 + x * d, op->f32 + y * d, d);
+        case K_L2SQ_F32: return k->l2sq_f32(op->f32 + x * d, op->f32 + y * d, d);
+        case K_DOT_I8:   return k->dot_i8(op->i8 + x * d, op->i8 + y * d, d);
+        case K_L2SQ_I8:  return k->l2sq_i8(op->i8 + x * d, op->i8 + y * d, d);
+        default:         return (double)k->hamming(op->bits + x * d, op->bits + y * d, d);
+    }
+}
+
+static void run_kernel(const bench_config *cfg, const vec_kernels *k, int kernel,
+                       const operands *op, int first) {
+    const vec_kernels *ref = vec_kernels_for("scalar");
+    double sink = 0.0, max_err = 0.0, seconds;
+    uint64_t t0;
+    long i;
+
+    for (i = 0; i < POOL; i++) {
+        double want = call_kernel(ref, kernel, op, (int)i, (int)(POOL - 1 - i));
+        double got = call_kernel(k, kernel, op, (int)i, (int)(POOL - 1 - i));
+        double err = fabs(got - want) / (fabs(want) > 1.0 ? fabs(want) : 1.0);
+        if (err > max_err) max_err = err;
+    }
+
+    t0 = now_ns();
+    for (i = 0; i < cfg->calls; i++) {
+        sink += call_kernel(k, kernel, op, (int)(i % POOL), (int)((i * 7 + 3) % POOL));
+    }
+    seconds = (double)(now_ns() - t0) / 1e9;
+
+    printf("%s    {\"isa\": \"%s\", \"kernel\": \"%s\", \"dim\": %d, \"calls\": %ld, "
+           "\"ns_per_call\": %.2f, \"gelem_per_sec\": %.3f, \"max_rel_err\": %.2e, "
+           "\"checksum\": %.6g}",
+           first ? "" : ",\n", k->isa, KERNEL_NAMES[kernel], op->dim, cfg->calls,
+           seconds * 1e9 / (double)cfg->calls,
+           (double)op->dim * (double)cfg->calls / seconds / 1e9, max_err, sink);
+    fflush(stdout);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--dims 128,768,1536] [--calls N] [--seed S]\n", argv0);
+}
+
+static int parse_dims(bench_config *cfg, const char *list) {
+    char *end;
+
+    cfg->n_dims = 0;
+    while (*list && cfg->n_dims < 16) {
+        long d = strtol(list, &end, 10);
+        if (end == list || d < 1 || d > VEC_MAX_DIM) return 1;
+        cfg->dims[cfg->n_dims++] = (int)d;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return cfg->n_dims == 0;
+}
+
+int main(int argc, char **argv) {
+    static const char *const ISAS[] = {"scalar", "avx2", "avx512"};
+    bench_config cfg = { {128, 768, 1536}, 3, 2000000, 42 };
+    int i, d, kernel, first = 1;
+    size_t s;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--dims") == 0) {
+            if (parse_dims(&cfg, val)) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--calls") == 0) {
+            cfg.calls = atol(val);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            cfg.seed = strtoull(val, NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.calls < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    vec_kernels_select();
+    printf("{\n  \"selected\": \"%s\",\n  \"calls\": %ld,\n  \"seed\": %llu,\n"
+           "  \"kernels\": [\n", vec_kern->isa, cfg.calls, (unsigned long long)cfg.seed);
+
+    rng_state = cfg.seed ? cfg.seed : 1;
+    for (d = 0; d < cfg.n_dims; d++) {
+        operands op;
+        if (make_operands(&op, cfg.dims[d])) {
+            fprintf(stderr, "vec_bench: out of memory\n");
+            return 1;
+        }
+        for (s = 0; s < sizeof(ISAS) / sizeof(ISAS[0]); s++) {
+            const vec_kernels *k = vec_kernels_for(ISAS[s]);
+            if (k == NULL) continue;
+            for (kernel = 0; kernel < K_COUNT; kernel++) {
+                run_kernel(&cfg, k, kernel, &op, first);
+                first = 0;
+            }
+        }
+        free_operands(&op);
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
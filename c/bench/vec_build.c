@@ -0,0 +1,261 @@
+#include "libcortex.h"
+#include "cortex_vec.h"
+#include "bench_util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Bulk build scaling of vec_index_build().
+
+    Loads one clustered data set into a plain table, then builds a
+    vec_hnsw index over it once per thread count and reports the build
+    time, the speedup and parallel efficiency against the first count,
+    and recall@k of each index against an exact scan (so a faster build
+    that links a worse graph shows up). The same rows are also inserted
+    one at a time into a vec_hnsw table, the path the bulk build
+    replaces. Results are written to stdout as a single JSON document:
+
+        vec_build [--db PATH] [--rows N] [--dim D] [--m M] [--ef N]
+                  [--threads 1,2,4,8,16] [--queries N] [--k K] [--seed S]
+                  [--no-serial]
+*/
+
+#define MAX_COUNTS 16
+
+typedef struct bench_config {
+    const char *db_path;
+    int rows;
+    int dim;
+    int m;
+    int ef;
+    int threads[MAX_COUNTS];
+    int n_threads;
+    int queries;
+    int k;
+    int serial;
+    uint64_t seed;
+} bench_config;
+
+/* Exact l2 top-k; ids are rowids (row i is rowid i + 1) */
+static void exact_knn(const bench_config *cfg, const float *data, const float *q, int64_t *ids) {
+    float *best = malloc((size_t)cfg->k * sizeof(float));
+    int i, j;
+
+    if (!best) return;
+    for (j = 0; j < cfg->k; j++) {
+        best[j] = 1e30f;
+        ids[j] = 0;
+    }
+    for (i = 0; i < cfg->rows; i++) {
+        float d = vec_l2sq_f32(q, data + (size_t)i * cfg->dim, cfg->dim);
+        if (d >= best[cfg->k - 1]) continue;
+        for (j = cfg->k - 1; j > 0 && best[j - 1] > d; j--) {
+            best[j] = best[j - 1];
+            ids[j] = ids[j - 1];
+        }
+        best[j] = d;
+        ids[j] = i + 1;
+    }
+    free(best);
+}
+
+static double recall(const bench_config *cfg, cortex *db, const char *table, const float *queries,
+                     const int64_t *truth) {
+    cortex_stmt *stmt = NULL;
+    char sql[256];
+    long long hits = 0;
+    int i, j;
+
+    snprintf(sql, sizeof(sql), "SELECT rowid FROM \"%s\" WHERE embedding MATCH ?1 AND k = %d", table, cfg->k);
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) return -1.0;
+    for (i = 0; i < cfg->queries; i++) {
+        const int64_t *want = truth + (size_t)i * cfg->k;
+        cortex_bind_blob(stmt, 1, queries + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float),
+                         CORTEX_STATIC);
+        while (cortex_step(stmt) == CORTEX_ROW) {
+            int64_t id = cortex_column_int64(stmt, 0);
+            for (j = 0; j < cfg->k; j++) {
+                if (want[j] == id) hits++;
+            }
+        }
+        cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    return (double)hits / ((double)cfg->queries * cfg->k);
+}
+
+/* rows -> base(id, embedding) in one transaction; returns seconds or -1 */
+static double load_base(const bench_config *cfg, cortex *db, const float *data) {
+    cortex_stmt *stmt = NULL;
+    uint64_t t0 = now_ns();
+    int i, rc = CORTEX_DONE;
+
+    if (cortex_exec(db, "CREATE TABLE base(id INTEGER PRIMARY KEY, embedding BLOB)", 0, 0, NULL)) return -1.0;
+    if (cortex_prepare_v2(db, "INSERT INTO base VALUES (?1, ?2)", -1, &stmt, NULL) != CORTEX_OK) return -1.0;
+    cortex_exec(db, "BEGIN", 0, 0, NULL);
+    for (i = 0; i < cfg->rows && rc == CORTEX_DONE; i++) {
+        cortex_bind_int64(stmt, 1, i + 1);
+        cortex_bind_blob(stmt, 2, data + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float), CORTEX_STATIC);
+        rc = cortex_step(stmt);
+        cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_DONE || cortex_exec(db, "COMMIT", 0, 0, NULL) != CORTEX_OK) return -1.0;
+    return (double)(now_ns() - t0) / 1e9;
+}
+
+/* The path vec_index_build replaces: INSERT ... SELECT row by row */
+static double serial_insert(const bench_config *cfg, cortex *db) {
+    char sql[256];
+    uint64_t t0;
+
+    snprintf(sql, sizeof(sql), "CREATE VIRTUAL TABLE serial USING vec_hnsw(dim=%d, m=%d, ef_construction=%d)",
+             cfg->dim, cfg->m, cfg->ef);
+    if (cortex_exec(db, sql, 0, 0, NULL) != CORTEX_OK) return -1.0;
+    t0 = now_ns();
+    if (cortex_exec(db, "INSERT INTO serial(rowid, embedding) SELECT id, embedding FROM base", 0, 0, NULL)) {
+        return -1.0;
+    }
+    return (double)(now_ns() - t0) / 1e9;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--db PATH] [--rows N] [--dim D] [--m M] [--ef N] [--threads 1,2,4,8,16] "
+            "[--queries N] [--k K] [--seed S] [--no-serial]\n", argv0);
+}
+
+static int parse_threads(bench_config *cfg, const char *list) {
+    char *end;
+
+    cfg->n_threads = 0;
+    while (*list && cfg->n_threads < MAX_COUNTS) {
+        long t = strtol(list, &end, 10);
+        if (end == list || t < 1 || t > 64) return 1;
+        cfg->threads[cfg->n_threads++] = (int)t;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return cfg->n_threads == 0;
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg = { "vec_build.ctx", 100000, 128, 16, 200, {1, 2, 4, 8, 16}, 5, 100, 10, 1, 42 };
+    cortex *db = NULL;
+    float *centers, *data, *queries;
+    int64_t *truth;
+    double base_s = 0.0, first_s = 0.0;
+    int i, n_centers, failed = 0;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--no-serial") == 0) {
+            cfg.serial = 0;
+            continue;
+        }
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--db") == 0) cfg.db_path = val;
+        else if (strcmp(argv[i], "--rows") == 0) cfg.rows = atoi(val);
+        else if (strcmp(argv[i], "--dim") == 0) cfg.dim = atoi(val);
+        else if (strcmp(argv[i], "--m") == 0) cfg.m = atoi(val);
+        else if (strcmp(argv[i], "--ef") == 0) cfg.ef = atoi(val);
+        else if (strcmp(argv[i], "--queries") == 0) cfg.queries = atoi(val);
+        else if (strcmp(argv[i], "--k") == 0) cfg.k = atoi(val);
+        else if (strcmp(argv[i], "--seed") == 0) cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(argv[i], "--threads") == 0) {
+            if (parse_threads(&cfg, val)) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.rows < 1 || cfg.dim < 1 || cfg.dim > VEC_MAX_DIM || cfg.m < 2 || cfg.ef < 4
+        || cfg.queries < 1 || cfg.k < 1 || cfg.k > cfg.rows) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    rng_state = cfg.seed ? cfg.seed : 1;
+    vec_kernels_select();
+    n_centers = cfg.rows / 100 > 1 ? cfg.rows / 100 : 1;
+    centers = malloc((size_t)n_centers * cfg.dim * sizeof(float));
+    truth = malloc((size_t)cfg.queries * cfg.k * sizeof(int64_t));
+    if (!centers || !truth) return 1;
+    for (i = 0; i < n_centers * cfg.dim; i++) centers[i] = rng_unit();
+    data = make_points(cfg.rows, cfg.dim, centers, n_centers);
+    queries = make_points(cfg.queries, cfg.dim, centers, n_centers);
+    if (!data || !queries) return 1;
+    for (i = 0; i < cfg.queries; i++) {
+        exact_knn(&cfg, data, queries + (size_t)i * cfg.dim, truth + (size_t)i * cfg.k);
+    }
+
+    remove_db(cfg.db_path);
+    if (cortex_open(cfg.db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK
+        || (base_s = load_base(&cfg, db, data)) < 0) {
+        fprintf(stderr, "vec_build: load: %s\n", db ? cortex_errmsg(db) : "cannot open database");
+        cortex_close(db);
+        remove_db(cfg.db_path);
+        return 1;
+    }
+
+    printf("{\n  \"library\": \"%s\",\n  \"kernels\": \"%s\",\n  \"cpus\": %d,\n  \"rows\": %d,\n"
+           "  \"dim\": %d,\n  \"m\": %d,\n  \"ef_construction\": %d,\n  \"k\": %d,\n"
+           "  \"seed\": %llu,\n  \"load_seconds\": %.3f,\n",
+           cortex_libversion(), vec_kern->isa, vec_default_threads(), cfg.rows, cfg.dim, cfg.m,
+           cfg.ef, cfg.k, (unsigned long long)cfg.seed, base_s);
+    if (cfg.serial) {
+        double s = serial_insert(&cfg, db);
+        if (s < 0) {
+            fprintf(stderr, "vec_build: serial: %s\n", cortex_errmsg(db));
+            failed = 1;
+        } else {
+            printf("  \"serial_insert\": {\"seconds\": %.3f, \"rows_per_second\": %.0f, \"recall\": %.4f},\n",
+                   s, cfg.rows / s, recall(&cfg, db, "serial", queries, truth));
+        }
+        cortex_exec(db, "DROP TABLE serial", 0, 0, NULL);
+    }
+    printf("  \"builds\": [\n");
+    fflush(stdout);
+    for (i = 0; i < cfg.n_threads; i++) {
+        char options[128], *err = NULL;
+        uint64_t t0;
+        double s;
+
+        snprintf(options, sizeof(options), "name=idx, dim=%d, m=%d, ef_construction=%d, threads=%d",
+                 cfg.dim, cfg.m, cfg.ef, cfg.threads[i]);
+        t0 = now_ns();
+        if (vec_index_build(db, "base", "embedding", options, NULL, NULL, &err) != CORTEX_OK) {
+            fprintf(stderr, "vec_build: %d threads: %s\n", cfg.threads[i], err ? err : cortex_errmsg(db));
+            cortex_free(err);
+            failed = 1;
+            break;
+        }
+        s = (double)(now_ns() - t0) / 1e9;
+        if (i == 0) first_s = s;
+        printf("%s    {\"threads\": %d, \"seconds\": %.3f, \"rows_per_second\": %.0f, "
+               "\"speedup\": %.2f, \"efficiency\": %.2f, \"recall\": %.4f}",
+               i == 0 ? "" : ",\n", cfg.threads[i], s, cfg.rows / s, first_s / s,
+               first_s / s * cfg.threads[0] / cfg.threads[i], recall(&cfg, db, "idx", queries, truth));
+        fflush(stdout);
+        cortex_exec(db, "DROP TABLE idx", 0, 0, NULL);
+    }
+    printf("\n  ]\n}\n");
+
+    cortex_close(db);
+    remove_db(cfg.db_path);
+    free(centers);
+    free(data);
+    free(queries);
+    free(truth);
+    return failed ? 1 : 0;
+}
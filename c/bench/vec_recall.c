@@ -0,0 +1,342 @@
+#include "libcortex.h"
+#include "cortex_vec.h"
+#include "bench_util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Recall / memory trade-off of the vector indexes.
+
+    Builds the same clustered data set into a vec_hnsw table once per
+    quantize mode, then measures recall@k against an exact scan, query
+    latency, the graph's resident memory after a cold load and the
+    database size. It then builds one vec_ivf table (training on
+    --threads threads) and sweeps nprobe over it. Results are written to
+    stdout as a single JSON document:
+
+        vec_recall [--db PATH] [--rows N] [--queries N] [--dim D] [--k K]
+                   [--metric l2|cosine|dot] [--seed S] [--lists N] [--pq-m N]
+                   [--rescore N] [--threads N]
+*/
+
+typedef struct bench_config {
+    const char *db_path;
+    const char *metric;
+    int rows;
+    int queries;
+    int dim;
+    int k;
+    int lists;
+    int pq_m;
+    int rescore;
+    int threads;
+    uint64_t seed;
+} bench_config;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Exact top-k by the table's metric, computed with the scalar kernels */
+static void exact_knn(const bench_config *cfg, const float *data, const float *q,
+                      int64_t *ids, float *best) {
+    const vec_kernels *kern = vec_kernels_for("scalar");
+    float q_inv = vec_inv_norm_f32(q, cfg->dim);
+    int i, j;
+
+    for (j = 0; j < cfg->k; j++) best[j] = 1e30f;
+    for (i = 0; i < cfg->rows; i++) {
+        const float *x = data + (size_t)i * cfg->dim;
+        float d;
+        if (strcmp(cfg->metric, "cosine") == 0) {
+            d = 1.0f - kern->dot_f32(q, x, cfg->dim) * q_inv * vec_inv_norm_f32(x, cfg->dim);
+        } else if (strcmp(cfg->metric, "dot") == 0) {
+            d = -kern->dot_f32(q, x, cfg->dim);
+        } else {
+            d = kern->l2sq_f32(q, x, cfg->dim);
+        }
+        if (d >= best[cfg->k - 1]) continue;
+        for (j = cfg->k - 1; j > 0 && best[j - 1] > d; j--) {
+            best[j] = best[j - 1];
+            ids[j] = ids[j - 1];
+        }
+        best[j] = d;
+        ids[j] = i + 1;
+    }
+}
+
+static int run_mode(const bench_config *cfg, const char *quant, const float *data,
+                    const float *queries, int first) {
+    int64_t *truth = malloc((size_t)cfg->k * sizeof(int64_t));
+    float *best = malloc((size_t)cfg->k * sizeof(float));
+    uint64_t *lat = malloc((size_t)cfg->queries * sizeof(uint64_t));
+    cortex *db = NULL;
+    cortex_stmt *stmt = NULL;
+    char sql[256];
+    struct stat st;
+    long long hits = 0, mem_before, mem_graph = 0;
+    double build_s;
+    uint64_t t0;
+    int i, rc;
+
+    if (!truth || !best || !lat) return 1;
+    remove_db(cfg->db_path);
+    if (cortex_open(cfg->db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK) goto fail;
+
+    snprintf(sql, sizeof(sql), "CREATE VIRTUAL TABLE v USING vec_hnsw(dim=%d, metric=%s, quantize=%s)",
+             cfg->dim, cfg->metric, quant);
+    if (cortex_exec(db, sql, 0, 0, NULL) != CORTEX_OK) goto fail;
+    if (cortex_prepare_v2(db, "INSERT INTO v(rowid, embedding) VALUES (?1, ?2)", -1, &stmt, NULL)) goto fail;
+    t0 = now_ns();
+    cortex_exec(db, "BEGIN", 0, 0, NULL);
+    for (i = 0; i < cfg->rows; i++) {
+        cortex_bind_int64(stmt, 1, i + 1);
+        cortex_bind_blob(stmt, 2, data + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float), CORTEX_STATIC);
+        rc = cortex_step(stmt);
+        cortex_reset(stmt);
+        if (rc != CORTEX_DONE) goto fail;
+    }
+    if (cortex_exec(db, "COMMIT", 0, 0, NULL) != CORTEX_OK) goto fail;
+    build_s = (double)(now_ns() - t0) / 1e9;
+    cortex_finalize(stmt);
+    stmt = NULL;
+    cortex_close(db);
+    db = NULL;
+
+    /* Reopen so the graph is loaded cold from the shadow tables */
+    if (cortex_open(cfg->db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK) goto fail;
+    snprintf(sql, sizeof(sql), "SELECT rowid FROM v WHERE embedding MATCH ?1 AND k = %d", cfg->k);
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) goto fail;
+    mem_before = cortex_memory_used();
+    for (i = 0; i < cfg->queries; i++) {
+        const float *q = queries + (size_t)i * cfg->dim;
+        int j;
+
+        exact_knn(cfg, data, q, truth, best);
+        cortex_bind_blob(stmt, 1, q, cfg->dim * (int)sizeof(float), CORTEX_STATIC);
+        t0 = now_ns();
+        while (cortex_step(stmt) == CORTEX_ROW) {
+            int64_t id = cortex_column_int64(stmt, 0);
+            for (j = 0; j < cfg->k; j++) {
+                if (truth[j] == id) hits++;
+            }
+        }
+        lat[i] = now_ns() - t0;
+        cortex_reset(stmt);
+        if (i == 0) mem_graph = cortex_memory_used() - mem_before;
+    }
+    qsort(lat, (size_t)cfg->queries, sizeof(uint64_t), cmp_u64);
+    cortex_finalize(stmt);
+    cortex_close(db);
+    stat(cfg->db_path, &st);
+    remove_db(cfg->db_path);
+
+    printf("%s    {\"quantize\": \"%s\", \"recall\": %.4f, \"build_seconds\": %.3f, "
+           "\"p50_us\": %.1f, \"p99_us\": %.1f, \"graph_bytes\": %lld, \"db_bytes\": %lld}",
+           first ? "" : ",\n", quant, (double)hits / ((double)cfg->queries * cfg->k), build_s,
+           (double)lat[cfg->queries / 2] / 1000.0,
+           (double)lat[(int)(0.99 * (cfg->queries - 1) + 0.5)] / 1000.0,
+           mem_graph, (long long)st.st_size);
+    fflush(stdout);
+    free(truth);
+    free(best);
+    free(lat);
+    return 0;
+
+fail:
+    fprintf(stderr, "vec_recall: %s: %s\n", quant, db ? cortex_errmsg(db) : "cannot open database");
+    cortex_finalize(stmt);
+    cortex_close(db);
+    remove_db(cfg->db_path);
+    free(truth);
+    free(best);
+    free(lat);
+    return 1;
+}
+
+/* Insert every row through stmt in one transaction; returns seconds or -1 */
+static double load_rows(const bench_config *cfg, cortex *db, const char *sql, const float *data) {
+    cortex_stmt *stmt = NULL;
+    uint64_t t0 = now_ns();
+    int i, rc = CORTEX_DONE;
+
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) return -1.0;
+    cortex_exec(db, "BEGIN", 0, 0, NULL);
+    for (i = 0; i < cfg->rows && rc == CORTEX_DONE; i++) {
+        cortex_bind_int64(stmt, 1, i + 1);
+        cortex_bind_blob(stmt, 2, data + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float), CORTEX_STATIC);
+        rc = cortex_step(stmt);
+        cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_DONE || cortex_exec(db, "COMMIT", 0, 0, NULL) != CORTEX_OK) return -1.0;
+    return (double)(now_ns() - t0) / 1e9;
+}
+
+/*
+    One vec_ivf build, queried at increasing nprobe. Training happens
+    inside the load when the table reaches train_rows, so build_seconds
+    includes it.
+*/
+static int run_ivf(const bench_config *cfg, const float *data, const float *queries) {
+    static const int NPROBES[] = {1, 2, 4, 8, 16, 32, 64};
+    int64_t *truth = malloc((size_t)cfg->queries * cfg->k * sizeof(int64_t));
+    float *best = malloc((size_t)cfg->k * sizeof(float));
+    uint64_t *lat = malloc((size_t)cfg->queries * sizeof(uint64_t));
+    cortex *db = NULL;
+    cortex_stmt *stmt = NULL;
+    char sql[256], pq_m[32] = "";
+    struct stat st;
+    double build_s;
+    size_t p;
+    int i, j, train_rows = cfg->rows < 40 * cfg->lists ? cfg->rows : 40 * cfg->lists;
+
+    if (!truth || !best || !lat) return 1;
+    for (i = 0; i < cfg->queries; i++) {
+        exact_knn(cfg, data, queries + (size_t)i * cfg->dim, truth + (size_t)i * cfg->k, best);
+    }
+    remove_db(cfg->db_path);
+    if (cortex_open(cfg->db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK) goto fail;
+    if (cfg->pq_m) snprintf(pq_m, sizeof(pq_m), ", pq_m=%d", cfg->pq_m);
+    snprintf(sql, sizeof(sql),
+             "CREATE VIRTUAL TABLE v USING vec_ivf(dim=%d, metric=%s, lists=%d, train_rows=%d,"
+             " threads=%d, rescore=%d%s)",
+             cfg->dim, cfg->metric, cfg->lists, train_rows, cfg->threads, cfg->rescore, pq_m);
+    if (cortex_exec(db, sql, 0, 0, NULL) != CORTEX_OK) goto fail;
+    build_s = load_rows(cfg, db, "INSERT INTO v(rowid, embedding) VALUES (?1, ?2)", data);
+    if (build_s < 0) goto fail;
+    cortex_close(db);
+    db = NULL;
+    stat(cfg->db_path, &st);
+
+    if (cortex_open(cfg->db_path, &db) != CORTEX_OK || cortex_vec_init(db) != CORTEX_OK) goto fail;
+    snprintf(sql, sizeof(sql), "SELECT rowid FROM v WHERE embedding MATCH ?1 AND k = %d AND nprobe = ?2",
+             cfg->k);
+    if (cortex_prepare_v2(db, sql, -1, &stmt, NULL) != CORTEX_OK) goto fail;
+    printf(",\n  \"ivf\": {\"lists\": %d, \"pq_m\": %d, \"rescore\": %d, \"train_rows\": %d, "
+           "\"threads\": %d, \"build_seconds\": %.3f, \"db_bytes\": %lld, \"nprobe\": [\n",
+           cfg->lists, cfg->pq_m, cfg->rescore, train_rows, cfg->threads, build_s, (long long)st.st_size);
+    for (p = 0; p < sizeof(NPROBES) / sizeof(NPROBES[0]) && NPROBES[p] <= cfg->lists; p++) {
+        long long hits = 0;
+
+        for (i = 0; i < cfg->queries; i++) {
+            const int64_t *want = truth + (size_t)i * cfg->k;
+            uint64_t t0;
+
+            cortex_bind_blob(stmt, 1, queries + (size_t)i * cfg->dim, cfg->dim * (int)sizeof(float),
+                             CORTEX_STATIC);
+            cortex_bind_int(stmt, 2, NPROBES[p]);
+            t0 = now_ns();
+            while (cortex_step(stmt) == CORTEX_ROW) {
+                int64_t id = cortex_column_int64(stmt, 0);
+                for (j = 0; j < cfg->k; j++) {
+                    if (want[j] == id) hits++;
+                }
+            }
+            lat[i] = now_ns() - t0;
+            cortex_reset(stmt);
+        }
+        qsort(lat, (size_t)cfg->queries, sizeof(uint64_t), cmp_u64);
+        printf("%s    {\"nprobe\": %d, \"recall\": %.4f, \"p50_us\": %.1f, \"p99_us\": %.1f}",
+               p == 0 ? "" : ",\n", NPROBES[p], (double)hits / ((double)cfg->queries * cfg->k),
+               (double)lat[cfg->queries / 2] / 1000.0,
+               (double)lat[(int)(0.99 * (cfg->queries - 1) + 0.5)] / 1000.0);
+        fflush(stdout);
+    }
+    printf("\n  ]}");
+    cortex_finalize(stmt);
+    cortex_close(db);
+    remove_db(cfg->db_path);
+    free(truth);
+    free(best);
+    free(lat);
+    return 0;
+
+fail:
+    fprintf(stderr, "vec_recall: ivf: %s\n", db ? cortex_errmsg(db) : "cannot open database");
+    cortex_finalize(stmt);
+    cortex_close(db);
+    remove_db(cfg->db_path);
+    free(truth);
+    free(best);
+    free(lat);
+    return 1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--db PATH] [--rows N] [--queries N] [--dim D] [--k K] "
+            "[--metric l2|cosine|dot] [--seed S] [--lists N] [--pq-m N] [--rescore N] "
+            "[--threads N]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    static const char *const MODES[] = {"none", "int8", "binary"};
+    bench_config cfg = { "vec_recall.ctx", "cosine", 20000, 200, 256, 10, 128, 0, 10, 0, 42 };
+    float *centers, *data, *queries;
+    int i, n_centers, failed = 0;
+
+    for (i = 1; i < argc; i++) {
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--db") == 0) cfg.db_path = val;
+        else if (strcmp(argv[i], "--rows") == 0) cfg.rows = atoi(val);
+        else if (strcmp(argv[i], "--queries") == 0) cfg.queries = atoi(val);
+        else if (strcmp(argv[i], "--dim") == 0) cfg.dim = atoi(val);
+        else if (strcmp(argv[i], "--k") == 0) cfg.k = atoi(val);
+        else if (strcmp(argv[i], "--metric") == 0) cfg.metric = val;
+        else if (strcmp(argv[i], "--seed") == 0) cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(argv[i], "--lists") == 0) cfg.lists = atoi(val);
+        else if (strcmp(argv[i], "--pq-m") == 0) cfg.pq_m = atoi(val);
+        else if (strcmp(argv[i], "--rescore") == 0) cfg.rescore = atoi(val);
+        else if (strcmp(argv[i], "--threads") == 0) cfg.threads = atoi(val);
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (cfg.rows < 1 || cfg.queries < 1 || cfg.dim < 1 || cfg.dim > VEC_MAX_DIM
+        || cfg.k < 1 || cfg.k > cfg.rows || cfg.lists < 1 || cfg.threads < 0
+        || cfg.pq_m < 0 || cfg.rescore < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    rng_state = cfg.seed ? cfg.seed : 1;
+    vec_kernels_select();
+    if (cfg.threads == 0) cfg.threads = vec_default_threads();
+    n_centers = cfg.rows / 100 > 1 ? cfg.rows / 100 : 1;
+    centers = malloc((size_t)n_centers * cfg.dim * sizeof(float));
+    if (!centers) return 1;
+    for (i = 0; i < n_centers * cfg.dim; i++) centers[i] = rng_unit();
+    data = make_points(cfg.rows, cfg.dim, centers, n_centers);
+    queries = make_points(cfg.queries, cfg.dim, centers, n_centers);
+    if (!data || !queries) return 1;
+
+    printf("{\n  \"library\": \"%s\",\n  \"kernels\": \"%s\",\n  \"rows\": %d,\n"
+           "  \"queries\": %d,\n  \"dim\": %d,\n  \"k\": %d,\n  \"metric\": \"%s\",\n"
+           "  \"seed\": %llu,\n  \"modes\": [\n",
+           cortex_libversion(), vec_kern->isa, cfg.rows, cfg.queries, cfg.dim, cfg.k,
+           cfg.metric, (unsigned long long)cfg.seed);
+    for (i = 0; i < (int)(sizeof(MODES) / sizeof(MODES[0])); i++) {
+        failed |= run_mode(&cfg, MODES[i], data, queries, i == 0);
+    }
+    printf("\n  ]");
+    failed |= run_ivf(&cfg, data, queries);
+    printf("\n}\n");
+
+    free(centers);
+    free(data);
+    free(queries);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef CORTEX_PCACHE_H
+#define CORTEX_PCACHE_H
+
+#include "libcortex.h"
+
+/*
+    Alternative page cache built into libcortex (pcache_sharded.c).
+
+    Each connection's cache is a private hash table with S3-FIFO
+    eviction: pages read once (a scan) pass through a small FIFO and
+    leave without displacing pages that were read again, which live in
+    the main FIFO. Nothing on the fetch and unpin paths takes a lock.
+    Page memory comes from 2 MiB slabs shared by all caches, handed out
+    in batches by 16 independently locked shards; with hugepages set the
+    slabs are backed by huge pages when the system has them. Slabs are
+    only returned to the OS by cortex_shutdown().
+
+    Installed process-wide with cortex_config(CORTEX_CONFIG_PCACHE2), so
+    it must be called before the first connection is opened (or after
+    cortex_shutdown()); otherwise it returns CORTEX_MISUSE. Returns
+    CORTEX_ERROR where threads are not available.
+*/
+int cortex_pcache_sharded_install(int hugepages);
+
+#endif
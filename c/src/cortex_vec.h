@@ -0,0 +1,207 @@
+#ifndef CORTEX_VEC_H
+#define CORTEX_VEC_H
+
+#include "libcortex.h"
+#include <stdint.h>
+
+/*
+    Cortex vector search extension.
+
+    Embeddings are float32 BLOBs (native byte order) or JSON arrays such
+    as '[0.1, -2, 3e-4]'. cortex_vec_init() registers every vector module
+    and SQL function on one connection; the Python package calls it right
+    after opening each handle.
+*/
+
+#define VEC_MAX_DIM 8192
+
+typedef enum vec_metric {
+    VEC_METRIC_L2,          /* euclidean distance */
+    VEC_METRIC_COSINE,      /* 1 - cosine similarity */
+    VEC_METRIC_DOT          /* negative inner product */
+} vec_metric;
+
+/* Compact codes an index can keep in place of float32 vectors */
+typedef enum vec_quant {
+    VEC_QUANT_NONE,
+    VEC_QUANT_INT8,         /* one signed byte per dimension, 4x smaller */
+    VEC_QUANT_BINARY        /* one sign bit per dimension, 32x smaller */
+} vec_quant;
+
+/*
+    Distance kernels (vec_distance.c). One table per instruction set;
+    vec_kernels_select() points vec_kern at the widest one the CPU
+    supports. Inputs may be unaligned: the kernels read BLOB bytes in
+    place. Bit vectors are packed 8 dimensions per byte.
+*/
+typedef struct vec_kernels {
+    const char *isa;        /* "scalar", "avx2" or "avx512" */
+    float (*dot_f32)(const float *a, const float *b, int dim);
+    float (*l2sq_f32)(const float *a, const float *b, int dim);
+    int32_t (*dot_i8)(const int8_t *a, const int8_t *b, int dim);
+    int32_t (*l2sq_i8)(const int8_t *a, const int8_t *b, int dim);
+    int64_t (*hamming)(const uint8_t *a, const uint8_t *b, int nbytes);
+} vec_kernels;
+
+extern const vec_kernels *vec_kern;
+
+/*
+    Kernel table for an instruction set name, or NULL when the build or
+    the CPU lacks it. Used by vec_kernels_select() and the benchmarks.
+*/
+const vec_kernels *vec_kernels_for(const char *isa);
+void vec_kernels_select(void);
+
+static inline float vec_dot_f32(const float *a, const float *b, int dim) {
+    return vec_kern->dot_f32(a, b, dim);
+}
+
+static inline float vec_l2sq_f32(const float *a, const float *b, int dim) {
+    return vec_kern->l2sq_f32(a, b, dim);
+}
+
+float vec_inv_norm_f32(const float *a, int dim);
+
+int vec_parse_metric(const char *name, vec_metric *metric);
+const char *vec_metric_name(vec_metric metric);
+int vec_parse_quant(const char *name, vec_quant *quant);
+const char *vec_quant_name(vec_quant quant);
+
+/*
+    Module argument helpers: vec_split_option() splits one "key = value"
+    argument (errors are prefixed with the module name); vec_parse_int()
+    accepts a whole number in [min, max].
+*/
+int vec_split_option(const char *module, const char *arg, char *key, int key_size,
+                     char *value, int value_size, char **errmsg);
+int vec_parse_int(const char *value, int min, int max, int *out);
+
+/*
+    Symmetric int8 quantization: out[i] = round(x[i] * 127 / max), clamped.
+    max <= 0 uses the vector's own largest magnitude. Returns the scale
+    (max / 127) that maps codes back to values.
+*/
+float vec_quantize_i8(const float *x, int dim, float max, int8_t *out);
+
+/* Sign bits, 8 dimensions per byte (dimension i is bit i % 8 of byte i / 8) */
+void vec_quantize_bits(const float *x, int dim, uint8_t *out);
+
+/*
+    Fill out[dim] from a float32 BLOB or JSON array value. Returns
+    CORTEX_OK, or CORTEX_ERROR with *errmsg set (free with cortex_free).
+*/
+int vec_from_value(cortex_value *value, int dim, float *out, char **errmsg);
+int vec_parse_json(const char *text, float *out, int cap, int *count, char **errmsg);
+
+/* vec_functions.c: vec_l2, vec_cosine, vec_dot, vec_hamming */
+int vec_functions_register(cortex *db);
+
+/*
+    Parallel loops and k-means for index training (vec_kmeans.c).
+    vec_parallel_for() runs fn(arg, task) for every task in [0, n_tasks)
+    on up to threads threads, the calling thread included; tasks must not
+    touch the database. Builds without pthreads run them serially.
+*/
+int vec_default_threads(void);
+void vec_parallel_for(int n_tasks, int threads, void (*fn)(void *arg, int task), void *arg);
+
+/* Index of the centroid nearest to x by l2 */
+int vec_nearest(const float *x, const float *centroids, int k, int dim, float *dist);
+
+/*
+    Lloyd's k-means over n points into k centroids (k * dim floats),
+    seeded from k distinct points. Returns CORTEX_OK or CORTEX_NOMEM.
+*/
+int vec_kmeans(const float *points, int n, int dim, int k, int iters, int threads,
+               uint64_t seed, float *centroids);
+
+/*
+    Filterable metadata columns (vec_meta.c). A table binds the helper
+    to its own schema and name fields so renames carry over; values live
+    in the %_meta shadow table. vec_meta_best_index() claims comparison
+    and IN constraints on columns first_col.., hands out argv slots from
+    *argv, stores them in idxStr, and sets *unclaimed when some other
+    constraint on a metadata column is left for SQLite to check.
+    vec_meta_filter() returns the rowids that pass (free with
+    cortex_free); its statements are kept per idxStr.
+*/
+#define VEC_MAX_META 16
+#define VEC_MAX_FILTERS 32
+#define VEC_META_PLANS 8
+
+typedef struct vec_meta_plan {
+    char *idx_str;
+    cortex_stmt *stmt;
+} vec_meta_plan;
+
+typedef struct vec_meta {
+    int n;
+    char *names[VEC_MAX_META];
+    const char *types[VEC_MAX_META];
+    cortex *db;
+    char **schema;
+    char **name;
+    cortex_stmt *stmt_get;
+    cortex_stmt *stmt_put;
+    cortex_stmt *stmt_del;
+    vec_meta_plan plans[VEC_META_PLANS];
+    int next_plan;          /* the plan replaced when all are taken */
+} vec_meta;
+
+void vec_meta_bind(vec_meta *m, cortex *db, char **schema, char **name);
+int vec_meta_add(vec_meta *m, const char *module, const char *arg, const char *const *reserved,
+                 char **errmsg);
+char *vec_meta_declare(const vec_meta *m, const char *fixed);
+int vec_meta_create(const vec_meta *m, char **errmsg);
+int vec_meta_rename(vec_meta *m, const char *new_name);
+int vec_meta_write(vec_meta *m, cortex_int64 rowid, cortex_value **values);
+int vec_meta_delete(vec_meta *m, cortex_int64 rowid);
+int vec_meta_column(vec_meta *m, cortex_int64 rowid, int col, cortex_context *ctx);
+int vec_meta_best_index(const vec_meta *m, int first_col, cortex_index_info *info, int *argv,
+                        int *unclaimed);
+int vec_meta_filter(vec_meta *m, const char *idx_str, cortex_value **argv,
+                    cortex_int64 **rowids, int *n);
+void vec_meta_reset(vec_meta *m);
+void vec_meta_free(vec_meta *m);
+
+/*
+    Bulk index builds (vec_build.c). vec_index_build() creates a vec_hnsw
+    index over table.column (options: name, default <table>_<column>_idx,
+    then any vec_hnsw option) and fills it from the rows already there
+    on the table's build threads. progress, if not NULL, is called as
+    rows are indexed (total is -1 when unknown); a nonzero return
+    cancels the build. Index modules report through vec_build_report(),
+    which returns nonzero to stop; vec_build_watched() says whether
+    anyone is listening, so they can skip counting rows otherwise.
+*/
+typedef int (*vec_progress)(void *arg, cortex_int64 done, cortex_int64 total);
+
+int vec_index_build(cortex *db, const char *table, const char *column, const char *options,
+                    vec_progress progress, void *arg, char **errmsg);
+int vec_build_watched(void);
+int vec_build_report(cortex_int64 done, cortex_int64 total);
+int vec_build_register(cortex *db);
+
+/* vec_hnsw.c */
+int vec_hnsw_register(cortex *db);
+
+/*
+    Query batches (vec_batch.c). vec_batch_from_value() reads the query
+    vectors of a batch, a BLOB of float32 vectors back to back or a
+    JSON array of vectors, into *out (n * dim floats, free with
+    cortex_free). Returns CORTEX_OK, CORTEX_NOMEM, or CORTEX_ERROR with
+    *errmsg set. vec_batch_register() adds vec_search_many().
+*/
+int vec_batch_from_value(cortex_value *value, int dim, float **out, int *n, char **errmsg);
+int vec_batch_register(cortex *db);
+
+/* vec_ivf.c */
+int vec_ivf_register(cortex *db);
+
+/* vec_hybrid.c: hybrid_search(), full-text and vector rankings fused */
+int vec_hybrid_register(cortex *db);
+
+/* vec_init.c */
+int cortex_vec_init(cortex *db);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef CORTEX_VFS_H
+#define CORTEX_VFS_H
+
+#include "libcortex.h"
+
+/*
+    Optional VFS layers built into libcortex.
+
+    Each one wraps the default unix VFS and is registered process-wide
+    under its own name, so a connection picks it with the zVfs argument
+    of cortex_open_v2() (or vfs= in cortex.connect()). make_default also
+    makes it the VFS of cortex_open(). Registering twice is harmless.
+*/
+
+/*
+    vfs_uring.c: "io_uring". Page writes are staged in a registered
+    buffer and submitted together at xSync (or when a read, lock change
+    or WAL index update needs them on disk), with the fsync drained
+    behind them in the same submission. PRAGMA uring_submitted counts
+    the submissions of the database file and its WAL. Linux only;
+    returns CORTEX_ERROR when the kernel does not allow io_uring.
+*/
+int cortex_vfs_uring_register(int make_default);
+
+/*
+    vfs_prefetch.c: "prefetch". Watches the page reads of each database
+    file and, once they step through it at a steady stride, reads ahead
+    on a background thread into two private windows that grow from
+    128 KiB to 1 MiB. Read-ahead is dropped at every lock change and
+    local write, so a window never outlives the snapshot it was read
+    under. PRAGMA prefetch_windows counts the windows read ahead.
+    Returns CORTEX_ERROR where threads are not available.
+*/
+int cortex_vfs_prefetch_register(int make_default);
+
+/*
+    vfs_compress.c: "compress". Database pages are compressed one by one
+    and stored behind a map from page to offset in the file; journals
+    and WAL files are left alone. The URI parameters compress=zstd|lz4
+    and compress_level=N pick the codec for pages written from then on.
+    A compressed file only opens through this VFS. Returns CORTEX_ERROR
+    when libcortex was built without zstd and LZ4 (CORTEX_HAVE_ZSTD,
+    CORTEX_HAVE_LZ4).
+*/
+int cortex_vfs_compress_register(int make_default);
+
+/*
+    vfs_checksum.c: "checksum". Stores a CRC32C of every database page in
+    its last 4 bytes, reserved with CORTEX_FCNTL_RESERVE_BYTES (set it
+    before the first table, or before a VACUUM of an existing database),
+    and checks reads against it: one read in N with the URI parameter
+    checksum_sample=N or PRAGMA checksum_sample=N, every read by default.
+    A bad page fails with CORTEX_IOERR_DATA. Databases without the
+    reserve pass through unchecked.
+*/
+int cortex_vfs_checksum_register(int make_default);
+
+/*
+    Shared by the layers (vfs_shim.c). vfs_shim_init() fills vfs so that
+    everything but xOpen forwards to root, with file_size bytes of layer
+    state in front of root's file. vfs_shim_methods() trims a layer's
+    io methods to what the file underneath implements. vfs_open_unix()
+    opens name through root and sets fd to the descriptor the unix VFS
+    opened for it, or -1 when that cannot be told for sure.
+*/
+void vfs_shim_init(cortex_vfs *vfs, cortex_vfs *root, const char *name, int file_size,
+                   int (*open)(cortex_vfs *, cortex_filename, cortex_file *, int, int *));
+void vfs_shim_methods(cortex_io_methods *methods, const cortex_io_methods *real);
+int vfs_open_unix(cortex_vfs *root, cortex_filename name, cortex_file *file, int flags,
+                  int *out_flags, int *fd);
+
+#endif
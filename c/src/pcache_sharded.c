@@ -0,0 +1,536 @@
+#include "cortex_pcache.h"
+
+/*
+    Sharded page cache: a cortex_pcache_methods2 with per-connection
+    S3-FIFO caches over a shared, sharded slab allocator.
+
+    A cache belongs to one pager and is only ever called by the thread
+    that holds its connection, so its hash table and queues need no
+    locking. What the caches share is page memory: fixed-size slots
+    (page buffer, then our header, then the pager's extra bytes) cut
+    from 2 MiB slabs, one size class per slot size. Each class has
+    PCACHE_SHARDS free lists with their own mutex, and a cache talks to
+    the shard it was given at creation, PCACHE_BATCH slots at a time, so
+    readers on different cores rarely meet on a lock and never on the
+    fetch path.
+
+    Eviction is S3-FIFO. New pages enter the small queue (about a tenth
+    of the cache); one that is fetched again before it reaches the end
+    moves to the main queue, the rest leave and are remembered in a
+    direct-mapped ghost table. A page that comes back while remembered
+    goes straight to main. Main pages carry a 2-bit hit count and get
+    another trip round for each hit. A scan's pages are read once and
+    leave through the small queue, so the working set survives it.
+    Pinned pages are passed over and requeued.
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CORTEX_HAVE_PCACHE_SHARDED 1
+#endif
+
+#ifdef CORTEX_HAVE_PCACHE_SHARDED
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define PCACHE_SHARDS 16
+#define PCACHE_CLASSES 16                   /* distinct slot sizes */
+#define PCACHE_SLAB (2u << 20)              /* one huge page on x86-64 */
+#define PCACHE_BATCH 32                     /* slots moved to or from a shard at once */
+#define PCACHE_SMALL_PCT 10                 /* share of the cache for the small queue */
+#define PCACHE_MAX_FREQ 3
+#define PCACHE_MIN_HASH 256
+
+enum { QUEUE_SMALL, QUEUE_MAIN };
+
+typedef struct pcache_slot pcache_slot;
+
+/* Lives between the page buffer and the extra bytes of each slot */
+struct pcache_slot {
+    cortex_pcache_page page;
+    pcache_slot *hash_next;
+    pcache_slot *prev, *next;               /* queue links, head is newest */
+    unsigned key;
+    unsigned char queue;
+    unsigned char freq;
+    unsigned char pinned;
+};
+
+typedef struct pcache_queue {
+    pcache_slot *head, *tail;
+    unsigned n;
+} pcache_queue;
+
+typedef struct pcache_shard {
+    pthread_mutex_t mutex;
+    void *free;                             /* free slots, linked through their first word */
+    char pad[64];                           /* keep neighbouring shards off this line */
+} pcache_shard;
+
+typedef struct pcache_class {
+    size_t slot_size;
+    pcache_shard shards[PCACHE_SHARDS];
+} pcache_class;
+
+typedef struct sharded_cache {
+    pcache_class *cls;
+    pcache_shard *shard;
+    int sz_page, sz_extra, purgeable;
+    unsigned max;                           /* PRAGMA cache_size, in pages */
+    unsigned n_page;                        /* pinned or not */
+    pcache_slot **hash;
+    unsigned n_hash;                        /* power of two */
+    pcache_queue small, main;
+    unsigned *ghost;                        /* keys recently evicted from small */
+    unsigned ghost_bits;
+    void *free;                             /* slots taken from the shard, unused */
+    unsigned n_free;
+} sharded_cache;
+
+static pthread_mutex_t registry = PTHREAD_MUTEX_INITIALIZER;
+static pcache_class *classes[PCACHE_CLASSES];
+static void **slabs;
+static size_t n_slabs, cap_slabs;
+static unsigned next_shard;
+static int use_hugepages;
+
+/*
+    Slabs and shards
+*/
+static void *slab_map(void) {
+    void *p;
+
+#ifdef MAP_HUGETLB
+    if (use_hugepages) {
+        p = mmap(NULL, PCACHE_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) return p;
+    }
+#endif
+    p = mmap(NULL, PCACHE_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (use_hugepages) madvise(p, PCACHE_SLAB, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+/* Adds a slab's slots to the shard; called with the shard locked */
+static int shard_grow(pcache_class *cls, pcache_shard *shard) {
+    unsigned char *slab, *slot;
+    size_t n, i;
+    void **grown;
+
+    slab = slab_map();
+    if (!slab) return 0;
+    pthread_mutex_lock(&registry);
+    if (n_slabs == cap_slabs) {
+        grown = realloc(slabs, (cap_slabs ? cap_slabs * 2 : 64) * sizeof(*slabs));
+        if (!grown) {
+            pthread_mutex_unlock(&registry);
+            munmap(slab, PCACHE_SLAB);
+            return 0;
+        }
+        slabs = grown;
+        cap_slabs = cap_slabs ? cap_slabs * 2 : 64;
+    }
+    slabs[n_slabs++] = slab;
+    pthread_mutex_unlock(&registry);
+
+    n = PCACHE_SLAB / cls->slot_size;
+    for (i = n; i-- > 0;) {
+        slot = slab + i * cls->slot_size;
+        *(void **)slot = shard->free;
+        shard->free = slot;
+    }
+    return 1;
+}
+
+/* Finds or makes the class for a slot size; called with the registry locked */
+static pcache_class *class_for(size_t slot_size) {
+    int i, j;
+
+    for (i = 0; i < PCACHE_CLASSES && classes[i]; i++) {
+        if (classes[i]->slot_size == slot_size) return classes[i];
+    }
+    if (i == PCACHE_CLASSES || slot_size > PCACHE_SLAB) return NULL;
+    classes[i] = calloc(1, sizeof(pcache_class));
+    if (!classes[i]) return NULL;
+    classes[i]->slot_size = slot_size;
+    for (j = 0; j < PCACHE_SHARDS; j++) pthread_mutex_init(&classes[i]->shards[j].mutex, NULL);
+    return classes[i];
+}
+
+/*
+    Slots of one cache
+*/
+static pcache_slot *slot_header(const sharded_cache *c, void *slot) {
+    return (pcache_slot *)((unsigned char *)slot + c->sz_page);
+}
+
+static void *slot_start(const sharded_cache *c, pcache_slot *p) {
+    return (unsigned char *)p - c->sz_page;
+}
+
+static pcache_slot *slot_alloc(sharded_cache *c) {
+    void *slot;
+    pcache_slot *p;
+
+    if (!c->free) {
+        pcache_shard *shard = c->shard;
+        pthread_mutex_lock(&shard->mutex);
+        if (!shard->free && !shard_grow(c->cls, shard)) {
+            pthread_mutex_unlock(&shard->mutex);
+            return NULL;
+        }
+        while (shard->free && c->n_free < PCACHE_BATCH) {
+            slot = shard->free;
+            shard->free = *(void **)slot;
+            *(void **)slot = c->free;
+            c->free = slot;
+            c->n_free++;
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    slot = c->free;
+    c->free = *(void **)slot;
+    c->n_free--;
+
+    p = slot_header(c, slot);
+    p->page.pBuf = slot;
+    p->page.pExtra = (unsigned char *)p + sizeof(pcache_slot);
+    return p;
+}
+
+/* Hands every local free slot back to the shard in one go */
+static void slots_release(sharded_cache *c) {
+    void *last = c->free;
+
+    if (!last) return;
+    while (*(void **)last) last = *(void **)last;
+    pthread_mutex_lock(&c->shard->mutex);
+    *(void **)last = c->shard->free;
+    c->shard->free = c->free;
+    pthread_mutex_unlock(&c->shard->mutex);
+    c->free = NULL;
+    c->n_free = 0;
+}
+
+static void slot_free(sharded_cache *c, pcache_slot *p) {
+    void *slot = slot_start(c, p);
+
+    *(void **)slot = c->free;
+    c->free = slot;
+    if (++c->n_free > 2 * PCACHE_BATCH) slots_release(c);
+}
+
+/*
+    Hash table, queues, ghost table
+*/
+static pcache_slot **hash_find(sharded_cache *c, unsigned key) {
+    pcache_slot **pp = &c->hash[key & (c->n_hash - 1)];
+    while (*pp && (*pp)->key != key) pp = &(*pp)->hash_next;
+    return pp;
+}
+
+static void hash_resize(sharded_cache *c, unsigned n_hash) {
+    pcache_slot **hash = calloc(n_hash, sizeof(*hash));
+    pcache_slot *p, *next;
+    unsigned i;
+
+    if (!hash) return;                      /* keep the old, longer chains */
+    for (i = 0; i < c->n_hash; i++) {
+        for (p = c->hash[i]; p; p = next) {
+            next = p->hash_next;
+            p->hash_next = hash[p->key & (n_hash - 1)];
+            hash[p->key & (n_hash - 1)] = p;
+        }
+    }
+    free(c->hash);
+    c->hash = hash;
+    c->n_hash = n_hash;
+}
+
+static void queue_push(pcache_queue *q, pcache_slot *p) {
+    p->prev = NULL;
+    p->next = q->head;
+    if (q->head) q->head->prev = p;
+    else q->tail = p;
+    q->head = p;
+    q->n++;
+}
+
+static void queue_remove(pcache_queue *q, pcache_slot *p) {
+    if (p->prev) p->prev->next = p->next;
+    else q->head = p->next;
+    if (p->next) p->next->prev = p->prev;
+    else q->tail = p->prev;
+    q->n--;
+}
+
+static pcache_queue *queue_of(sharded_cache *c, pcache_slot *p) {
+    return p->queue == QUEUE_MAIN ? &c->main : &c->small;
+}
+
+static unsigned *ghost_slot(sharded_cache *c, unsigned key) {
+    return &c->ghost[(key * 2654435761u) >> (32 - c->ghost_bits)];
+}
+
+/* A ghost table about the size of the main queue */
+static void ghost_resize(sharded_cache *c, unsigned max) {
+    unsigned bits = 6, *ghost;
+
+    while (bits < 24 && (1u << bits) < max) bits++;
+    if (c->ghost && bits == c->ghost_bits) return;
+    ghost = calloc((size_t)1 << bits, sizeof(*ghost));
+    if (!ghost) return;
+    free(c->ghost);
+    c->ghost = ghost;
+    c->ghost_bits = bits;
+}
+
+/* Takes a page out of the cache and returns its slot */
+static void page_drop(sharded_cache *c, pcache_slot *p) {
+    *hash_find(c, p->key) = p->hash_next;
+    queue_remove(queue_of(c, p), p);
+    c->n_page--;
+    slot_free(c, p);
+}
+
+/*
+    S3-FIFO: finds an unpinned page to evict and drops it. Every step
+    either requeues a page (at most PCACHE_MAX_FREQ + 2 times each) or
+    evicts one, so the walk is bounded.
+*/
+static int evict_one(sharded_cache *c) {
+    unsigned long steps = (unsigned long)c->n_page * (PCACHE_MAX_FREQ + 2) + 2;
+    pcache_slot *p;
+
+    while (steps--) {
+        if (c->small.n && (c->small.n * 100 >= (unsigned long)c->max * PCACHE_SMALL_PCT || !c->main.n)) {
+            p = c->small.tail;
+            if (!p->pinned && !p->freq) {
+                *ghost_slot(c, p->key) = p->key;
+                page_drop(c, p);
+                return 1;
+            }
+            queue_remove(&c->small, p);
+            if (!p->pinned) {
+                p->queue = QUEUE_MAIN;
+                p->freq = 0;
+                queue_push(&c->main, p);
+            } else {
+                queue_push(&c->small, p);
+            }
+        } else if (c->main.n) {
+            p = c->main.tail;
+            if (!p->pinned && !p->freq) {
+                page_drop(c, p);
+                return 1;
+            }
+            queue_remove(&c->main, p);
+            if (p->freq) p->freq--;
+            queue_push(&c->main, p);
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void enforce_max(sharded_cache *c) {
+    while (c->purgeable && c->n_page > c->max && evict_one(c)) {
+    }
+}
+
+/*
+    cortex_pcache_methods2
+*/
+static int sharded_init(void *arg) {
+    (void)arg;
+    return CORTEX_OK;
+}
+
+static void sharded_shutdown(void *arg) {
+    size_t i;
+
+    (void)arg;
+    pthread_mutex_lock(&registry);
+    for (i = 0; i < n_slabs; i++) munmap(slabs[i], PCACHE_SLAB);
+    free(slabs);
+    slabs = NULL;
+    n_slabs = cap_slabs = 0;
+    for (i = 0; i < PCACHE_CLASSES && classes[i]; i++) {
+        int j;
+        for (j = 0; j < PCACHE_SHARDS; j++) pthread_mutex_destroy(&classes[i]->shards[j].mutex);
+        free(classes[i]);
+        classes[i] = NULL;
+    }
+    pthread_mutex_unlock(&registry);
+}
+
+static cortex_pcache *sharded_create(int sz_page, int sz_extra, int purgeable) {
+    sharded_cache *c = calloc(1, sizeof(sharded_cache));
+    size_t slot_size = ((size_t)sz_page + sizeof(pcache_slot) + (size_t)sz_extra + 63) & ~(size_t)63;
+
+    if (!c) return NULL;
+    pthread_mutex_lock(&registry);
+    c->cls = class_for(slot_size);
+    c->shard = c->cls ? &c->cls->shards[next_shard++ % PCACHE_SHARDS] : NULL;
+    pthread_mutex_unlock(&registry);
+    c->sz_page = sz_page;
+    c->sz_extra = sz_extra;
+    c->purgeable = purgeable;
+    c->max = 100;
+    c->n_hash = PCACHE_MIN_HASH;
+    c->hash = calloc(c->n_hash, sizeof(*c->hash));
+    ghost_resize(c, c->max);
+    if (!c->cls || !c->hash || !c->ghost) {
+        free(c->hash);
+        free(c->ghost);
+        free(c);
+        return NULL;
+    }
+    return (cortex_pcache *)c;
+}
+
+static void sharded_cachesize(cortex_pcache *cache, int n) {
+    sharded_cache *c = (sharded_cache *)cache;
+
+    c->max = n > 0 ? (unsigned)n : 1;
+    ghost_resize(c, c->max);
+    enforce_max(c);
+}
+
+static int sharded_pagecount(cortex_pcache *cache) {
+    return (int)((sharded_cache *)cache)->n_page;
+}
+
+static cortex_pcache_page *sharded_fetch(cortex_pcache *cache, unsigned key, int create) {
+    sharded_cache *c = (sharded_cache *)cache;
+    pcache_slot *p = *hash_find(c, key);
+    unsigned *ghost;
+
+    if (p) {
+        if (p->freq < PCACHE_MAX_FREQ) p->freq++;
+        p->pinned = 1;
+        return &p->page;
+    }
+    if (!create) return NULL;
+    if (c->purgeable && c->n_page >= c->max && !evict_one(c) && create == 1) return NULL;
+    p = slot_alloc(c);
+    if (!p) return NULL;
+
+    p->key = key;
+    p->freq = 0;
+    p->pinned = 1;
+    *(void **)p->page.pExtra = NULL;        /* the pager's "not initialised yet" */
+    ghost = ghost_slot(c, key);
+    if (*ghost == key) {
+        *ghost = 0;
+        p->queue = QUEUE_MAIN;
+        queue_push(&c->main, p);
+    } else {
+        p->queue = QUEUE_SMALL;
+        queue_push(&c->small, p);
+    }
+    p->hash_next = c->hash[key & (c->n_hash - 1)];
+    c->hash[key & (c->n_hash - 1)] = p;
+    if (++c->n_page > c->n_hash) hash_resize(c, c->n_hash * 2);
+    return &p->page;
+}
+
+static void sharded_unpin(cortex_pcache *cache, cortex_pcache_page *page, int discard) {
+    sharded_cache *c = (sharded_cache *)cache;
+    pcache_slot *p = (pcache_slot *)page;
+
+    p->pinned = 0;
+    if (discard || !c->purgeable) page_drop(c, p);
+    else enforce_max(c);
+}
+
+static void sharded_rekey(cortex_pcache *cache, cortex_pcache_page *page, unsigned old_key,
+                          unsigned new_key) {
+    sharded_cache *c = (sharded_cache *)cache;
+    pcache_slot *p = (pcache_slot *)page, *other;
+
+    (void)old_key;
+    *hash_find(c, p->key) = p->hash_next;
+    other = *hash_find(c, new_key);
+    if (other) page_drop(c, other);
+    p->key = new_key;
+    p->hash_next = c->hash[new_key & (c->n_hash - 1)];
+    c->hash[new_key & (c->n_hash - 1)] = p;
+}
+
+static void sharded_truncate(cortex_pcache *cache, unsigned limit) {
+    sharded_cache *c = (sharded_cache *)cache;
+    pcache_queue *queues[2] = { &c->small, &c->main };
+    pcache_slot *p, *next;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        for (p = queues[i]->head; p; p = next) {
+            next = p->next;
+            if (p->key >= limit) page_drop(c, p);
+        }
+    }
+}
+
+static void sharded_destroy(cortex_pcache *cache) {
+    sharded_cache *c = (sharded_cache *)cache;
+
+    sharded_truncate(cache, 0);
+    slots_release(c);
+    free(c->hash);
+    free(c->ghost);
+    free(c);
+}
+
+static void sharded_shrink(cortex_pcache *cache) {
+    sharded_cache *c = (sharded_cache *)cache;
+    pcache_queue *queues[2] = { &c->small, &c->main };
+    pcache_slot *p, *next;
+    int i;
+
+    for (i = 0; c->purgeable && i < 2; i++) {
+        for (p = queues[i]->head; p; p = next) {
+            next = p->next;
+            if (!p->pinned) page_drop(c, p);
+        }
+    }
+    slots_release(c);
+}
+
+static const cortex_pcache_methods2 sharded_methods = {
+    1,
+    NULL,
+    sharded_init,
+    sharded_shutdown,
+    sharded_create,
+    sharded_cachesize,
+    sharded_pagecount,
+    sharded_fetch,
+    sharded_unpin,
+    sharded_rekey,
+    sharded_truncate,
+    sharded_destroy,
+    sharded_shrink
+};
+
+int cortex_pcache_sharded_install(int hugepages) {
+    int rc = cortex_config(CORTEX_CONFIG_PCACHE2, &sharded_methods);
+    if (rc == CORTEX_OK) use_hugepages = hugepages;
+    return rc;
+}
+
+#else
+
+int cortex_pcache_sharded_install(int hugepages) {
+    (void)hugepages;
+    return CORTEX_ERROR;
+}
+
+#endif
@@ -0,0 +1,350 @@
+#include "cortex_vec.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    vec_search_many — nearest neighbours of a batch of query vectors.
+
+        SELECT query, id, distance FROM vec_search_many('notes_vec', ?1, 10);
+
+    Arguments: a vec_hnsw table, the queries and k. Returns the k nearest
+    rows of each query, numbered from 0 in batch order, ranked 1..k, by
+    query then distance. The queries are either
+
+        one BLOB of float32 vectors back to back;
+        a JSON array of vectors, '[[0.1, 0.2], [0.3, 0.4]]'.
+
+    The function fronts the batch plan of vec_hnsw
+    (WHERE queries MATCH ?1 AND k = ?2), which does the work once for
+    all queries; see there. A carray is not read: the object behind
+    cortex_carray_bind() is private to the carray extension, and a BLOB
+    carries the same vectors without a parse.
+*/
+
+#define BATCH_MAX_QUERIES 100000
+
+static int skip_space(const char **p) {
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') (*p)++;
+    return **p;
+}
+
+static int batch_alloc(int n, int dim, float **out, char **errmsg) {
+    if (n > BATCH_MAX_QUERIES) {
+        *errmsg = cortex_mprintf("a batch holds at most %d queries", BATCH_MAX_QUERIES);
+        return CORTEX_ERROR;
+    }
+    *out = cortex_malloc64((cortex_uint64)(n ? n : 1) * dim * sizeof(float));
+    return *out ? CORTEX_OK : CORTEX_NOMEM;
+}
+
+/* '[[...], [...]]': each inner array goes through vec_parse_json() */
+static int batch_from_json(const char *text, int dim, float **out, int *n_out, char **errmsg) {
+    const char *p = text;
+    float *queries = NULL;
+    int n = 0, cap = 0, rc = CORTEX_OK;
+
+    if (skip_space(&p) != '[') goto malformed;
+    p++;
+    if (skip_space(&p) == ']') goto done;
+    for (;;) {
+        int count;
+
+        if (n >= BATCH_MAX_QUERIES) {
+            *errmsg = cortex_mprintf("a batch holds at most %d queries", BATCH_MAX_QUERIES);
+            rc = CORTEX_ERROR;
+            goto done;
+        }
+        if (n == cap) {
+            float *grown;
+            cap = cap ? cap * 2 : 16;
+            if (cap > BATCH_MAX_QUERIES) cap = BATCH_MAX_QUERIES;
+            grown = cortex_realloc64(queries, (cortex_uint64)cap * dim * sizeof(float));
+            if (grown == NULL) {
+                rc = CORTEX_NOMEM;
+                goto done;
+            }
+            queries = grown;
+        }
+        if (skip_space(&p) != '[') goto malformed;
+        if ((rc = vec_parse_json(p, queries + (size_t)n * dim, dim, &count, errmsg)) != CORTEX_OK) {
+            goto done;
+        }
+        if (count != dim) {
+            *errmsg = cortex_mprintf("query %d has %d dimensions, expected %d", n, count, dim);
+            rc = CORTEX_ERROR;
+            goto done;
+        }
+        n++;
+        p = strchr(p, ']') + 1;
+        if (skip_space(&p) == ',') {
+            p++;
+            continue;
+        }
+        if (*p == ']') break;
+        goto malformed;
+    }
+done:
+    if (rc != CORTEX_OK) {
+        cortex_free(queries);
+        return rc;
+    }
+    if (queries == NULL && (queries = cortex_malloc(sizeof(float))) == NULL) return CORTEX_NOMEM;
+    *out = queries;
+    *n_out = n;
+    return CORTEX_OK;
+malformed:
+    cortex_free(queries);
+    *errmsg = cortex_mprintf("queries must be a JSON array of vectors");
+    return CORTEX_ERROR;
+}
+
+int vec_batch_from_value(cortex_value *value, int dim, float **out, int *n_out, char **errmsg) {
+    int rc;
+
+    *out = NULL;
+    *n_out = 0;
+    *errmsg = NULL;
+    switch (cortex_value_type(value)) {
+        case CORTEX_BLOB: {
+            int bytes = cortex_value_bytes(value), size = dim * (int)sizeof(float);
+            if (bytes % size != 0) {
+                *errmsg = cortex_mprintf("a %d-byte query blob is not a whole number of float32 x %d vectors",
+                                         bytes, dim);
+                return CORTEX_ERROR;
+            }
+            if ((rc = batch_alloc(bytes / size, dim, out, errmsg)) != CORTEX_OK) return rc;
+            if (bytes) memcpy(*out, cortex_value_blob(value), (size_t)bytes);
+            *n_out = bytes / size;
+            return CORTEX_OK;
+        }
+        case CORTEX_TEXT:
+            return batch_from_json((const char *)cortex_value_text(value), dim, out, n_out, errmsg);
+        default:
+            *errmsg = cortex_mprintf("queries must be a float32 blob or a JSON array of vectors");
+            return CORTEX_ERROR;
+    }
+}
+
+/* ─────────────────────────────────────────
+   vec_search_many()
+   ───────────────────────────────────────── */
+
+enum {
+    MANY_COL_QUERY, MANY_COL_ID, MANY_COL_DISTANCE, MANY_COL_RANK,
+    /* hidden arguments, in call order */
+    MANY_COL_TABLE, MANY_COL_QUERIES, MANY_COL_K
+};
+
+#define MANY_N_ARGS 3
+#define MANY_ALL_ARGS ((1 << MANY_N_ARGS) - 1)
+
+typedef struct many_row {
+    int query;
+    int rank;
+    cortex_int64 id;
+    double distance;
+} many_row;
+
+typedef struct many_vtab {
+    cortex_vtab base;
+    cortex *db;
+} many_vtab;
+
+typedef struct many_cursor {
+    cortex_vtab_cursor base;
+    many_row *rows;
+    int n, pos;
+} many_cursor;
+
+static int many_connect(cortex *db, void *aux, int argc, const char *const *argv,
+                        cortex_vtab **ppVtab, char **pzErr) {
+    many_vtab *v;
+    int rc;
+
+    (void)aux;
+    (void)argc;
+    (void)argv;
+    (void)pzErr;
+    rc = cortex_declare_vtab(db,
+        "CREATE TABLE x(query INTEGER, id INTEGER, distance REAL, rank INTEGER,"
+        " vec_table HIDDEN, queries HIDDEN, k HIDDEN)");
+    if (rc != CORTEX_OK) return rc;
+    v = cortex_malloc(sizeof(many_vtab));
+    if (v == NULL) return CORTEX_NOMEM;
+    memset(v, 0, sizeof(many_vtab));
+    v->db = db;
+    *ppVtab = &v->base;
+    return CORTEX_OK;
+}
+
+static int many_disconnect(cortex_vtab *pVtab) {
+    cortex_free(pVtab);
+    return CORTEX_OK;
+}
+
+/* idxNum has bit i set when argument i is given; argv follows column order */
+static int many_best_index(cortex_vtab *pVtab, cortex_index_info *info) {
+    int given[MANY_N_ARGS] = {-1, -1, -1};
+    int i, argv = 1;
+
+    (void)pVtab;
+    for (i = 0; i < info->nConstraint; i++) {
+        const struct cortex_index_constraint *c = &info->aConstraint[i];
+        int arg = c->iColumn - MANY_COL_TABLE;
+        if (arg < 0 || c->op != CORTEX_INDEX_CONSTRAINT_EQ) continue;
+        /* an argument we cannot use yet rules this plan out */
+        if (!c->usable) return CORTEX_CONSTRAINT;
+        given[arg] = i;
+    }
+    info->idxNum = 0;
+    for (i = 0; i < MANY_N_ARGS; i++) {
+        if (given[i] < 0) continue;
+        info->idxNum |= 1 << i;
+        info->aConstraintUsage[given[i]].argvIndex = argv++;
+        info->aConstraintUsage[given[i]].omit = 1;
+    }
+    if (info->nOrderBy >= 1 && info->nOrderBy <= 2 && info->aOrderBy[0].iColumn == MANY_COL_QUERY
+        && !info->aOrderBy[0].desc
+        && (info->nOrderBy == 1
+            || ((info->aOrderBy[1].iColumn == MANY_COL_DISTANCE || info->aOrderBy[1].iColumn == MANY_COL_RANK)
+                && !info->aOrderBy[1].desc))) {
+        info->orderByConsumed = 1;
+    }
+    info->estimatedCost = 100.0;
+    info->estimatedRows = 100;
+    return CORTEX_OK;
+}
+
+static int many_open(cortex_vtab *pVtab, cortex_vtab_cursor **ppCursor) {
+    many_cursor *cur = cortex_malloc(sizeof(many_cursor));
+
+    (void)pVtab;
+    if (cur == NULL) return CORTEX_NOMEM;
+    memset(cur, 0, sizeof(many_cursor));
+    *ppCursor = &cur->base;
+    return CORTEX_OK;
+}
+
+static int many_close(cortex_vtab_cursor *pCursor) {
+    many_cursor *cur = (many_cursor *)pCursor;
+    cortex_free(cur->rows);
+    cortex_free(cur);
+    return CORTEX_OK;
+}
+
+static int many_filter(cortex_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                       int argc, cortex_value **argv) {
+    many_cursor *cur = (many_cursor *)pCursor;
+    many_vtab *v = (many_vtab *)pCursor->pVtab;
+    const char *table;
+    cortex_stmt *stmt = NULL;
+    many_row *rows = NULL;
+    char *sql;
+    int n = 0, cap = 0, rc;
+
+    (void)idxStr;
+    (void)argc;
+    cortex_free(cur->rows);
+    cur->rows = NULL;
+    cur->n = cur->pos = 0;
+    table = idxNum == MANY_ALL_ARGS ? (const char *)cortex_value_text(argv[0]) : NULL;
+    if (table == NULL) {
+        v->base.zErrMsg = cortex_mprintf("vec_search_many: usage is vec_search_many(vec_table, queries, k)");
+        return CORTEX_ERROR;
+    }
+    sql = cortex_mprintf("SELECT query, rowid, distance FROM \"%w\" WHERE queries MATCH ?1 AND k = ?2"
+                         " ORDER BY query, distance", table);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) rc = cortex_bind_value(stmt, 1, argv[1]);
+    if (rc == CORTEX_OK) rc = cortex_bind_value(stmt, 2, argv[2]);
+    while (rc == CORTEX_OK && (rc = cortex_step(stmt)) == CORTEX_ROW) {
+        many_row *row;
+        if (n == cap) {
+            int grown_cap = cap ? cap * 2 : 64;
+            many_row *grown = cortex_realloc64(rows, (cortex_uint64)grown_cap * sizeof(many_row));
+            if (grown == NULL) {
+                rc = CORTEX_NOMEM;
+                break;
+            }
+            rows = grown;
+            cap = grown_cap;
+        }
+        row = &rows[n++];
+        row->query = cortex_column_int(stmt, 0);
+        row->id = cortex_column_int64(stmt, 1);
+        row->distance = cortex_column_double(stmt, 2);
+        row->rank = n > 1 && rows[n - 2].query == row->query ? rows[n - 2].rank + 1 : 1;
+        rc = CORTEX_OK;
+    }
+    if (rc == CORTEX_DONE) rc = CORTEX_OK;
+    if (rc != CORTEX_OK && rc != CORTEX_NOMEM) {
+        v->base.zErrMsg = cortex_mprintf("vec_search_many: %s: %s", table, cortex_errmsg(v->db));
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_OK) {
+        cortex_free(rows);
+        return rc;
+    }
+    cur->rows = rows;
+    cur->n = n;
+    return CORTEX_OK;
+}
+
+static int many_next(cortex_vtab_cursor *pCursor) {
+    ((many_cursor *)pCursor)->pos++;
+    return CORTEX_OK;
+}
+
+static int many_eof(cortex_vtab_cursor *pCursor) {
+    many_cursor *cur = (many_cursor *)pCursor;
+    return cur->pos >= cur->n;
+}
+
+static int many_column(cortex_vtab_cursor *pCursor, cortex_context *ctx, int col) {
+    many_cursor *cur = (many_cursor *)pCursor;
+    const many_row *row = &cur->rows[cur->pos];
+
+    switch (col) {
+        case MANY_COL_QUERY:
+            cortex_result_int(ctx, row->query);
+            break;
+        case MANY_COL_ID:
+            cortex_result_int64(ctx, row->id);
+            break;
+        case MANY_COL_DISTANCE:
+            cortex_result_double(ctx, row->distance);
+            break;
+        case MANY_COL_RANK:
+            cortex_result_int(ctx, row->rank);
+            break;
+    }
+    return CORTEX_OK;
+}
+
+static int many_rowid(cortex_vtab_cursor *pCursor, cortex_int64 *pRowid) {
+    *pRowid = ((many_cursor *)pCursor)->pos;
+    return CORTEX_OK;
+}
+
+static cortex_module many_module = {
+    0,                      /* iVersion */
+    NULL,                   /* xCreate: eponymous only */
+    many_connect,
+    many_best_index,
+    many_disconnect,
+    NULL,                   /* xDestroy */
+    many_open,
+    many_close,
+    many_filter,
+    many_next,
+    many_eof,
+    many_column,
+    many_rowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+int vec_batch_register(cortex *db) {
+    return cortex_create_module_v2(db, "vec_search_many", &many_module, NULL, NULL);
+}
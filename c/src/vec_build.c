@@ -0,0 +1,152 @@
+#include "cortex_vec.h"
+#include <string.h>
+
+/*
+    Bulk index builds over an existing table.
+
+        SELECT vec_index_build('notes', 'embedding', 'name=notes_vec, dim=768, threads=16');
+
+    creates notes_vec as a vec_hnsw table with content=notes and indexes
+    every row notes already holds; the function returns how many. The
+    index module does the work inside xCreate (content_backfill in
+    vec_hnsw.c): rows are read in rowid order in shards and each shard is
+    linked into the graph on the table's build threads.
+
+    C callers use vec_index_build() to get progress as well. The
+    callback cannot be handed through CREATE VIRTUAL TABLE, so it is
+    parked in a thread-local for the duration of the statement: xCreate
+    runs on the thread that prepared it, and the index reports through
+    vec_build_report().
+*/
+
+#if defined(_MSC_VER)
+#define VEC_THREAD_LOCAL __declspec(thread)
+#else
+#define VEC_THREAD_LOCAL __thread
+#endif
+
+typedef struct build_watch {
+    vec_progress fn;        /* NULL when only the row count is wanted */
+    void *arg;
+    cortex_int64 done;
+} build_watch;
+
+static VEC_THREAD_LOCAL build_watch *watching;
+
+int vec_build_watched(void) {
+    return watching != NULL && watching->fn != NULL;
+}
+
+int vec_build_report(cortex_int64 done, cortex_int64 total) {
+    if (watching == NULL) return 0;
+    watching->done = done;
+    return watching->fn ? watching->fn(watching->arg, done, total) : 0;
+}
+
+/*
+    Split options on commas: name= picks the index name and everything
+    else goes to the module as is, metadata column declarations included.
+*/
+static int index_build(cortex *db, const char *table, const char *column, const char *options,
+                       build_watch *watch, char **errmsg) {
+    build_watch *outer = watching;
+    char *name = NULL, *args = cortex_mprintf(""), *sql;
+    const char *p = options ? options : "";
+    int rc = CORTEX_OK;
+
+    while (args && *p && rc == CORTEX_OK) {
+        const char *end = strchr(p, ',');
+        int len = end ? (int)(end - p) : (int)strlen(p);
+        char *item = cortex_mprintf("%.*s", len, p);
+        char key[32], value[256];
+
+        p += end ? len + 1 : len;
+        if (item == NULL) {
+            rc = CORTEX_NOMEM;
+        } else if (strspn(item, " \t\n") == strlen(item)) {
+            /* empty */
+        } else if (strchr(item, '=') == NULL) {
+            args = cortex_mprintf("%z%s, ", args, item);
+        } else if ((rc = vec_split_option("vec_index_build", item, key, sizeof(key), value,
+                                          sizeof(value), errmsg)) == CORTEX_OK) {
+            if (strcmp(key, "name") != 0) {
+                args = cortex_mprintf("%z%s, ", args, item);
+            } else if (value[0] == '\0') {
+                if (errmsg) *errmsg = cortex_mprintf("vec_index_build: name must not be empty");
+                rc = CORTEX_ERROR;
+            } else {
+                cortex_free(name);
+                if ((name = cortex_mprintf("%s", value)) == NULL) rc = CORTEX_NOMEM;
+            }
+        }
+        cortex_free(item);
+    }
+    if (rc == CORTEX_OK && args == NULL) rc = CORTEX_NOMEM;
+    if (rc == CORTEX_OK && name == NULL && (name = cortex_mprintf("%s_%s_idx", table, column)) == NULL) {
+        rc = CORTEX_NOMEM;
+    }
+    if (rc != CORTEX_OK) {
+        cortex_free(name);
+        cortex_free(args);
+        return rc;
+    }
+    /* content last, so it names this table whatever the options say */
+    sql = cortex_mprintf(
+        "CREATE VIRTUAL TABLE \"%w\" USING vec_hnsw(%scontent=\"%w\", content_column=\"%w\")",
+        name, args, table, column);
+    cortex_free(name);
+    cortex_free(args);
+    if (sql == NULL) return CORTEX_NOMEM;
+    watching = watch;
+    rc = cortex_exec(db, sql, NULL, NULL, errmsg);
+    watching = outer;
+    cortex_free(sql);
+    return rc;
+}
+
+int vec_index_build(cortex *db, const char *table, const char *column, const char *options,
+                    vec_progress progress, void *arg, char **errmsg) {
+    build_watch watch;
+
+    watch.fn = progress;
+    watch.arg = arg;
+    watch.done = 0;
+    if (errmsg) *errmsg = NULL;
+    return index_build(db, table, column, options, &watch, errmsg);
+}
+
+/* vec_index_build(table, column [, options]) -> rows indexed */
+static void build_func(cortex_context *ctx, int argc, cortex_value **argv) {
+    const char *table = (const char *)cortex_value_text(argv[0]);
+    const char *column = (const char *)cortex_value_text(argv[1]);
+    const char *options = argc > 2 ? (const char *)cortex_value_text(argv[2]) : NULL;
+    build_watch watch;
+    char *err = NULL;
+    int rc;
+
+    if (table == NULL || column == NULL) {
+        cortex_result_error(ctx, "vec_index_build: table and column are required", -1);
+        return;
+    }
+    watch.fn = NULL;
+    watch.arg = NULL;
+    watch.done = 0;
+    rc = index_build(cortex_context_db_handle(ctx), table, column, options, &watch, &err);
+    if (rc != CORTEX_OK) {
+        cortex_result_error(ctx, err ? err : cortex_errstr(rc), -1);
+        cortex_result_error_code(ctx, rc);
+        cortex_free(err);
+        return;
+    }
+    cortex_result_int64(ctx, watch.done);
+}
+
+int vec_build_register(cortex *db) {
+    /* creates tables: never from triggers, views or schema expressions */
+    const int flags = CORTEX_UTF8 | CORTEX_DIRECTONLY;
+    int rc = cortex_create_function_v2(db, "vec_index_build", 2, flags, NULL, build_func, NULL, NULL, NULL);
+    if (rc == CORTEX_OK) {
+        rc = cortex_create_function_v2(db, "vec_index_build", 3, flags, NULL, build_func, NULL, NULL, NULL);
+    }
+    return rc;
+}
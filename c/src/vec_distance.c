@@ -0,0 +1,558 @@
+#include "cortex_vec.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VEC_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+    Distance kernels and vector parsing shared by the vector modules.
+
+    Each instruction set gets one vec_kernels table. The SIMD kernels are
+    compiled with per-function target attributes, so a single build runs
+    anywhere and vec_kernels_select() picks the widest table at runtime.
+*/
+
+/* ─────────────────────────────────────────
+   Scalar
+   ───────────────────────────────────────── */
+
+static int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (int)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/* Four independent sums so the adds are not one serial dependency chain */
+static float dot_f32_scalar(const float *a, const float *b, int dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float l2sq_f32_scalar(const float *a, const float *b, int dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f, d;
+    int i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        d = a[i] - b[i];
+        s0 += d * d;
+        d = a[i + 1] - b[i + 1];
+        s1 += d * d;
+        d = a[i + 2] - b[i + 2];
+        s2 += d * d;
+        d = a[i + 3] - b[i + 3];
+        s3 += d * d;
+    }
+    for (; i < dim; i++) {
+        d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int dim) {
+    int32_t sum = 0;
+    int i;
+
+    for (i = 0; i < dim; i++) sum += (int32_t)a[i] * b[i];
+    return sum;
+}
+
+static int32_t l2sq_i8_scalar(const int8_t *a, const int8_t *b, int dim) {
+    int32_t sum = 0;
+    int i;
+
+    for (i = 0; i < dim; i++) {
+        int32_t d = (int32_t)a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static int64_t hamming_scalar(const uint8_t *a, const uint8_t *b, int nbytes) {
+    int64_t sum = 0;
+    int i = 0;
+
+    for (; i + 8 <= nbytes; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        sum += popcount64(x ^ y);
+    }
+    for (; i < nbytes; i++) sum += popcount64((uint64_t)(a[i] ^ b[i]));
+    return sum;
+}
+
+static const vec_kernels SCALAR_KERNELS = {
+    "scalar", dot_f32_scalar, l2sq_f32_scalar, dot_i8_scalar, l2sq_i8_scalar, hamming_scalar
+};
+
+#ifdef VEC_X86
+
+/* ─────────────────────────────────────────
+   AVX2 + FMA
+   ───────────────────────────────────────── */
+
+#define VEC_AVX2 __attribute__((target("avx2,fma")))
+
+VEC_AVX2 static float hsum_ps_avx2(__m256 v) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_movehdup_ps(x));
+    return _mm_cvtss_f32(x);
+}
+
+VEC_AVX2 static int32_t hsum_epi32_avx2(__m256i v) {
+    __m128i x = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(x);
+}
+
+VEC_AVX2 static float dot_f32_avx2(const float *a, const float *b, int dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    float sum;
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    if (i + 8 <= dim) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        i += 8;
+    }
+    sum = hsum_ps_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+VEC_AVX2 static float l2sq_f32_avx2(const float *a, const float *b, int dim) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), d;
+    float sum;
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        s0 = _mm256_fmadd_ps(d, d, s0);
+        d = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        s1 = _mm256_fmadd_ps(d, d, s1);
+    }
+    if (i + 8 <= dim) {
+        d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        s0 = _mm256_fmadd_ps(d, d, s0);
+        i += 8;
+    }
+    sum = hsum_ps_avx2(_mm256_add_ps(s0, s1));
+    for (; i < dim; i++) {
+        float e = a[i] - b[i];
+        sum += e * e;
+    }
+    return sum;
+}
+
+/* int8 lanes are widened to int16 and multiplied pairwise into int32 (vpmaddwd) */
+VEC_AVX2 static int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int dim) {
+    __m256i acc = _mm256_setzero_si256();
+    int32_t sum;
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i y = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+    }
+    sum = hsum_epi32_avx2(acc);
+    for (; i < dim; i++) sum += (int32_t)a[i] * b[i];
+    return sum;
+}
+
+VEC_AVX2 static int32_t l2sq_i8_avx2(const int8_t *a, const int8_t *b, int dim) {
+    __m256i acc = _mm256_setzero_si256();
+    int32_t sum;
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i y = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i d = _mm256_sub_epi16(x, y);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+    }
+    sum = hsum_epi32_avx2(acc);
+    for (; i < dim; i++) {
+        int32_t d = (int32_t)a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+/* Nibble lookup popcount (Mula et al.), summed per 8 bytes with vpsadbw */
+VEC_AVX2 static int64_t hamming_avx2(const uint8_t *a, const uint8_t *b, int nbytes) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    int64_t lanes[4];
+    int i = 0;
+
+    for (; i + 32 <= nbytes; i += 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i n = _mm256_add_epi8(
+            _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+            _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(n, _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + hamming_scalar(a + i, b + i, nbytes - i);
+}
+
+static const vec_kernels AVX2_KERNELS = {
+    "avx2", dot_f32_avx2, l2sq_f32_avx2, dot_i8_avx2, l2sq_i8_avx2, hamming_avx2
+};
+
+/* ─────────────────────────────────────────
+   AVX-512 (F + BW, VPOPCNTDQ when present)
+   ───────────────────────────────────────── */
+
+#define VEC_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+static __mmask16 tail_mask16(int n) {
+    return n >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << n) - 1);
+}
+
+VEC_AVX512 static float dot_f32_avx512(const float *a, const float *b, int dim) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    for (; i < dim; i += 16) {
+        __mmask16 m = tail_mask16(dim - i);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+VEC_AVX512 static float l2sq_f32_avx512(const float *a, const float *b, int dim) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), d;
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        s0 = _mm512_fmadd_ps(d, d, s0);
+        d = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        s1 = _mm512_fmadd_ps(d, d, s1);
+    }
+    for (; i < dim; i += 16) {
+        __mmask16 m = tail_mask16(dim - i);
+        d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        s0 = _mm512_fmadd_ps(d, d, s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+VEC_AVX512 static int32_t dot_i8_avx512(const int8_t *a, const int8_t *b, int dim) {
+    __m512i acc = _mm512_setzero_si512();
+    int32_t sum;
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        __m512i x = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(a + i)));
+        __m512i y = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(x, y));
+    }
+    sum = _mm512_reduce_add_epi32(acc);
+    return sum + dot_i8_scalar(a + i, b + i, dim - i);
+}
+
+VEC_AVX512 static int32_t l2sq_i8_avx512(const int8_t *a, const int8_t *b, int dim) {
+    __m512i acc = _mm512_setzero_si512();
+    int32_t sum;
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        __m512i x = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(a + i)));
+        __m512i y = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(b + i)));
+        __m512i d = _mm512_sub_epi16(x, y);
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(d, d));
+    }
+    sum = _mm512_reduce_add_epi32(acc);
+    return sum + l2sq_i8_scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vpopcntdq")))
+static int64_t hamming_avx512(const uint8_t *a, const uint8_t *b, int nbytes) {
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+
+    for (; i < nbytes; i += 64) {
+        int n = nbytes - i;
+        __mmask64 m = n >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << n) - 1);
+        __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi8(m, a + i),
+                                     _mm512_maskz_loadu_epi8(m, b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+
+static const vec_kernels AVX512_KERNELS = {
+    "avx512", dot_f32_avx512, l2sq_f32_avx512, dot_i8_avx512, l2sq_i8_avx512, hamming_avx512
+};
+
+/* Skylake-X and Cascade Lake have AVX-512BW but no VPOPCNTDQ */
+static const vec_kernels AVX512_NOPOPCNT_KERNELS = {
+    "avx512", dot_f32_avx512, l2sq_f32_avx512, dot_i8_avx512, l2sq_i8_avx512, hamming_avx2
+};
+
+#endif /* VEC_X86 */
+
+/* ─────────────────────────────────────────
+   Dispatch
+   ───────────────────────────────────────── */
+
+const vec_kernels *vec_kern = &SCALAR_KERNELS;
+
+const vec_kernels *vec_kernels_for(const char *isa) {
+    if (strcmp(isa, "scalar") == 0) return &SCALAR_KERNELS;
+#ifdef VEC_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx2") == 0) {
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return &AVX2_KERNELS;
+    } else if (strcmp(isa, "avx512") == 0) {
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return __builtin_cpu_supports("avx512vpopcntdq") ? &AVX512_KERNELS
+                                                             : &AVX512_NOPOPCNT_KERNELS;
+        }
+    }
+#endif
+    return NULL;
+}
+
+/*
+    Point vec_kern at the widest supported table. CORTEX_VEC_ISA=scalar
+    (or avx2, avx512) pins a narrower one for debugging and benchmarks.
+    Every call stores the same pointer, so concurrent first opens are
+    harmless.
+*/
+void vec_kernels_select(void) {
+    static const char *const ORDER[] = {"avx512", "avx2"};
+    const char *forced = getenv("CORTEX_VEC_ISA");
+    const vec_kernels *k = NULL;
+    size_t i;
+
+    if (forced != NULL) k = vec_kernels_for(forced);
+    for (i = 0; k == NULL && i < sizeof(ORDER) / sizeof(ORDER[0]); i++) {
+        k = vec_kernels_for(ORDER[i]);
+    }
+    vec_kern = k != NULL ? k : &SCALAR_KERNELS;
+}
+
+float vec_inv_norm_f32(const float *a, int dim) {
+    float norm = sqrtf(vec_dot_f32(a, a, dim));
+    return norm > 0.0f ? 1.0f / norm : 0.0f;
+}
+
+/* ─────────────────────────────────────────
+   Quantizers
+   ───────────────────────────────────────── */
+
+float vec_quantize_i8(const float *x, int dim, float max, int8_t *out) {
+    float mul;
+    int i;
+
+    if (max <= 0.0f) {
+        for (i = 0; i < dim; i++) {
+            float a = fabsf(x[i]);
+            if (a > max) max = a;
+        }
+    }
+    if (max <= 0.0f) {
+        memset(out, 0, (size_t)dim);
+        return 0.0f;
+    }
+    mul = 127.0f / max;
+    for (i = 0; i < dim; i++) {
+        float q = x[i] * mul;
+        q = q > 127.0f ? 127.0f : q < -127.0f ? -127.0f : q;
+        out[i] = (int8_t)lrintf(q);
+    }
+    return max / 127.0f;
+}
+
+void vec_quantize_bits(const float *x, int dim, uint8_t *out) {
+    int i;
+
+    memset(out, 0, (size_t)(dim + 7) / 8);
+    for (i = 0; i < dim; i++) {
+        if (x[i] > 0.0f) out[i >> 3] |= (uint8_t)(1u << (i & 7));
+    }
+}
+
+/* ─────────────────────────────────────────
+   Names and parsing
+   ───────────────────────────────────────── */
+
+static const char *METRIC_NAMES[] = {"l2", "cosine", "dot"};
+
+int vec_parse_metric(const char *name, vec_metric *metric) {
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (cortex_stricmp(name, METRIC_NAMES[i]) == 0) {
+            *metric = (vec_metric)i;
+            return CORTEX_OK;
+        }
+    }
+    return CORTEX_ERROR;
+}
+
+const char *vec_metric_name(vec_metric metric) {
+    return METRIC_NAMES[metric];
+}
+
+static const char *QUANT_NAMES[] = {"none", "int8", "binary"};
+
+int vec_parse_quant(const char *name, vec_quant *quant) {
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (cortex_stricmp(name, QUANT_NAMES[i]) == 0) {
+            *quant = (vec_quant)i;
+            return CORTEX_OK;
+        }
+    }
+    return CORTEX_ERROR;
+}
+
+const char *vec_quant_name(vec_quant quant) {
+    return QUANT_NAMES[quant];
+}
+
+int vec_parse_int(const char *value, int min, int max, int *out) {
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < min || n > max) return CORTEX_ERROR;
+    *out = (int)n;
+    return CORTEX_OK;
+}
+
+/*
+    Split one "key = value" module argument, trimming blanks around both
+    and quotes around the value.
+*/
+int vec_split_option(const char *module, const char *arg, char *key, int key_size,
+                     char *value, int value_size, char **errmsg) {
+    const char *eq = strchr(arg, '=');
+    const char *p;
+    size_t klen, vlen;
+
+    if (eq == NULL) {
+        *errmsg = cortex_mprintf("%s: expected key=value, got \"%s\"", module, arg);
+        return CORTEX_ERROR;
+    }
+    for (p = arg; *p == ' '; p++) {}
+    klen = (size_t)(eq - p);
+    while (klen > 0 && p[klen - 1] == ' ') klen--;
+    for (eq++; *eq == ' ' || *eq == '\'' || *eq == '"'; eq++) {}
+    vlen = strlen(eq);
+    while (vlen > 0 && (eq[vlen - 1] == ' ' || eq[vlen - 1] == '\'' || eq[vlen - 1] == '"')) vlen--;
+    if (klen >= (size_t)key_size || vlen >= (size_t)value_size) {
+        *errmsg = cortex_mprintf("%s: option too long: \"%s\"", module, arg);
+        return CORTEX_ERROR;
+    }
+    memcpy(key, p, klen);
+    key[klen] = '\0';
+    memcpy(value, eq, vlen);
+    value[vlen] = '\0';
+    return CORTEX_OK;
+}
+
+/*
+    Parse a JSON array of numbers into out[cap]. *count receives the full
+    element count even when it exceeds cap (nothing past cap is written).
+*/
+int vec_parse_json(const char *text, float *out, int cap, int *count, char **errmsg) {
+    const char *p = text;
+    int n = 0;
+
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    if (*p++ != '[') {
+        *errmsg = cortex_mprintf("vector must be a float32 blob or a JSON array");
+        return CORTEX_ERROR;
+    }
+    for (;;) {
+        char *end;
+        double v;
+
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (*p == ']' && n == 0) break;
+        v = strtod(p, &end);
+        if (end == p) {
+            *errmsg = cortex_mprintf("invalid number in vector at element %d", n);
+            return CORTEX_ERROR;
+        }
+        if (n < cap) out[n] = (float)v;
+        n++;
+        p = end;
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == ']') break;
+        *errmsg = cortex_mprintf("malformed JSON vector");
+        return CORTEX_ERROR;
+    }
+    *count = n;
+    return CORTEX_OK;
+}
+
+int vec_from_value(cortex_value *value, int dim, float *out, char **errmsg) {
+    switch (cortex_value_type(value)) {
+        case CORTEX_BLOB: {
+            int bytes = cortex_value_bytes(value);
+            if (bytes != dim * (int)sizeof(float)) {
+                *errmsg = cortex_mprintf(
+                    "vector blob has %d bytes, expected %d (float32 x %d)",
+                    bytes, dim * (int)sizeof(float), dim);
+                return CORTEX_ERROR;
+            }
+            memcpy(out, cortex_value_blob(value), bytes);
+            return CORTEX_OK;
+        }
+        case CORTEX_TEXT: {
+            int n;
+            if (vec_parse_json((const char *)cortex_value_text(value), out, dim, &n, errmsg)) {
+                return CORTEX_ERROR;
+            }
+            if (n != dim) {
+                *errmsg = cortex_mprintf("vector has %d dimensions, expected %d", n, dim);
+                return CORTEX_ERROR;
+            }
+            return CORTEX_OK;
+        }
+        default:
+            *errmsg = cortex_mprintf("vector must be a float32 blob or a JSON array");
+            return CORTEX_ERROR;
+    }
+}
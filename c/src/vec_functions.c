@@ -0,0 +1,229 @@
+#include "cortex_vec.h"
+#include <math.h>
+#include <string.h>
+
+/*
+    Scalar distance functions for exact search over stored embeddings.
+
+        vec_l2(a, b [, type])       euclidean distance
+        vec_cosine(a, b [, type])   1 - cosine similarity
+        vec_dot(a, b [, type])      inner product
+        vec_hamming(a, b)           differing bits of two bit-packed BLOBs
+
+        vec_quantize_int8(v [, max])    float32 -> int8 codes
+        vec_quantize_binary(v)          float32 -> sign bits, 8 per byte
+
+    type is 'float32' (the default) or 'int8'. BLOB arguments are read in
+    place through the dispatched kernels; float32 arguments may also be
+    JSON arrays, which are parsed into a temporary buffer. NULL in gives
+    NULL out.
+
+    vec_quantize_int8 maps [-max, max] onto [-127, 127]. Without max each
+    vector uses its own largest magnitude, which preserves cosine
+    distance but not l2 or dot.
+*/
+
+typedef enum {
+    FN_L2, FN_COSINE, FN_DOT, FN_HAMMING, FN_QUANTIZE_INT8, FN_QUANTIZE_BINARY
+} vec_fn_kind;
+
+typedef struct vec_fn {
+    const char *name;
+    vec_fn_kind kind;
+} vec_fn;
+
+typedef struct vec_arg {
+    const void *data;
+    int dim;
+    float *owned;           /* parsed JSON, freed by the caller */
+} vec_arg;
+
+static int load_arg(cortex_context *ctx, const vec_fn *fn, cortex_value *value,
+                    int elem_size, vec_arg *arg) {
+    arg->owned = NULL;
+    if (cortex_value_type(value) == CORTEX_TEXT && elem_size == (int)sizeof(float)) {
+        const char *text = (const char *)cortex_value_text(value);
+        int cap = cortex_value_bytes(value) / 2 + 1;
+        char *err = NULL;
+
+        arg->owned = cortex_malloc64((cortex_uint64)cap * sizeof(float));
+        if (arg->owned == NULL) {
+            cortex_result_error_nomem(ctx);
+            return CORTEX_NOMEM;
+        }
+        if (vec_parse_json(text, arg->owned, cap, &arg->dim, &err) != CORTEX_OK) {
+            char *msg = cortex_mprintf("%s: %s", fn->name, err);
+            cortex_result_error(ctx, msg ? msg : fn->name, -1);
+            cortex_free(msg);
+            cortex_free(err);
+            return CORTEX_ERROR;
+        }
+        arg->data = arg->owned;
+    } else if (cortex_value_type(value) == CORTEX_BLOB) {
+        int bytes = cortex_value_bytes(value);
+        if (bytes % elem_size != 0) {
+            char *msg = cortex_mprintf("%s: a %d-byte BLOB is not a whole number of %s elements",
+                                       fn->name, bytes, elem_size == 1 ? "int8" : "float32");
+            cortex_result_error(ctx, msg ? msg : fn->name, -1);
+            cortex_free(msg);
+            return CORTEX_ERROR;
+        }
+        arg->data = cortex_value_blob(value);
+        arg->dim = bytes / elem_size;
+    } else {
+        char *msg = cortex_mprintf("%s: vectors must be BLOBs%s", fn->name,
+                                   elem_size == (int)sizeof(float) ? " or JSON arrays" : "");
+        cortex_result_error(ctx, msg ? msg : fn->name, -1);
+        cortex_free(msg);
+        return CORTEX_ERROR;
+    }
+    if (arg->dim == 0) {
+        char *msg = cortex_mprintf("%s: empty vector", fn->name);
+        cortex_result_error(ctx, msg ? msg : fn->name, -1);
+        cortex_free(msg);
+        return CORTEX_ERROR;
+    }
+    return CORTEX_OK;
+}
+
+static double cosine_distance(double dot, double aa, double bb) {
+    double denom = sqrt(aa) * sqrt(bb);
+    return denom > 0.0 ? 1.0 - dot / denom : 1.0;
+}
+
+static double distance_f32(vec_fn_kind kind, const float *a, const float *b, int dim) {
+    switch (kind) {
+        case FN_L2:
+            return sqrt((double)vec_kern->l2sq_f32(a, b, dim));
+        case FN_COSINE:
+            return cosine_distance(vec_kern->dot_f32(a, b, dim), vec_kern->dot_f32(a, a, dim),
+                                   vec_kern->dot_f32(b, b, dim));
+        default:
+            return vec_kern->dot_f32(a, b, dim);
+    }
+}
+
+static double distance_i8(vec_fn_kind kind, const int8_t *a, const int8_t *b, int dim) {
+    switch (kind) {
+        case FN_L2:
+            return sqrt((double)vec_kern->l2sq_i8(a, b, dim));
+        case FN_COSINE:
+            return cosine_distance(vec_kern->dot_i8(a, b, dim), vec_kern->dot_i8(a, a, dim),
+                                   vec_kern->dot_i8(b, b, dim));
+        default:
+            return vec_kern->dot_i8(a, b, dim);
+    }
+}
+
+static void distance_func(cortex_context *ctx, int argc, cortex_value **argv) {
+    const vec_fn *fn = cortex_user_data(ctx);
+    int elem_size = sizeof(float);
+    vec_arg a, b;
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        if (cortex_value_type(argv[i]) == CORTEX_NULL) return;
+    }
+    if (fn->kind == FN_HAMMING) {
+        elem_size = 1;
+    } else if (argc == 3) {
+        const char *type = (const char *)cortex_value_text(argv[2]);
+        if (cortex_stricmp(type, "int8") == 0) {
+            elem_size = 1;
+        } else if (cortex_stricmp(type, "float32") != 0) {
+            char *msg = cortex_mprintf("%s: type must be 'float32' or 'int8'", fn->name);
+            cortex_result_error(ctx, msg ? msg : fn->name, -1);
+            cortex_free(msg);
+            return;
+        }
+    }
+
+    if (load_arg(ctx, fn, argv[0], elem_size, &a) != CORTEX_OK) return;
+    if (load_arg(ctx, fn, argv[1], elem_size, &b) != CORTEX_OK) {
+        cortex_free(a.owned);
+        return;
+    }
+    if (a.dim != b.dim) {
+        char *msg = cortex_mprintf("%s: vectors have different dimensions (%d and %d)",
+                                   fn->name, a.dim, b.dim);
+        cortex_result_error(ctx, msg ? msg : fn->name, -1);
+        cortex_free(msg);
+    } else if (fn->kind == FN_HAMMING) {
+        cortex_result_int64(ctx, vec_kern->hamming(a.data, b.data, a.dim));
+    } else if (elem_size == 1) {
+        cortex_result_double(ctx, distance_i8(fn->kind, a.data, b.data, a.dim));
+    } else {
+        cortex_result_double(ctx, distance_f32(fn->kind, a.data, b.data, a.dim));
+    }
+    cortex_free(a.owned);
+    cortex_free(b.owned);
+}
+
+static void quantize_func(cortex_context *ctx, int argc, cortex_value **argv) {
+    const vec_fn *fn = cortex_user_data(ctx);
+    unsigned char *out;
+    float max = 0.0f;
+    vec_arg a;
+    int bytes;
+
+    if (cortex_value_type(argv[0]) == CORTEX_NULL) return;
+    if (argc == 2) {
+        max = (float)cortex_value_double(argv[1]);
+        if (!(max > 0.0f)) {
+            cortex_result_error(ctx, "vec_quantize_int8: max must be positive", -1);
+            return;
+        }
+    }
+    if (load_arg(ctx, fn, argv[0], sizeof(float), &a) != CORTEX_OK) return;
+
+    bytes = fn->kind == FN_QUANTIZE_INT8 ? a.dim : (a.dim + 7) / 8;
+    out = cortex_malloc(bytes);
+    if (out == NULL) {
+        cortex_result_error_nomem(ctx);
+    } else {
+        if (fn->kind == FN_QUANTIZE_INT8) {
+            vec_quantize_i8(a.data, a.dim, max, (int8_t *)out);
+        } else {
+            vec_quantize_bits(a.data, a.dim, out);
+        }
+        cortex_result_blob(ctx, out, bytes, cortex_free);
+    }
+    cortex_free(a.owned);
+}
+
+static const vec_fn FUNCTIONS[] = {
+    { "vec_l2",      FN_L2 },
+    { "vec_cosine",  FN_COSINE },
+    { "vec_dot",     FN_DOT },
+    { "vec_hamming", FN_HAMMING },
+};
+
+static const vec_fn QUANTIZERS[] = {
+    { "vec_quantize_int8",   FN_QUANTIZE_INT8 },
+    { "vec_quantize_binary", FN_QUANTIZE_BINARY },
+};
+
+int vec_functions_register(cortex *db) {
+    const int flags = CORTEX_UTF8 | CORTEX_DETERMINISTIC | CORTEX_INNOCUOUS;
+    size_t i;
+    int rc = CORTEX_OK;
+
+    for (i = 0; rc == CORTEX_OK && i < sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]); i++) {
+        void *fn = (void *)&FUNCTIONS[i];
+        rc = cortex_create_function_v2(db, FUNCTIONS[i].name, 2, flags, fn,
+                                       distance_func, NULL, NULL, NULL);
+        if (rc == CORTEX_OK && FUNCTIONS[i].kind != FN_HAMMING) {
+            rc = cortex_create_function_v2(db, FUNCTIONS[i].name, 3, flags, fn,
+                                           distance_func, NULL, NULL, NULL);
+        }
+    }
+    for (i = 0; rc == CORTEX_OK && i < sizeof(QUANTIZERS) / sizeof(QUANTIZERS[0]); i++) {
+        rc = cortex_create_function_v2(db, QUANTIZERS[i].name, 1, flags, (void *)&QUANTIZERS[i],
+                                       quantize_func, NULL, NULL, NULL);
+    }
+    if (rc == CORTEX_OK) {
+        rc = cortex_create_function_v2(db, "vec_quantize_int8", 2, flags, (void *)&QUANTIZERS[0],
+                                       quantize_func, NULL, NULL, NULL);
+    }
+    return rc;
+}
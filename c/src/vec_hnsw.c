@@ -0,0 +1,2824 @@
+#include "cortex_vec.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    vec_hnsw — approximate nearest neighbour search over float32 embeddings.
+
+        CREATE VIRTUAL TABLE mem USING vec_hnsw(dim=768, metric=cosine);
+        INSERT INTO mem(rowid, embedding) VALUES (?, ?);
+        SELECT rowid, distance FROM mem
+         WHERE embedding MATCH ? ORDER BY distance LIMIT 10;
+
+    Options: dim (required), metric (l2 | cosine | dot, default l2),
+    m (links per node, default 16), ef_construction (default 200),
+    ef_search (default 64), quantize (none | int8 | binary, default none)
+    rescore (default 4 for int8, 10 for binary), compact (default 20),
+    threads (build, compaction and batch search threads, default one
+    per CPU), and content and content_column (see below). The result
+    size comes from LIMIT, or from the hidden k column (`AND k = 10`)
+    when LIMIT cannot be pushed down.
+
+    A batch of queries goes through the hidden queries column instead:
+
+        SELECT query, rowid, distance FROM mem WHERE queries MATCH ? AND k = 10;
+
+    takes the query vectors as one BLOB of float32 vectors back to back
+    or a JSON array of vectors (vec_batch_from_value), and
+    returns k rows per query ordered by query (numbered from 0), then
+    distance. The graph is checked and any metadata filter evaluated
+    once for the whole batch, the queries are split over the table's
+    threads, filtered scans compare a block of rows against every query
+    while the block is in cache (batch_scan), and quantized tables read
+    a candidate's full vector once however many queries found it
+    (batch_rescore).
+
+    The graph (Malkov & Yashunin, HNSW) is held in memory per connection
+    and persisted in shadow tables:
+
+        %_config(key, value)                       format and generation
+        %_nodes(id, rid, level, vector, links)     one row per graph node
+        %_vectors(id, vector)                      quantized tables only
+
+    id is the node's slot in the in-memory graph and links holds its
+    neighbour slots for every level. Deleted rows are tombstoned (rid is
+    NULL): they stay in the graph so searches can route through them but
+    are never returned. Once tombstones make up compact percent of the
+    graph, the committing transaction relinks their neighbours around
+    them and frees their slots for new rows (graph_compact), so a stream
+    of deletes never needs a rebuild.
+
+    graph_load() gives every connection that touches the table its own
+    full copy, so a process with several handles on one file pays for the
+    index once per handle. The Python reader pool sends vector queries to
+    a single reader for this reason.
+
+    With content=<table>, triggers on that table keep the index in step
+    with it (content_triggers): rows are read from content_column
+    (default embedding) and become searchable when the base table's
+    transaction commits. The rows already there are indexed at CREATE
+    time by a parallel bulk build (content_backfill, graph_build).
+
+    With quantize, the graph and %_nodes.vector hold compact codes, not
+    float32 vectors. A search walks the graph on the codes, collects
+    k * rescore candidates and re-ranks them by exact distance to the
+    full vectors in %_vectors, which are only read for those candidates.
+
+    Writes mark nodes dirty; dirty nodes are written at xSavepoint and
+    xSync. Each committed write transaction bumps the generation and
+    records the slots it wrote under %_config key 'log.<generation>'.
+    Other connections compare the generation on their next query and
+    re-read just those %_nodes rows (check_generation); only when they
+    fall more than HNSW_LOG_KEEP generations behind, or a transaction
+    rewrote a large part of the graph, do they reload it whole. A
+    rollback drops the in-memory graph and it is reloaded from the
+    (rolled back) shadow tables.
+
+    Module arguments without '=' declare metadata columns (vec_meta.c):
+
+        CREATE VIRTUAL TABLE mem USING vec_hnsw(dim=768, agent_id INTEGER);
+        SELECT rowid FROM mem
+         WHERE embedding MATCH ? AND agent_id IN (1, 2) ORDER BY distance LIMIT 10;
+
+    Constraints on them are pushed into the search. The rows that pass
+    become a bitmap over slots, and the search picks whichever costs
+    fewer distance computations: an exact scan of the n matching rows,
+    or a graph traversal that routes through other rows but only returns
+    matching ones. With selectivity s = n / n_live the traversal widens
+    its beam to ef / s so that it still holds about ef matches, and
+    expands that many nodes of m0 links each, so the scan wins while
+    n * n < ef * m0 * n_live. Either way the answer holds k rows whenever
+    k rows match.
+*/
+
+#define HNSW_MAX_LEVEL 16
+#define HNSW_FORMAT    1
+
+enum {
+    HNSW_COL_EMBEDDING, HNSW_COL_DISTANCE, HNSW_COL_K, HNSW_COL_QUERY, HNSW_COL_QUERIES,
+    HNSW_COL_META
+};
+
+/* xBestIndex plan bits, passed to xFilter as idxNum */
+enum {
+    HNSW_PLAN_KNN    = 1,
+    HNSW_PLAN_ROWID  = 2,
+    HNSW_ARG_K       = 4,
+    HNSW_ARG_LIMIT   = 8,
+    HNSW_ARG_OFFSET  = 16,
+    HNSW_ARG_META    = 32,  /* metadata constraints, described by idxStr */
+    HNSW_PLAN_BATCH  = 64   /* with HNSW_PLAN_KNN: queries MATCH, k required */
+};
+
+enum { HNSW_DIRTY_NEW = 1, HNSW_DIRTY_LINKS = 2, HNSW_DIRTY_FREE = 4 };
+
+/* Generations whose written slots stay in %_config for other connections */
+#define HNSW_LOG_KEEP 64
+
+/* Fewest tombstones worth a compaction pass */
+#define HNSW_COMPACT_MIN 64
+
+/* Rows read and placed per step of a bulk build; a power of two */
+#define HNSW_BUILD_SHARD 8192
+#define HNSW_LOCK_STRIPES 1024
+
+/* Bytes of codes a batched scan compares against every query at a time */
+#define HNSW_SCAN_BLOCK (256 * 1024)
+#define HNSW_BATCH_ROWS 10000000
+
+typedef struct hnsw_node {
+    cortex_int64 rowid;
+    int level;              /* -1 marks a free slot */
+    int deleted;            /* tombstone */
+    int dirty;              /* HNSW_DIRTY_* */
+    int *links;             /* per level: count, then neighbour slots */
+} hnsw_node;
+
+typedef struct hnsw_cand {
+    float dist;
+    int slot;
+} hnsw_cand;
+
+typedef struct hnsw_heap {
+    hnsw_cand *items;
+    int n, cap;
+    int max;                /* 1: max-heap, 0: min-heap */
+} hnsw_heap;
+
+/* Rows a filtered search may return: a bitmap over slots, and the slots */
+typedef struct hnsw_allow {
+    unsigned char *bits;
+    int *slots;
+    int n;
+} hnsw_allow;
+
+/*
+    Per-thread state of a graph walk. Queries and single inserts use the
+    table's own; a parallel build (graph_build) gives each worker one
+    and sets build, so link lists are read and changed under their
+    stripe lock and changed lists are collected instead of marked dirty.
+*/
+typedef struct hnsw_walk {
+    unsigned *visited;      /* per slot: tag of the last walk that saw it */
+    unsigned tag;
+    int cap;
+    struct hnsw_build *build;
+    int *copy;              /* m0 + 1 ints: a link list read under its lock */
+    int *touched;           /* slots whose links this worker changed */
+    int n_touched, touched_cap;
+    int failed;
+} hnsw_walk;
+
+typedef struct hnsw_vtab {
+    cortex_vtab base;
+    cortex *db;
+    char *schema;
+    char *name;
+
+    int dim;
+    vec_metric metric;
+    int m, m0;
+    int ef_construction, ef_search;
+    double level_mult;
+    vec_quant quant;
+    int rescore;            /* candidates per result when quantized */
+    int code_size;          /* bytes per node in codes */
+    int compact;            /* tombstone percentage that triggers compaction */
+    int threads;            /* build and compaction threads */
+    char *content;          /* base table kept in sync by triggers, or NULL */
+    char *content_column;
+
+    /* in-memory graph, loaded lazily */
+    int loaded;
+    cortex_int64 generation;
+    int n_slots, cap;
+    int n_live, n_dead;
+    cortex_int64 max_rowid;
+    hnsw_node *nodes;
+    unsigned char *codes;   /* cap * code_size */
+    float *inv_norm;        /* cap, for cosine; unquantized only */
+    int entry, max_level;
+
+    /* rowid -> slot, open addressing; map_slot -1 is empty */
+    cortex_int64 *map_key;
+    int *map_slot;
+    int map_cap, map_used;
+
+    hnsw_walk walk;
+    hnsw_walk *walks;       /* batch search threads' own */
+    int n_walks;
+
+    int *dirty;
+    int n_dirty, dirty_cap;
+    int txn_writes;
+    int *logged;            /* slots flushed this transaction, for the log */
+    int n_logged, logged_cap;
+
+    int *free_slots;        /* compacted slots, reused by inserts */
+    int n_free, free_cap;
+
+    cortex_stmt *stmt_insert;
+    cortex_stmt *stmt_update;
+    cortex_stmt *stmt_get_gen;
+    cortex_stmt *stmt_set_gen;
+    cortex_stmt *stmt_vec_get;
+    cortex_stmt *stmt_vec_put;
+    cortex_stmt *stmt_free;
+    cortex_stmt *stmt_vec_free;
+    cortex_stmt *stmt_get_log;
+    cortex_stmt *stmt_put_log;
+    cortex_stmt *stmt_drop_log;
+    cortex_stmt *stmt_node;
+
+    vec_meta meta;
+} hnsw_vtab;
+
+typedef struct hnsw_build {
+    hnsw_vtab *v;
+    cortex_mutex *locks[HNSW_LOCK_STRIPES];
+    cortex_mutex *lock;     /* entry point and task counter */
+    hnsw_walk *walks;       /* per thread */
+    int threads;
+    const int *slots;       /* nodes this pass links in */
+    int n, next;
+} hnsw_build;
+
+typedef struct hnsw_cursor {
+    cortex_vtab_cursor base;
+    int plan;
+    int pos, n;
+    int *slots;
+    float *dists;
+    int *queries;           /* batch plans: the query each row answers */
+    cortex_int64 k;
+} hnsw_cursor;
+
+/* ─────────────────────────────────────────
+   Heaps
+   ───────────────────────────────────────── */
+
+static int heap_above(const hnsw_heap *h, int a, int b) {
+    return h->max ? h->items[a].dist > h->items[b].dist
+                  : h->items[a].dist < h->items[b].dist;
+}
+
+static int heap_push(hnsw_heap *h, float dist, int slot) {
+    int i;
+
+    if (h->n == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 64;
+        hnsw_cand *items = cortex_realloc64(h->items, (cortex_uint64)cap * sizeof(hnsw_cand));
+        if (items == NULL) return CORTEX_NOMEM;
+        h->items = items;
+        h->cap = cap;
+    }
+    i = h->n++;
+    h->items[i].dist = dist;
+    h->items[i].slot = slot;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        hnsw_cand tmp;
+        if (!heap_above(h, i, parent)) break;
+        tmp = h->items[i];
+        h->items[i] = h->items[parent];
+        h->items[parent] = tmp;
+        i = parent;
+    }
+    return CORTEX_OK;
+}
+
+static hnsw_cand heap_pop(hnsw_heap *h) {
+    hnsw_cand top = h->items[0];
+    int i = 0;
+
+    h->items[0] = h->items[--h->n];
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, best = i;
+        hnsw_cand tmp;
+        if (l < h->n && heap_above(h, l, best)) best = l;
+        if (r < h->n && heap_above(h, r, best)) best = r;
+        if (best == i) break;
+        tmp = h->items[i];
+        h->items[i] = h->items[best];
+        h->items[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+static int cand_cmp(const void *a, const void *b) {
+    float da = ((const hnsw_cand *)a)->dist, db = ((const hnsw_cand *)b)->dist;
+    return da < db ? -1 : da > db;
+}
+
+static int cand_slot_cmp(const void *a, const void *b) {
+    int sa = ((const hnsw_cand *)a)->slot, sb = ((const hnsw_cand *)b)->slot;
+    return (sa > sb) - (sa < sb);
+}
+
+static int int_cmp(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/* ─────────────────────────────────────────
+   Graph storage
+   ───────────────────────────────────────── */
+
+static int link_ints(const hnsw_vtab *v, int level) {
+    return (v->m0 + 1) + level * (v->m + 1);
+}
+
+static int *links_at(const hnsw_vtab *v, int slot, int level) {
+    int *links = v->nodes[slot].links;
+    return level == 0 ? links : links + (v->m0 + 1) + (level - 1) * (v->m + 1);
+}
+
+static unsigned char *code_at(const hnsw_vtab *v, int slot) {
+    return v->codes + (size_t)slot * v->code_size;
+}
+
+static cortex_uint64 hash_rowid(cortex_int64 rowid) {
+    cortex_uint64 x = (cortex_uint64)rowid + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static int map_get(const hnsw_vtab *v, cortex_int64 rowid) {
+    cortex_uint64 i;
+
+    if (v->map_cap == 0) return -1;
+    for (i = hash_rowid(rowid) & (v->map_cap - 1); v->map_slot[i] >= 0; i = (i + 1) & (v->map_cap - 1)) {
+        if (v->map_key[i] == rowid) return v->map_slot[i];
+    }
+    return -1;
+}
+
+static int map_grow(hnsw_vtab *v) {
+    int old_cap = v->map_cap, i;
+    cortex_int64 *old_key = v->map_key;
+    int *old_slot = v->map_slot;
+    int cap = old_cap ? old_cap * 2 : 1024;
+
+    v->map_key = cortex_malloc64((cortex_uint64)cap * sizeof(cortex_int64));
+    v->map_slot = cortex_malloc64((cortex_uint64)cap * sizeof(int));
+    if (v->map_key == NULL || v->map_slot == NULL) {
+        cortex_free(v->map_key);
+        cortex_free(v->map_slot);
+        v->map_key = old_key;
+        v->map_slot = old_slot;
+        return CORTEX_NOMEM;
+    }
+    memset(v->map_slot, 0xff, (size_t)cap * sizeof(int));
+    v->map_cap = cap;
+    for (i = 0; i < old_cap; i++) {
+        if (old_slot[i] >= 0) {
+            cortex_uint64 j = hash_rowid(old_key[i]) & (cap - 1);
+            while (v->map_slot[j] >= 0) j = (j + 1) & (cap - 1);
+            v->map_key[j] = old_key[i];
+            v->map_slot[j] = old_slot[i];
+        }
+    }
+    cortex_free(old_key);
+    cortex_free(old_slot);
+    return CORTEX_OK;
+}
+
+static int map_put(hnsw_vtab *v, cortex_int64 rowid, int slot) {
+    cortex_uint64 i;
+
+    if ((v->map_used + 1) * 2 > v->map_cap && map_grow(v) != CORTEX_OK) return CORTEX_NOMEM;
+    i = hash_rowid(rowid) & (v->map_cap - 1);
+    while (v->map_slot[i] >= 0 && v->map_key[i] != rowid) i = (i + 1) & (v->map_cap - 1);
+    if (v->map_slot[i] < 0) v->map_used++;
+    v->map_key[i] = rowid;
+    v->map_slot[i] = slot;
+    return CORTEX_OK;
+}
+
+static void map_del(hnsw_vtab *v, cortex_int64 rowid) {
+    cortex_uint64 mask = v->map_cap - 1, i, j;
+
+    if (v->map_cap == 0) return;
+    for (i = hash_rowid(rowid) & mask; v->map_slot[i] >= 0; i = (i + 1) & mask) {
+        if (v->map_key[i] == rowid) break;
+    }
+    if (v->map_slot[i] < 0) return;
+    /* backward-shift deletion keeps probe chains intact */
+    v->map_slot[i] = -1;
+    v->map_used--;
+    for (j = (i + 1) & mask; v->map_slot[j] >= 0; j = (j + 1) & mask) {
+        cortex_uint64 home = hash_rowid(v->map_key[j]) & mask;
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            v->map_key[i] = v->map_key[j];
+            v->map_slot[i] = v->map_slot[j];
+            v->map_slot[j] = -1;
+            i = j;
+        }
+    }
+}
+
+static int ensure_capacity(hnsw_vtab *v, int slots) {
+    int cap = v->cap ? v->cap : 1024, i;
+    hnsw_node *nodes;
+    unsigned char *codes;
+    float *inv_norm;
+    unsigned *visited;
+
+    if (slots <= v->cap) return CORTEX_OK;
+    while (cap < slots) cap *= 2;
+    nodes = cortex_realloc64(v->nodes, (cortex_uint64)cap * sizeof(hnsw_node));
+    if (nodes == NULL) return CORTEX_NOMEM;
+    v->nodes = nodes;
+    codes = cortex_realloc64(v->codes, (cortex_uint64)cap * v->code_size);
+    if (codes == NULL) return CORTEX_NOMEM;
+    v->codes = codes;
+    if (v->quant == VEC_QUANT_NONE) {
+        inv_norm = cortex_realloc64(v->inv_norm, (cortex_uint64)cap * sizeof(float));
+        if (inv_norm == NULL) return CORTEX_NOMEM;
+        v->inv_norm = inv_norm;
+    }
+    visited = cortex_realloc64(v->walk.visited, (cortex_uint64)cap * sizeof(unsigned));
+    if (visited == NULL) return CORTEX_NOMEM;
+    v->walk.visited = visited;
+    for (i = v->cap; i < cap; i++) {
+        memset(&v->nodes[i], 0, sizeof(hnsw_node));
+        v->nodes[i].level = -1;
+        v->walk.visited[i] = 0;
+    }
+    v->cap = v->walk.cap = cap;
+    return CORTEX_OK;
+}
+
+static int mark_dirty(hnsw_vtab *v, int slot, int flag) {
+    if (v->nodes[slot].dirty == 0) {
+        if (v->n_dirty == v->dirty_cap) {
+            int cap = v->dirty_cap ? v->dirty_cap * 2 : 256;
+            int *dirty = cortex_realloc64(v->dirty, (cortex_uint64)cap * sizeof(int));
+            if (dirty == NULL) return CORTEX_NOMEM;
+            v->dirty = dirty;
+            v->dirty_cap = cap;
+        }
+        v->dirty[v->n_dirty++] = slot;
+    }
+    v->nodes[slot].dirty |= flag;
+    return CORTEX_OK;
+}
+
+static void graph_free(hnsw_vtab *v) {
+    int i;
+
+    for (i = 0; i < v->n_slots; i++) cortex_free(v->nodes[i].links);
+    cortex_free(v->nodes);
+    cortex_free(v->codes);
+    cortex_free(v->inv_norm);
+    cortex_free(v->walk.visited);
+    for (i = 0; i < v->n_walks; i++) cortex_free(v->walks[i].visited);
+    cortex_free(v->walks);
+    cortex_free(v->map_key);
+    cortex_free(v->map_slot);
+    cortex_free(v->dirty);
+    cortex_free(v->free_slots);
+    v->free_slots = NULL;
+    v->n_free = v->free_cap = 0;
+    v->nodes = NULL;
+    v->codes = NULL;
+    v->inv_norm = NULL;
+    v->walk.visited = NULL;
+    v->walk.cap = 0;
+    v->walks = NULL;
+    v->n_walks = 0;
+    v->map_key = NULL;
+    v->map_slot = NULL;
+    v->dirty = NULL;
+    v->n_slots = v->cap = v->n_live = v->n_dead = 0;
+    v->map_cap = v->map_used = 0;
+    v->n_dirty = v->dirty_cap = 0;
+    v->entry = -1;
+    v->max_level = -1;
+    v->max_rowid = 0;
+    v->walk.tag = 0;
+    v->loaded = 0;
+}
+
+/* ─────────────────────────────────────────
+   Distances
+   ───────────────────────────────────────── */
+
+/*
+    Node codes: the float32 vector itself (quantize=none); int8 codes
+    followed by their float scale and the exact L2 norm of the original
+    vector (quantize=int8); or sign bits (quantize=binary).
+*/
+static void encode(const hnsw_vtab *v, const float *vec, unsigned char *code) {
+    float trailer[2];
+
+    switch (v->quant) {
+        case VEC_QUANT_INT8:
+            trailer[0] = vec_quantize_i8(vec, v->dim, 0.0f, (int8_t *)code);
+            trailer[1] = sqrtf(vec_dot_f32(vec, vec, v->dim));
+            memcpy(code + v->dim, trailer, sizeof(trailer));
+            break;
+        case VEC_QUANT_BINARY:
+            vec_quantize_bits(vec, v->dim, code);
+            break;
+        default:
+            memcpy(code, vec, (size_t)v->dim * sizeof(float));
+    }
+}
+
+static float exact_dist(const hnsw_vtab *v, const float *q, float q_inv, const float *x, float x_inv) {
+    switch (v->metric) {
+        case VEC_METRIC_COSINE:
+            return 1.0f - vec_dot_f32(q, x, v->dim) * q_inv * x_inv;
+        case VEC_METRIC_DOT:
+            return -vec_dot_f32(q, x, v->dim);
+        default:
+            return vec_l2sq_f32(q, x, v->dim);
+    }
+}
+
+/* q.x ~= scale_q * scale_x * (int8 dot); l2 expands to |q|^2 + |x|^2 - 2 q.x */
+static float int8_dist(const hnsw_vtab *v, const unsigned char *q, const unsigned char *x) {
+    float qt[2], xt[2], dot;
+
+    memcpy(qt, q + v->dim, sizeof(qt));
+    memcpy(xt, x + v->dim, sizeof(xt));
+    dot = qt[0] * xt[0] * (float)vec_kern->dot_i8((const int8_t *)q, (const int8_t *)x, v->dim);
+    switch (v->metric) {
+        case VEC_METRIC_COSINE:
+            return qt[1] * xt[1] > 0.0f ? 1.0f - dot / (qt[1] * xt[1]) : 1.0f;
+        case VEC_METRIC_DOT:
+            return -dot;
+        default:
+            return qt[1] * qt[1] + xt[1] * xt[1] - 2.0f * dot;
+    }
+}
+
+static float query_dist(const hnsw_vtab *v, const unsigned char *q, float q_inv, int slot) {
+    const unsigned char *x = code_at(v, slot);
+
+    switch (v->quant) {
+        case VEC_QUANT_INT8:
+            return int8_dist(v, q, x);
+        case VEC_QUANT_BINARY:
+            return (float)vec_kern->hamming(q, x, v->code_size);
+        default:
+            return exact_dist(v, (const float *)q, q_inv, (const float *)x, v->inv_norm[slot]);
+    }
+}
+
+static float node_dist(const hnsw_vtab *v, int a, int b) {
+    return query_dist(v, code_at(v, a), v->inv_norm ? v->inv_norm[a] : 0.0f, b);
+}
+
+/* Internal distances skip the square root; this is what users see. */
+static double reported_dist(const hnsw_vtab *v, float d) {
+    return v->metric == VEC_METRIC_L2 ? sqrt(d > 0 ? d : 0) : d;
+}
+
+/* ─────────────────────────────────────────
+   HNSW search and insert
+   ───────────────────────────────────────── */
+
+static unsigned next_visit_tag(hnsw_walk *w) {
+    if (++w->tag == 0) {
+        memset(w->visited, 0, (size_t)w->cap * sizeof(unsigned));
+        w->tag = 1;
+    }
+    return w->tag;
+}
+
+/* A node's stripe lock, or NULL outside builds (cortex_mutex_enter(NULL) is a no-op) */
+static cortex_mutex *node_lock(const hnsw_walk *w, int slot) {
+    return w->build ? w->build->locks[slot & (HNSW_LOCK_STRIPES - 1)] : NULL;
+}
+
+/* A node's links on level; during a build, a copy taken under its lock */
+static const int *read_links(const hnsw_vtab *v, hnsw_walk *w, int slot, int level) {
+    const int *links = links_at(v, slot, level);
+    cortex_mutex *lock;
+
+    if (w->build == NULL) return links;
+    lock = node_lock(w, slot);
+    cortex_mutex_enter(lock);
+    memcpy(w->copy, links, (size_t)(links[0] + 1) * sizeof(int));
+    cortex_mutex_leave(lock);
+    return w->copy;
+}
+
+static int greedy_descend(const hnsw_vtab *v, hnsw_walk *w, const unsigned char *q, float q_inv,
+                          int ep, int from, int to) {
+    float best = query_dist(v, q, q_inv, ep);
+    int level;
+
+    for (level = from; level > to; level--) {
+        int changed = 1;
+        while (changed) {
+            const int *links = read_links(v, w, ep, level);
+            int i;
+            changed = 0;
+            for (i = 1; i <= links[0]; i++) {
+                float d = query_dist(v, q, q_inv, links[i]);
+                if (d < best) {
+                    best = d;
+                    ep = links[i];
+                    changed = 1;
+                }
+            }
+        }
+    }
+    return ep;
+}
+
+/*
+    Beam search on one level. entries holds the starting points on input
+    and the ef closest nodes found (a max-heap) on output.
+*/
+static int search_layer(const hnsw_vtab *v, hnsw_walk *w, const unsigned char *q, float q_inv,
+                        hnsw_heap *entries, int ef, int level) {
+    hnsw_heap cand = {NULL, 0, 0, 0};
+    unsigned tag = next_visit_tag(w);
+    int i, rc = CORTEX_OK;
+
+    for (i = 0; i < entries->n; i++) {
+        w->visited[entries->items[i].slot] = tag;
+        rc = heap_push(&cand, entries->items[i].dist, entries->items[i].slot);
+        if (rc != CORTEX_OK) goto done;
+    }
+    while (entries->n > ef) heap_pop(entries);
+
+    while (cand.n > 0) {
+        hnsw_cand c = heap_pop(&cand);
+        const int *links;
+
+        if (entries->n >= ef && c.dist > entries->items[0].dist) break;
+        links = read_links(v, w, c.slot, level);
+        for (i = 1; i <= links[0]; i++) {
+            int e = links[i];
+            float d;
+            if (w->visited[e] == tag) continue;
+            w->visited[e] = tag;
+            d = query_dist(v, q, q_inv, e);
+            if (entries->n < ef || d < entries->items[0].dist) {
+                if ((rc = heap_push(&cand, d, e)) != CORTEX_OK) goto done;
+                if ((rc = heap_push(entries, d, e)) != CORTEX_OK) goto done;
+                if (entries->n > ef) heap_pop(entries);
+            }
+        }
+    }
+done:
+    cortex_free(cand.items);
+    return rc;
+}
+
+/*
+    Neighbour selection heuristic (HNSW paper, algorithm 4): keep a
+    candidate only if it is closer to the base than to any neighbour kept
+    so far, then top up with the pruned ones. cands must be sorted by
+    distance to the base. Returns the number written to out.
+*/
+static int select_neighbors(const hnsw_vtab *v, const hnsw_cand *cands, int n, int max, int *out) {
+    int kept = 0, i, j;
+    char *used;
+
+    if (n <= max) {
+        for (i = 0; i < n; i++) out[i] = cands[i].slot;
+        return n;
+    }
+    used = cortex_malloc(n);
+    if (used == NULL) {
+        for (i = 0; i < max; i++) out[i] = cands[i].slot;
+        return max;
+    }
+    memset(used, 0, n);
+    for (i = 0; i < n && kept < max; i++) {
+        int good = 1;
+        for (j = 0; j < kept; j++) {
+            if (node_dist(v, cands[i].slot, out[j]) < cands[i].dist) {
+                good = 0;
+                break;
+            }
+        }
+        if (good) {
+            out[kept++] = cands[i].slot;
+            used[i] = 1;
+        }
+    }
+    for (i = 0; i < n && kept < max; i++) {
+        if (!used[i]) out[kept++] = cands[i].slot;
+    }
+    cortex_free(used);
+    return kept;
+}
+
+/* Put target in node's links on level, pruning when full. */
+static int link_into(const hnsw_vtab *v, int node, int target, int level) {
+    int max = level == 0 ? v->m0 : v->m;
+    int *links = links_at(v, node, level);
+    hnsw_cand *cands;
+    int i, n;
+
+    for (i = 1; i <= links[0]; i++) {
+        if (links[i] == target) return CORTEX_OK;
+    }
+    if (links[0] < max) {
+        links[++links[0]] = target;
+        return CORTEX_OK;
+    }
+    n = links[0] + 1;
+    cands = cortex_malloc64((cortex_uint64)n * sizeof(hnsw_cand));
+    if (cands == NULL) return CORTEX_NOMEM;
+    for (i = 0; i < links[0]; i++) {
+        cands[i].slot = links[i + 1];
+        cands[i].dist = node_dist(v, node, links[i + 1]);
+    }
+    cands[n - 1].slot = target;
+    cands[n - 1].dist = node_dist(v, node, target);
+    qsort(cands, n, sizeof(hnsw_cand), cand_cmp);
+    links[0] = select_neighbors(v, cands, n, max, links + 1);
+    cortex_free(cands);
+    return CORTEX_OK;
+}
+
+/* A node's links changed: mark it dirty, or during a build note it for graph_build() */
+static int touch(hnsw_vtab *v, hnsw_walk *w, int node) {
+    if (w->build == NULL) return mark_dirty(v, node, HNSW_DIRTY_LINKS);
+    if (v->nodes[node].dirty) return CORTEX_OK;
+    if (w->n_touched == w->touched_cap) {
+        int cap = w->touched_cap ? w->touched_cap * 2 : 256;
+        int *touched = cortex_realloc64(w->touched, (cortex_uint64)cap * sizeof(int));
+        if (touched == NULL) return CORTEX_NOMEM;
+        w->touched = touched;
+        w->touched_cap = cap;
+    }
+    w->touched[w->n_touched++] = node;
+    return CORTEX_OK;
+}
+
+/* Add a back link from node to target on level. */
+static int add_link(hnsw_vtab *v, hnsw_walk *w, int node, int target, int level) {
+    cortex_mutex *lock = node_lock(w, node);
+    int rc;
+
+    cortex_mutex_enter(lock);
+    rc = link_into(v, node, target, level);
+    if (rc == CORTEX_OK) rc = touch(v, w, node);
+    cortex_mutex_leave(lock);
+    return rc;
+}
+
+static int random_level(const hnsw_vtab *v, cortex_int64 rowid, int slot) {
+    cortex_uint64 x = hash_rowid(rowid ^ ((cortex_int64)slot << 32));
+    double u = ((double)(x >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+    int level = (int)(-log(u) * v->level_mult);
+    return level > HNSW_MAX_LEVEL ? HNSW_MAX_LEVEL : level;
+}
+
+/* The slot graph_insert() will use: a compacted one if any, else a new one */
+static int next_slot(const hnsw_vtab *v) {
+    return v->n_free > 0 ? v->free_slots[v->n_free - 1] : v->n_slots;
+}
+
+/*
+    Give a row a slot, a level and its code. The node has no links until
+    graph_link() connects it, so searches cannot reach it before then.
+*/
+static int graph_place(hnsw_vtab *v, cortex_int64 rowid, const float *vec, int *slot_out) {
+    int slot = next_slot(v), level, rc;
+    hnsw_node *node;
+
+    if ((rc = ensure_capacity(v, slot + 1)) != CORTEX_OK) return rc;
+    node = &v->nodes[slot];
+    level = random_level(v, rowid, slot);
+    node->links = cortex_malloc64((cortex_uint64)link_ints(v, level) * sizeof(int));
+    if (node->links == NULL) return CORTEX_NOMEM;
+    memset(node->links, 0, (size_t)link_ints(v, level) * sizeof(int));
+    if ((rc = map_put(v, rowid, slot)) != CORTEX_OK) {
+        cortex_free(node->links);
+        node->links = NULL;
+        return rc;
+    }
+    node->rowid = rowid;
+    node->level = level;
+    node->deleted = 0;
+    encode(v, vec, code_at(v, slot));
+    if (v->inv_norm) v->inv_norm[slot] = vec_inv_norm_f32(vec, v->dim);
+    v->walk.visited[slot] = 0;
+    if (slot == v->n_slots) {
+        v->n_slots++;
+    } else {
+        v->n_free--;
+    }
+    v->n_live++;
+    if (rowid > v->max_rowid) v->max_rowid = rowid;
+    if ((rc = mark_dirty(v, slot, HNSW_DIRTY_NEW)) != CORTEX_OK) return rc;
+    if (v->entry < 0) {
+        v->entry = slot;
+        v->max_level = level;
+    }
+    *slot_out = slot;
+    return CORTEX_OK;
+}
+
+/*
+    Connect a placed node: descend from the entry point, then on every
+    level it shares with the graph pick its neighbours and link both
+    ways. Under a build other workers may be linking nodes at the same
+    time, and may already have linked back to this one.
+*/
+static int graph_link(hnsw_vtab *v, hnsw_walk *w, int slot) {
+    cortex_mutex *lock = w->build ? w->build->lock : NULL;
+    const unsigned char *q = code_at(v, slot);
+    float q_inv = v->inv_norm ? v->inv_norm[slot] : 0.0f;
+    int level = v->nodes[slot].level, entry, max_level, l, top, rc, i;
+    hnsw_heap heap = {NULL, 0, 0, 1};
+    hnsw_cand *sorted = NULL;
+    int *selected = NULL;
+
+    cortex_mutex_enter(lock);
+    entry = v->entry;
+    max_level = v->max_level;
+    cortex_mutex_leave(lock);
+    if (entry == slot) return CORTEX_OK;
+
+    top = level < max_level ? level : max_level;
+    i = greedy_descend(v, w, q, q_inv, entry, max_level, top);
+    if ((rc = heap_push(&heap, query_dist(v, q, q_inv, i), i)) != CORTEX_OK) goto done;
+
+    sorted = cortex_malloc64((cortex_uint64)(v->ef_construction + 1) * sizeof(hnsw_cand));
+    selected = cortex_malloc64((cortex_uint64)(v->m0 + 1) * sizeof(int));
+    if (sorted == NULL || selected == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    for (l = top; l >= 0; l--) {
+        cortex_mutex *own = node_lock(w, slot);
+        int n = 0, n_sel;
+
+        if ((rc = search_layer(v, w, q, q_inv, &heap, v->ef_construction, l)) != CORTEX_OK) goto done;
+        for (i = 0; i < heap.n; i++) {
+            /* a worker that linked to this node lets the walk find it */
+            if (heap.items[i].slot != slot) sorted[n++] = heap.items[i];
+        }
+        qsort(sorted, n, sizeof(hnsw_cand), cand_cmp);
+        n_sel = select_neighbors(v, sorted, n, v->m, selected);
+        cortex_mutex_enter(own);
+        for (i = 0; i < n_sel && rc == CORTEX_OK; i++) rc = link_into(v, slot, selected[i], l);
+        cortex_mutex_leave(own);
+        for (i = 0; i < n_sel && rc == CORTEX_OK; i++) rc = add_link(v, w, selected[i], slot, l);
+        if (rc != CORTEX_OK) goto done;
+    }
+    cortex_mutex_enter(lock);
+    if (level > v->max_level) {
+        v->entry = slot;
+        v->max_level = level;
+    }
+    cortex_mutex_leave(lock);
+done:
+    cortex_free(heap.items);
+    cortex_free(sorted);
+    cortex_free(selected);
+    return rc;
+}
+
+static int graph_insert(hnsw_vtab *v, cortex_int64 rowid, const float *vec) {
+    int slot, rc = graph_place(v, rowid, vec, &slot);
+    return rc == CORTEX_OK ? graph_link(v, &v->walk, slot) : rc;
+}
+
+/*
+    Parallel bulk insert. Rows are placed on the calling thread (slots,
+    codes and the rowid map are shared), then graph_build() links a batch
+    of them on worker threads, each with its own walk. Link lists are
+    guarded by HNSW_LOCK_STRIPES mutexes picked by slot and a worker
+    holds at most one of them at a time, so there is no lock order to
+    keep. A node is linked against the graph as it stands when its task
+    starts: every node linked before it, less the few still in flight.
+*/
+static void build_close(hnsw_build *b) {
+    int i;
+
+    for (i = 0; i < HNSW_LOCK_STRIPES; i++) cortex_mutex_free(b->locks[i]);
+    cortex_mutex_free(b->lock);
+    for (i = 0; b->walks && i < b->threads; i++) {
+        cortex_free(b->walks[i].visited);
+        cortex_free(b->walks[i].copy);
+        cortex_free(b->walks[i].touched);
+    }
+    cortex_free(b->walks);
+    memset(b, 0, sizeof(hnsw_build));
+}
+
+static int build_open(hnsw_vtab *v, hnsw_build *b) {
+    int i;
+
+    memset(b, 0, sizeof(hnsw_build));
+    b->v = v;
+    if (v->threads < 2) return CORTEX_OK;
+    b->lock = cortex_mutex_alloc(CORTEX_MUTEX_FAST);
+    for (i = 0; b->lock && i < HNSW_LOCK_STRIPES; i++) {
+        if ((b->locks[i] = cortex_mutex_alloc(CORTEX_MUTEX_FAST)) == NULL) break;
+    }
+    if (b->lock == NULL || i < HNSW_LOCK_STRIPES) {
+        /* a library built without mutexes: link on this thread */
+        build_close(b);
+        b->v = v;
+        return CORTEX_OK;
+    }
+    b->walks = cortex_malloc64((cortex_uint64)v->threads * sizeof(hnsw_walk));
+    if (b->walks == NULL) {
+        build_close(b);
+        return CORTEX_NOMEM;
+    }
+    memset(b->walks, 0, (size_t)v->threads * sizeof(hnsw_walk));
+    b->threads = v->threads;
+    for (i = 0; i < b->threads; i++) {
+        b->walks[i].build = b;
+        b->walks[i].copy = cortex_malloc64((cortex_uint64)(v->m0 + 1) * sizeof(int));
+        if (b->walks[i].copy == NULL) {
+            build_close(b);
+            return CORTEX_NOMEM;
+        }
+    }
+    return CORTEX_OK;
+}
+
+static int walk_reserve(hnsw_walk *w, int cap) {
+    unsigned *visited;
+
+    if (cap <= w->cap) return CORTEX_OK;
+    visited = cortex_realloc64(w->visited, (cortex_uint64)cap * sizeof(unsigned));
+    if (visited == NULL) return CORTEX_NOMEM;
+    memset(visited + w->cap, 0, (size_t)(cap - w->cap) * sizeof(unsigned));
+    w->visited = visited;
+    w->cap = cap;
+    return CORTEX_OK;
+}
+
+static void build_task(void *arg, int task) {
+    hnsw_build *b = arg;
+    hnsw_walk *w = &b->walks[task];
+
+    for (;;) {
+        int i;
+        cortex_mutex_enter(b->lock);
+        i = b->next++;
+        cortex_mutex_leave(b->lock);
+        if (i >= b->n) break;
+        if (graph_link(b->v, w, b->slots[i]) != CORTEX_OK) {
+            w->failed = 1;
+            break;
+        }
+    }
+}
+
+static int graph_build(hnsw_build *b, const int *slots, int n) {
+    hnsw_vtab *v = b->v;
+    int rc = CORTEX_OK, t, i;
+
+    if (b->threads == 0) {
+        for (i = 0; i < n && rc == CORTEX_OK; i++) rc = graph_link(v, &v->walk, slots[i]);
+        return rc;
+    }
+    for (t = 0; t < b->threads; t++) {
+        if ((rc = walk_reserve(&b->walks[t], v->cap)) != CORTEX_OK) return rc;
+    }
+    b->slots = slots;
+    b->n = n;
+    b->next = 0;
+    vec_parallel_for(b->threads, b->threads, build_task, b);
+    for (t = 0; t < b->threads; t++) {
+        hnsw_walk *w = &b->walks[t];
+        if (w->failed) rc = CORTEX_NOMEM;
+        for (i = 0; i < w->n_touched && rc == CORTEX_OK; i++) {
+            rc = mark_dirty(v, w->touched[i], HNSW_DIRTY_LINKS);
+        }
+        w->n_touched = 0;
+        w->failed = 0;
+    }
+    return rc;
+}
+
+static int graph_delete(hnsw_vtab *v, cortex_int64 rowid) {
+    int slot = map_get(v, rowid);
+
+    if (slot < 0) return CORTEX_OK;
+    map_del(v, rowid);
+    v->nodes[slot].deleted = 1;
+    v->n_live--;
+    v->n_dead++;
+    return mark_dirty(v, slot, HNSW_DIRTY_LINKS);
+}
+
+/*
+    Tombstone compaction. One pass over the graph rewrites every link
+    list that points at a tombstone: the live nodes among its links and
+    the tombstones' own neighbours on that level are the candidates, and
+    select_neighbors() picks the new list. A task only writes the lists
+    of its own slots and reads codes and tombstone links, which the pass
+    leaves alone, so slot ranges run on worker threads. The tombstones'
+    slots then go on the free list for new rows.
+*/
+typedef struct compact_job {
+    hnsw_vtab *v;
+    int n_tasks;
+    unsigned char *changed; /* per slot */
+    int *failed;            /* per task */
+} compact_job;
+
+static int repair_links(const hnsw_vtab *v, int slot, int level, hnsw_cand *cands) {
+    int *links = links_at(v, slot, level);
+    int max = level == 0 ? v->m0 : v->m, dead = 0, n = 0, i, j;
+
+    for (i = 1; i <= links[0]; i++) dead |= v->nodes[links[i]].deleted;
+    if (!dead) return 0;
+    for (i = 1; i <= links[0]; i++) {
+        int e = links[i], *via;
+        if (!v->nodes[e].deleted) {
+            cands[n++].slot = e;
+            continue;
+        }
+        via = links_at(v, e, level);
+        for (j = 1; j <= via[0]; j++) {
+            if (via[j] != slot && !v->nodes[via[j]].deleted) cands[n++].slot = via[j];
+        }
+    }
+    qsort(cands, n, sizeof(hnsw_cand), cand_slot_cmp);
+    for (i = j = 0; i < n; i++) {
+        if (j > 0 && cands[j - 1].slot == cands[i].slot) continue;
+        cands[j].slot = cands[i].slot;
+        cands[j].dist = node_dist(v, slot, cands[i].slot);
+        j++;
+    }
+    qsort(cands, j, sizeof(hnsw_cand), cand_cmp);
+    links[0] = select_neighbors(v, cands, j, max, links + 1);
+    return 1;
+}
+
+static void compact_task(void *arg, int task) {
+    compact_job *job = arg;
+    hnsw_vtab *v = job->v;
+    int lo = (int)((long long)v->n_slots * task / job->n_tasks);
+    int hi = (int)((long long)v->n_slots * (task + 1) / job->n_tasks);
+    hnsw_cand *cands = cortex_malloc64((cortex_uint64)v->m0 * (v->m0 + 1) * sizeof(hnsw_cand));
+    int slot, level;
+
+    if (cands == NULL) {
+        job->failed[task] = 1;
+        return;
+    }
+    for (slot = lo; slot < hi; slot++) {
+        if (v->nodes[slot].level < 0 || v->nodes[slot].deleted) continue;
+        for (level = 0; level <= v->nodes[slot].level; level++) {
+            if (repair_links(v, slot, level, cands)) job->changed[slot] = 1;
+        }
+    }
+    cortex_free(cands);
+}
+
+static int graph_compact(hnsw_vtab *v) {
+    compact_job job;
+    int threads = v->threads, failed = 0, rc = CORTEX_OK, slot, i;
+    int *free_slots;
+
+    if (v->free_cap < v->n_free + v->n_dead) {
+        free_slots = cortex_realloc64(v->free_slots, (cortex_uint64)(v->n_free + v->n_dead) * sizeof(int));
+        if (free_slots == NULL) return CORTEX_NOMEM;
+        v->free_slots = free_slots;
+        v->free_cap = v->n_free + v->n_dead;
+    }
+    job.v = v;
+    job.n_tasks = threads;
+    job.changed = cortex_malloc64((cortex_uint64)v->n_slots);
+    job.failed = cortex_malloc64((cortex_uint64)threads * sizeof(int));
+    if (job.changed == NULL || job.failed == NULL) {
+        cortex_free(job.changed);
+        cortex_free(job.failed);
+        return CORTEX_NOMEM;
+    }
+    memset(job.changed, 0, (size_t)v->n_slots);
+    memset(job.failed, 0, (size_t)threads * sizeof(int));
+    vec_parallel_for(threads, threads, compact_task, &job);
+
+    for (slot = 0; slot < v->n_slots && rc == CORTEX_OK; slot++) {
+        if (job.changed[slot]) rc = mark_dirty(v, slot, HNSW_DIRTY_LINKS);
+    }
+    for (i = 0; i < threads; i++) failed |= job.failed[i];
+    /* with a task short of memory some lists still point at tombstones; keep them */
+    for (slot = 0; slot < v->n_slots && rc == CORTEX_OK && !failed; slot++) {
+        hnsw_node *node = &v->nodes[slot];
+        if (node->level < 0 || !node->deleted) continue;
+        cortex_free(node->links);
+        node->links = NULL;
+        node->level = -1;
+        node->deleted = 0;
+        v->free_slots[v->n_free++] = slot;
+        v->n_dead--;
+        rc = mark_dirty(v, slot, HNSW_DIRTY_FREE);
+    }
+    if (v->entry >= 0 && v->nodes[v->entry].level < 0) {
+        v->entry = -1;
+        v->max_level = -1;
+        for (slot = 0; slot < v->n_slots; slot++) {
+            if (v->nodes[slot].level > v->max_level) {
+                v->max_level = v->nodes[slot].level;
+                v->entry = slot;
+            }
+        }
+    }
+    cortex_free(job.changed);
+    cortex_free(job.failed);
+    return rc;
+}
+
+static int allowed(const hnsw_allow *allow, int slot) {
+    return allow == NULL || (allow->bits[slot >> 3] >> (slot & 7)) & 1;
+}
+
+/* Keep a candidate if it beats the worst of the k best so far (a max-heap) */
+static int top_offer(hnsw_heap *top, int k, float dist, int slot) {
+    if (top->n < k) return heap_push(top, dist, slot);
+    if (dist < top->items[0].dist) {
+        heap_pop(top);
+        return heap_push(top, dist, slot);
+    }
+    return CORTEX_OK;
+}
+
+/* The heap's candidates, nearest first; returns how many */
+static int top_sorted(hnsw_heap *top, int *slots, float *dists) {
+    int i;
+
+    qsort(top->items, top->n, sizeof(hnsw_cand), cand_cmp);
+    for (i = 0; i < top->n; i++) {
+        slots[i] = top->items[i].slot;
+        dists[i] = top->items[i].dist;
+    }
+    return top->n;
+}
+
+/* Whether an exact scan of allow costs less than a widened traversal */
+static int scan_cheaper(const hnsw_vtab *v, const hnsw_allow *allow, int k) {
+    int ef;
+
+    if (k > v->n_live) k = v->n_live;
+    if (k > allow->n) k = allow->n;
+    ef = k > v->ef_search ? k : v->ef_search;
+    return (double)allow->n * allow->n < (double)ef * v->m0 * v->n_live;
+}
+
+/* Exact top-k over the allowed slots, for filters too selective to traverse */
+static int flat_knn(const hnsw_vtab *v, const unsigned char *q, float q_inv, int k,
+                    const hnsw_allow *allow, int *slots, float *dists, int *n_out) {
+    hnsw_heap top = {NULL, 0, 0, 1};
+    int rc = CORTEX_OK, i;
+
+    for (i = 0; i < allow->n && rc == CORTEX_OK; i++) {
+        rc = top_offer(&top, k, query_dist(v, q, q_inv, allow->slots[i]), allow->slots[i]);
+    }
+    if (rc == CORTEX_OK) *n_out = top_sorted(&top, slots, dists);
+    cortex_free(top.items);
+    return rc;
+}
+
+/*
+    Top-k search on the node codes. Tombstones, and rows outside allow
+    when it is set, route the search but are filtered from the result;
+    if they crowd out the rest, retry with a wider beam.
+*/
+static int graph_knn(const hnsw_vtab *v, hnsw_walk *walk, const float *query, int k,
+                     const hnsw_allow *allow, int **slots_out, float **dists_out, int *n_out) {
+    float q_inv = vec_inv_norm_f32(query, v->dim);
+    hnsw_heap w = {NULL, 0, 0, 1};
+    unsigned char *q = NULL;
+    int *slots = NULL;
+    float *dists = NULL;
+    int rc = CORTEX_OK, n = 0, ef;
+
+    *n_out = 0;
+    if (v->entry < 0 || k <= 0 || v->n_live == 0) return CORTEX_OK;
+    if (allow && allow->n == 0) return CORTEX_OK;
+    if (k > v->n_live) k = v->n_live;
+    if (allow && k > allow->n) k = allow->n;
+    ef = k > v->ef_search ? k : v->ef_search;
+    q = cortex_malloc64((cortex_uint64)v->code_size);
+    slots = cortex_malloc64((cortex_uint64)k * sizeof(int));
+    dists = cortex_malloc64((cortex_uint64)k * sizeof(float));
+    if (q == NULL || slots == NULL || dists == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    encode(v, query, q);
+
+    if (allow && scan_cheaper(v, allow, k)) {
+        rc = flat_knn(v, q, q_inv, k, allow, slots, dists, &n);
+        goto done;
+    }
+    if (allow) {
+        /* widen the beam so it holds about ef matching rows */
+        double wide = (double)ef * v->n_live / allow->n;
+        ef = wide < v->n_slots ? (int)wide : v->n_slots;
+    }
+    for (;;) {
+        int ep = greedy_descend(v, walk, q, q_inv, v->entry, v->max_level, 0), i;
+        w.n = 0;
+        if ((rc = heap_push(&w, query_dist(v, q, q_inv, ep), ep)) != CORTEX_OK) goto done;
+        if ((rc = search_layer(v, walk, q, q_inv, &w, ef, 0)) != CORTEX_OK) goto done;
+        qsort(w.items, w.n, sizeof(hnsw_cand), cand_cmp);
+        n = 0;
+        for (i = 0; i < w.n && n < k; i++) {
+            if (v->nodes[w.items[i].slot].deleted || !allowed(allow, w.items[i].slot)) continue;
+            slots[n] = w.items[i].slot;
+            dists[n] = w.items[i].dist;
+            n++;
+        }
+        if (n >= k || ef >= v->n_slots) break;
+        ef *= 2;
+    }
+done:
+    cortex_free(w.items);
+    cortex_free(q);
+    if (rc != CORTEX_OK) {
+        cortex_free(slots);
+        cortex_free(dists);
+        return rc;
+    }
+    *slots_out = slots;
+    *dists_out = dists;
+    *n_out = n;
+    return CORTEX_OK;
+}
+
+/* ─────────────────────────────────────────
+   Persistence
+   ───────────────────────────────────────── */
+
+static int prepare(hnsw_vtab *v, cortex_stmt **stmt, const char *fmt) {
+    char *sql;
+    int rc;
+
+    if (*stmt) return CORTEX_OK;
+    sql = cortex_mprintf(fmt, v->schema, v->name);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v3(v->db, sql, -1, CORTEX_PREPARE_PERSISTENT, stmt, NULL);
+    cortex_free(sql);
+    return rc;
+}
+
+static int read_generation(hnsw_vtab *v, cortex_int64 *generation) {
+    int rc = prepare(v, &v->stmt_get_gen,
+        "SELECT value FROM \"%w\".\"%w_config\" WHERE key = 'generation'");
+    if (rc != CORTEX_OK) return rc;
+    *generation = 0;
+    if (cortex_step(v->stmt_get_gen) == CORTEX_ROW) {
+        *generation = cortex_column_int64(v->stmt_get_gen, 0);
+    }
+    return cortex_reset(v->stmt_get_gen);
+}
+
+/* Install one %_nodes row (id, rid, level, vector, links) in the graph */
+static int node_read(hnsw_vtab *v, cortex_stmt *stmt) {
+    cortex_int64 id = cortex_column_int64(stmt, 0);
+    int level = cortex_column_int(stmt, 2);
+    int n_links = link_ints(v, level), rc;
+    hnsw_node *node;
+
+    if (id < 0 || id >= 0x7fffffff || level < 0 || level > HNSW_MAX_LEVEL
+        || cortex_column_bytes(stmt, 3) != v->code_size
+        || cortex_column_bytes(stmt, 4) != n_links * (int)sizeof(int)) {
+        return CORTEX_CORRUPT_VTAB;
+    }
+    if ((rc = ensure_capacity(v, (int)id + 1)) != CORTEX_OK) return rc;
+    node = &v->nodes[id];
+    node->links = cortex_malloc64((cortex_uint64)n_links * sizeof(int));
+    if (node->links == NULL) return CORTEX_NOMEM;
+    memcpy(node->links, cortex_column_blob(stmt, 4), (size_t)n_links * sizeof(int));
+    memcpy(code_at(v, (int)id), cortex_column_blob(stmt, 3), (size_t)v->code_size);
+    if (v->inv_norm) v->inv_norm[id] = vec_inv_norm_f32((const float *)code_at(v, (int)id), v->dim);
+    node->level = level;
+    node->deleted = cortex_column_type(stmt, 1) == CORTEX_NULL;
+    node->dirty = 0;
+    if (id >= v->n_slots) v->n_slots = (int)id + 1;
+    if (!node->deleted) {
+        node->rowid = cortex_column_int64(stmt, 1);
+        if ((rc = map_put(v, node->rowid, (int)id)) != CORTEX_OK) return rc;
+        if (node->rowid > v->max_rowid) v->max_rowid = node->rowid;
+        v->n_live++;
+    } else {
+        v->n_dead++;
+    }
+    if (level > v->max_level) {
+        v->max_level = level;
+        v->entry = (int)id;
+    }
+    return CORTEX_OK;
+}
+
+/* Rebuild the free slot list and pick the entry point again */
+static int graph_settle(hnsw_vtab *v) {
+    int holes = 0, slot;
+
+    v->entry = -1;
+    v->max_level = -1;
+    for (slot = 0; slot < v->n_slots; slot++) {
+        if (v->nodes[slot].level < 0) {
+            holes++;
+        } else if (v->nodes[slot].level > v->max_level) {
+            v->max_level = v->nodes[slot].level;
+            v->entry = slot;
+        }
+    }
+    if (holes > v->free_cap) {
+        int *free_slots = cortex_realloc64(v->free_slots, (cortex_uint64)holes * sizeof(int));
+        if (free_slots == NULL) return CORTEX_NOMEM;
+        v->free_slots = free_slots;
+        v->free_cap = holes;
+    }
+    v->n_free = 0;
+    for (slot = v->n_slots - 1; slot >= 0; slot--) {
+        if (v->nodes[slot].level < 0) v->free_slots[v->n_free++] = slot;
+    }
+    return CORTEX_OK;
+}
+
+/*
+    Re-read one slot another connection wrote. The row may be new, have
+    new links or a tombstone, or be gone (compacted). Sets *settle when
+    the free list or the entry point has to be worked out again.
+*/
+static int node_reload(hnsw_vtab *v, int slot, int *settle) {
+    int was_free, rc;
+
+    if (slot < 0) return CORTEX_CORRUPT_VTAB;
+    rc = prepare(v, &v->stmt_node,
+        "SELECT id, rid, level, vector, links FROM \"%w\".\"%w_nodes\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    was_free = slot >= v->n_slots || v->nodes[slot].level < 0;
+    if (!was_free) {
+        hnsw_node *node = &v->nodes[slot];
+        if (node->deleted) {
+            v->n_dead--;
+        } else {
+            /* an UPDATE may already have moved the rowid to a slot read before this one */
+            if (map_get(v, node->rowid) == slot) map_del(v, node->rowid);
+            v->n_live--;
+        }
+        cortex_free(node->links);
+        node->links = NULL;
+        node->level = -1;
+        node->deleted = 0;
+        if (slot == v->entry) *settle = 1;
+    }
+    cortex_bind_int64(v->stmt_node, 1, slot);
+    rc = cortex_step(v->stmt_node);
+    if (rc == CORTEX_ROW) {
+        /* anything but the next new slot comes off the free list or leaves holes */
+        if (was_free && slot != v->n_slots) *settle = 1;
+        rc = node_read(v, v->stmt_node);
+    } else if (rc == CORTEX_DONE) {
+        if (!was_free) *settle = 1;
+        rc = CORTEX_OK;
+    }
+    cortex_reset(v->stmt_node);
+    return rc;
+}
+
+/*
+    Bring the cached graph up to the committed generation. When every
+    generation since ours still has its log, only the slots those
+    transactions wrote are re-read; otherwise the graph is dropped and
+    graph_load() reads it whole.
+*/
+static int check_generation(hnsw_vtab *v) {
+    cortex_int64 generation, g;
+    int rc, stale = 0, settle = 0;
+
+    if (!v->loaded) return CORTEX_OK;
+    if ((rc = read_generation(v, &generation)) != CORTEX_OK) return rc;
+    if (generation == v->generation) return CORTEX_OK;
+    if (generation < v->generation || generation - v->generation > HNSW_LOG_KEEP) {
+        graph_free(v);
+        return CORTEX_OK;
+    }
+    rc = prepare(v, &v->stmt_get_log,
+        "SELECT value FROM \"%w\".\"%w_config\" WHERE key = 'log.' || ?1");
+    for (g = v->generation + 1; g <= generation && rc == CORTEX_OK && !stale; g++) {
+        cortex_bind_int64(v->stmt_get_log, 1, g);
+        if (cortex_step(v->stmt_get_log) == CORTEX_ROW
+            && cortex_column_type(v->stmt_get_log, 0) == CORTEX_BLOB) {
+            const int *slots = cortex_column_blob(v->stmt_get_log, 0);
+            int n = cortex_column_bytes(v->stmt_get_log, 0) / (int)sizeof(int), i;
+            for (i = 0; i < n && rc == CORTEX_OK; i++) rc = node_reload(v, slots[i], &settle);
+        } else {
+            stale = 1;  /* written before logs were kept, pruned, or too large to log */
+        }
+        if (rc == CORTEX_OK) {
+            rc = cortex_reset(v->stmt_get_log);
+        } else {
+            cortex_reset(v->stmt_get_log);
+        }
+    }
+    if (rc == CORTEX_OK && !stale && settle) rc = graph_settle(v);
+    if (rc != CORTEX_OK || stale) {
+        graph_free(v);
+        return rc;
+    }
+    v->generation = generation;
+    return CORTEX_OK;
+}
+
+static int graph_load(hnsw_vtab *v) {
+    cortex_stmt *stmt = NULL;
+    char *sql;
+    int rc;
+
+    if (v->loaded) return CORTEX_OK;
+    graph_free(v);
+    if ((rc = read_generation(v, &v->generation)) != CORTEX_OK) return rc;
+
+    sql = cortex_mprintf("SELECT id, rid, level, vector, links FROM \"%w\".\"%w_nodes\"",
+                         v->schema, v->name);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc != CORTEX_OK) return rc;
+
+    while ((rc = cortex_step(stmt)) == CORTEX_ROW) {
+        if ((rc = node_read(v, stmt)) != CORTEX_OK) break;
+    }
+    cortex_finalize(stmt);
+    /* holes left by compaction */
+    if (rc == CORTEX_DONE && v->n_slots > v->n_live + v->n_dead && graph_settle(v) != CORTEX_OK) {
+        rc = CORTEX_NOMEM;
+    }
+    if (rc != CORTEX_DONE) {
+        graph_free(v);
+        return rc == CORTEX_ROW ? CORTEX_ERROR : rc;
+    }
+    v->loaded = 1;
+    return CORTEX_OK;
+}
+
+static int free_row(hnsw_vtab *v, int slot, int with_vector) {
+    int rc = prepare(v, &v->stmt_free, "DELETE FROM \"%w\".\"%w_nodes\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_free, 1, slot);
+    cortex_step(v->stmt_free);
+    if ((rc = cortex_reset(v->stmt_free)) != CORTEX_OK || !with_vector || v->quant == VEC_QUANT_NONE) {
+        return rc;
+    }
+    rc = prepare(v, &v->stmt_vec_free, "DELETE FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_free, 1, slot);
+    cortex_step(v->stmt_vec_free);
+    return cortex_reset(v->stmt_vec_free);
+}
+
+static int graph_flush(hnsw_vtab *v) {
+    int rc, i;
+    cortex_int64 last_rowid;
+
+    if (v->n_dirty == 0) return CORTEX_OK;
+    rc = prepare(v, &v->stmt_insert,
+        "INSERT INTO \"%w\".\"%w_nodes\"(id, rid, level, vector, links) VALUES (?1, ?2, ?3, ?4, ?5)");
+    if (rc == CORTEX_OK) {
+        rc = prepare(v, &v->stmt_update,
+            "UPDATE \"%w\".\"%w_nodes\" SET rid = ?2, links = ?5 WHERE id = ?1");
+    }
+    if (rc != CORTEX_OK) return rc;
+
+    /* in slot order, so %_nodes fills front to back */
+    qsort(v->dirty, v->n_dirty, sizeof(int), int_cmp);
+    /* the flush runs at commit, after the caller's INSERT; keep its rowid */
+    last_rowid = cortex_last_insert_rowid(v->db);
+    for (i = 0; i < v->n_dirty; i++) {
+        int slot = v->dirty[i];
+        hnsw_node *node = &v->nodes[slot];
+        cortex_stmt *stmt = (node->dirty & HNSW_DIRTY_NEW) ? v->stmt_insert : v->stmt_update;
+
+        if (node->dirty & HNSW_DIRTY_FREE) {
+            /* compacted; the slot may since hold a new node */
+            if ((rc = free_row(v, slot, node->level < 0)) != CORTEX_OK) break;
+            if (node->level < 0) {
+                node->dirty = 0;
+                continue;
+            }
+        }
+        cortex_bind_int64(stmt, 1, slot);
+        if (node->deleted) {
+            cortex_bind_null(stmt, 2);
+        } else {
+            cortex_bind_int64(stmt, 2, node->rowid);
+        }
+        if (stmt == v->stmt_insert) {
+            cortex_bind_int(stmt, 3, node->level);
+            cortex_bind_blob(stmt, 4, code_at(v, slot), v->code_size, CORTEX_STATIC);
+        }
+        cortex_bind_blob(stmt, 5, node->links, link_ints(v, node->level) * (int)sizeof(int), CORTEX_STATIC);
+        cortex_step(stmt);
+        rc = cortex_reset(stmt);
+        if (rc != CORTEX_OK) break;
+        node->dirty = 0;
+    }
+    cortex_set_last_insert_rowid(v->db, last_rowid);
+    if (rc != CORTEX_OK) return rc;
+    if (v->n_logged + v->n_dirty > v->logged_cap) {
+        int cap = v->logged_cap ? v->logged_cap : 256;
+        int *logged;
+        while (cap < v->n_logged + v->n_dirty) cap *= 2;
+        logged = cortex_realloc64(v->logged, (cortex_uint64)cap * sizeof(int));
+        if (logged == NULL) return CORTEX_NOMEM;
+        v->logged = logged;
+        v->logged_cap = cap;
+    }
+    memcpy(v->logged + v->n_logged, v->dirty, (size_t)v->n_dirty * sizeof(int));
+    v->n_logged += v->n_dirty;
+    v->n_dirty = 0;
+    return CORTEX_OK;
+}
+
+/*
+    Record the slots this transaction wrote as the log of generation,
+    and drop the log that falls out of the HNSW_LOG_KEEP window. When
+    the transaction rewrote more than a quarter of the graph the log is
+    NULL: re-reading that many rows one by one costs more than a reload.
+*/
+static int write_log(hnsw_vtab *v, cortex_int64 generation) {
+    int rc, n = 0, i;
+
+    rc = prepare(v, &v->stmt_put_log,
+        "INSERT OR REPLACE INTO \"%w\".\"%w_config\" VALUES ('log.' || ?1, ?2)");
+    if (rc == CORTEX_OK) {
+        rc = prepare(v, &v->stmt_drop_log,
+            "DELETE FROM \"%w\".\"%w_config\" WHERE key = 'log.' || ?1");
+    }
+    if (rc != CORTEX_OK) return rc;
+    qsort(v->logged, v->n_logged, sizeof(int), int_cmp);
+    for (i = 0; i < v->n_logged; i++) {
+        if (n == 0 || v->logged[i] != v->logged[n - 1]) v->logged[n++] = v->logged[i];
+    }
+    cortex_bind_int64(v->stmt_put_log, 1, generation);
+    if (n > v->n_slots / 4) {
+        cortex_bind_null(v->stmt_put_log, 2);
+    } else {
+        cortex_bind_blob(v->stmt_put_log, 2, n ? (const void *)v->logged : "", n * (int)sizeof(int),
+                         CORTEX_STATIC);
+    }
+    cortex_step(v->stmt_put_log);
+    if ((rc = cortex_reset(v->stmt_put_log)) != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_drop_log, 1, generation - HNSW_LOG_KEEP);
+    cortex_step(v->stmt_drop_log);
+    return cortex_reset(v->stmt_drop_log);
+}
+
+/*
+    Full-precision vectors of quantized tables. They are written as rows
+    are inserted, not at flush time, so a search later in the same
+    transaction can rescore new rows too. A reused slot replaces the
+    vector of the node compacted out of it.
+*/
+static int store_vector(hnsw_vtab *v, int slot, const float *vec) {
+    int rc = prepare(v, &v->stmt_vec_put,
+        "INSERT OR REPLACE INTO \"%w\".\"%w_vectors\"(id, vector) VALUES (?1, ?2)");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_put, 1, slot);
+    cortex_bind_blob(v->stmt_vec_put, 2, vec, v->dim * (int)sizeof(float), CORTEX_STATIC);
+    cortex_step(v->stmt_vec_put);
+    return cortex_reset(v->stmt_vec_put);
+}
+
+/* Position stmt_vec_get on a slot's vector; the caller resets it. */
+static int seek_vector(hnsw_vtab *v, int slot) {
+    int rc = prepare(v, &v->stmt_vec_get,
+        "SELECT vector FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_get, 1, slot);
+    rc = cortex_step(v->stmt_vec_get);
+    if (rc == CORTEX_ROW) {
+        if (cortex_column_bytes(v->stmt_vec_get, 0) == v->dim * (int)sizeof(float)) return CORTEX_OK;
+        rc = CORTEX_CORRUPT_VTAB;
+    } else if (rc == CORTEX_DONE) {
+        rc = CORTEX_CORRUPT_VTAB;
+    }
+    cortex_reset(v->stmt_vec_get);
+    return rc;
+}
+
+/*
+    Re-rank quantized candidates by exact distance and keep the best k.
+    Candidates are read in slot order so the lookups walk %_vectors
+    forwards.
+*/
+static int rescore(hnsw_vtab *v, const float *q, int *slots, float *dists, int *n, int k) {
+    float q_inv = vec_inv_norm_f32(q, v->dim);
+    hnsw_cand *cands = cortex_malloc64((cortex_uint64)*n * sizeof(hnsw_cand));
+    int rc = CORTEX_OK, i;
+
+    if (cands == NULL) return CORTEX_NOMEM;
+    for (i = 0; i < *n; i++) cands[i].slot = slots[i];
+    qsort(cands, *n, sizeof(hnsw_cand), cand_slot_cmp);
+    for (i = 0; i < *n && rc == CORTEX_OK; i++) {
+        if ((rc = seek_vector(v, cands[i].slot)) == CORTEX_OK) {
+            const float *x = cortex_column_blob(v->stmt_vec_get, 0);
+            cands[i].dist = exact_dist(v, q, q_inv, x, vec_inv_norm_f32(x, v->dim));
+            rc = cortex_reset(v->stmt_vec_get);
+        }
+    }
+    if (rc == CORTEX_OK) {
+        qsort(cands, *n, sizeof(hnsw_cand), cand_cmp);
+        if (*n > k) *n = k;
+        for (i = 0; i < *n; i++) {
+            slots[i] = cands[i].slot;
+            dists[i] = cands[i].dist;
+        }
+    }
+    cortex_free(cands);
+    return rc;
+}
+
+/* ─────────────────────────────────────────
+   Batch search
+   ───────────────────────────────────────── */
+
+/*
+    One batch: per query, the pool best candidates (k, or k * rescore
+    when quantized) in slots[q], dists[q] and n[q]. Task t searches a
+    contiguous run of queries with its own walk.
+*/
+typedef struct batch_job {
+    hnsw_vtab *v;
+    const float *queries;
+    int n_q, pool, tasks;
+    const hnsw_allow *allow;
+    int scan;               /* exact scan of allow rather than the graph */
+    int **slots;
+    float **dists;
+    int *n;
+    int *rc;                /* per task */
+} batch_job;
+
+/* A candidate of one query, for batch_rescore */
+typedef struct hnsw_pick {
+    int slot;
+    int query;
+    int pos;                /* in slots[query] */
+} hnsw_pick;
+
+static int pick_cmp(const void *a, const void *b) {
+    const hnsw_pick *pa = a, *pb = b;
+    if (pa->slot != pb->slot) return (pa->slot > pb->slot) - (pa->slot < pb->slot);
+    return (pa->query > pb->query) - (pa->query < pb->query);
+}
+
+/*
+    flat_knn() for queries [lo, hi): the allowed slots are taken a block
+    of HNSW_SCAN_BLOCK bytes of codes at a time and every query is
+    compared with the block before moving on, so the codes come from
+    memory once per batch rather than once per query.
+*/
+static int batch_scan(batch_job *job, int lo, int hi) {
+    const hnsw_vtab *v = job->v;
+    const hnsw_allow *allow = job->allow;
+    int n_q = hi - lo, block = HNSW_SCAN_BLOCK / v->code_size, rc = CORTEX_OK, b, q, i;
+    unsigned char *codes = cortex_malloc64((cortex_uint64)n_q * v->code_size);
+    float *inv = cortex_malloc64((cortex_uint64)n_q * sizeof(float));
+    hnsw_heap *tops = cortex_malloc64((cortex_uint64)n_q * sizeof(hnsw_heap));
+
+    if (codes == NULL || inv == NULL || tops == NULL) {
+        cortex_free(codes);
+        cortex_free(inv);
+        cortex_free(tops);
+        return CORTEX_NOMEM;
+    }
+    if (block < 1) block = 1;
+    for (q = 0; q < n_q; q++) {
+        const float *x = job->queries + (size_t)(lo + q) * v->dim;
+        encode(v, x, codes + (size_t)q * v->code_size);
+        inv[q] = vec_inv_norm_f32(x, v->dim);
+        memset(&tops[q], 0, sizeof(hnsw_heap));
+        tops[q].max = 1;
+    }
+    for (b = 0; b < allow->n && rc == CORTEX_OK; b += block) {
+        int end = allow->n - b > block ? b + block : allow->n;
+        for (q = 0; q < n_q && rc == CORTEX_OK; q++) {
+            const unsigned char *code = codes + (size_t)q * v->code_size;
+            for (i = b; i < end && rc == CORTEX_OK; i++) {
+                rc = top_offer(&tops[q], job->pool, query_dist(v, code, inv[q], allow->slots[i]),
+                               allow->slots[i]);
+            }
+        }
+    }
+    for (q = 0; q < n_q && rc == CORTEX_OK; q++) {
+        int at = lo + q, size = tops[q].n ? tops[q].n : 1;
+        job->slots[at] = cortex_malloc64((cortex_uint64)size * sizeof(int));
+        job->dists[at] = cortex_malloc64((cortex_uint64)size * sizeof(float));
+        if (job->slots[at] == NULL || job->dists[at] == NULL) {
+            rc = CORTEX_NOMEM;
+            break;
+        }
+        job->n[at] = top_sorted(&tops[q], job->slots[at], job->dists[at]);
+    }
+    for (q = 0; q < n_q; q++) cortex_free(tops[q].items);
+    cortex_free(tops);
+    cortex_free(codes);
+    cortex_free(inv);
+    return rc;
+}
+
+static void batch_task(void *arg, int task) {
+    batch_job *job = arg;
+    const hnsw_vtab *v = job->v;
+    int lo = (int)((cortex_int64)job->n_q * task / job->tasks);
+    int hi = (int)((cortex_int64)job->n_q * (task + 1) / job->tasks);
+    hnsw_walk *walk = job->tasks > 1 ? &job->v->walks[task] : &job->v->walk;
+    int rc = CORTEX_OK, q;
+
+    if (job->scan) {
+        rc = batch_scan(job, lo, hi);
+    } else {
+        for (q = lo; q < hi && rc == CORTEX_OK; q++) {
+            rc = graph_knn(v, walk, job->queries + (size_t)q * v->dim, job->pool, job->allow,
+                           &job->slots[q], &job->dists[q], &job->n[q]);
+        }
+    }
+    job->rc[task] = rc;
+}
+
+/*
+    rescore() for a whole batch. The candidates of every query are read
+    in one pass in slot order, so a row that several queries found is
+    fetched from %_vectors once, then each query keeps its best k.
+*/
+static int batch_rescore(hnsw_vtab *v, batch_job *job, int k) {
+    hnsw_pick *picks;
+    hnsw_cand *cands;
+    float *q_inv;
+    cortex_int64 total = 0;
+    int rc = CORTEX_OK, most = 0, q, i, j;
+
+    for (q = 0; q < job->n_q; q++) {
+        total += job->n[q];
+        if (job->n[q] > most) most = job->n[q];
+    }
+    if (total == 0) return CORTEX_OK;
+    picks = cortex_malloc64((cortex_uint64)total * sizeof(hnsw_pick));
+    cands = cortex_malloc64((cortex_uint64)most * sizeof(hnsw_cand));
+    q_inv = cortex_malloc64((cortex_uint64)job->n_q * sizeof(float));
+    if (picks == NULL || cands == NULL || q_inv == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    for (q = 0, j = 0; q < job->n_q; q++) {
+        q_inv[q] = vec_inv_norm_f32(job->queries + (size_t)q * v->dim, v->dim);
+        for (i = 0; i < job->n[q]; i++, j++) {
+            picks[j].slot = job->slots[q][i];
+            picks[j].query = q;
+            picks[j].pos = i;
+        }
+    }
+    qsort(picks, (size_t)total, sizeof(hnsw_pick), pick_cmp);
+    for (j = 0; j < total && rc == CORTEX_OK;) {
+        int slot = picks[j].slot;
+        const float *x;
+        float x_inv;
+
+        if ((rc = seek_vector(v, slot)) != CORTEX_OK) break;
+        x = cortex_column_blob(v->stmt_vec_get, 0);
+        x_inv = vec_inv_norm_f32(x, v->dim);
+        for (; j < total && picks[j].slot == slot; j++) {
+            const hnsw_pick *p = &picks[j];
+            job->dists[p->query][p->pos] = exact_dist(v, job->queries + (size_t)p->query * v->dim,
+                                                      q_inv[p->query], x, x_inv);
+        }
+        rc = cortex_reset(v->stmt_vec_get);
+    }
+    for (q = 0; q < job->n_q && rc == CORTEX_OK; q++) {
+        for (i = 0; i < job->n[q]; i++) {
+            cands[i].slot = job->slots[q][i];
+            cands[i].dist = job->dists[q][i];
+        }
+        qsort(cands, job->n[q], sizeof(hnsw_cand), cand_cmp);
+        if (job->n[q] > k) job->n[q] = k;
+        for (i = 0; i < job->n[q]; i++) {
+            job->slots[q][i] = cands[i].slot;
+            job->dists[q][i] = cands[i].dist;
+        }
+    }
+done:
+    cortex_free(picks);
+    cortex_free(cands);
+    cortex_free(q_inv);
+    return rc;
+}
+
+/* Walks for tasks threads of batch search, sized to the graph */
+static int walks_reserve(hnsw_vtab *v, int tasks) {
+    int i, rc;
+
+    if (tasks > v->n_walks) {
+        hnsw_walk *walks = cortex_realloc64(v->walks, (cortex_uint64)tasks * sizeof(hnsw_walk));
+        if (walks == NULL) return CORTEX_NOMEM;
+        memset(walks + v->n_walks, 0, (size_t)(tasks - v->n_walks) * sizeof(hnsw_walk));
+        v->walks = walks;
+        v->n_walks = tasks;
+    }
+    for (i = 0; i < tasks; i++) {
+        if ((rc = walk_reserve(&v->walks[i], v->cap)) != CORTEX_OK) return rc;
+    }
+    return CORTEX_OK;
+}
+
+/*
+    Top-k of every query in a batch of n_q, flattened into the cursor in
+    query order. The searches only read the graph, so the tasks share it
+    without locks.
+*/
+static int graph_knn_many(hnsw_vtab *v, const float *queries, int n_q, int k,
+                          const hnsw_allow *allow, hnsw_cursor *cur) {
+    batch_job job;
+    cortex_int64 total = 0;
+    int rc = CORTEX_OK, q, i, j;
+
+    if (n_q == 0 || k <= 0) return CORTEX_OK;
+    memset(&job, 0, sizeof(batch_job));
+    job.v = v;
+    job.queries = queries;
+    job.n_q = n_q;
+    job.pool = v->quant == VEC_QUANT_NONE ? k : k * v->rescore;
+    job.tasks = n_q < v->threads ? n_q : v->threads;
+    job.allow = allow;
+    job.scan = allow != NULL && scan_cheaper(v, allow, job.pool);
+    job.slots = cortex_malloc64((cortex_uint64)n_q * sizeof(int *));
+    job.dists = cortex_malloc64((cortex_uint64)n_q * sizeof(float *));
+    job.n = cortex_malloc64((cortex_uint64)n_q * sizeof(int));
+    job.rc = cortex_malloc64((cortex_uint64)job.tasks * sizeof(int));
+    if (job.slots == NULL || job.dists == NULL || job.n == NULL || job.rc == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    memset(job.slots, 0, (size_t)n_q * sizeof(int *));
+    memset(job.dists, 0, (size_t)n_q * sizeof(float *));
+    memset(job.n, 0, (size_t)n_q * sizeof(int));
+    if (job.tasks > 1 && !job.scan && (rc = walks_reserve(v, job.tasks)) != CORTEX_OK) goto done;
+
+    vec_parallel_for(job.tasks, job.tasks, batch_task, &job);
+    for (i = 0; i < job.tasks && rc == CORTEX_OK; i++) rc = job.rc[i];
+    if (rc == CORTEX_OK && v->quant != VEC_QUANT_NONE) rc = batch_rescore(v, &job, k);
+    if (rc != CORTEX_OK) goto done;
+
+    for (q = 0; q < n_q; q++) total += job.n[q];
+    if (total == 0) goto done;
+    cur->slots = cortex_malloc64((cortex_uint64)total * sizeof(int));
+    cur->dists = cortex_malloc64((cortex_uint64)total * sizeof(float));
+    cur->queries = cortex_malloc64((cortex_uint64)total * sizeof(int));
+    if (cur->slots == NULL || cur->dists == NULL || cur->queries == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    for (q = 0, j = 0; q < n_q; q++) {
+        for (i = 0; i < job.n[q]; i++, j++) {
+            cur->slots[j] = job.slots[q][i];
+            cur->dists[j] = job.dists[q][i];
+            cur->queries[j] = q;
+        }
+    }
+    cur->n = (int)total;
+done:
+    for (q = 0; job.slots && job.dists && q < n_q; q++) {
+        cortex_free(job.slots[q]);
+        cortex_free(job.dists[q]);
+    }
+    cortex_free(job.slots);
+    cortex_free(job.dists);
+    cortex_free(job.n);
+    cortex_free(job.rc);
+    return rc;
+}
+
+/* ─────────────────────────────────────────
+   Virtual table methods
+   ───────────────────────────────────────── */
+
+static const char *const HNSW_RESERVED[] = {
+    "embedding", "distance", "k", "query", "queries", "rowid", NULL
+};
+
+static int parse_options(hnsw_vtab *v, int argc, const char *const *argv, char **pzErr) {
+    int i;
+
+    v->dim = 0;
+    v->metric = VEC_METRIC_L2;
+    v->m = 16;
+    v->ef_construction = 200;
+    v->ef_search = 64;
+    v->quant = VEC_QUANT_NONE;
+    v->rescore = 0;
+    v->compact = 20;
+    v->threads = 0;
+
+    for (i = 3; i < argc; i++) {
+        char key[32], value[64];
+        int bad = 0;
+
+        if (strchr(argv[i], '=') == NULL) {
+            if (vec_meta_add(&v->meta, "vec_hnsw", argv[i], HNSW_RESERVED, pzErr)) return CORTEX_ERROR;
+            continue;
+        }
+        if (vec_split_option("vec_hnsw", argv[i], key, sizeof(key), value, sizeof(value), pzErr)) {
+            return CORTEX_ERROR;
+        }
+        if (strcmp(key, "dim") == 0) {
+            bad = vec_parse_int(value, 1, VEC_MAX_DIM, &v->dim);
+        } else if (strcmp(key, "metric") == 0) {
+            bad = vec_parse_metric(value, &v->metric);
+        } else if (strcmp(key, "m") == 0) {
+            bad = vec_parse_int(value, 2, 128, &v->m);
+        } else if (strcmp(key, "ef_construction") == 0) {
+            bad = vec_parse_int(value, 4, 4096, &v->ef_construction);
+        } else if (strcmp(key, "ef_search") == 0) {
+            bad = vec_parse_int(value, 1, 4096, &v->ef_search);
+        } else if (strcmp(key, "quantize") == 0) {
+            bad = vec_parse_quant(value, &v->quant);
+        } else if (strcmp(key, "rescore") == 0) {
+            bad = vec_parse_int(value, 1, 100, &v->rescore);
+        } else if (strcmp(key, "compact") == 0) {
+            bad = vec_parse_int(value, 0, 100, &v->compact);
+        } else if (strcmp(key, "threads") == 0) {
+            bad = vec_parse_int(value, 1, 64, &v->threads);
+        } else if (strcmp(key, "content") == 0 || strcmp(key, "content_column") == 0) {
+            char **field = key[7] ? &v->content_column : &v->content;
+            bad = value[0] == '\0';
+            cortex_free(*field);
+            if ((*field = cortex_mprintf("%s", value)) == NULL) return CORTEX_NOMEM;
+        } else {
+            *pzErr = cortex_mprintf("vec_hnsw: unknown option \"%s\"", key);
+            return CORTEX_ERROR;
+        }
+        if (bad) {
+            *pzErr = cortex_mprintf("vec_hnsw: invalid value for %s: \"%s\"", key, value);
+            return CORTEX_ERROR;
+        }
+    }
+    if (v->dim == 0) {
+        *pzErr = cortex_mprintf("vec_hnsw: the dim option is required");
+        return CORTEX_ERROR;
+    }
+    if (v->content_column && !v->content) {
+        *pzErr = cortex_mprintf("vec_hnsw: content_column needs content");
+        return CORTEX_ERROR;
+    }
+    if (v->content && !v->content_column) {
+        v->content_column = cortex_mprintf("embedding");
+        if (v->content_column == NULL) return CORTEX_NOMEM;
+    }
+    switch (v->quant) {
+        case VEC_QUANT_INT8:
+            v->code_size = v->dim + 2 * (int)sizeof(float);
+            if (v->rescore == 0) v->rescore = 4;
+            break;
+        case VEC_QUANT_BINARY:
+            v->code_size = (v->dim + 7) / 8;
+            if (v->rescore == 0) v->rescore = 10;
+            break;
+        default:
+            v->code_size = v->dim * (int)sizeof(float);
+            v->rescore = 1;
+    }
+    v->m0 = v->m * 2;
+    v->level_mult = 1.0 / log((double)v->m);
+    if (v->threads == 0) v->threads = vec_default_threads();
+    return CORTEX_OK;
+}
+
+/*
+    External content: triggers on the base table replay every INSERT,
+    UPDATE and DELETE into this table inside the writing transaction, so
+    a row is searchable as soon as it commits, whichever connection wrote
+    it. Metadata columns are copied from base columns of the same name;
+    a change to them alone updates %_meta without touching the graph.
+    Trigger names keep the table's name at creation (ALTER TABLE rewrites
+    their bodies, not their names) and are recorded in %_config for
+    xDestroy.
+*/
+static int content_triggers(hnsw_vtab *v, char **pzErr) {
+    const char *s = v->schema, *n = v->name, *t = v->content, *c = v->content_column;
+    char *cols = cortex_mprintf("rowid, embedding"), *vals, *changed, *sets, *sql;
+    int i, rc;
+
+    vals = cortex_mprintf("new.rowid, new.\"%w\"", c);
+    changed = cortex_mprintf("0");
+    sets = cortex_mprintf("");
+    for (i = 0; i < v->meta.n; i++) {
+        const char *m = v->meta.names[i];
+        if (cols) cols = cortex_mprintf("%z, \"%w\"", cols, m);
+        if (vals) vals = cortex_mprintf("%z, new.\"%w\"", vals, m);
+        if (changed) changed = cortex_mprintf("%z OR old.\"%w\" IS NOT new.\"%w\"", changed, m, m);
+        if (sets) sets = cortex_mprintf("%z%s\"%w\" = new.\"%w\"", sets, i ? ", " : "", m, m);
+    }
+    sql = (cols && vals && changed && sets) ? cortex_mprintf(
+        "CREATE TRIGGER \"%w\".\"%w_insert\" AFTER INSERT ON \"%w\" WHEN new.\"%w\" IS NOT NULL BEGIN"
+        " INSERT INTO \"%w\"(%s) VALUES (%s); END;"
+        "CREATE TRIGGER \"%w\".\"%w_delete\" AFTER DELETE ON \"%w\" BEGIN"
+        " DELETE FROM \"%w\" WHERE rowid = old.rowid; END;"
+        "CREATE TRIGGER \"%w\".\"%w_update\" AFTER UPDATE ON \"%w\""
+        " WHEN old.rowid IS NOT new.rowid OR old.\"%w\" IS NOT new.\"%w\" BEGIN"
+        " DELETE FROM \"%w\" WHERE rowid = old.rowid;"
+        " INSERT INTO \"%w\"(%s) SELECT %s WHERE new.\"%w\" IS NOT NULL; END;"
+        "INSERT INTO \"%w\".\"%w_config\" VALUES ('content', %Q), ('triggers', %Q);",
+        s, n, t, c, n, cols, vals,
+        s, n, t, n,
+        s, n, t, c, c, n, n, cols, vals, c,
+        s, n, t, n) : NULL;
+    if (sql && v->meta.n > 0) {
+        sql = cortex_mprintf(
+            "%zCREATE TRIGGER \"%w\".\"%w_update_meta\" AFTER UPDATE ON \"%w\""
+            " WHEN old.rowid IS new.rowid AND old.\"%w\" IS new.\"%w\" AND (%s) BEGIN"
+            " UPDATE \"%w\" SET %s WHERE rowid = new.rowid; END;",
+            sql, s, n, t, c, c, changed, n, sets);
+    }
+    cortex_free(cols);
+    cortex_free(vals);
+    cortex_free(changed);
+    cortex_free(sets);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_exec(v->db, sql, NULL, NULL, pzErr);
+    cortex_free(sql);
+    return rc;
+}
+
+/*
+    Index the rows the base table already holds. They are read in rowid
+    order HNSW_BUILD_SHARD at a time; each shard is placed on this thread,
+    which owns the connection, and then linked on `threads` threads by
+    graph_build(). Progress goes to vec_build_report() after every shard,
+    and the dirty nodes are written once at the end.
+*/
+static int content_backfill(hnsw_vtab *v, char **pzErr) {
+    cortex_value *meta[VEC_MAX_META];
+    cortex_stmt *stmt = NULL;
+    cortex_int64 done = 0, total = -1;
+    hnsw_build build;
+    float *vec = NULL;
+    int *shard = NULL;
+    char *sql = cortex_mprintf("SELECT c.rowid, c.\"%w\"", v->content_column);
+    int rc, n = 0, i;
+
+    /* qualified, so a missing column is an error rather than a string */
+    for (i = 0; sql && i < v->meta.n; i++) sql = cortex_mprintf("%z, c.\"%w\"", sql, v->meta.names[i]);
+    if (sql) {
+        sql = cortex_mprintf("%z FROM \"%w\".\"%w\" AS c WHERE c.\"%w\" IS NOT NULL ORDER BY c.rowid",
+                             sql, v->schema, v->content, v->content_column);
+    }
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc != CORTEX_OK) {
+        *pzErr = cortex_mprintf("vec_hnsw: content: %s", cortex_errmsg(v->db));
+        return rc;
+    }
+    if (vec_build_watched()) {
+        cortex_stmt *count = NULL;
+        sql = cortex_mprintf("SELECT count(*) FROM \"%w\".\"%w\" WHERE \"%w\" IS NOT NULL",
+                             v->schema, v->content, v->content_column);
+        if (sql && cortex_prepare_v2(v->db, sql, -1, &count, NULL) == CORTEX_OK
+            && cortex_step(count) == CORTEX_ROW) {
+            total = cortex_column_int64(count, 0);
+        }
+        cortex_finalize(count);
+        cortex_free(sql);
+    }
+    memset(&build, 0, sizeof(hnsw_build));
+    if ((rc = graph_load(v)) == CORTEX_OK) {
+        vec = cortex_malloc64((cortex_uint64)v->dim * sizeof(float));
+        shard = cortex_malloc64((cortex_uint64)HNSW_BUILD_SHARD * sizeof(int));
+        if (vec == NULL || shard == NULL) rc = CORTEX_NOMEM;
+    }
+    if (rc == CORTEX_OK) rc = build_open(v, &build);
+    while (rc == CORTEX_OK) {
+        int step = cortex_step(stmt);
+
+        if (step == CORTEX_ROW) {
+            cortex_int64 rowid = cortex_column_int64(stmt, 0);
+            int slot;
+            if ((rc = vec_from_value(cortex_column_value(stmt, 1), v->dim, vec, pzErr)) != CORTEX_OK) break;
+            if (v->quant != VEC_QUANT_NONE && (rc = store_vector(v, next_slot(v), vec)) != CORTEX_OK) break;
+            if ((rc = graph_place(v, rowid, vec, &slot)) != CORTEX_OK) break;
+            for (i = 0; i < v->meta.n; i++) meta[i] = cortex_column_value(stmt, 2 + i);
+            if ((rc = vec_meta_write(&v->meta, rowid, meta)) != CORTEX_OK) break;
+            shard[n++] = slot;
+            if (n < HNSW_BUILD_SHARD) continue;
+        } else if (step != CORTEX_DONE) {
+            rc = step;
+            break;
+        }
+        if (n > 0 && (rc = graph_build(&build, shard, n)) != CORTEX_OK) break;
+        done += n;
+        n = 0;
+        if (vec_build_report(done, total)) {
+            *pzErr = cortex_mprintf("vec_hnsw: build cancelled");
+            rc = CORTEX_INTERRUPT;
+        } else if (step == CORTEX_DONE) {
+            break;
+        }
+    }
+    build_close(&build);
+    cortex_free(vec);
+    cortex_free(shard);
+    cortex_finalize(stmt);
+    if (rc != CORTEX_OK) return rc;
+    return graph_flush(v);
+}
+
+static int hnsw_init(cortex *db, int argc, const char *const *argv,
+                     cortex_vtab **ppVtab, char **pzErr, int create) {
+    hnsw_vtab *v;
+    int rc;
+
+    v = cortex_malloc(sizeof(hnsw_vtab));
+    if (v == NULL) return CORTEX_NOMEM;
+    memset(v, 0, sizeof(hnsw_vtab));
+    v->db = db;
+    v->entry = -1;
+    v->max_level = -1;
+
+    rc = parse_options(v, argc, argv, pzErr);
+    if (rc == CORTEX_OK) {
+        v->schema = cortex_mprintf("%s", argv[1]);
+        v->name = cortex_mprintf("%s", argv[2]);
+        if (v->schema == NULL || v->name == NULL) rc = CORTEX_NOMEM;
+        vec_meta_bind(&v->meta, db, &v->schema, &v->name);
+    }
+    if (rc == CORTEX_OK && create) {
+        char *sql = cortex_mprintf(
+            "CREATE TABLE \"%w\".\"%w_config\"(key TEXT PRIMARY KEY, value) WITHOUT ROWID;"
+            "INSERT INTO \"%w\".\"%w_config\" VALUES"
+            " ('format', %d), ('dim', %d), ('metric', '%s'), ('quantize', '%s'), ('generation', 0);"
+            "CREATE TABLE \"%w\".\"%w_nodes\"(id INTEGER PRIMARY KEY, rid INTEGER,"
+            " level INTEGER NOT NULL, vector BLOB NOT NULL, links BLOB NOT NULL);",
+            argv[1], argv[2], argv[1], argv[2], HNSW_FORMAT, v->dim, vec_metric_name(v->metric),
+            vec_quant_name(v->quant), argv[1], argv[2]);
+        if (sql == NULL) {
+            rc = CORTEX_NOMEM;
+        } else {
+            rc = cortex_exec(db, sql, NULL, NULL, pzErr);
+            cortex_free(sql);
+        }
+    }
+    if (rc == CORTEX_OK && create && v->quant != VEC_QUANT_NONE) {
+        char *sql = cortex_mprintf(
+            "CREATE TABLE \"%w\".\"%w_vectors\"(id INTEGER PRIMARY KEY, vector BLOB NOT NULL);",
+            argv[1], argv[2]);
+        if (sql == NULL) {
+            rc = CORTEX_NOMEM;
+        } else {
+            rc = cortex_exec(db, sql, NULL, NULL, pzErr);
+            cortex_free(sql);
+        }
+    }
+    if (rc == CORTEX_OK && create) rc = vec_meta_create(&v->meta, pzErr);
+    if (rc == CORTEX_OK && create && v->content) rc = content_triggers(v, pzErr);
+    if (rc == CORTEX_OK && create && v->content) rc = content_backfill(v, pzErr);
+    if (rc == CORTEX_OK) {
+        char *sql = vec_meta_declare(&v->meta,
+            "embedding BLOB, distance REAL HIDDEN, k INTEGER HIDDEN, query INTEGER HIDDEN,"
+            " queries HIDDEN");
+        if (sql == NULL) {
+            rc = CORTEX_NOMEM;
+        } else {
+            rc = cortex_declare_vtab(db, sql);
+            cortex_free(sql);
+        }
+    }
+    if (rc != CORTEX_OK) {
+        graph_free(v);
+        vec_meta_free(&v->meta);
+        cortex_free(v->content);
+        cortex_free(v->content_column);
+        cortex_free(v->schema);
+        cortex_free(v->name);
+        cortex_free(v);
+        return rc;
+    }
+    *ppVtab = &v->base;
+    return CORTEX_OK;
+}
+
+static int hnsw_create(cortex *db, void *aux, int argc, const char *const *argv,
+                       cortex_vtab **ppVtab, char **pzErr) {
+    (void)aux;
+    return hnsw_init(db, argc, argv, ppVtab, pzErr, 1);
+}
+
+static int hnsw_connect(cortex *db, void *aux, int argc, const char *const *argv,
+                        cortex_vtab **ppVtab, char **pzErr) {
+    (void)aux;
+    return hnsw_init(db, argc, argv, ppVtab, pzErr, 0);
+}
+
+static int hnsw_disconnect(cortex_vtab *pVtab) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+
+    graph_free(v);
+    cortex_finalize(v->stmt_insert);
+    cortex_finalize(v->stmt_update);
+    cortex_finalize(v->stmt_get_gen);
+    cortex_finalize(v->stmt_set_gen);
+    cortex_finalize(v->stmt_vec_get);
+    cortex_finalize(v->stmt_vec_put);
+    cortex_finalize(v->stmt_free);
+    cortex_finalize(v->stmt_vec_free);
+    cortex_finalize(v->stmt_get_log);
+    cortex_finalize(v->stmt_put_log);
+    cortex_finalize(v->stmt_drop_log);
+    cortex_finalize(v->stmt_node);
+    cortex_free(v->logged);
+    vec_meta_free(&v->meta);
+    cortex_free(v->content);
+    cortex_free(v->content_column);
+    cortex_free(v->schema);
+    cortex_free(v->name);
+    cortex_free(v);
+    return CORTEX_OK;
+}
+
+/* The content triggers, under the name they were created with */
+static int drop_triggers(hnsw_vtab *v) {
+    cortex_stmt *stmt = NULL;
+    char *sql = cortex_mprintf("SELECT value FROM \"%w\".\"%w_config\" WHERE key = 'triggers'",
+                               v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc != CORTEX_OK) return rc;
+    sql = NULL;
+    if (cortex_step(stmt) == CORTEX_ROW) {
+        const char *name = (const char *)cortex_column_text(stmt, 0);
+        sql = cortex_mprintf(
+            "DROP TRIGGER IF EXISTS \"%w\".\"%w_insert\"; DROP TRIGGER IF EXISTS \"%w\".\"%w_delete\";"
+            "DROP TRIGGER IF EXISTS \"%w\".\"%w_update\"; DROP TRIGGER IF EXISTS \"%w\".\"%w_update_meta\";",
+            v->schema, name, v->schema, name, v->schema, name, v->schema, name);
+        if (sql == NULL) rc = CORTEX_NOMEM;
+    }
+    cortex_finalize(stmt);
+    if (sql) {
+        rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+        cortex_free(sql);
+    }
+    return rc;
+}
+
+static int hnsw_destroy(cortex_vtab *pVtab) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+    char *sql = cortex_mprintf(
+        "DROP TABLE IF EXISTS \"%w\".\"%w_config\"; DROP TABLE IF EXISTS \"%w\".\"%w_nodes\";"
+        "DROP TABLE IF EXISTS \"%w\".\"%w_vectors\"; DROP TABLE IF EXISTS \"%w\".\"%w_meta\";",
+        v->schema, v->name, v->schema, v->name, v->schema, v->name, v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = v->content ? drop_triggers(v) : CORTEX_OK;
+    if (rc == CORTEX_OK) rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) hnsw_disconnect(pVtab);
+    return rc;
+}
+
+/*
+    argv order for xFilter: the MATCH query, the metadata constraints
+    (idxStr), then k or LIMIT and OFFSET.
+*/
+static int hnsw_best_index(cortex_vtab *pVtab, cortex_index_info *info) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+    int match = -1, batch = -1, k = -1, limit = -1, offset = -1, rowid = -1, i, argv = 1;
+    int unclaimed, rc;
+    int ordered = info->nOrderBy == 1 && info->aOrderBy[0].iColumn == HNSW_COL_DISTANCE
+                  && !info->aOrderBy[0].desc;
+    /* batches come out by query, then distance */
+    int batch_ordered = (info->nOrderBy == 1 || info->nOrderBy == 2)
+                        && info->aOrderBy[0].iColumn == HNSW_COL_QUERY && !info->aOrderBy[0].desc
+                        && (info->nOrderBy == 1 || (info->aOrderBy[1].iColumn == HNSW_COL_DISTANCE
+                                                    && !info->aOrderBy[1].desc));
+
+    for (i = 0; i < info->nConstraint; i++) {
+        const struct cortex_index_constraint *c = &info->aConstraint[i];
+        if (!c->usable) continue;
+        if (c->op == CORTEX_INDEX_CONSTRAINT_MATCH && c->iColumn == HNSW_COL_EMBEDDING) {
+            match = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_MATCH && c->iColumn == HNSW_COL_QUERIES) {
+            batch = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_EQ && c->iColumn == HNSW_COL_K) {
+            k = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_LIMIT) {
+            limit = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_OFFSET) {
+            offset = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_EQ && c->iColumn == -1) {
+            rowid = i;
+        }
+    }
+
+    if (match >= 0) {
+        info->idxNum = HNSW_PLAN_KNN;
+        info->aConstraintUsage[match].argvIndex = argv++;
+        info->aConstraintUsage[match].omit = 1;
+        rc = vec_meta_best_index(&v->meta, HNSW_COL_META, info, &argv, &unclaimed);
+        if (rc != CORTEX_OK) return rc;
+        if (info->idxStr) info->idxNum |= HNSW_ARG_META;
+        if (k >= 0) {
+            info->idxNum |= HNSW_ARG_K;
+            info->aConstraintUsage[k].argvIndex = argv++;
+            info->aConstraintUsage[k].omit = 1;
+        } else if (limit >= 0 && (info->nOrderBy == 0 || ordered) && !unclaimed) {
+            /* LIMIT is only ours to apply when the result order and every filter are too */
+            info->idxNum |= HNSW_ARG_LIMIT;
+            info->aConstraintUsage[limit].argvIndex = argv++;
+            if (offset >= 0) {
+                info->idxNum |= HNSW_ARG_OFFSET;
+                info->aConstraintUsage[offset].argvIndex = argv++;
+            }
+        }
+        info->orderByConsumed = ordered;
+        info->estimatedCost = 10.0;
+        info->estimatedRows = 10;
+    } else if (batch >= 0) {
+        /* LIMIT would count the rows of the whole batch: only k sizes a query's share */
+        info->idxNum = HNSW_PLAN_KNN | HNSW_PLAN_BATCH;
+        info->aConstraintUsage[batch].argvIndex = argv++;
+        info->aConstraintUsage[batch].omit = 1;
+        rc = vec_meta_best_index(&v->meta, HNSW_COL_META, info, &argv, &unclaimed);
+        if (rc != CORTEX_OK) return rc;
+        if (info->idxStr) info->idxNum |= HNSW_ARG_META;
+        if (k >= 0) {
+            info->idxNum |= HNSW_ARG_K;
+            info->aConstraintUsage[k].argvIndex = argv++;
+            info->aConstraintUsage[k].omit = 1;
+        }
+        info->orderByConsumed = batch_ordered;
+        info->estimatedCost = 100.0;
+        info->estimatedRows = 100;
+    } else if (rowid >= 0) {
+        info->idxNum = HNSW_PLAN_ROWID;
+        info->aConstraintUsage[rowid].argvIndex = 1;
+        info->aConstraintUsage[rowid].omit = 1;
+        info->idxFlags = CORTEX_INDEX_SCAN_UNIQUE;
+        info->estimatedCost = 1.0;
+        info->estimatedRows = 1;
+    } else {
+        rc = vec_meta_best_index(&v->meta, HNSW_COL_META, info, &argv, &unclaimed);
+        if (rc != CORTEX_OK) return rc;
+        if (info->idxStr) {
+            info->idxNum = HNSW_ARG_META;
+            info->estimatedCost = 1e3;
+            info->estimatedRows = 1000;
+        } else {
+            info->idxNum = 0;
+            info->estimatedCost = 1e6;
+            info->estimatedRows = 1000000;
+        }
+    }
+    return CORTEX_OK;
+}
+
+static int hnsw_open(cortex_vtab *pVtab, cortex_vtab_cursor **ppCursor) {
+    hnsw_cursor *cur = cortex_malloc(sizeof(hnsw_cursor));
+
+    (void)pVtab;
+    if (cur == NULL) return CORTEX_NOMEM;
+    memset(cur, 0, sizeof(hnsw_cursor));
+    *ppCursor = &cur->base;
+    return CORTEX_OK;
+}
+
+static void cursor_reset(hnsw_cursor *cur) {
+    cortex_free(cur->slots);
+    cortex_free(cur->dists);
+    cortex_free(cur->queries);
+    cur->slots = NULL;
+    cur->dists = NULL;
+    cur->queries = NULL;
+    cur->pos = cur->n = 0;
+}
+
+static int hnsw_close(cortex_vtab_cursor *pCursor) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+    cursor_reset(cur);
+    cortex_free(cur);
+    return CORTEX_OK;
+}
+
+/* Full scans walk the slots directly; skip free slots and tombstones. */
+static void scan_skip(hnsw_vtab *v, hnsw_cursor *cur) {
+    while (cur->pos < v->n_slots && (v->nodes[cur->pos].level < 0 || v->nodes[cur->pos].deleted)) {
+        cur->pos++;
+    }
+}
+
+/* The live rows that pass the metadata constraints in idx_str */
+static int meta_allow(hnsw_vtab *v, const char *idx_str, cortex_value **argv, hnsw_allow *allow) {
+    cortex_int64 *rowids;
+    int n, rc, i;
+
+    memset(allow, 0, sizeof(hnsw_allow));
+    if ((rc = vec_meta_filter(&v->meta, idx_str, argv, &rowids, &n)) != CORTEX_OK) return rc;
+    allow->bits = cortex_malloc64((cortex_uint64)v->n_slots / 8 + 1);
+    allow->slots = cortex_malloc64((cortex_uint64)(n ? n : 1) * sizeof(int));
+    if (allow->bits == NULL || allow->slots == NULL) {
+        cortex_free(rowids);
+        cortex_free(allow->bits);
+        cortex_free(allow->slots);
+        return CORTEX_NOMEM;
+    }
+    memset(allow->bits, 0, (size_t)v->n_slots / 8 + 1);
+    for (i = 0; i < n; i++) {
+        int slot = map_get(v, rowids[i]);
+        if (slot < 0 || allowed(allow, slot)) continue;
+        allow->bits[slot >> 3] |= (unsigned char)(1 << (slot & 7));
+        allow->slots[allow->n++] = slot;
+    }
+    cortex_free(rowids);
+    /* slot order keeps scans of the codes sequential */
+    qsort(allow->slots, allow->n, sizeof(int), int_cmp);
+    return CORTEX_OK;
+}
+
+static int hnsw_filter(cortex_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                       int argc, cortex_value **argv) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+    hnsw_vtab *v = (hnsw_vtab *)pCursor->pVtab;
+    int n_meta = (idxNum & HNSW_ARG_META) ? (int)strlen(idxStr) / 2 : 0;
+    hnsw_allow allow;
+    int rc;
+
+    (void)argc;
+    cursor_reset(cur);
+    cur->plan = idxNum;
+    if ((rc = check_generation(v)) != CORTEX_OK) return rc;
+    if ((rc = graph_load(v)) != CORTEX_OK) return rc;
+
+    if (idxNum & HNSW_PLAN_BATCH) {
+        float *queries;
+        char *err = NULL;
+        int n_q;
+
+        if (!(idxNum & HNSW_ARG_K)) {
+            v->base.zErrMsg = cortex_mprintf("vec_hnsw: a batch query needs k = N");
+            return CORTEX_ERROR;
+        }
+        cur->k = cortex_value_int64(argv[1 + n_meta]);
+        if (cur->k > 100000) {
+            v->base.zErrMsg = cortex_mprintf("vec_hnsw: k must be at most 100000");
+            return CORTEX_ERROR;
+        }
+        if ((rc = vec_batch_from_value(argv[0], v->dim, &queries, &n_q, &err)) != CORTEX_OK) {
+            v->base.zErrMsg = err;
+            return rc;
+        }
+        if (cur->k > 0 && (cortex_int64)n_q * cur->k > HNSW_BATCH_ROWS) {
+            cortex_free(queries);
+            v->base.zErrMsg = cortex_mprintf("vec_hnsw: a batch may return at most %d rows",
+                                             HNSW_BATCH_ROWS);
+            return CORTEX_ERROR;
+        }
+        if (n_meta > 0 && (rc = meta_allow(v, idxStr, argv + 1, &allow)) != CORTEX_OK) {
+            cortex_free(queries);
+            return rc;
+        }
+        rc = graph_knn_many(v, queries, n_q, (int)cur->k, n_meta ? &allow : NULL, cur);
+        if (n_meta > 0) {
+            cortex_free(allow.bits);
+            cortex_free(allow.slots);
+        }
+        cortex_free(queries);
+        return rc;
+    }
+    if (idxNum & HNSW_PLAN_KNN) {
+        float *q;
+        char *err = NULL;
+        cortex_int64 k;
+        int arg = 1 + n_meta;
+
+        if (!(idxNum & (HNSW_ARG_K | HNSW_ARG_LIMIT))) {
+            v->base.zErrMsg = cortex_mprintf("vec_hnsw: a KNN query needs LIMIT or k = N");
+            return CORTEX_ERROR;
+        }
+        k = cortex_value_int64(argv[arg]);
+        if (idxNum & HNSW_ARG_OFFSET) k += cortex_value_int64(argv[arg + 1]);
+        if (k > 100000) {
+            v->base.zErrMsg = cortex_mprintf("vec_hnsw: k must be at most 100000");
+            return CORTEX_ERROR;
+        }
+        cur->k = k;
+
+        q = cortex_malloc64((cortex_uint64)v->dim * sizeof(float));
+        if (q == NULL) return CORTEX_NOMEM;
+        if (vec_from_value(argv[0], v->dim, q, &err) != CORTEX_OK) {
+            cortex_free(q);
+            v->base.zErrMsg = err;
+            return CORTEX_ERROR;
+        }
+        if (n_meta > 0 && (rc = meta_allow(v, idxStr, argv + 1, &allow)) != CORTEX_OK) {
+            cortex_free(q);
+            return rc;
+        }
+        if (v->quant == VEC_QUANT_NONE) {
+            rc = graph_knn(v, &v->walk, q, (int)k, n_meta ? &allow : NULL,
+                           &cur->slots, &cur->dists, &cur->n);
+        } else {
+            rc = graph_knn(v, &v->walk, q, (int)(k * v->rescore), n_meta ? &allow : NULL,
+                           &cur->slots, &cur->dists, &cur->n);
+            if (rc == CORTEX_OK && cur->n > 0) {
+                rc = rescore(v, q, cur->slots, cur->dists, &cur->n, (int)k);
+            }
+        }
+        if (n_meta > 0) {
+            cortex_free(allow.bits);
+            cortex_free(allow.slots);
+        }
+        cortex_free(q);
+        return rc;
+    }
+    if (idxNum & HNSW_ARG_META) {
+        if ((rc = meta_allow(v, idxStr, argv, &allow)) != CORTEX_OK) return rc;
+        cortex_free(allow.bits);
+        cur->slots = allow.slots;
+        cur->n = allow.n;
+        return CORTEX_OK;
+    }
+    if (idxNum & HNSW_PLAN_ROWID) {
+        int slot = map_get(v, cortex_value_int64(argv[0]));
+        if (slot >= 0 && cortex_value_type(argv[0]) == CORTEX_INTEGER) {
+            cur->slots = cortex_malloc(sizeof(int));
+            if (cur->slots == NULL) return CORTEX_NOMEM;
+            cur->slots[0] = slot;
+            cur->n = 1;
+        }
+        return CORTEX_OK;
+    }
+    scan_skip(v, cur);
+    return CORTEX_OK;
+}
+
+static int current_slot(const hnsw_cursor *cur) {
+    return cur->plan ? cur->slots[cur->pos] : cur->pos;
+}
+
+static int hnsw_next(cortex_vtab_cursor *pCursor) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+
+    cur->pos++;
+    if (!cur->plan) scan_skip((hnsw_vtab *)pCursor->pVtab, cur);
+    return CORTEX_OK;
+}
+
+static int hnsw_eof(cortex_vtab_cursor *pCursor) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+    hnsw_vtab *v = (hnsw_vtab *)pCursor->pVtab;
+
+    return cur->plan ? cur->pos >= cur->n : cur->pos >= v->n_slots;
+}
+
+static int hnsw_column(cortex_vtab_cursor *pCursor, cortex_context *ctx, int col) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+    hnsw_vtab *v = (hnsw_vtab *)pCursor->pVtab;
+    int slot = current_slot(cur);
+
+    switch (col) {
+        case HNSW_COL_EMBEDDING:
+            /* an UPDATE that leaves the embedding alone need not read it */
+            if (cortex_vtab_nochange(ctx)) break;
+            if (v->quant == VEC_QUANT_NONE) {
+                cortex_result_blob(ctx, code_at(v, slot), v->code_size, CORTEX_TRANSIENT);
+            } else {
+                int rc = seek_vector(v, slot);
+                if (rc != CORTEX_OK) return rc;
+                cortex_result_blob(ctx, cortex_column_blob(v->stmt_vec_get, 0),
+                                   v->dim * (int)sizeof(float), CORTEX_TRANSIENT);
+                cortex_reset(v->stmt_vec_get);
+            }
+            break;
+        case HNSW_COL_DISTANCE:
+            if (cur->plan & HNSW_PLAN_KNN) {
+                cortex_result_double(ctx, reported_dist(v, cur->dists[cur->pos]));
+            }
+            break;
+        case HNSW_COL_K:
+            if (cur->plan & HNSW_PLAN_KNN) cortex_result_int64(ctx, cur->k);
+            break;
+        case HNSW_COL_QUERY:
+            if (cur->plan & HNSW_PLAN_BATCH) cortex_result_int(ctx, cur->queries[cur->pos]);
+            break;
+        case HNSW_COL_QUERIES:
+            break;
+        default:
+            return vec_meta_column(&v->meta, v->nodes[slot].rowid, col - HNSW_COL_META, ctx);
+    }
+    return CORTEX_OK;
+}
+
+static int hnsw_rowid(cortex_vtab_cursor *pCursor, cortex_int64 *pRowid) {
+    hnsw_cursor *cur = (hnsw_cursor *)pCursor;
+    hnsw_vtab *v = (hnsw_vtab *)pCursor->pVtab;
+
+    *pRowid = v->nodes[current_slot(cur)].rowid;
+    return CORTEX_OK;
+}
+
+static int hnsw_update(cortex_vtab *pVtab, int argc, cortex_value **argv, cortex_int64 *pRowid) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+    cortex_int64 old_rowid = 0, rowid;
+    float *vec;
+    char *err = NULL;
+    int rc;
+
+    if ((rc = graph_load(v)) != CORTEX_OK) return rc;
+    v->txn_writes = 1;
+
+    if (cortex_value_type(argv[0]) != CORTEX_NULL) {
+        old_rowid = cortex_value_int64(argv[0]);
+        if (argc == 1) {
+            rc = graph_delete(v, old_rowid);
+            return rc == CORTEX_OK ? vec_meta_delete(&v->meta, old_rowid) : rc;
+        }
+    }
+
+    if (cortex_value_type(argv[1]) == CORTEX_NULL) {
+        rowid = v->max_rowid + 1;
+    } else {
+        rowid = cortex_value_int64(argv[1]);
+    }
+    if (cortex_value_type(argv[0]) != CORTEX_NULL && rowid == old_rowid
+        && cortex_value_nochange(argv[2 + HNSW_COL_EMBEDDING])) {
+        /* metadata only: the node stays where it is */
+        *pRowid = rowid;
+        return vec_meta_write(&v->meta, rowid, argv + 2 + HNSW_COL_META);
+    }
+    if (map_get(v, rowid) >= 0 && !(cortex_value_type(argv[0]) != CORTEX_NULL && rowid == old_rowid)) {
+        v->base.zErrMsg = cortex_mprintf("UNIQUE constraint failed: %s.rowid", v->name);
+        return CORTEX_CONSTRAINT;
+    }
+
+    vec = cortex_malloc64((cortex_uint64)v->dim * sizeof(float));
+    if (vec == NULL) return CORTEX_NOMEM;
+    if (vec_from_value(argv[2 + HNSW_COL_EMBEDDING], v->dim, vec, &err) != CORTEX_OK) {
+        cortex_free(vec);
+        v->base.zErrMsg = err;
+        return CORTEX_CONSTRAINT;
+    }
+    /* an UPDATE retires the old node and links in a fresh one */
+    if (cortex_value_type(argv[0]) != CORTEX_NULL) rc = graph_delete(v, old_rowid);
+    if (rc == CORTEX_OK && cortex_value_type(argv[0]) != CORTEX_NULL && rowid != old_rowid) {
+        rc = vec_meta_delete(&v->meta, old_rowid);
+    }
+    if (rc == CORTEX_OK && v->quant != VEC_QUANT_NONE) rc = store_vector(v, next_slot(v), vec);
+    if (rc == CORTEX_OK) rc = graph_insert(v, rowid, vec);
+    if (rc == CORTEX_OK) rc = vec_meta_write(&v->meta, rowid, argv + 2 + HNSW_COL_META);
+    cortex_free(vec);
+    *pRowid = rowid;
+    return rc;
+}
+
+static int hnsw_begin(cortex_vtab *pVtab) {
+    return check_generation((hnsw_vtab *)pVtab);
+}
+
+static int hnsw_sync(cortex_vtab *pVtab) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+    int rc;
+
+    if (!v->txn_writes) return CORTEX_OK;
+    if (v->compact > 0 && v->n_dead >= HNSW_COMPACT_MIN
+        && (cortex_int64)v->n_dead * 100 >= (cortex_int64)(v->n_live + v->n_dead) * v->compact) {
+        if ((rc = graph_compact(v)) != CORTEX_OK) return rc;
+    }
+    if ((rc = graph_flush(v)) != CORTEX_OK) return rc;
+    if ((rc = write_log(v, v->generation + 1)) != CORTEX_OK) return rc;
+    rc = prepare(v, &v->stmt_set_gen,
+        "UPDATE \"%w\".\"%w_config\" SET value = ?1 WHERE key = 'generation'");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_set_gen, 1, v->generation + 1);
+    cortex_step(v->stmt_set_gen);
+    rc = cortex_reset(v->stmt_set_gen);
+    if (rc == CORTEX_OK) v->generation++;
+    return rc;
+}
+
+static int hnsw_commit(cortex_vtab *pVtab) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+
+    v->txn_writes = 0;
+    v->n_logged = 0;
+    return CORTEX_OK;
+}
+
+static int hnsw_rollback(cortex_vtab *pVtab) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+
+    if (v->txn_writes || v->n_dirty) graph_free(v);
+    v->txn_writes = 0;
+    v->n_logged = 0;
+    return CORTEX_OK;
+}
+
+static int hnsw_savepoint(cortex_vtab *pVtab, int n) {
+    (void)n;
+    /* the shadow tables must match the graph at every savepoint */
+    return graph_flush((hnsw_vtab *)pVtab);
+}
+
+static int hnsw_release(cortex_vtab *pVtab, int n) {
+    (void)pVtab;
+    (void)n;
+    return CORTEX_OK;
+}
+
+static int hnsw_rollback_to(cortex_vtab *pVtab, int n) {
+    (void)n;
+    graph_free((hnsw_vtab *)pVtab);
+    return CORTEX_OK;
+}
+
+static int hnsw_rename(cortex_vtab *pVtab, const char *zNew) {
+    hnsw_vtab *v = (hnsw_vtab *)pVtab;
+    char *sql = cortex_mprintf(
+        "ALTER TABLE \"%w\".\"%w_config\" RENAME TO \"%w_config\";"
+        "ALTER TABLE \"%w\".\"%w_nodes\" RENAME TO \"%w_nodes\";",
+        v->schema, v->name, zNew, v->schema, v->name, zNew);
+    char *name;
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK && v->quant != VEC_QUANT_NONE) {
+        sql = cortex_mprintf("ALTER TABLE \"%w\".\"%w_vectors\" RENAME TO \"%w_vectors\";",
+                             v->schema, v->name, zNew);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+        cortex_free(sql);
+    }
+    if (rc == CORTEX_OK) rc = vec_meta_rename(&v->meta, zNew);
+    if (rc != CORTEX_OK) return rc;
+    name = cortex_mprintf("%s", zNew);
+    if (name == NULL) return CORTEX_NOMEM;
+    cortex_free(v->name);
+    v->name = name;
+    /* statements still point at the old shadow table names */
+    cortex_finalize(v->stmt_insert);
+    cortex_finalize(v->stmt_update);
+    cortex_finalize(v->stmt_get_gen);
+    cortex_finalize(v->stmt_set_gen);
+    cortex_finalize(v->stmt_vec_get);
+    cortex_finalize(v->stmt_vec_put);
+    cortex_finalize(v->stmt_free);
+    cortex_finalize(v->stmt_vec_free);
+    cortex_finalize(v->stmt_get_log);
+    cortex_finalize(v->stmt_put_log);
+    cortex_finalize(v->stmt_drop_log);
+    cortex_finalize(v->stmt_node);
+    v->stmt_insert = v->stmt_update = v->stmt_get_gen = v->stmt_set_gen = NULL;
+    v->stmt_vec_get = v->stmt_vec_put = v->stmt_free = v->stmt_vec_free = NULL;
+    v->stmt_get_log = v->stmt_put_log = v->stmt_drop_log = v->stmt_node = NULL;
+    return CORTEX_OK;
+}
+
+static int hnsw_shadow_name(const char *zName) {
+    return strcmp(zName, "config") == 0 || strcmp(zName, "nodes") == 0
+           || strcmp(zName, "vectors") == 0 || strcmp(zName, "meta") == 0;
+}
+
+static cortex_module hnsw_module = {
+    3,                      /* iVersion */
+    hnsw_create,
+    hnsw_connect,
+    hnsw_best_index,
+    hnsw_disconnect,
+    hnsw_destroy,
+    hnsw_open,
+    hnsw_close,
+    hnsw_filter,
+    hnsw_next,
+    hnsw_eof,
+    hnsw_column,
+    hnsw_rowid,
+    hnsw_update,
+    hnsw_begin,
+    hnsw_sync,
+    hnsw_commit,
+    hnsw_rollback,
+    NULL,                   /* xFindFunction */
+    hnsw_rename,
+    hnsw_savepoint,
+    hnsw_release,
+    hnsw_rollback_to,
+    hnsw_shadow_name,
+    NULL                    /* xIntegrity */
+};
+
+int vec_hnsw_register(cortex *db) {
+    return cortex_create_module_v2(db, "vec_hnsw", &hnsw_module, NULL, NULL);
+}
@@ -0,0 +1,338 @@
+#include "cortex_vec.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    hybrid_search — keyword and semantic recall fused in one query.
+
+        SELECT id, score FROM hybrid_search('notes_fts', 'notes_vec', :text, :vec, 10);
+        SELECT n.body FROM hybrid_search('notes_fts', 'notes_vec', :text, :vec, 10, 0.7) h
+          JOIN notes n ON n.rowid = h.id ORDER BY h.score DESC;
+
+    Arguments: an FTS5 table, a vector table (vec_hnsw or vec_ivf), the
+    text query, the query vector, k, and alpha, the weight of the vector
+    ranking (default 0.5). Either query may be NULL to rank by the other
+    alone. Both tables must share rowids.
+
+    Each side contributes its best k * HYBRID_DEPTH rows: FTS5 ordered by
+    bm25 (its rank column), the vector table by distance. The rankings
+    are fused by weighted reciprocal rank,
+
+        score = (1 - alpha) / (60 + text_rank) + alpha / (60 + vec_rank)
+
+    with a missing rank contributing nothing, and the k best rows are
+    returned by descending score. Ranks are 1-based; text_rank, vec_rank
+    and distance are NULL for rows only the other side found.
+
+    The two queries run one after the other on the calling connection:
+    statements on one connection cannot run concurrently. What the
+    function saves is the second round trip and the merge in the caller.
+*/
+
+#define HYBRID_DEPTH 4
+#define HYBRID_RRF_K 60.0
+#define HYBRID_MAX_K 10000
+
+enum {
+    HYBRID_COL_ID, HYBRID_COL_SCORE, HYBRID_COL_TEXT_RANK, HYBRID_COL_VEC_RANK,
+    HYBRID_COL_DISTANCE,
+    /* hidden arguments, in call order */
+    HYBRID_COL_FTS, HYBRID_COL_VEC, HYBRID_COL_QUERY_TEXT, HYBRID_COL_QUERY_VEC,
+    HYBRID_COL_K, HYBRID_COL_ALPHA
+};
+
+#define HYBRID_N_ARGS 6
+
+typedef struct hybrid_row {
+    cortex_int64 id;
+    int text_rank;          /* 0: not found by full-text search */
+    int vec_rank;           /* 0: not found by vector search */
+    double distance;
+    double score;
+} hybrid_row;
+
+typedef struct hybrid_vtab {
+    cortex_vtab base;
+    cortex *db;
+} hybrid_vtab;
+
+typedef struct hybrid_cursor {
+    cortex_vtab_cursor base;
+    hybrid_row *rows;
+    int n, pos;
+} hybrid_cursor;
+
+static int hybrid_connect(cortex *db, void *aux, int argc, const char *const *argv,
+                          cortex_vtab **ppVtab, char **pzErr) {
+    hybrid_vtab *v;
+    int rc;
+
+    (void)aux;
+    (void)argc;
+    (void)argv;
+    (void)pzErr;
+    rc = cortex_declare_vtab(db,
+        "CREATE TABLE x(id INTEGER, score REAL, text_rank INTEGER, vec_rank INTEGER, distance REAL,"
+        " fts_table HIDDEN, vec_table HIDDEN, query_text HIDDEN, query_vec HIDDEN,"
+        " k HIDDEN, alpha HIDDEN)");
+    if (rc != CORTEX_OK) return rc;
+    v = cortex_malloc(sizeof(hybrid_vtab));
+    if (v == NULL) return CORTEX_NOMEM;
+    memset(v, 0, sizeof(hybrid_vtab));
+    v->db = db;
+    *ppVtab = &v->base;
+    return CORTEX_OK;
+}
+
+static int hybrid_disconnect(cortex_vtab *pVtab) {
+    cortex_free(pVtab);
+    return CORTEX_OK;
+}
+
+/* idxNum has bit i set when argument i is given; argv follows column order */
+static int hybrid_best_index(cortex_vtab *pVtab, cortex_index_info *info) {
+    int given[HYBRID_N_ARGS] = {-1, -1, -1, -1, -1, -1};
+    int i, argv = 1;
+
+    (void)pVtab;
+    for (i = 0; i < info->nConstraint; i++) {
+        const struct cortex_index_constraint *c = &info->aConstraint[i];
+        int arg = c->iColumn - HYBRID_COL_FTS;
+        if (arg < 0 || c->op != CORTEX_INDEX_CONSTRAINT_EQ) continue;
+        /* an argument we cannot use yet rules this plan out */
+        if (!c->usable) return CORTEX_CONSTRAINT;
+        given[arg] = i;
+    }
+    info->idxNum = 0;
+    for (i = 0; i < HYBRID_N_ARGS; i++) {
+        if (given[i] < 0) continue;
+        info->idxNum |= 1 << i;
+        info->aConstraintUsage[given[i]].argvIndex = argv++;
+        info->aConstraintUsage[given[i]].omit = 1;
+    }
+    if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == HYBRID_COL_SCORE && info->aOrderBy[0].desc) {
+        info->orderByConsumed = 1;
+    }
+    info->estimatedCost = 100.0;
+    info->estimatedRows = 10;
+    return CORTEX_OK;
+}
+
+static int hybrid_open(cortex_vtab *pVtab, cortex_vtab_cursor **ppCursor) {
+    hybrid_cursor *cur = cortex_malloc(sizeof(hybrid_cursor));
+
+    (void)pVtab;
+    if (cur == NULL) return CORTEX_NOMEM;
+    memset(cur, 0, sizeof(hybrid_cursor));
+    *ppCursor = &cur->base;
+    return CORTEX_OK;
+}
+
+static int hybrid_close(cortex_vtab_cursor *pCursor) {
+    hybrid_cursor *cur = (hybrid_cursor *)pCursor;
+    cortex_free(cur->rows);
+    cortex_free(cur);
+    return CORTEX_OK;
+}
+
+static int id_cmp(const void *a, const void *b) {
+    cortex_int64 ia = ((const hybrid_row *)a)->id, ib = ((const hybrid_row *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Best score first; ties by id so the order is stable */
+static int score_cmp(const void *a, const void *b) {
+    const hybrid_row *ra = a, *rb = b;
+    if (ra->score != rb->score) return ra->score < rb->score ? 1 : -1;
+    return id_cmp(a, b);
+}
+
+/*
+    Append one side's ranking to rows. The statement yields rowids best
+    first (and the distance as column 1 for the vector side).
+*/
+static int collect(cortex_stmt *stmt, int is_vec, hybrid_row **rows, int *n, int *cap) {
+    int rank = 0, rc;
+
+    while ((rc = cortex_step(stmt)) == CORTEX_ROW) {
+        hybrid_row *row;
+        if (*n == *cap) {
+            int grown_cap = *cap ? *cap * 2 : 64;
+            hybrid_row *grown = cortex_realloc64(*rows, (cortex_uint64)grown_cap * sizeof(hybrid_row));
+            if (grown == NULL) return CORTEX_NOMEM;
+            *rows = grown;
+            *cap = grown_cap;
+        }
+        row = &(*rows)[(*n)++];
+        memset(row, 0, sizeof(hybrid_row));
+        row->id = cortex_column_int64(stmt, 0);
+        if (is_vec) {
+            row->vec_rank = ++rank;
+            row->distance = cortex_column_double(stmt, 1);
+        } else {
+            row->text_rank = ++rank;
+        }
+    }
+    return rc == CORTEX_DONE ? CORTEX_OK : rc;
+}
+
+/* Run one side's top-depth query and append its ranking to rows */
+static int run_side(hybrid_vtab *v, const char *fmt, const char *table, cortex_value *query,
+                    int depth, int is_vec, hybrid_row **rows, int *n, int *cap) {
+    cortex_stmt *stmt = NULL;
+    char *sql = cortex_mprintf(fmt, table, table);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) {
+        cortex_bind_value(stmt, 1, query);
+        cortex_bind_int(stmt, 2, depth);
+        rc = collect(stmt, is_vec, rows, n, cap);
+    }
+    if (rc != CORTEX_OK && rc != CORTEX_NOMEM) {
+        v->base.zErrMsg = cortex_mprintf("hybrid_search: %s: %s", table, cortex_errmsg(v->db));
+    }
+    cortex_finalize(stmt);
+    return rc;
+}
+
+static int hybrid_filter(cortex_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                         int argc, cortex_value **argv) {
+    hybrid_cursor *cur = (hybrid_cursor *)pCursor;
+    hybrid_vtab *v = (hybrid_vtab *)pCursor->pVtab;
+    cortex_value *args[HYBRID_N_ARGS] = {NULL, NULL, NULL, NULL, NULL, NULL};
+    const char *fts, *vec;
+    hybrid_row *rows = NULL;
+    double alpha = 0.5;
+    int n = 0, cap = 0, k, i, j, a = 0, rc = CORTEX_OK;
+
+    (void)idxStr;
+    (void)argc;
+    cortex_free(cur->rows);
+    cur->rows = NULL;
+    cur->n = cur->pos = 0;
+    for (i = 0; i < HYBRID_N_ARGS; i++) {
+        if (idxNum & (1 << i)) args[i] = argv[a++];
+    }
+
+    fts = args[0] ? (const char *)cortex_value_text(args[0]) : NULL;
+    vec = args[1] ? (const char *)cortex_value_text(args[1]) : NULL;
+    if (fts == NULL || vec == NULL || args[4] == NULL) {
+        v->base.zErrMsg = cortex_mprintf(
+            "hybrid_search: usage is hybrid_search(fts_table, vec_table, query_text, query_vec, k [, alpha])");
+        return CORTEX_ERROR;
+    }
+    k = cortex_value_int(args[4]);
+    if (k < 1 || k > HYBRID_MAX_K) {
+        v->base.zErrMsg = cortex_mprintf("hybrid_search: k must be between 1 and %d", HYBRID_MAX_K);
+        return CORTEX_ERROR;
+    }
+    if (args[5] && cortex_value_type(args[5]) != CORTEX_NULL) {
+        alpha = cortex_value_double(args[5]);
+        if (!(alpha >= 0.0 && alpha <= 1.0)) {
+            v->base.zErrMsg = cortex_mprintf("hybrid_search: alpha must be between 0 and 1");
+            return CORTEX_ERROR;
+        }
+    }
+
+    if (args[2] && cortex_value_type(args[2]) != CORTEX_NULL && alpha < 1.0) {
+        rc = run_side(v, "SELECT rowid FROM \"%w\" WHERE \"%w\" MATCH ?1 ORDER BY rank LIMIT ?2",
+                      fts, args[2], k * HYBRID_DEPTH, 0, &rows, &n, &cap);
+    }
+    if (rc == CORTEX_OK && args[3] && cortex_value_type(args[3]) != CORTEX_NULL && alpha > 0.0) {
+        rc = run_side(v, "SELECT rowid, distance FROM \"%w\" WHERE embedding MATCH ?1 AND k = ?2"
+                         " ORDER BY distance",
+                      vec, args[3], k * HYBRID_DEPTH, 1, &rows, &n, &cap);
+    }
+    if (rc != CORTEX_OK) {
+        cortex_free(rows);
+        return rc;
+    }
+
+    /* rows found by both sides appear twice; merge them by id */
+    qsort(rows, n, sizeof(hybrid_row), id_cmp);
+    for (i = 0, j = -1; i < n; i++) {
+        if (j >= 0 && rows[j].id == rows[i].id) {
+            if (rows[i].text_rank) rows[j].text_rank = rows[i].text_rank;
+            if (rows[i].vec_rank) {
+                rows[j].vec_rank = rows[i].vec_rank;
+                rows[j].distance = rows[i].distance;
+            }
+        } else {
+            rows[++j] = rows[i];
+        }
+    }
+    n = j + 1;
+    for (i = 0; i < n; i++) {
+        rows[i].score = 0.0;
+        if (rows[i].text_rank) rows[i].score += (1.0 - alpha) / (HYBRID_RRF_K + rows[i].text_rank);
+        if (rows[i].vec_rank) rows[i].score += alpha / (HYBRID_RRF_K + rows[i].vec_rank);
+    }
+    qsort(rows, n, sizeof(hybrid_row), score_cmp);
+    cur->rows = rows;
+    cur->n = n < k ? n : k;
+    return CORTEX_OK;
+}
+
+static int hybrid_next(cortex_vtab_cursor *pCursor) {
+    ((hybrid_cursor *)pCursor)->pos++;
+    return CORTEX_OK;
+}
+
+static int hybrid_eof(cortex_vtab_cursor *pCursor) {
+    hybrid_cursor *cur = (hybrid_cursor *)pCursor;
+    return cur->pos >= cur->n;
+}
+
+static int hybrid_column(cortex_vtab_cursor *pCursor, cortex_context *ctx, int col) {
+    hybrid_cursor *cur = (hybrid_cursor *)pCursor;
+    const hybrid_row *row = &cur->rows[cur->pos];
+
+    switch (col) {
+        case HYBRID_COL_ID:
+            cortex_result_int64(ctx, row->id);
+            break;
+        case HYBRID_COL_SCORE:
+            cortex_result_double(ctx, row->score);
+            break;
+        case HYBRID_COL_TEXT_RANK:
+            if (row->text_rank) cortex_result_int(ctx, row->text_rank);
+            break;
+        case HYBRID_COL_VEC_RANK:
+            if (row->vec_rank) cortex_result_int(ctx, row->vec_rank);
+            break;
+        case HYBRID_COL_DISTANCE:
+            if (row->vec_rank) cortex_result_double(ctx, row->distance);
+            break;
+    }
+    return CORTEX_OK;
+}
+
+static int hybrid_rowid(cortex_vtab_cursor *pCursor, cortex_int64 *pRowid) {
+    hybrid_cursor *cur = (hybrid_cursor *)pCursor;
+    *pRowid = cur->rows[cur->pos].id;
+    return CORTEX_OK;
+}
+
+static cortex_module hybrid_module = {
+    0,                      /* iVersion */
+    NULL,                   /* xCreate: eponymous only */
+    hybrid_connect,
+    hybrid_best_index,
+    hybrid_disconnect,
+    NULL,                   /* xDestroy */
+    hybrid_open,
+    hybrid_close,
+    hybrid_filter,
+    hybrid_next,
+    hybrid_eof,
+    hybrid_column,
+    hybrid_rowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+int vec_hybrid_register(cortex *db) {
+    return cortex_create_module_v2(db, "hybrid_search", &hybrid_module, NULL, NULL);
+}
@@ -0,0 +1,18 @@
+#include "cortex_vec.h"
+
+/*
+    Register the vector extension on one connection. Called once per
+    handle by the Python package (and by C users after cortex_open).
+*/
+int cortex_vec_init(cortex *db) {
+    int rc;
+
+    vec_kernels_select();
+    rc = vec_functions_register(db);
+    if (rc == CORTEX_OK) rc = vec_hnsw_register(db);
+    if (rc == CORTEX_OK) rc = vec_ivf_register(db);
+    if (rc == CORTEX_OK) rc = vec_hybrid_register(db);
+    if (rc == CORTEX_OK) rc = vec_batch_register(db);
+    if (rc == CORTEX_OK) rc = vec_build_register(db);
+    return rc;
+}
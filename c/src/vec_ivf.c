@@ -0,0 +1,1616 @@
+#include "cortex_vec.h"
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    vec_ivf — disk-resident approximate nearest neighbour search (IVF-PQ).
+
+        CREATE VIRTUAL TABLE mem USING vec_ivf(dim=768, metric=cosine, lists=1024);
+        INSERT INTO mem(rowid, embedding) VALUES (?, ?);
+        SELECT rowid, distance FROM mem
+         WHERE embedding MATCH ? AND nprobe = 16 ORDER BY distance LIMIT 10;
+
+    Options: dim (required), metric (l2 | cosine | dot, default l2),
+    lists (coarse clusters, default 256), pq_m (code bytes per vector;
+    must divide dim, default dim / 8), nprobe (lists searched per query,
+    default 8), rescore (candidates per result re-ranked by exact
+    distance, default 10; 0 reports PQ distances), train_rows (default
+    40 * max(lists, 256)) and threads (training threads, default one
+    per CPU). The hidden nprobe column overrides the option per query.
+
+    Vectors are clustered around `lists` k-means centroids; each row is
+    filed under its nearest centroid and only the residual from that
+    centroid is stored, product-quantized into pq_m one-byte codes
+    (Jégou et al., "Product quantization for nearest neighbor search").
+    A query ranks the centroids, reads the nprobe closest lists and
+    scores their codes from a per-list lookup table, so its cost follows
+    nprobe and the list sizes, not the table size. Only the centroids and
+    codebooks are held in memory; the lists stay in the database.
+
+        %_config(key, value)            format, trained flag and generation
+        %_codebooks(id, data)           0: centroids, 1: PQ codebooks
+        %_lists(id, ids, codes)         inverted lists in chunks
+        %_vectors(id, list, vector)     every row's float32 vector
+
+    %_lists.id is list << 24 | chunk, so the chunks of one list are
+    adjacent in the table's b-tree; each holds up to IVF_CHUNK rowids and
+    their codes back to back.
+
+    Until the table holds train_rows rows it is untrained: rows are only
+    kept in %_vectors and searched exactly. The insert that reaches
+    train_rows trains the quantizers on a sample (k-means and PQ training
+    run on `threads` threads) and files every row. Training can also be
+    rerun at any time, e.g. after the data has drifted:
+
+        INSERT INTO mem(command) VALUES ('train');
+
+    Writes go straight to the shadow tables. Each committed write
+    transaction bumps the generation so other connections reload the
+    quantizers; a rollback drops them and they are reloaded.
+*/
+
+#define IVF_FORMAT      1
+#define IVF_CODEBOOK    256         /* codewords per subquantizer */
+#define IVF_CHUNK       64          /* entries per %_lists row */
+#define IVF_CHUNK_BITS  24
+#define IVF_COARSE_ITERS 20
+#define IVF_PQ_ITERS    15
+#define IVF_BATCH       4096        /* rows encoded per step while filing */
+#define IVF_SEED        0x9e3779b97f4a7c15ULL
+
+enum { IVF_COL_EMBEDDING, IVF_COL_DISTANCE, IVF_COL_K, IVF_COL_NPROBE, IVF_COL_COMMAND };
+
+/* xBestIndex plan bits, passed to xFilter as idxNum */
+enum {
+    IVF_PLAN_KNN    = 1,
+    IVF_PLAN_ROWID  = 2,
+    IVF_ARG_K       = 4,
+    IVF_ARG_LIMIT   = 8,
+    IVF_ARG_OFFSET  = 16,
+    IVF_ARG_NPROBE  = 32
+};
+
+typedef struct ivf_hit {
+    float dist;
+    cortex_int64 id;
+} ivf_hit;
+
+/* Bounded max-heap: keeps the cap smallest distances pushed */
+typedef struct ivf_topk {
+    ivf_hit *items;
+    int n, cap;
+} ivf_topk;
+
+typedef struct ivf_vtab {
+    cortex_vtab base;
+    cortex *db;
+    char *schema;
+    char *name;
+
+    int dim;
+    vec_metric metric;
+    int lists;
+    int pq_m, dsub;
+    int nprobe;
+    int rescore;
+    int train_rows;
+    int threads;
+
+    /* quantizers, loaded lazily */
+    int loaded;
+    int trained;
+    cortex_int64 generation;
+    cortex_int64 n_rows;    /* only counted while untrained */
+    float *centroids;       /* lists * dim */
+    float *codebooks;       /* pq_m * IVF_CODEBOOK * dsub */
+    int txn_writes;
+
+    cortex_stmt *stmt_get_config;
+    cortex_stmt *stmt_set_config;
+    cortex_stmt *stmt_vec_get;
+    cortex_stmt *stmt_vec_put;
+    cortex_stmt *stmt_vec_list;
+    cortex_stmt *stmt_vec_del;
+    cortex_stmt *stmt_vec_max;
+    cortex_stmt *stmt_list_read;
+    cortex_stmt *stmt_list_last;
+    cortex_stmt *stmt_chunk_put;
+    cortex_stmt *stmt_chunk_del;
+} ivf_vtab;
+
+typedef struct ivf_cursor {
+    cortex_vtab_cursor base;
+    int plan;
+    cortex_stmt *scan;      /* full scans step %_vectors directly */
+    int scan_eof;
+    int pos, n;
+    cortex_int64 *ids;
+    float *dists;
+    cortex_int64 k;
+    int nprobe;
+} ivf_cursor;
+
+/* ─────────────────────────────────────────
+   Top-k
+   ───────────────────────────────────────── */
+
+static int topk_init(ivf_topk *t, int cap) {
+    t->n = 0;
+    t->cap = cap;
+    t->items = cortex_malloc64((cortex_uint64)(cap > 0 ? cap : 1) * sizeof(ivf_hit));
+    return t->items ? CORTEX_OK : CORTEX_NOMEM;
+}
+
+static void topk_push(ivf_topk *t, float dist, cortex_int64 id) {
+    ivf_hit *h = t->items;
+    int i;
+
+    if (t->n < t->cap) {
+        i = t->n++;
+        while (i > 0 && h[(i - 1) / 2].dist < dist) {
+            h[i] = h[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else if (t->cap > 0 && dist < h[0].dist) {
+        i = 0;
+        for (;;) {
+            int l = 2 * i + 1, r = l + 1, big = l;
+            if (l >= t->n) break;
+            if (r < t->n && h[r].dist > h[l].dist) big = r;
+            if (h[big].dist <= dist) break;
+            h[i] = h[big];
+            i = big;
+        }
+    } else {
+        return;
+    }
+    h[i].dist = dist;
+    h[i].id = id;
+}
+
+static int hit_cmp(const void *a, const void *b) {
+    float da = ((const ivf_hit *)a)->dist, db = ((const ivf_hit *)b)->dist;
+    return da < db ? -1 : da > db;
+}
+
+static int hit_id_cmp(const void *a, const void *b) {
+    cortex_int64 ia = ((const ivf_hit *)a)->id, ib = ((const ivf_hit *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+/* ─────────────────────────────────────────
+   Distances and codes
+   ───────────────────────────────────────── */
+
+/* What the quantizers see: unit vectors for cosine, the input otherwise */
+static void normalize(const ivf_vtab *v, float *x) {
+    float inv;
+    int d;
+
+    if (v->metric != VEC_METRIC_COSINE) return;
+    inv = vec_inv_norm_f32(x, v->dim);
+    for (d = 0; d < v->dim; d++) x[d] *= inv;
+}
+
+static float exact_dist(const ivf_vtab *v, const float *q, float q_inv, const float *x) {
+    switch (v->metric) {
+        case VEC_METRIC_COSINE:
+            return 1.0f - vec_dot_f32(q, x, v->dim) * q_inv * vec_inv_norm_f32(x, v->dim);
+        case VEC_METRIC_DOT:
+            return -vec_dot_f32(q, x, v->dim);
+        default:
+            return vec_l2sq_f32(q, x, v->dim);
+    }
+}
+
+/* Internal distances skip the square root; this is what users see. */
+static double reported_dist(const ivf_vtab *v, float d) {
+    return v->metric == VEC_METRIC_L2 ? sqrt(d > 0 ? d : 0) : d;
+}
+
+static const float *codebook_at(const ivf_vtab *v, int sub) {
+    return v->codebooks + (size_t)sub * IVF_CODEBOOK * v->dsub;
+}
+
+/* File a normalized vector under its list and encode its residual. */
+static int encode(const ivf_vtab *v, const float *x, unsigned char *code, float *resid) {
+    int list = vec_nearest(x, v->centroids, v->lists, v->dim, NULL);
+    const float *c = v->centroids + (size_t)list * v->dim;
+    int d, j;
+
+    for (d = 0; d < v->dim; d++) resid[d] = x[d] - c[d];
+    for (j = 0; j < v->pq_m; j++) {
+        code[j] = (unsigned char)vec_nearest(resid + j * v->dsub, codebook_at(v, j),
+                                             IVF_CODEBOOK, v->dsub, NULL);
+    }
+    return list;
+}
+
+/*
+    Lookup table for scoring one list's codes against a normalized
+    query: the distance to a row is *base plus table[j * 256 + code[j]]
+    summed over the subquantizers. l2 splits exactly across subspaces of
+    the residual q - centroid; cosine is half the l2 of unit vectors; dot
+    splits as q.centroid + q.residual.
+*/
+static void adc_table(const ivf_vtab *v, const float *q, int list, float *resid,
+                      float *table, float *base) {
+    const float *c = v->centroids + (size_t)list * v->dim;
+    float scale = v->metric == VEC_METRIC_COSINE ? 0.5f : 1.0f;
+    int d, j, b;
+
+    if (v->metric == VEC_METRIC_DOT) {
+        *base = -vec_dot_f32(q, c, v->dim);
+        for (j = 0; j < v->pq_m; j++) {
+            const float *cb = codebook_at(v, j);
+            for (b = 0; b < IVF_CODEBOOK; b++) {
+                table[j * IVF_CODEBOOK + b] = -vec_dot_f32(q + j * v->dsub, cb + b * v->dsub, v->dsub);
+            }
+        }
+        return;
+    }
+    *base = 0.0f;
+    for (d = 0; d < v->dim; d++) resid[d] = q[d] - c[d];
+    for (j = 0; j < v->pq_m; j++) {
+        const float *cb = codebook_at(v, j);
+        for (b = 0; b < IVF_CODEBOOK; b++) {
+            table[j * IVF_CODEBOOK + b] = scale * vec_l2sq_f32(resid + j * v->dsub, cb + b * v->dsub, v->dsub);
+        }
+    }
+}
+
+/* ─────────────────────────────────────────
+   Persistence
+   ───────────────────────────────────────── */
+
+static int prepare(ivf_vtab *v, cortex_stmt **stmt, const char *fmt) {
+    char *sql;
+    int rc;
+
+    if (*stmt) return CORTEX_OK;
+    sql = cortex_mprintf(fmt, v->schema, v->name);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v3(v->db, sql, -1, CORTEX_PREPARE_PERSISTENT, stmt, NULL);
+    cortex_free(sql);
+    return rc;
+}
+
+static int exec_sql(ivf_vtab *v, const char *fmt) {
+    char *sql = cortex_mprintf(fmt, v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+    cortex_free(sql);
+    return rc;
+}
+
+static int read_config(ivf_vtab *v, const char *key, cortex_int64 *value) {
+    int rc = prepare(v, &v->stmt_get_config,
+        "SELECT value FROM \"%w\".\"%w_config\" WHERE key = ?1");
+    if (rc != CORTEX_OK) return rc;
+    *value = 0;
+    cortex_bind_text(v->stmt_get_config, 1, key, -1, CORTEX_STATIC);
+    if (cortex_step(v->stmt_get_config) == CORTEX_ROW) {
+        *value = cortex_column_int64(v->stmt_get_config, 0);
+    }
+    return cortex_reset(v->stmt_get_config);
+}
+
+static int write_config(ivf_vtab *v, const char *key, cortex_int64 value) {
+    int rc = prepare(v, &v->stmt_set_config,
+        "UPDATE \"%w\".\"%w_config\" SET value = ?2 WHERE key = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_text(v->stmt_set_config, 1, key, -1, CORTEX_STATIC);
+    cortex_bind_int64(v->stmt_set_config, 2, value);
+    cortex_step(v->stmt_set_config);
+    return cortex_reset(v->stmt_set_config);
+}
+
+static void quantizers_free(ivf_vtab *v) {
+    cortex_free(v->centroids);
+    cortex_free(v->codebooks);
+    v->centroids = NULL;
+    v->codebooks = NULL;
+    v->trained = 0;
+    v->n_rows = 0;
+    v->loaded = 0;
+}
+
+/* Drop the cached quantizers if another connection committed since we loaded. */
+static int check_generation(ivf_vtab *v) {
+    cortex_int64 generation;
+    int rc;
+
+    if (!v->loaded) return CORTEX_OK;
+    if ((rc = read_config(v, "generation", &generation)) != CORTEX_OK) return rc;
+    if (generation != v->generation) quantizers_free(v);
+    return CORTEX_OK;
+}
+
+static int load_blob(cortex_stmt *stmt, int id, float **out, cortex_uint64 floats) {
+    int rc;
+
+    cortex_bind_int(stmt, 1, id);
+    rc = cortex_step(stmt);
+    if (rc == CORTEX_ROW && (cortex_uint64)cortex_column_bytes(stmt, 0) == floats * sizeof(float)) {
+        *out = cortex_malloc64(floats * sizeof(float));
+        if (*out == NULL) {
+            cortex_reset(stmt);
+            return CORTEX_NOMEM;
+        }
+        memcpy(*out, cortex_column_blob(stmt, 0), (size_t)floats * sizeof(float));
+        return cortex_reset(stmt);
+    }
+    cortex_reset(stmt);
+    return rc == CORTEX_ROW || rc == CORTEX_DONE ? CORTEX_CORRUPT_VTAB : rc;
+}
+
+static int quantizers_load(ivf_vtab *v) {
+    cortex_stmt *stmt = NULL;
+    cortex_int64 trained;
+    char *sql;
+    int rc;
+
+    if (v->loaded) return CORTEX_OK;
+    quantizers_free(v);
+    if ((rc = read_config(v, "generation", &v->generation)) != CORTEX_OK) return rc;
+    if ((rc = read_config(v, "trained", &trained)) != CORTEX_OK) return rc;
+
+    if (trained) {
+        sql = cortex_mprintf("SELECT data FROM \"%w\".\"%w_codebooks\" WHERE id = ?1", v->schema, v->name);
+    } else {
+        sql = cortex_mprintf("SELECT count(*) FROM \"%w\".\"%w_vectors\"", v->schema, v->name);
+    }
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc != CORTEX_OK) return rc;
+
+    if (trained) {
+        rc = load_blob(stmt, 0, &v->centroids, (cortex_uint64)v->lists * v->dim);
+        if (rc == CORTEX_OK) {
+            rc = load_blob(stmt, 1, &v->codebooks, (cortex_uint64)IVF_CODEBOOK * v->dim);
+        }
+    } else {
+        if (cortex_step(stmt) == CORTEX_ROW) v->n_rows = cortex_column_int64(stmt, 0);
+        rc = cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_OK) {
+        quantizers_free(v);
+        return rc;
+    }
+    v->trained = trained != 0;
+    v->loaded = 1;
+    return CORTEX_OK;
+}
+
+/* Position stmt_vec_get on a row's vector; the caller resets it. */
+static int seek_vector(ivf_vtab *v, cortex_int64 id) {
+    int rc = prepare(v, &v->stmt_vec_get,
+        "SELECT vector FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_get, 1, id);
+    rc = cortex_step(v->stmt_vec_get);
+    if (rc == CORTEX_ROW) {
+        if (cortex_column_bytes(v->stmt_vec_get, 0) == v->dim * (int)sizeof(float)) return CORTEX_OK;
+        rc = CORTEX_CORRUPT_VTAB;
+    } else if (rc == CORTEX_DONE) {
+        rc = CORTEX_CORRUPT_VTAB;
+    }
+    cortex_reset(v->stmt_vec_get);
+    return rc;
+}
+
+static int chunk_write(ivf_vtab *v, cortex_int64 chunk, const cortex_int64 *ids,
+                       const unsigned char *codes, int n) {
+    cortex_stmt *stmt;
+    int rc;
+
+    if (n == 0) {
+        rc = prepare(v, &v->stmt_chunk_del, "DELETE FROM \"%w\".\"%w_lists\" WHERE id = ?1");
+        stmt = v->stmt_chunk_del;
+    } else {
+        rc = prepare(v, &v->stmt_chunk_put,
+            "INSERT OR REPLACE INTO \"%w\".\"%w_lists\"(id, ids, codes) VALUES (?1, ?2, ?3)");
+        stmt = v->stmt_chunk_put;
+    }
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(stmt, 1, chunk);
+    if (n > 0) {
+        cortex_bind_blob(stmt, 2, ids, n * (int)sizeof(cortex_int64), CORTEX_STATIC);
+        cortex_bind_blob(stmt, 3, codes, n * v->pq_m, CORTEX_STATIC);
+    }
+    cortex_step(stmt);
+    return cortex_reset(stmt);
+}
+
+/* Copy the chunk stmt is on into ids/codes; returns its entry count or -1 */
+static int chunk_read(const ivf_vtab *v, cortex_stmt *stmt, int col, cortex_int64 *ids,
+                      unsigned char *codes) {
+    int id_bytes = cortex_column_bytes(stmt, col);
+    int n = id_bytes / (int)sizeof(cortex_int64);
+
+    if (id_bytes % (int)sizeof(cortex_int64) != 0 || n > IVF_CHUNK
+        || cortex_column_bytes(stmt, col + 1) != n * v->pq_m) {
+        return -1;
+    }
+    if (n > 0) {
+        memcpy(ids, cortex_column_blob(stmt, col), (size_t)id_bytes);
+        memcpy(codes, cortex_column_blob(stmt, col + 1), (size_t)n * v->pq_m);
+    }
+    return n;
+}
+
+/* Append entries to the tail of a list, topping up its last chunk first. */
+static int list_append(ivf_vtab *v, int list, const cortex_int64 *ids, const unsigned char *codes, int n) {
+    cortex_int64 lo = (cortex_int64)list << IVF_CHUNK_BITS;
+    cortex_int64 hi = lo | ((1 << IVF_CHUNK_BITS) - 1);
+    cortex_int64 chunk = lo;
+    cortex_int64 chunk_ids[IVF_CHUNK];
+    unsigned char *chunk_codes;
+    int fill = 0, rc;
+
+    rc = prepare(v, &v->stmt_list_last,
+        "SELECT id, ids, codes FROM \"%w\".\"%w_lists\" WHERE id BETWEEN ?1 AND ?2"
+        " ORDER BY id DESC LIMIT 1");
+    if (rc != CORTEX_OK) return rc;
+    chunk_codes = cortex_malloc64((cortex_uint64)IVF_CHUNK * v->pq_m);
+    if (chunk_codes == NULL) return CORTEX_NOMEM;
+
+    cortex_bind_int64(v->stmt_list_last, 1, lo);
+    cortex_bind_int64(v->stmt_list_last, 2, hi);
+    if (cortex_step(v->stmt_list_last) == CORTEX_ROW) {
+        chunk = cortex_column_int64(v->stmt_list_last, 0);
+        fill = chunk_read(v, v->stmt_list_last, 1, chunk_ids, chunk_codes);
+        if (fill == IVF_CHUNK) {
+            chunk++;
+            fill = 0;
+        }
+    }
+    if (fill < 0) {
+        cortex_reset(v->stmt_list_last);
+        rc = CORTEX_CORRUPT_VTAB;
+    } else {
+        rc = cortex_reset(v->stmt_list_last);
+    }
+
+    while (rc == CORTEX_OK && n > 0) {
+        int take = IVF_CHUNK - fill < n ? IVF_CHUNK - fill : n;
+
+        if (chunk > hi) {
+            rc = CORTEX_FULL;
+            break;
+        }
+        memcpy(chunk_ids + fill, ids, (size_t)take * sizeof(cortex_int64));
+        memcpy(chunk_codes + (size_t)fill * v->pq_m, codes, (size_t)take * v->pq_m);
+        fill += take;
+        ids += take;
+        codes += (size_t)take * v->pq_m;
+        n -= take;
+        rc = chunk_write(v, chunk, chunk_ids, chunk_codes, fill);
+        chunk++;
+        fill = 0;
+    }
+    cortex_free(chunk_codes);
+    return rc;
+}
+
+/* Remove one entry from a list by moving its chunk's last entry into its place. */
+static int list_remove(ivf_vtab *v, int list, cortex_int64 id) {
+    cortex_int64 lo = (cortex_int64)list << IVF_CHUNK_BITS;
+    cortex_int64 chunk_ids[IVF_CHUNK];
+    unsigned char *chunk_codes;
+    cortex_int64 chunk = -1;
+    int fill = 0, pos = -1, rc;
+
+    rc = prepare(v, &v->stmt_list_read,
+        "SELECT id, ids, codes FROM \"%w\".\"%w_lists\" WHERE id BETWEEN ?1 AND ?2");
+    if (rc != CORTEX_OK) return rc;
+    chunk_codes = cortex_malloc64((cortex_uint64)IVF_CHUNK * v->pq_m);
+    if (chunk_codes == NULL) return CORTEX_NOMEM;
+
+    cortex_bind_int64(v->stmt_list_read, 1, lo);
+    cortex_bind_int64(v->stmt_list_read, 2, lo | ((1 << IVF_CHUNK_BITS) - 1));
+    while (pos < 0 && (rc = cortex_step(v->stmt_list_read)) == CORTEX_ROW) {
+        int i;
+        fill = chunk_read(v, v->stmt_list_read, 1, chunk_ids, chunk_codes);
+        if (fill < 0) break;
+        for (i = 0; i < fill; i++) {
+            if (chunk_ids[i] == id) {
+                chunk = cortex_column_int64(v->stmt_list_read, 0);
+                pos = i;
+                break;
+            }
+        }
+    }
+    if (fill < 0) {
+        cortex_reset(v->stmt_list_read);
+        rc = CORTEX_CORRUPT_VTAB;
+    } else {
+        rc = cortex_reset(v->stmt_list_read);
+    }
+    if (rc == CORTEX_OK && pos >= 0) {
+        fill--;
+        chunk_ids[pos] = chunk_ids[fill];
+        memmove(chunk_codes + (size_t)pos * v->pq_m, chunk_codes + (size_t)fill * v->pq_m, (size_t)v->pq_m);
+        rc = chunk_write(v, chunk, chunk_ids, chunk_codes, fill);
+    }
+    cortex_free(chunk_codes);
+    return rc;
+}
+
+static int store_vector(ivf_vtab *v, cortex_int64 id, int list, const float *vec) {
+    int rc = prepare(v, &v->stmt_vec_put,
+        "INSERT INTO \"%w\".\"%w_vectors\"(id, list, vector) VALUES (?1, ?2, ?3)");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_put, 1, id);
+    if (list < 0) {
+        cortex_bind_null(v->stmt_vec_put, 2);
+    } else {
+        cortex_bind_int(v->stmt_vec_put, 2, list);
+    }
+    cortex_bind_blob(v->stmt_vec_put, 3, vec, v->dim * (int)sizeof(float), CORTEX_STATIC);
+    cortex_step(v->stmt_vec_put);
+    return cortex_reset(v->stmt_vec_put);
+}
+
+/* ─────────────────────────────────────────
+   Training
+   ───────────────────────────────────────── */
+
+typedef struct train_job {
+    const ivf_vtab *v;
+    float *points;          /* n * dim; turned into residuals in place */
+    int n;
+    int n_tasks;
+    int rc;
+} train_job;
+
+static void residual_task(void *arg, int task) {
+    train_job *job = arg;
+    const ivf_vtab *v = job->v;
+    int lo = (int)((long long)job->n * task / job->n_tasks);
+    int hi = (int)((long long)job->n * (task + 1) / job->n_tasks);
+    int i, d;
+
+    for (i = lo; i < hi; i++) {
+        float *x = job->points + (size_t)i * v->dim;
+        const float *c = v->centroids + (size_t)vec_nearest(x, v->centroids, v->lists, v->dim, NULL) * v->dim;
+        for (d = 0; d < v->dim; d++) x[d] -= c[d];
+    }
+}
+
+/* One task per subquantizer: k-means on that slice of the residuals */
+static void codebook_task(void *arg, int sub) {
+    train_job *job = arg;
+    const ivf_vtab *v = job->v;
+    float *slice = cortex_malloc64((cortex_uint64)job->n * v->dsub * sizeof(float));
+    int i, rc;
+
+    if (slice == NULL) {
+        job->rc = CORTEX_NOMEM;
+        return;
+    }
+    for (i = 0; i < job->n; i++) {
+        memcpy(slice + (size_t)i * v->dsub, job->points + (size_t)i * v->dim + sub * v->dsub,
+               (size_t)v->dsub * sizeof(float));
+    }
+    rc = vec_kmeans(slice, job->n, v->dsub, IVF_CODEBOOK, IVF_PQ_ITERS, 1, IVF_SEED + (uint64_t)sub,
+                    (float *)codebook_at(v, sub));
+    if (rc != CORTEX_OK) job->rc = rc;
+    cortex_free(slice);
+}
+
+typedef struct encode_job {
+    const ivf_vtab *v;
+    const float *vectors;   /* n * dim, normalized */
+    int n;
+    int n_tasks;
+    int *lists;
+    unsigned char *codes;
+    float *scratch;         /* n_tasks * dim */
+} encode_job;
+
+static void encode_task(void *arg, int task) {
+    encode_job *job = arg;
+    const ivf_vtab *v = job->v;
+    int lo = (int)((long long)job->n * task / job->n_tasks);
+    int hi = (int)((long long)job->n * (task + 1) / job->n_tasks);
+    float *resid = job->scratch + (size_t)task * v->dim;
+    int i;
+
+    for (i = lo; i < hi; i++) {
+        job->lists[i] = encode(v, job->vectors + (size_t)i * v->dim, job->codes + (size_t)i * v->pq_m, resid);
+    }
+}
+
+/* Reservoir sample of up to train_rows normalized vectors */
+static int train_sample(ivf_vtab *v, float **out, int *n_out) {
+    cortex_stmt *stmt = NULL;
+    cortex_uint64 rng = IVF_SEED;
+    cortex_int64 seen = 0;
+    float *sample;
+    char *sql;
+    int rc;
+
+    *out = NULL;
+    *n_out = 0;
+    sample = cortex_malloc64((cortex_uint64)v->train_rows * v->dim * sizeof(float));
+    if (sample == NULL) return CORTEX_NOMEM;
+    sql = cortex_mprintf("SELECT vector FROM \"%w\".\"%w_vectors\"", v->schema, v->name);
+    if (sql == NULL) {
+        cortex_free(sample);
+        return CORTEX_NOMEM;
+    }
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    while (rc == CORTEX_OK && (rc = cortex_step(stmt)) == CORTEX_ROW) {
+        cortex_int64 slot = seen++;
+        rc = CORTEX_OK;
+        if (cortex_column_bytes(stmt, 0) != v->dim * (int)sizeof(float)) {
+            rc = CORTEX_CORRUPT_VTAB;
+            break;
+        }
+        if (slot >= v->train_rows) {
+            rng ^= rng >> 12;
+            rng ^= rng << 25;
+            rng ^= rng >> 27;
+            slot = (cortex_int64)((rng * 2685821657736338717ULL) % (cortex_uint64)seen);
+            if (slot >= v->train_rows) continue;
+        }
+        memcpy(sample + (size_t)slot * v->dim, cortex_column_blob(stmt, 0), (size_t)v->dim * sizeof(float));
+        normalize(v, sample + (size_t)slot * v->dim);
+    }
+    cortex_finalize(stmt);
+    if (rc != CORTEX_DONE) {
+        cortex_free(sample);
+        return rc;
+    }
+    *out = sample;
+    *n_out = seen < v->train_rows ? (int)seen : v->train_rows;
+    return CORTEX_OK;
+}
+
+static int list_of_cmp(const void *a, const void *b) {
+    const int *x = a, *y = b;
+    return x[0] != y[0] ? (x[0] > y[0]) - (x[0] < y[0]) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+/*
+    File every row under the current quantizers. Rows are read in rowid
+    batches so the vectors never need to fit in memory at once; each
+    batch is encoded in parallel, then written list by list.
+*/
+static int file_rows(ivf_vtab *v) {
+    encode_job job;
+    cortex_stmt *read = NULL, *assign = NULL;
+    cortex_int64 *ids = NULL, *run_ids = NULL, from = LLONG_MIN;
+    unsigned char *run_codes = NULL;
+    float *vectors = NULL;
+    int *order = NULL;
+    int rc, tasks = v->threads;
+    char *sql;
+
+    if ((rc = exec_sql(v, "DELETE FROM \"%w\".\"%w_lists\"")) != CORTEX_OK) return rc;
+    sql = cortex_mprintf("SELECT id, vector FROM \"%w\".\"%w_vectors\" WHERE id >= ?1 ORDER BY id LIMIT %d",
+                         v->schema, v->name, IVF_BATCH);
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &read, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) {
+        sql = cortex_mprintf("UPDATE \"%w\".\"%w_vectors\" SET list = ?2 WHERE id = ?1", v->schema, v->name);
+        if (sql == NULL) rc = CORTEX_NOMEM;
+        else rc = cortex_prepare_v2(v->db, sql, -1, &assign, NULL);
+        cortex_free(sql);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.v = v;
+    job.n_tasks = tasks;
+    ids = cortex_malloc64((cortex_uint64)IVF_BATCH * sizeof(cortex_int64));
+    vectors = cortex_malloc64((cortex_uint64)IVF_BATCH * v->dim * sizeof(float));
+    order = cortex_malloc64((cortex_uint64)IVF_BATCH * 2 * sizeof(int));
+    job.lists = cortex_malloc64((cortex_uint64)IVF_BATCH * sizeof(int));
+    job.codes = cortex_malloc64((cortex_uint64)IVF_BATCH * v->pq_m);
+    job.scratch = cortex_malloc64((cortex_uint64)tasks * v->dim * sizeof(float));
+    run_ids = cortex_malloc64((cortex_uint64)IVF_BATCH * sizeof(cortex_int64));
+    run_codes = cortex_malloc64((cortex_uint64)IVF_BATCH * v->pq_m);
+    if (rc == CORTEX_OK && (!ids || !vectors || !order || !job.lists || !job.codes || !job.scratch
+                            || !run_ids || !run_codes)) {
+        rc = CORTEX_NOMEM;
+    }
+    job.vectors = vectors;
+
+    while (rc == CORTEX_OK) {
+        int n = 0, i;
+
+        cortex_bind_int64(read, 1, from);
+        while ((rc = cortex_step(read)) == CORTEX_ROW) {
+            if (cortex_column_bytes(read, 1) != v->dim * (int)sizeof(float)) {
+                rc = CORTEX_CORRUPT_VTAB;
+                break;
+            }
+            ids[n] = cortex_column_int64(read, 0);
+            memcpy(vectors + (size_t)n * v->dim, cortex_column_blob(read, 1), (size_t)v->dim * sizeof(float));
+            normalize(v, vectors + (size_t)n * v->dim);
+            n++;
+        }
+        if (rc != CORTEX_DONE) {
+            cortex_reset(read);
+            break;
+        }
+        if ((rc = cortex_reset(read)) != CORTEX_OK || n == 0) break;
+
+        job.n = n;
+        vec_parallel_for(tasks, tasks, encode_task, &job);
+
+        for (i = 0; i < n && rc == CORTEX_OK; i++) {
+            cortex_bind_int64(assign, 1, ids[i]);
+            cortex_bind_int(assign, 2, job.lists[i]);
+            cortex_step(assign);
+            rc = cortex_reset(assign);
+            order[2 * i] = job.lists[i];
+            order[2 * i + 1] = i;
+        }
+        qsort(order, n, 2 * sizeof(int), list_of_cmp);
+
+        for (i = 0; i < n && rc == CORTEX_OK;) {
+            int list = order[2 * i], m = 0;
+            for (; i < n && order[2 * i] == list; i++, m++) {
+                run_ids[m] = ids[order[2 * i + 1]];
+                memcpy(run_codes + (size_t)m * v->pq_m, job.codes + (size_t)order[2 * i + 1] * v->pq_m,
+                       (size_t)v->pq_m);
+            }
+            rc = list_append(v, list, run_ids, run_codes, m);
+        }
+        if (n < IVF_BATCH || ids[n - 1] == LLONG_MAX) break;
+        from = ids[n - 1] + 1;
+    }
+    cortex_finalize(read);
+    cortex_finalize(assign);
+    cortex_free(ids);
+    cortex_free(vectors);
+    cortex_free(order);
+    cortex_free(job.lists);
+    cortex_free(job.codes);
+    cortex_free(job.scratch);
+    cortex_free(run_ids);
+    cortex_free(run_codes);
+    return rc;
+}
+
+static int save_quantizers(ivf_vtab *v) {
+    cortex_stmt *stmt = NULL;
+    char *sql = cortex_mprintf("INSERT OR REPLACE INTO \"%w\".\"%w_codebooks\"(id, data) VALUES (?1, ?2)",
+                               v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) {
+        cortex_bind_int(stmt, 1, 0);
+        cortex_bind_blob(stmt, 2, v->centroids, v->lists * v->dim * (int)sizeof(float), CORTEX_STATIC);
+        cortex_step(stmt);
+        rc = cortex_reset(stmt);
+    }
+    if (rc == CORTEX_OK) {
+        cortex_bind_int(stmt, 1, 1);
+        cortex_bind_blob(stmt, 2, v->codebooks, IVF_CODEBOOK * v->dim * (int)sizeof(float), CORTEX_STATIC);
+        cortex_step(stmt);
+        rc = cortex_reset(stmt);
+    }
+    cortex_finalize(stmt);
+    if (rc == CORTEX_OK) rc = write_config(v, "trained", 1);
+    return rc;
+}
+
+/*
+    Train the coarse centroids on a sample, then the PQ codebooks on the
+    sample's residuals, then file every row. Nothing is kept in memory on
+    failure; the statement's rollback undoes any shadow table writes.
+*/
+static int ivf_train(ivf_vtab *v) {
+    train_job job;
+    float *sample = NULL;
+    int n, rc;
+
+    if ((rc = train_sample(v, &sample, &n)) != CORTEX_OK) return rc;
+    if (n == 0) {
+        cortex_free(sample);
+        v->base.zErrMsg = cortex_mprintf("vec_ivf: the table is empty, there is nothing to train on");
+        return CORTEX_ERROR;
+    }
+    cortex_free(v->centroids);
+    cortex_free(v->codebooks);
+    v->centroids = cortex_malloc64((cortex_uint64)v->lists * v->dim * sizeof(float));
+    v->codebooks = cortex_malloc64((cortex_uint64)IVF_CODEBOOK * v->dim * sizeof(float));
+    rc = v->centroids && v->codebooks ? CORTEX_OK : CORTEX_NOMEM;
+
+    if (rc == CORTEX_OK) {
+        rc = vec_kmeans(sample, n, v->dim, v->lists, IVF_COARSE_ITERS, v->threads, IVF_SEED, v->centroids);
+    }
+    if (rc == CORTEX_OK) {
+        job.v = v;
+        job.points = sample;
+        job.n = n;
+        job.n_tasks = v->threads;
+        job.rc = CORTEX_OK;
+        vec_parallel_for(job.n_tasks, v->threads, residual_task, &job);
+        vec_parallel_for(v->pq_m, v->threads, codebook_task, &job);
+        rc = job.rc;
+    }
+    cortex_free(sample);
+    if (rc == CORTEX_OK) rc = save_quantizers(v);
+    if (rc == CORTEX_OK) rc = file_rows(v);
+    if (rc != CORTEX_OK) {
+        quantizers_free(v);
+        return rc;
+    }
+    v->trained = 1;
+    v->n_rows = 0;
+    return CORTEX_OK;
+}
+
+/* ─────────────────────────────────────────
+   Search
+   ───────────────────────────────────────── */
+
+/* Before training: exact distances over every stored vector */
+static int scan_exact(ivf_vtab *v, const float *q, ivf_topk *top) {
+    float q_inv = vec_inv_norm_f32(q, v->dim);
+    cortex_stmt *stmt = NULL;
+    char *sql = cortex_mprintf("SELECT id, vector FROM \"%w\".\"%w_vectors\"", v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_prepare_v2(v->db, sql, -1, &stmt, NULL);
+    cortex_free(sql);
+    while (rc == CORTEX_OK && (rc = cortex_step(stmt)) == CORTEX_ROW) {
+        rc = CORTEX_OK;
+        if (cortex_column_bytes(stmt, 1) != v->dim * (int)sizeof(float)) {
+            rc = CORTEX_CORRUPT_VTAB;
+            break;
+        }
+        topk_push(top, exact_dist(v, q, q_inv, cortex_column_blob(stmt, 1)), cortex_column_int64(stmt, 0));
+    }
+    cortex_finalize(stmt);
+    return rc == CORTEX_DONE ? CORTEX_OK : rc;
+}
+
+static int scan_list(ivf_vtab *v, int list, const float *table, float base, ivf_topk *top) {
+    cortex_int64 lo = (cortex_int64)list << IVF_CHUNK_BITS;
+    int rc;
+
+    rc = prepare(v, &v->stmt_list_read,
+        "SELECT id, ids, codes FROM \"%w\".\"%w_lists\" WHERE id BETWEEN ?1 AND ?2");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_list_read, 1, lo);
+    cortex_bind_int64(v->stmt_list_read, 2, lo | ((1 << IVF_CHUNK_BITS) - 1));
+    while ((rc = cortex_step(v->stmt_list_read)) == CORTEX_ROW) {
+        const unsigned char *ids = cortex_column_blob(v->stmt_list_read, 1);
+        const unsigned char *codes = cortex_column_blob(v->stmt_list_read, 2);
+        int n = cortex_column_bytes(v->stmt_list_read, 1) / (int)sizeof(cortex_int64), e, j;
+
+        if (cortex_column_bytes(v->stmt_list_read, 2) != n * v->pq_m) {
+            cortex_reset(v->stmt_list_read);
+            return CORTEX_CORRUPT_VTAB;
+        }
+        for (e = 0; e < n; e++) {
+            const unsigned char *code = codes + (size_t)e * v->pq_m;
+            float d = base;
+            cortex_int64 id;
+            for (j = 0; j < v->pq_m; j++) d += table[j * IVF_CODEBOOK + code[j]];
+            if (top->n == top->cap && d >= top->items[0].dist) continue;
+            memcpy(&id, ids + (size_t)e * sizeof(cortex_int64), sizeof(id));
+            topk_push(top, d, id);
+        }
+    }
+    cortex_reset(v->stmt_list_read);
+    return rc == CORTEX_DONE ? CORTEX_OK : rc;
+}
+
+/* Rank the centroids, then score the codes of the nprobe closest lists */
+static int search_lists(ivf_vtab *v, const float *query, int nprobe, ivf_topk *top) {
+    ivf_topk probe;
+    float *q, *resid, *table;
+    int rc, i;
+
+    if (nprobe > v->lists) nprobe = v->lists;
+    if ((rc = topk_init(&probe, nprobe)) != CORTEX_OK) return rc;
+    q = cortex_malloc64((cortex_uint64)v->dim * 2 * sizeof(float));
+    table = cortex_malloc64((cortex_uint64)v->pq_m * IVF_CODEBOOK * sizeof(float));
+    if (q == NULL || table == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    resid = q + v->dim;
+    memcpy(q, query, (size_t)v->dim * sizeof(float));
+    normalize(v, q);
+
+    for (i = 0; i < v->lists; i++) {
+        topk_push(&probe, vec_l2sq_f32(q, v->centroids + (size_t)i * v->dim, v->dim), i);
+    }
+    for (i = 0; i < probe.n && rc == CORTEX_OK; i++) {
+        float base;
+        adc_table(v, q, (int)probe.items[i].id, resid, table, &base);
+        rc = scan_list(v, (int)probe.items[i].id, table, base, top);
+    }
+done:
+    cortex_free(probe.items);
+    cortex_free(q);
+    cortex_free(table);
+    return rc;
+}
+
+/* Re-rank PQ candidates by exact distance, reading vectors in rowid order */
+static int rescore(ivf_vtab *v, const float *q, ivf_topk *top, int k) {
+    float q_inv = vec_inv_norm_f32(q, v->dim);
+    int rc = CORTEX_OK, i;
+
+    qsort(top->items, top->n, sizeof(ivf_hit), hit_id_cmp);
+    for (i = 0; i < top->n && rc == CORTEX_OK; i++) {
+        if ((rc = seek_vector(v, top->items[i].id)) == CORTEX_OK) {
+            top->items[i].dist = exact_dist(v, q, q_inv, cortex_column_blob(v->stmt_vec_get, 0));
+            rc = cortex_reset(v->stmt_vec_get);
+        }
+    }
+    qsort(top->items, top->n, sizeof(ivf_hit), hit_cmp);
+    if (top->n > k) top->n = k;
+    return rc;
+}
+
+static int ivf_knn(ivf_vtab *v, const float *q, int k, int nprobe, ivf_cursor *cur) {
+    int rescoring = v->trained && v->rescore > 0;
+    ivf_topk top;
+    int rc, i;
+
+    if ((rc = topk_init(&top, rescoring ? k * v->rescore : k)) != CORTEX_OK) return rc;
+    if (!v->trained) {
+        rc = scan_exact(v, q, &top);
+    } else {
+        rc = search_lists(v, q, nprobe, &top);
+        if (rc == CORTEX_OK && rescoring) rc = rescore(v, q, &top, k);
+    }
+    if (rc == CORTEX_OK && !rescoring) qsort(top.items, top.n, sizeof(ivf_hit), hit_cmp);
+    if (rc == CORTEX_OK && top.n > 0) {
+        cur->ids = cortex_malloc64((cortex_uint64)top.n * sizeof(cortex_int64));
+        cur->dists = cortex_malloc64((cortex_uint64)top.n * sizeof(float));
+        if (cur->ids == NULL || cur->dists == NULL) {
+            rc = CORTEX_NOMEM;
+        } else {
+            for (i = 0; i < top.n; i++) {
+                cur->ids[i] = top.items[i].id;
+                cur->dists[i] = top.items[i].dist;
+            }
+            cur->n = top.n;
+        }
+    }
+    cortex_free(top.items);
+    return rc;
+}
+
+/* ─────────────────────────────────────────
+   Writes
+   ───────────────────────────────────────── */
+
+static int ivf_insert(ivf_vtab *v, cortex_int64 rowid, const float *vec) {
+    unsigned char *code;
+    float *x;
+    int list, rc;
+
+    if (!v->trained) {
+        if ((rc = store_vector(v, rowid, -1, vec)) != CORTEX_OK) return rc;
+        if (++v->n_rows >= v->train_rows) return ivf_train(v);
+        return CORTEX_OK;
+    }
+    x = cortex_malloc64((cortex_uint64)v->dim * 2 * sizeof(float) + v->pq_m);
+    if (x == NULL) return CORTEX_NOMEM;
+    code = (unsigned char *)(x + 2 * v->dim);
+    memcpy(x, vec, (size_t)v->dim * sizeof(float));
+    normalize(v, x);
+    list = encode(v, x, code, x + v->dim);
+    rc = store_vector(v, rowid, list, vec);
+    if (rc == CORTEX_OK) rc = list_append(v, list, &rowid, code, 1);
+    cortex_free(x);
+    return rc;
+}
+
+static int ivf_delete(ivf_vtab *v, cortex_int64 rowid) {
+    int rc = prepare(v, &v->stmt_vec_list,
+        "SELECT list FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    int found = 0, list = -1;
+
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_list, 1, rowid);
+    if (cortex_step(v->stmt_vec_list) == CORTEX_ROW) {
+        found = 1;
+        if (cortex_column_type(v->stmt_vec_list, 0) != CORTEX_NULL) {
+            list = cortex_column_int(v->stmt_vec_list, 0);
+        }
+    }
+    if ((rc = cortex_reset(v->stmt_vec_list)) != CORTEX_OK || !found) return rc;
+    if (list >= 0 && (rc = list_remove(v, list, rowid)) != CORTEX_OK) return rc;
+
+    rc = prepare(v, &v->stmt_vec_del, "DELETE FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_del, 1, rowid);
+    cortex_step(v->stmt_vec_del);
+    rc = cortex_reset(v->stmt_vec_del);
+    if (rc == CORTEX_OK && !v->trained) v->n_rows--;
+    return rc;
+}
+
+static int row_exists(ivf_vtab *v, cortex_int64 rowid, int *exists) {
+    int rc = prepare(v, &v->stmt_vec_list,
+        "SELECT list FROM \"%w\".\"%w_vectors\" WHERE id = ?1");
+    if (rc != CORTEX_OK) return rc;
+    cortex_bind_int64(v->stmt_vec_list, 1, rowid);
+    *exists = cortex_step(v->stmt_vec_list) == CORTEX_ROW;
+    return cortex_reset(v->stmt_vec_list);
+}
+
+static int next_rowid(ivf_vtab *v, cortex_int64 *rowid) {
+    int rc = prepare(v, &v->stmt_vec_max,
+        "SELECT coalesce(max(id), 0) + 1 FROM \"%w\".\"%w_vectors\"");
+    if (rc != CORTEX_OK) return rc;
+    *rowid = 1;
+    if (cortex_step(v->stmt_vec_max) == CORTEX_ROW) *rowid = cortex_column_int64(v->stmt_vec_max, 0);
+    return cortex_reset(v->stmt_vec_max);
+}
+
+/* ─────────────────────────────────────────
+   Virtual table methods
+   ───────────────────────────────────────── */
+
+static int parse_options(ivf_vtab *v, int argc, const char *const *argv, char **pzErr) {
+    int i;
+
+    v->dim = 0;
+    v->metric = VEC_METRIC_L2;
+    v->lists = 256;
+    v->pq_m = 0;
+    v->nprobe = 8;
+    v->rescore = 10;
+    v->train_rows = 0;
+    v->threads = 0;
+
+    for (i = 3; i < argc; i++) {
+        char key[32], value[64];
+        int bad = 0;
+
+        if (vec_split_option("vec_ivf", argv[i], key, sizeof(key), value, sizeof(value), pzErr)) {
+            return CORTEX_ERROR;
+        }
+        if (strcmp(key, "dim") == 0) {
+            bad = vec_parse_int(value, 1, VEC_MAX_DIM, &v->dim);
+        } else if (strcmp(key, "metric") == 0) {
+            bad = vec_parse_metric(value, &v->metric);
+        } else if (strcmp(key, "lists") == 0) {
+            bad = vec_parse_int(value, 1, 65536, &v->lists);
+        } else if (strcmp(key, "pq_m") == 0) {
+            bad = vec_parse_int(value, 1, VEC_MAX_DIM, &v->pq_m);
+        } else if (strcmp(key, "nprobe") == 0) {
+            bad = vec_parse_int(value, 1, 65536, &v->nprobe);
+        } else if (strcmp(key, "rescore") == 0) {
+            bad = vec_parse_int(value, 0, 100, &v->rescore);
+        } else if (strcmp(key, "train_rows") == 0) {
+            bad = vec_parse_int(value, 1, 10000000, &v->train_rows);
+        } else if (strcmp(key, "threads") == 0) {
+            bad = vec_parse_int(value, 1, 64, &v->threads);
+        } else {
+            *pzErr = cortex_mprintf("vec_ivf: unknown option \"%s\"", key);
+            return CORTEX_ERROR;
+        }
+        if (bad) {
+            *pzErr = cortex_mprintf("vec_ivf: invalid value for %s: \"%s\"", key, value);
+            return CORTEX_ERROR;
+        }
+    }
+    if (v->dim == 0) {
+        *pzErr = cortex_mprintf("vec_ivf: the dim option is required");
+        return CORTEX_ERROR;
+    }
+    if (v->pq_m == 0) {
+        for (v->dsub = 8; v->dim % v->dsub != 0; v->dsub /= 2) {}
+        v->pq_m = v->dim / v->dsub;
+    } else if (v->dim % v->pq_m != 0) {
+        *pzErr = cortex_mprintf("vec_ivf: pq_m (%d) must divide dim (%d)", v->pq_m, v->dim);
+        return CORTEX_ERROR;
+    }
+    v->dsub = v->dim / v->pq_m;
+    if (v->train_rows == 0) v->train_rows = 40 * (v->lists > IVF_CODEBOOK ? v->lists : IVF_CODEBOOK);
+    if (v->threads == 0) v->threads = vec_default_threads();
+    return CORTEX_OK;
+}
+
+static int ivf_init(cortex *db, int argc, const char *const *argv,
+                    cortex_vtab **ppVtab, char **pzErr, int create) {
+    ivf_vtab *v;
+    int rc;
+
+    v = cortex_malloc(sizeof(ivf_vtab));
+    if (v == NULL) return CORTEX_NOMEM;
+    memset(v, 0, sizeof(ivf_vtab));
+    v->db = db;
+
+    rc = parse_options(v, argc, argv, pzErr);
+    if (rc == CORTEX_OK) {
+        v->schema = cortex_mprintf("%s", argv[1]);
+        v->name = cortex_mprintf("%s", argv[2]);
+        if (v->schema == NULL || v->name == NULL) rc = CORTEX_NOMEM;
+    }
+    if (rc == CORTEX_OK && create) {
+        char *sql = cortex_mprintf(
+            "CREATE TABLE \"%w\".\"%w_config\"(key TEXT PRIMARY KEY, value) WITHOUT ROWID;"
+            "INSERT INTO \"%w\".\"%w_config\" VALUES"
+            " ('format', %d), ('dim', %d), ('metric', '%s'), ('lists', %d), ('pq_m', %d),"
+            " ('trained', 0), ('generation', 0);"
+            "CREATE TABLE \"%w\".\"%w_codebooks\"(id INTEGER PRIMARY KEY, data BLOB NOT NULL);"
+            "CREATE TABLE \"%w\".\"%w_lists\"(id INTEGER PRIMARY KEY, ids BLOB NOT NULL, codes BLOB NOT NULL);"
+            "CREATE TABLE \"%w\".\"%w_vectors\"(id INTEGER PRIMARY KEY, list INTEGER, vector BLOB NOT NULL);",
+            argv[1], argv[2], argv[1], argv[2], IVF_FORMAT, v->dim, vec_metric_name(v->metric),
+            v->lists, v->pq_m, argv[1], argv[2], argv[1], argv[2], argv[1], argv[2]);
+        if (sql == NULL) {
+            rc = CORTEX_NOMEM;
+        } else {
+            rc = cortex_exec(db, sql, NULL, NULL, pzErr);
+            cortex_free(sql);
+        }
+    }
+    if (rc == CORTEX_OK) {
+        rc = cortex_declare_vtab(db,
+            "CREATE TABLE x(embedding BLOB, distance REAL HIDDEN, k INTEGER HIDDEN,"
+            " nprobe INTEGER HIDDEN, command TEXT HIDDEN)");
+    }
+    if (rc != CORTEX_OK) {
+        cortex_free(v->schema);
+        cortex_free(v->name);
+        cortex_free(v);
+        return rc;
+    }
+    *ppVtab = &v->base;
+    return CORTEX_OK;
+}
+
+static int ivf_create(cortex *db, void *aux, int argc, const char *const *argv,
+                      cortex_vtab **ppVtab, char **pzErr) {
+    (void)aux;
+    return ivf_init(db, argc, argv, ppVtab, pzErr, 1);
+}
+
+static int ivf_connect(cortex *db, void *aux, int argc, const char *const *argv,
+                       cortex_vtab **ppVtab, char **pzErr) {
+    (void)aux;
+    return ivf_init(db, argc, argv, ppVtab, pzErr, 0);
+}
+
+static void finalize_all(ivf_vtab *v) {
+    cortex_stmt **stmts[] = {
+        &v->stmt_get_config, &v->stmt_set_config, &v->stmt_vec_get, &v->stmt_vec_put,
+        &v->stmt_vec_list, &v->stmt_vec_del, &v->stmt_vec_max, &v->stmt_list_read,
+        &v->stmt_list_last, &v->stmt_chunk_put, &v->stmt_chunk_del
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+        cortex_finalize(*stmts[i]);
+        *stmts[i] = NULL;
+    }
+}
+
+static int ivf_disconnect(cortex_vtab *pVtab) {
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+
+    quantizers_free(v);
+    finalize_all(v);
+    cortex_free(v->schema);
+    cortex_free(v->name);
+    cortex_free(v);
+    return CORTEX_OK;
+}
+
+static int ivf_destroy(cortex_vtab *pVtab) {
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+    char *sql = cortex_mprintf(
+        "DROP TABLE IF EXISTS \"%w\".\"%w_config\"; DROP TABLE IF EXISTS \"%w\".\"%w_codebooks\";"
+        "DROP TABLE IF EXISTS \"%w\".\"%w_lists\"; DROP TABLE IF EXISTS \"%w\".\"%w_vectors\";",
+        v->schema, v->name, v->schema, v->name, v->schema, v->name, v->schema, v->name);
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+    cortex_free(sql);
+    if (rc == CORTEX_OK) ivf_disconnect(pVtab);
+    return rc;
+}
+
+static int ivf_best_index(cortex_vtab *pVtab, cortex_index_info *info) {
+    int match = -1, k = -1, limit = -1, offset = -1, nprobe = -1, rowid = -1, i, argv = 1;
+    int ordered = info->nOrderBy == 1 && info->aOrderBy[0].iColumn == IVF_COL_DISTANCE
+                  && !info->aOrderBy[0].desc;
+
+    (void)pVtab;
+    for (i = 0; i < info->nConstraint; i++) {
+        const struct cortex_index_constraint *c = &info->aConstraint[i];
+        if (!c->usable) continue;
+        if (c->op == CORTEX_INDEX_CONSTRAINT_MATCH && c->iColumn == IVF_COL_EMBEDDING) {
+            match = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_EQ && c->iColumn == IVF_COL_K) {
+            k = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_EQ && c->iColumn == IVF_COL_NPROBE) {
+            nprobe = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_LIMIT) {
+            limit = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_OFFSET) {
+            offset = i;
+        } else if (c->op == CORTEX_INDEX_CONSTRAINT_EQ && c->iColumn == -1) {
+            rowid = i;
+        }
+    }
+
+    if (match >= 0) {
+        info->idxNum = IVF_PLAN_KNN;
+        info->aConstraintUsage[match].argvIndex = argv++;
+        info->aConstraintUsage[match].omit = 1;
+        if (k >= 0) {
+            info->idxNum |= IVF_ARG_K;
+            info->aConstraintUsage[k].argvIndex = argv++;
+            info->aConstraintUsage[k].omit = 1;
+        } else if (limit >= 0 && (info->nOrderBy == 0 || ordered)) {
+            /* LIMIT is only ours to apply when the result order is too */
+            info->idxNum |= IVF_ARG_LIMIT;
+            info->aConstraintUsage[limit].argvIndex = argv++;
+            if (offset >= 0) {
+                info->idxNum |= IVF_ARG_OFFSET;
+                info->aConstraintUsage[offset].argvIndex = argv++;
+            }
+        }
+        if (nprobe >= 0) {
+            info->idxNum |= IVF_ARG_NPROBE;
+            info->aConstraintUsage[nprobe].argvIndex = argv++;
+            info->aConstraintUsage[nprobe].omit = 1;
+        }
+        info->orderByConsumed = ordered;
+        info->estimatedCost = 100.0;
+        info->estimatedRows = 10;
+    } else if (rowid >= 0) {
+        info->idxNum = IVF_PLAN_ROWID;
+        info->aConstraintUsage[rowid].argvIndex = 1;
+        info->aConstraintUsage[rowid].omit = 1;
+        info->idxFlags = CORTEX_INDEX_SCAN_UNIQUE;
+        info->estimatedCost = 1.0;
+        info->estimatedRows = 1;
+    } else {
+        info->idxNum = 0;
+        info->estimatedCost = 1e6;
+        info->estimatedRows = 1000000;
+    }
+    return CORTEX_OK;
+}
+
+static int ivf_open(cortex_vtab *pVtab, cortex_vtab_cursor **ppCursor) {
+    ivf_cursor *cur = cortex_malloc(sizeof(ivf_cursor));
+
+    (void)pVtab;
+    if (cur == NULL) return CORTEX_NOMEM;
+    memset(cur, 0, sizeof(ivf_cursor));
+    *ppCursor = &cur->base;
+    return CORTEX_OK;
+}
+
+static void cursor_reset(ivf_cursor *cur) {
+    cortex_finalize(cur->scan);
+    cortex_free(cur->ids);
+    cortex_free(cur->dists);
+    cur->scan = NULL;
+    cur->ids = NULL;
+    cur->dists = NULL;
+    cur->pos = cur->n = 0;
+    cur->scan_eof = 0;
+}
+
+static int ivf_close(cortex_vtab_cursor *pCursor) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+    cursor_reset(cur);
+    cortex_free(cur);
+    return CORTEX_OK;
+}
+
+static int scan_step(ivf_cursor *cur) {
+    int rc = cortex_step(cur->scan);
+    if (rc == CORTEX_ROW) return CORTEX_OK;
+    cur->scan_eof = 1;
+    return rc == CORTEX_DONE ? CORTEX_OK : rc;
+}
+
+static int ivf_filter(cortex_vtab_cursor *pCursor, int idxNum, const char *idxStr,
+                      int argc, cortex_value **argv) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+    ivf_vtab *v = (ivf_vtab *)pCursor->pVtab;
+    int rc;
+
+    (void)idxStr;
+    cursor_reset(cur);
+    cur->plan = idxNum;
+    if ((rc = check_generation(v)) != CORTEX_OK) return rc;
+    if ((rc = quantizers_load(v)) != CORTEX_OK) return rc;
+
+    if (idxNum & IVF_PLAN_KNN) {
+        cortex_int64 k, nprobe = v->nprobe;
+        char *err = NULL;
+        float *q;
+
+        if (!(idxNum & (IVF_ARG_K | IVF_ARG_LIMIT))) {
+            v->base.zErrMsg = cortex_mprintf("vec_ivf: a KNN query needs LIMIT or k = N");
+            return CORTEX_ERROR;
+        }
+        k = cortex_value_int64(argv[1]);
+        if (idxNum & IVF_ARG_OFFSET) k += cortex_value_int64(argv[2]);
+        if (k > 100000) {
+            v->base.zErrMsg = cortex_mprintf("vec_ivf: k must be at most 100000");
+            return CORTEX_ERROR;
+        }
+        if (idxNum & IVF_ARG_NPROBE) {
+            nprobe = cortex_value_int64(argv[argc - 1]);
+            if (nprobe < 1 || nprobe > 65536) {
+                v->base.zErrMsg = cortex_mprintf("vec_ivf: nprobe must be between 1 and 65536");
+                return CORTEX_ERROR;
+            }
+        }
+        cur->k = k;
+        cur->nprobe = (int)nprobe;
+        if (k <= 0) return CORTEX_OK;
+
+        q = cortex_malloc64((cortex_uint64)v->dim * sizeof(float));
+        if (q == NULL) return CORTEX_NOMEM;
+        if (vec_from_value(argv[0], v->dim, q, &err) != CORTEX_OK) {
+            cortex_free(q);
+            v->base.zErrMsg = err;
+            return CORTEX_ERROR;
+        }
+        rc = ivf_knn(v, q, (int)k, (int)nprobe, cur);
+        cortex_free(q);
+        return rc;
+    }
+    if (idxNum & IVF_PLAN_ROWID) {
+        int exists = 0;
+        cortex_int64 rowid = cortex_value_int64(argv[0]);
+        if (cortex_value_type(argv[0]) != CORTEX_INTEGER) return CORTEX_OK;
+        if ((rc = row_exists(v, rowid, &exists)) != CORTEX_OK || !exists) return rc;
+        cur->ids = cortex_malloc(sizeof(cortex_int64));
+        if (cur->ids == NULL) return CORTEX_NOMEM;
+        cur->ids[0] = rowid;
+        cur->n = 1;
+        return CORTEX_OK;
+    }
+    {
+        char *sql = cortex_mprintf("SELECT id, vector FROM \"%w\".\"%w_vectors\"", v->schema, v->name);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_prepare_v2(v->db, sql, -1, &cur->scan, NULL);
+        cortex_free(sql);
+        if (rc != CORTEX_OK) return rc;
+        return scan_step(cur);
+    }
+}
+
+static int ivf_next(cortex_vtab_cursor *pCursor) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+
+    if (cur->scan) return scan_step(cur);
+    cur->pos++;
+    return CORTEX_OK;
+}
+
+static int ivf_eof(cortex_vtab_cursor *pCursor) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+    return cur->scan ? cur->scan_eof : cur->pos >= cur->n;
+}
+
+static int ivf_column(cortex_vtab_cursor *pCursor, cortex_context *ctx, int col) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+    ivf_vtab *v = (ivf_vtab *)pCursor->pVtab;
+
+    switch (col) {
+        case IVF_COL_EMBEDDING:
+            if (cur->scan) {
+                cortex_result_blob(ctx, cortex_column_blob(cur->scan, 1),
+                                   cortex_column_bytes(cur->scan, 1), CORTEX_TRANSIENT);
+            } else {
+                int rc = seek_vector(v, cur->ids[cur->pos]);
+                if (rc != CORTEX_OK) return rc;
+                cortex_result_blob(ctx, cortex_column_blob(v->stmt_vec_get, 0),
+                                   v->dim * (int)sizeof(float), CORTEX_TRANSIENT);
+                cortex_reset(v->stmt_vec_get);
+            }
+            break;
+        case IVF_COL_DISTANCE:
+            if (cur->plan & IVF_PLAN_KNN) {
+                cortex_result_double(ctx, reported_dist(v, cur->dists[cur->pos]));
+            }
+            break;
+        case IVF_COL_K:
+            if (cur->plan & IVF_PLAN_KNN) cortex_result_int64(ctx, cur->k);
+            break;
+        case IVF_COL_NPROBE:
+            if (cur->plan & IVF_PLAN_KNN) cortex_result_int(ctx, cur->nprobe);
+            break;
+    }
+    return CORTEX_OK;
+}
+
+static int ivf_rowid(cortex_vtab_cursor *pCursor, cortex_int64 *pRowid) {
+    ivf_cursor *cur = (ivf_cursor *)pCursor;
+
+    *pRowid = cur->scan ? cortex_column_int64(cur->scan, 0) : cur->ids[cur->pos];
+    return CORTEX_OK;
+}
+
+static int run_command(ivf_vtab *v, cortex_value *command) {
+    const char *text = (const char *)cortex_value_text(command);
+
+    if (text && cortex_stricmp(text, "train") == 0) return ivf_train(v);
+    v->base.zErrMsg = cortex_mprintf("vec_ivf: unknown command \"%s\"", text ? text : "");
+    return CORTEX_ERROR;
+}
+
+static int ivf_update(cortex_vtab *pVtab, int argc, cortex_value **argv, cortex_int64 *pRowid) {
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+    cortex_int64 old_rowid = 0, rowid;
+    int has_old = cortex_value_type(argv[0]) != CORTEX_NULL;
+    float *vec;
+    char *err = NULL;
+    int rc, exists = 0;
+
+    if ((rc = quantizers_load(v)) != CORTEX_OK) return rc;
+    v->txn_writes = 1;
+
+    if (has_old) {
+        old_rowid = cortex_value_int64(argv[0]);
+        if (argc == 1) return ivf_delete(v, old_rowid);
+    }
+    if (cortex_value_type(argv[2 + IVF_COL_COMMAND]) != CORTEX_NULL) {
+        if (has_old) {
+            v->base.zErrMsg = cortex_mprintf("vec_ivf: commands are run with INSERT");
+            return CORTEX_ERROR;
+        }
+        return run_command(v, argv[2 + IVF_COL_COMMAND]);
+    }
+
+    if (cortex_value_type(argv[1]) == CORTEX_NULL) {
+        if ((rc = next_rowid(v, &rowid)) != CORTEX_OK) return rc;
+    } else {
+        rowid = cortex_value_int64(argv[1]);
+        if (!(has_old && rowid == old_rowid) && (rc = row_exists(v, rowid, &exists)) != CORTEX_OK) return rc;
+    }
+    if (exists) {
+        v->base.zErrMsg = cortex_mprintf("UNIQUE constraint failed: %s.rowid", v->name);
+        return CORTEX_CONSTRAINT;
+    }
+
+    vec = cortex_malloc64((cortex_uint64)v->dim * sizeof(float));
+    if (vec == NULL) return CORTEX_NOMEM;
+    if (vec_from_value(argv[2 + IVF_COL_EMBEDDING], v->dim, vec, &err) != CORTEX_OK) {
+        cortex_free(vec);
+        v->base.zErrMsg = err;
+        return CORTEX_CONSTRAINT;
+    }
+    if (has_old) rc = ivf_delete(v, old_rowid);
+    if (rc == CORTEX_OK) rc = ivf_insert(v, rowid, vec);
+    cortex_free(vec);
+    *pRowid = rowid;
+    return rc;
+}
+
+static int ivf_begin(cortex_vtab *pVtab) {
+    return check_generation((ivf_vtab *)pVtab);
+}
+
+static int ivf_sync(cortex_vtab *pVtab) {
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+    cortex_int64 generation;
+    int rc;
+
+    if (!v->txn_writes) return CORTEX_OK;
+    if ((rc = read_config(v, "generation", &generation)) != CORTEX_OK) return rc;
+    rc = write_config(v, "generation", generation + 1);
+    if (rc == CORTEX_OK && v->loaded) v->generation = generation + 1;
+    return rc;
+}
+
+static int ivf_commit(cortex_vtab *pVtab) {
+    ((ivf_vtab *)pVtab)->txn_writes = 0;
+    return CORTEX_OK;
+}
+
+static int ivf_rollback(cortex_vtab *pVtab) {
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+
+    if (v->txn_writes) quantizers_free(v);
+    v->txn_writes = 0;
+    return CORTEX_OK;
+}
+
+static int ivf_savepoint(cortex_vtab *pVtab, int n) {
+    (void)pVtab;
+    (void)n;
+    return CORTEX_OK;
+}
+
+static int ivf_release(cortex_vtab *pVtab, int n) {
+    (void)pVtab;
+    (void)n;
+    return CORTEX_OK;
+}
+
+static int ivf_rollback_to(cortex_vtab *pVtab, int n) {
+    (void)n;
+    quantizers_free((ivf_vtab *)pVtab);
+    return CORTEX_OK;
+}
+
+static int ivf_rename(cortex_vtab *pVtab, const char *zNew) {
+    static const char *const SHADOWS[] = {"config", "codebooks", "lists", "vectors"};
+    ivf_vtab *v = (ivf_vtab *)pVtab;
+    char *name;
+    size_t i;
+    int rc = CORTEX_OK;
+
+    for (i = 0; rc == CORTEX_OK && i < sizeof(SHADOWS) / sizeof(SHADOWS[0]); i++) {
+        char *sql = cortex_mprintf("ALTER TABLE \"%w\".\"%w_%s\" RENAME TO \"%w_%s\";",
+                                   v->schema, v->name, SHADOWS[i], zNew, SHADOWS[i]);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_exec(v->db, sql, NULL, NULL, NULL);
+        cortex_free(sql);
+    }
+    if (rc != CORTEX_OK) return rc;
+    name = cortex_mprintf("%s", zNew);
+    if (name == NULL) return CORTEX_NOMEM;
+    cortex_free(v->name);
+    v->name = name;
+    /* statements still point at the old shadow table names */
+    finalize_all(v);
+    return CORTEX_OK;
+}
+
+static int ivf_shadow_name(const char *zName) {
+    return strcmp(zName, "config") == 0 || strcmp(zName, "codebooks") == 0
+           || strcmp(zName, "lists") == 0 || strcmp(zName, "vectors") == 0;
+}
+
+static cortex_module ivf_module = {
+    3,                      /* iVersion */
+    ivf_create,
+    ivf_connect,
+    ivf_best_index,
+    ivf_disconnect,
+    ivf_destroy,
+    ivf_open,
+    ivf_close,
+    ivf_filter,
+    ivf_next,
+    ivf_eof,
+    ivf_column,
+    ivf_rowid,
+    ivf_update,
+    ivf_begin,
+    ivf_sync,
+    ivf_commit,
+    ivf_rollback,
+    NULL,                   /* xFindFunction */
+    ivf_rename,
+    ivf_savepoint,
+    ivf_release,
+    ivf_rollback_to,
+    ivf_shadow_name,
+    NULL                    /* xIntegrity */
+};
+
+int vec_ivf_register(cortex *db) {
+    return cortex_create_module_v2(db, "vec_ivf", &ivf_module, NULL, NULL);
+}
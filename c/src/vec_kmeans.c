@@ -0,0 +1,234 @@
+#include "cortex_vec.h"
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#define VEC_THREADS 1
+#endif
+
+/*
+    Training helpers for the vector indexes: a small work-sharing loop
+    and Lloyd's k-means on top of it.
+
+    Only the assignment step of k-means is parallel. It costs
+    n * k * dim per iteration; the centroid update is n * dim and stays
+    on the calling thread so the sums need no per-thread copies.
+*/
+
+#define VEC_MAX_THREADS 64
+
+/* ─────────────────────────────────────────
+   Parallel loops
+   ───────────────────────────────────────── */
+
+int vec_default_threads(void) {
+#ifdef VEC_THREADS
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    return n > VEC_MAX_THREADS ? VEC_MAX_THREADS : (int)n;
+#else
+    return 1;
+#endif
+}
+
+#ifdef VEC_THREADS
+typedef struct par_loop {
+    void (*fn)(void *arg, int task);
+    void *arg;
+    int n_tasks;
+    int next;
+    pthread_mutex_t lock;
+} par_loop;
+
+static void *par_worker(void *p) {
+    par_loop *loop = p;
+
+    for (;;) {
+        int task;
+        pthread_mutex_lock(&loop->lock);
+        task = loop->next++;
+        pthread_mutex_unlock(&loop->lock);
+        if (task >= loop->n_tasks) break;
+        loop->fn(loop->arg, task);
+    }
+    return NULL;
+}
+#endif
+
+void vec_parallel_for(int n_tasks, int threads, void (*fn)(void *arg, int task), void *arg) {
+#ifdef VEC_THREADS
+    pthread_t workers[VEC_MAX_THREADS];
+    par_loop loop;
+    int started = 0, i;
+
+    if (threads > n_tasks) threads = n_tasks;
+    if (threads > VEC_MAX_THREADS) threads = VEC_MAX_THREADS;
+    if (threads > 1) {
+        loop.fn = fn;
+        loop.arg = arg;
+        loop.n_tasks = n_tasks;
+        loop.next = 0;
+        pthread_mutex_init(&loop.lock, NULL);
+        /* a worker that fails to start just leaves more tasks for the rest */
+        for (i = 1; i < threads; i++) {
+            if (pthread_create(&workers[started], NULL, par_worker, &loop) == 0) started++;
+        }
+        par_worker(&loop);
+        for (i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        pthread_mutex_destroy(&loop.lock);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    {
+        int task;
+        for (task = 0; task < n_tasks; task++) fn(arg, task);
+    }
+}
+
+/* ─────────────────────────────────────────
+   k-means
+   ───────────────────────────────────────── */
+
+int vec_nearest(const float *x, const float *centroids, int k, int dim, float *dist) {
+    float best = FLT_MAX;
+    int i, arg = 0;
+
+    for (i = 0; i < k; i++) {
+        float d = vec_l2sq_f32(x, centroids + (size_t)i * dim, dim);
+        if (d < best) {
+            best = d;
+            arg = i;
+        }
+    }
+    if (dist) *dist = best;
+    return arg;
+}
+
+typedef struct assign_job {
+    const float *points;
+    const float *centroids;
+    int *assign;
+    int n, dim, k;
+    int n_tasks;
+    int *changed;           /* per task */
+} assign_job;
+
+static void assign_task(void *arg, int task) {
+    assign_job *job = arg;
+    int lo = (int)((long long)job->n * task / job->n_tasks);
+    int hi = (int)((long long)job->n * (task + 1) / job->n_tasks);
+    int i, changed = 0;
+
+    for (i = lo; i < hi; i++) {
+        int c = vec_nearest(job->points + (size_t)i * job->dim, job->centroids, job->k, job->dim, NULL);
+        if (c != job->assign[i]) {
+            job->assign[i] = c;
+            changed++;
+        }
+    }
+    job->changed[task] = changed;
+}
+
+static uint64_t kmeans_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ull;
+}
+
+/* k distinct points by a partial Fisher-Yates shuffle; cycles when n < k */
+static int kmeans_seed(const float *points, int n, int dim, int k, uint64_t *rng, float *centroids) {
+    int *order = cortex_malloc64((cortex_uint64)n * sizeof(int));
+    int i;
+
+    if (order == NULL) return CORTEX_NOMEM;
+    for (i = 0; i < n; i++) order[i] = i;
+    for (i = 0; i < k; i++) {
+        int pick;
+        if (i < n) {
+            int j = i + (int)(kmeans_rand(rng) % (uint64_t)(n - i));
+            int tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+            pick = order[i];
+        } else {
+            pick = order[i % n];
+        }
+        memcpy(centroids + (size_t)i * dim, points + (size_t)pick * dim, (size_t)dim * sizeof(float));
+    }
+    cortex_free(order);
+    return CORTEX_OK;
+}
+
+int vec_kmeans(const float *points, int n, int dim, int k, int iters, int threads,
+               uint64_t seed, float *centroids) {
+    assign_job job;
+    double *sums = NULL;
+    int *counts = NULL, *assign = NULL, *changed = NULL;
+    uint64_t rng = seed ? seed : 1;
+    int rc, it, i, d;
+
+    if (n <= 0 || k <= 0) return CORTEX_MISUSE;
+    if ((rc = kmeans_seed(points, n, dim, k, &rng, centroids)) != CORTEX_OK) return rc;
+    if (n <= k) return CORTEX_OK;
+
+    if (threads < 1) threads = 1;
+    sums = cortex_malloc64((cortex_uint64)k * dim * sizeof(double));
+    counts = cortex_malloc64((cortex_uint64)k * sizeof(int));
+    assign = cortex_malloc64((cortex_uint64)n * sizeof(int));
+    changed = cortex_malloc64((cortex_uint64)threads * sizeof(int));
+    if (sums == NULL || counts == NULL || assign == NULL || changed == NULL) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    memset(assign, 0xff, (size_t)n * sizeof(int));
+
+    job.points = points;
+    job.centroids = centroids;
+    job.assign = assign;
+    job.n = n;
+    job.dim = dim;
+    job.k = k;
+    job.n_tasks = threads;
+    job.changed = changed;
+
+    for (it = 0; it < iters; it++) {
+        int moved = 0;
+
+        vec_parallel_for(threads, threads, assign_task, &job);
+        for (i = 0; i < threads; i++) moved += changed[i];
+        if (moved == 0) break;
+
+        memset(sums, 0, (size_t)k * dim * sizeof(double));
+        memset(counts, 0, (size_t)k * sizeof(int));
+        for (i = 0; i < n; i++) {
+            const float *p = points + (size_t)i * dim;
+            double *s = sums + (size_t)assign[i] * dim;
+            for (d = 0; d < dim; d++) s[d] += p[d];
+            counts[assign[i]]++;
+        }
+        for (i = 0; i < k; i++) {
+            float *c = centroids + (size_t)i * dim;
+            if (counts[i] == 0) {
+                /* re-seed an empty cluster on a random point */
+                const float *p = points + (size_t)(kmeans_rand(&rng) % (uint64_t)n) * dim;
+                memcpy(c, p, (size_t)dim * sizeof(float));
+                continue;
+            }
+            for (d = 0; d < dim; d++) c[d] = (float)(sums[(size_t)i * dim + d] / counts[i]);
+        }
+    }
+done:
+    cortex_free(sums);
+    cortex_free(counts);
+    cortex_free(assign);
+    cortex_free(changed);
+    return rc;
+}
@@ -0,0 +1,438 @@
+#include "cortex_vec.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+/*
+    Metadata columns for the vector tables.
+
+        CREATE VIRTUAL TABLE mem USING vec_hnsw(dim=768, agent_id INTEGER, created_at INTEGER);
+        SELECT rowid FROM mem
+         WHERE embedding MATCH ? AND k = 10 AND agent_id = ? AND created_at > ?;
+
+    Any module argument without '=' declares a column: a name and one of
+    INTEGER, REAL or TEXT. Values live in %_meta(id, <columns>), keyed by
+    the table's rowid, with an index on every column. xBestIndex claims
+    =, <>, <, <=, >, >= and IN constraints on them; xFilter turns those
+    into one query over %_meta that yields the matching rowids, which
+    the index then searches within.
+
+    idx_str records the claimed constraints, two characters each: the
+    column ('A' + index) and the operator, in argv order. An IN list is
+    bound as one JSON array and read back through json_each(), so the
+    SQL only depends on idx_str: however long the list, it takes one
+    variable, and each idx_str is prepared once and kept (m->plans).
+*/
+
+static const char *const META_TYPES[] = {"INTEGER", "REAL", "TEXT"};
+
+void vec_meta_bind(vec_meta *m, cortex *db, char **schema, char **name) {
+    m->db = db;
+    m->schema = schema;
+    m->name = name;
+}
+
+static int valid_name(const char *p, size_t len) {
+    size_t i;
+
+    if (len == 0 || len >= 64 || !(isalpha((unsigned char)p[0]) || p[0] == '_')) return 0;
+    for (i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char)p[i]) || p[i] == '_')) return 0;
+    }
+    return 1;
+}
+
+int vec_meta_add(vec_meta *m, const char *module, const char *arg, const char *const *reserved,
+                 char **errmsg) {
+    const char *p = arg, *type;
+    size_t len, i;
+
+    while (*p == ' ') p++;
+    for (len = 0; p[len] && p[len] != ' '; len++) {}
+    for (type = p + len; *type == ' '; type++) {}
+
+    if (!valid_name(p, len)) {
+        *errmsg = cortex_mprintf("%s: expected key=value or a column \"name TYPE\", got \"%s\"", module, arg);
+        return CORTEX_ERROR;
+    }
+    for (i = 0; reserved[i]; i++) {
+        if (strlen(reserved[i]) == len && cortex_strnicmp(p, reserved[i], (int)len) == 0) {
+            *errmsg = cortex_mprintf("%s: column name \"%.*s\" is reserved", module, (int)len, p);
+            return CORTEX_ERROR;
+        }
+    }
+    for (i = 0; i < (size_t)m->n; i++) {
+        if (strlen(m->names[i]) == len && cortex_strnicmp(p, m->names[i], (int)len) == 0) {
+            *errmsg = cortex_mprintf("%s: duplicate column \"%.*s\"", module, (int)len, p);
+            return CORTEX_ERROR;
+        }
+    }
+    if (m->n == VEC_MAX_META) {
+        *errmsg = cortex_mprintf("%s: at most %d metadata columns", module, VEC_MAX_META);
+        return CORTEX_ERROR;
+    }
+    for (i = 0; i < sizeof(META_TYPES) / sizeof(META_TYPES[0]); i++) {
+        size_t tlen = strlen(META_TYPES[i]);
+        if (cortex_strnicmp(type, META_TYPES[i], (int)tlen) == 0 && type[tlen] == '\0') break;
+    }
+    if (i == sizeof(META_TYPES) / sizeof(META_TYPES[0])) {
+        *errmsg = cortex_mprintf("%s: column \"%.*s\" needs a type: INTEGER, REAL or TEXT", module, (int)len, p);
+        return CORTEX_ERROR;
+    }
+    m->names[m->n] = cortex_mprintf("%.*s", (int)len, p);
+    if (m->names[m->n] == NULL) return CORTEX_NOMEM;
+    m->types[m->n] = META_TYPES[i];
+    m->n++;
+    return CORTEX_OK;
+}
+
+void vec_meta_reset(vec_meta *m) {
+    int i;
+
+    cortex_finalize(m->stmt_get);
+    cortex_finalize(m->stmt_put);
+    cortex_finalize(m->stmt_del);
+    m->stmt_get = m->stmt_put = m->stmt_del = NULL;
+    for (i = 0; i < VEC_META_PLANS; i++) {
+        cortex_finalize(m->plans[i].stmt);
+        cortex_free(m->plans[i].idx_str);
+        m->plans[i].stmt = NULL;
+        m->plans[i].idx_str = NULL;
+    }
+    m->next_plan = 0;
+}
+
+void vec_meta_free(vec_meta *m) {
+    int i;
+
+    vec_meta_reset(m);
+    for (i = 0; i < m->n; i++) cortex_free(m->names[i]);
+    m->n = 0;
+}
+
+char *vec_meta_declare(const vec_meta *m, const char *fixed) {
+    char *sql = cortex_mprintf("CREATE TABLE x(%s", fixed);
+    int i;
+
+    for (i = 0; sql && i < m->n; i++) {
+        sql = cortex_mprintf("%z, \"%w\" %s", sql, m->names[i], m->types[i]);
+    }
+    return sql ? cortex_mprintf("%z)", sql) : NULL;
+}
+
+static int exec_owned(cortex *db, char *sql, char **errmsg) {
+    int rc;
+
+    if (sql == NULL) return CORTEX_NOMEM;
+    rc = cortex_exec(db, sql, NULL, NULL, errmsg);
+    cortex_free(sql);
+    return rc;
+}
+
+/*
+    Indexes are named after the table, but xRename cannot drop or rename
+    them (the running ALTER TABLE keeps the schema locked), so they keep
+    their first name for life. A later table that reuses the name takes
+    the next free suffix instead.
+*/
+static int create_index(const vec_meta *m, int col, char **errmsg) {
+    int rc = CORTEX_ERROR, suffix;
+
+    for (suffix = 0; rc == CORTEX_ERROR && suffix < 100; suffix++) {
+        char tail[16] = "";
+        char *sql;
+
+        if (suffix) cortex_snprintf(sizeof(tail), tail, "_%d", suffix);
+        sql = cortex_mprintf("CREATE INDEX \"%w\".\"%w_meta_%w%s\" ON \"%w_meta\"(\"%w\");",
+                             *m->schema, *m->name, m->names[col], tail, *m->name, m->names[col]);
+        cortex_free(*errmsg);
+        *errmsg = NULL;
+        rc = exec_owned(m->db, sql, errmsg);
+    }
+    return rc;
+}
+
+int vec_meta_create(const vec_meta *m, char **errmsg) {
+    char *sql;
+    int i, rc;
+
+    if (m->n == 0) return CORTEX_OK;
+    sql = cortex_mprintf("CREATE TABLE \"%w\".\"%w_meta\"(id INTEGER PRIMARY KEY", *m->schema, *m->name);
+    for (i = 0; sql && i < m->n; i++) {
+        sql = cortex_mprintf("%z, \"%w\" %s", sql, m->names[i], m->types[i]);
+    }
+    if (sql) sql = cortex_mprintf("%z);", sql);
+    rc = exec_owned(m->db, sql, errmsg);
+    for (i = 0; rc == CORTEX_OK && i < m->n; i++) rc = create_index(m, i, errmsg);
+    return rc;
+}
+
+int vec_meta_rename(vec_meta *m, const char *new_name) {
+    if (m->n == 0) return CORTEX_OK;
+    vec_meta_reset(m);
+    return exec_owned(m->db, cortex_mprintf("ALTER TABLE \"%w\".\"%w_meta\" RENAME TO \"%w_meta\";",
+                                            *m->schema, *m->name, new_name), NULL);
+}
+
+int vec_meta_write(vec_meta *m, cortex_int64 rowid, cortex_value **values) {
+    int rc, i;
+
+    if (m->n == 0) return CORTEX_OK;
+    if (m->stmt_put == NULL) {
+        char *sql = cortex_mprintf("INSERT OR REPLACE INTO \"%w\".\"%w_meta\" VALUES (?1", *m->schema, *m->name);
+        for (i = 0; sql && i < m->n; i++) sql = cortex_mprintf("%z, ?%d", sql, i + 2);
+        if (sql) sql = cortex_mprintf("%z)", sql);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_prepare_v3(m->db, sql, -1, CORTEX_PREPARE_PERSISTENT, &m->stmt_put, NULL);
+        cortex_free(sql);
+        if (rc != CORTEX_OK) return rc;
+    }
+    cortex_bind_int64(m->stmt_put, 1, rowid);
+    for (i = 0; i < m->n; i++) cortex_bind_value(m->stmt_put, i + 2, values[i]);
+    cortex_step(m->stmt_put);
+    return cortex_reset(m->stmt_put);
+}
+
+int vec_meta_delete(vec_meta *m, cortex_int64 rowid) {
+    int rc;
+
+    if (m->n == 0) return CORTEX_OK;
+    if (m->stmt_del == NULL) {
+        char *sql = cortex_mprintf("DELETE FROM \"%w\".\"%w_meta\" WHERE id = ?1", *m->schema, *m->name);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_prepare_v3(m->db, sql, -1, CORTEX_PREPARE_PERSISTENT, &m->stmt_del, NULL);
+        cortex_free(sql);
+        if (rc != CORTEX_OK) return rc;
+    }
+    cortex_bind_int64(m->stmt_del, 1, rowid);
+    cortex_step(m->stmt_del);
+    return cortex_reset(m->stmt_del);
+}
+
+int vec_meta_column(vec_meta *m, cortex_int64 rowid, int col, cortex_context *ctx) {
+    int rc;
+
+    if (m->stmt_get == NULL) {
+        char *sql = cortex_mprintf("SELECT * FROM \"%w\".\"%w_meta\" WHERE id = ?1", *m->schema, *m->name);
+        if (sql == NULL) return CORTEX_NOMEM;
+        rc = cortex_prepare_v3(m->db, sql, -1, CORTEX_PREPARE_PERSISTENT, &m->stmt_get, NULL);
+        cortex_free(sql);
+        if (rc != CORTEX_OK) return rc;
+    }
+    cortex_bind_int64(m->stmt_get, 1, rowid);
+    if (cortex_step(m->stmt_get) == CORTEX_ROW) {
+        cortex_result_value(ctx, cortex_column_value(m->stmt_get, col + 1));
+    }
+    return cortex_reset(m->stmt_get);
+}
+
+static char op_code(unsigned char op) {
+    switch (op) {
+        case CORTEX_INDEX_CONSTRAINT_EQ: return '=';
+        case CORTEX_INDEX_CONSTRAINT_NE: return '!';
+        case CORTEX_INDEX_CONSTRAINT_GT: return '>';
+        case CORTEX_INDEX_CONSTRAINT_GE: return 'G';
+        case CORTEX_INDEX_CONSTRAINT_LT: return '<';
+        case CORTEX_INDEX_CONSTRAINT_LE: return 'L';
+        default: return 0;
+    }
+}
+
+static const char *op_sql(char code) {
+    switch (code) {
+        case '=': return "=";
+        case '!': return "<>";
+        case '>': return ">";
+        case 'G': return ">=";
+        case '<': return "<";
+        default:  return "<=";
+    }
+}
+
+int vec_meta_best_index(const vec_meta *m, int first_col, cortex_index_info *info, int *argv,
+                        int *unclaimed) {
+    char codes[2 * VEC_MAX_FILTERS + 1];
+    int n = 0, i;
+
+    *unclaimed = 0;
+    for (i = 0; i < info->nConstraint; i++) {
+        const struct cortex_index_constraint *c = &info->aConstraint[i];
+        int col = c->iColumn - first_col;
+        char op;
+
+        if (col < 0 || col >= m->n) continue;
+        op = op_code(c->op);
+        if (!c->usable || op == 0 || n == VEC_MAX_FILTERS) {
+            *unclaimed = 1;
+            continue;
+        }
+        /* take a whole IN list at once rather than one xFilter per value */
+        if (op == '=' && cortex_vtab_in(info, i, -1)) {
+            cortex_vtab_in(info, i, 1);
+            op = 'I';
+        }
+        codes[2 * n] = (char)('A' + col);
+        codes[2 * n + 1] = op;
+        n++;
+        info->aConstraintUsage[i].argvIndex = (*argv)++;
+        info->aConstraintUsage[i].omit = 1;
+    }
+    if (n == 0) return CORTEX_OK;
+    codes[2 * n] = '\0';
+    info->idxStr = cortex_mprintf("%s", codes);
+    if (info->idxStr == NULL) return CORTEX_NOMEM;
+    info->needToFreeIdxStr = 1;
+    return CORTEX_OK;
+}
+
+/* The statement for one idx_str, prepared on first use */
+static int filter_plan(vec_meta *m, const char *idx_str, cortex_stmt **stmt) {
+    vec_meta_plan *plan;
+    char *sql;
+    int i, rc;
+
+    for (i = 0; i < VEC_META_PLANS; i++) {
+        if (m->plans[i].idx_str && strcmp(m->plans[i].idx_str, idx_str) == 0) {
+            *stmt = m->plans[i].stmt;
+            return CORTEX_OK;
+        }
+    }
+    sql = cortex_mprintf("SELECT id FROM \"%w\".\"%w_meta\" WHERE 1", *m->schema, *m->name);
+    for (i = 0; sql && idx_str[2 * i]; i++) {
+        const char *col = m->names[idx_str[2 * i] - 'A'];
+        char op = idx_str[2 * i + 1];
+
+        if (op == 'I') {
+            sql = cortex_mprintf("%z AND \"%w\" IN (SELECT value FROM json_each(?))", sql, col);
+        } else {
+            sql = cortex_mprintf("%z AND \"%w\" %s ?", sql, col, op_sql(op));
+        }
+    }
+    if (sql == NULL) return CORTEX_NOMEM;
+    plan = &m->plans[m->next_plan];
+    m->next_plan = (m->next_plan + 1) % VEC_META_PLANS;
+    cortex_finalize(plan->stmt);
+    cortex_free(plan->idx_str);
+    plan->stmt = NULL;
+    plan->idx_str = cortex_mprintf("%s", idx_str);
+    rc = plan->idx_str ? cortex_prepare_v3(m->db, sql, -1, CORTEX_PREPARE_PERSISTENT, &plan->stmt, NULL)
+                       : CORTEX_NOMEM;
+    cortex_free(sql);
+    if (rc != CORTEX_OK) {
+        cortex_finalize(plan->stmt);
+        cortex_free(plan->idx_str);
+        plan->stmt = NULL;
+        plan->idx_str = NULL;
+        return rc;
+    }
+    *stmt = plan->stmt;
+    return CORTEX_OK;
+}
+
+static void json_string(cortex_str *out, const unsigned char *z, int n) {
+    int i, run = 0;
+
+    cortex_str_appendchar(out, 1, '"');
+    for (i = 0; i < n; i++) {
+        if (z[i] != '"' && z[i] != '\\' && z[i] >= 0x20) continue;
+        cortex_str_append(out, (const char *)z + run, i - run);
+        if (z[i] < 0x20) {
+            cortex_str_appendf(out, "\\u%04x", z[i]);
+        } else {
+            cortex_str_appendchar(out, 1, '\\');
+            cortex_str_appendchar(out, 1, (char)z[i]);
+        }
+        run = i + 1;
+    }
+    cortex_str_append(out, (const char *)z + run, n - run);
+    cortex_str_appendchar(out, 1, '"');
+}
+
+/*
+    An IN list as a JSON array. NULL and BLOB values become null, which
+    json_each() hands back as NULL and so matches no row.
+*/
+static int bind_in_list(cortex_stmt *stmt, int slot, cortex_value *list) {
+    cortex_str *json = cortex_str_new(NULL);
+    cortex_value *val;
+    char *text;
+    int rc, len, first = 1;
+
+    cortex_str_appendchar(json, 1, '[');
+    for (rc = cortex_vtab_in_first(list, &val); rc == CORTEX_OK; rc = cortex_vtab_in_next(list, &val)) {
+        if (!first) cortex_str_appendchar(json, 1, ',');
+        first = 0;
+        switch (cortex_value_type(val)) {
+            case CORTEX_INTEGER:
+                cortex_str_appendf(json, "%lld", cortex_value_int64(val));
+                break;
+            case CORTEX_FLOAT: {
+                double d = cortex_value_double(val);
+                if (isinf(d)) {
+                    cortex_str_appendall(json, d > 0 ? "9e999" : "-9e999");
+                } else {
+                    cortex_str_appendf(json, "%!.17g", d);
+                }
+                break;
+            }
+            case CORTEX_TEXT:
+                json_string(json, cortex_value_text(val), cortex_value_bytes(val));
+                break;
+            default:
+                cortex_str_appendall(json, "null");
+        }
+    }
+    cortex_str_appendchar(json, 1, ']');
+    len = cortex_str_length(json);
+    text = cortex_str_finish(json);
+    if (rc != CORTEX_DONE) {
+        cortex_free(text);
+        return rc;
+    }
+    if (text == NULL) return CORTEX_NOMEM;
+    return cortex_bind_text(stmt, slot, text, len, cortex_free);
+}
+
+int vec_meta_filter(vec_meta *m, const char *idx_str, cortex_value **argv,
+                    cortex_int64 **rowids, int *n_out) {
+    cortex_stmt *stmt = NULL;
+    cortex_int64 *ids = NULL;
+    int n_filters = (int)strlen(idx_str) / 2, cap = 0, n = 0, i, rc;
+
+    *rowids = NULL;
+    *n_out = 0;
+    rc = filter_plan(m, idx_str, &stmt);
+    for (i = 0; rc == CORTEX_OK && i < n_filters; i++) {
+        if (idx_str[2 * i + 1] == 'I') {
+            rc = bind_in_list(stmt, i + 1, argv[i]);
+        } else {
+            rc = cortex_bind_value(stmt, i + 1, argv[i]);
+        }
+    }
+
+    while (rc == CORTEX_OK && (rc = cortex_step(stmt)) == CORTEX_ROW) {
+        rc = CORTEX_OK;
+        if (n == cap) {
+            cortex_int64 *grown;
+            cap = cap ? cap * 2 : 256;
+            grown = cortex_realloc64(ids, (cortex_uint64)cap * sizeof(cortex_int64));
+            if (grown == NULL) {
+                rc = CORTEX_NOMEM;
+                break;
+            }
+            ids = grown;
+        }
+        ids[n++] = cortex_column_int64(stmt, 0);
+    }
+    if (stmt) {
+        cortex_reset(stmt);
+        cortex_clear_bindings(stmt);
+    }
+    if (rc != CORTEX_DONE) {
+        cortex_free(ids);
+        return rc;
+    }
+    *rowids = ids;
+    *n_out = n;
+    return CORTEX_OK;
+}
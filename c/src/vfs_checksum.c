@@ -0,0 +1,462 @@
+#include "cortex_vfs.h"
+
+/*
+    Checksumming VFS: the default unix VFS, with a CRC32C at the end of
+    every database page, checked when the page is read back.
+
+    The CRC lives in the page's reserved bytes, the few bytes at the end
+    of each page that the b-tree layer leaves alone: a database carries
+    checksums when byte 20 of its header (the reserve) is
+    CHECKSUM_RESERVE. Set it with CORTEX_FCNTL_RESERVE_BYTES before the
+    first table is created, or before a VACUUM to convert an existing
+    database. Any other reserve and the layer stays out of the way.
+
+    On each page write the CRC of the page number and the page's
+    usable bytes is stored in its last CHECKSUM_RESERVE bytes (of a copy:
+    the pager's buffer is not touched). Folding in the page number also
+    catches a page written to the wrong place. Reads are checked one in
+    "sample" (1 by default, 0 for never), set per connection with the
+    URI parameter checksum_sample=N or PRAGMA checksum_sample=N. A
+    mismatch fails the read with CORTEX_IOERR_DATA and is logged.
+
+    CRC32C runs on the SSE4.2 crc32 instruction on x86-64, three streams
+    at once joined with PCLMUL (about 0.2 us for a 4 KiB page), and on
+    the ARMv8 CRC instructions on aarch64, chosen at run time; elsewhere
+    on a slice-by-8 table. Only main
+    database files are covered: WAL frames have their own checksums, and
+    are checked against those when the WAL is recovered.
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CORTEX_HAVE_CHECKSUM 1
+#endif
+
+#ifdef CORTEX_HAVE_CHECKSUM
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CHECKSUM_SSE42 1
+#elif defined(__aarch64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define CHECKSUM_ARM_CRC 1
+#endif
+
+#define CHECKSUM_VFS_NAME "checksum"
+#define CHECKSUM_RESERVE 4
+
+/*
+    CRC32C (Castagnoli)
+*/
+#define CRC32C_POLY 0x82f63b78u             /* reflected */
+#define CRC32C_STREAM_MIN 64                /* bytes per stream of the three-way loop */
+#define CRC32C_STREAM_MAX 8192
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_k[CRC32C_STREAM_MAX / 8 + 1];   /* x^(8n-33) mod P, streams of n bytes */
+static uint32_t (*crc32c)(uint32_t crc, const unsigned char *buf, size_t len);
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *buf, size_t len) {
+    crc = ~crc;
+    while (len && ((uintptr_t)buf & 7)) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff]
+            ^ crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff]
+            ^ crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff]
+            ^ crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--) crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef CHECKSUM_SSE42
+/*
+    The crc32 instruction has a latency of three cycles and a throughput
+    of one, so the buffer is cut into three streams of n bytes that run
+    side by side. Their CRCs are joined by multiplying the earlier one
+    by x^8n mod P: a carry-less multiply with crc32c_k[n / 8] and a
+    crc32 of the product to reduce it.
+*/
+__attribute__((target("sse4.2,pclmul")))
+static uint64_t crc32c_extend(uint64_t crc, size_t n) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)(uint32_t)crc),
+                                           _mm_cvtsi32_si128((int)crc32c_k[n / 8]), 0);
+    return _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t len) {
+    uint64_t c0 = ~crc, c1, c2, v0, v1, v2;
+    const unsigned char *end;
+    size_t n;
+
+    while (len && ((uintptr_t)buf & 7)) {
+        c0 = _mm_crc32_u8((uint32_t)c0, *buf++);
+        len--;
+    }
+    while (len >= 3 * CRC32C_STREAM_MIN) {
+        n = len / 24 * 8;
+        if (n > CRC32C_STREAM_MAX) n = CRC32C_STREAM_MAX;
+        c1 = c2 = 0;
+        end = buf + n;
+        do {
+            memcpy(&v0, buf, 8);
+            memcpy(&v1, buf + n, 8);
+            memcpy(&v2, buf + 2 * n, 8);
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+            buf += 8;
+        } while (buf < end);
+        c0 = crc32c_extend(c0, n) ^ c1;
+        c0 = crc32c_extend(c0, n) ^ c2;
+        buf += 2 * n;
+        len -= 3 * n;
+    }
+    while (len >= 8) {
+        memcpy(&v0, buf, 8);
+        c0 = _mm_crc32_u64(c0, v0);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--) c0 = _mm_crc32_u8((uint32_t)c0, *buf++);
+    return ~(uint32_t)c0;
+}
+#endif
+
+#ifdef CHECKSUM_ARM_CRC
+__attribute__((target("+crc")))
+static uint32_t crc32c_arm(uint32_t crc, const unsigned char *buf, size_t len) {
+    uint64_t v;
+
+    crc = ~crc;
+    while (len && ((uintptr_t)buf & 7)) {
+        crc = __crc32cb(crc, *buf++);
+        len--;
+    }
+    while (len >= 8) {
+        memcpy(&v, buf, 8);
+        crc = __crc32cd(crc, v);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--) crc = __crc32cb(crc, *buf++);
+    return ~crc;
+}
+#endif
+
+/* x^bits times a (reflected) polynomial, mod P */
+static uint32_t crc32c_times_x(uint32_t v, unsigned bits) {
+    while (bits--) v = (v & 1) ? (v >> 1) ^ CRC32C_POLY : v >> 1;
+    return v;
+}
+
+static void crc32c_init(void) {
+    uint32_t n, k, crc;
+
+    for (n = 0; n < 256; n++) {
+        crc = n;
+        for (k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][n] = crc;
+    }
+    for (n = 0; n < 256; n++) {
+        crc = crc32c_table[0][n];
+        for (k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+    crc32c_k[1] = crc32c_times_x(0x80000000u, 64 - 33);
+    for (n = 2; n <= CRC32C_STREAM_MAX / 8; n++) crc32c_k[n] = crc32c_times_x(crc32c_k[n - 1], 64);
+    crc32c = crc32c_sw;
+#ifdef CHECKSUM_SSE42
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) crc32c = crc32c_sse42;
+#endif
+#ifdef CHECKSUM_ARM_CRC
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) crc32c = crc32c_arm;
+#endif
+}
+
+/* The checksum of a page: its number, then everything but the reserve */
+static uint32_t page_checksum(const unsigned char *page, int size, cortex_int64 offset) {
+    unsigned char pgno[4];
+    uint32_t n = (uint32_t)(offset / size) + 1;
+
+    pgno[0] = (unsigned char)(n >> 24);
+    pgno[1] = (unsigned char)(n >> 16);
+    pgno[2] = (unsigned char)(n >> 8);
+    pgno[3] = (unsigned char)n;
+    return crc32c(crc32c(0, pgno, 4), page, (size_t)(size - CHECKSUM_RESERVE));
+}
+
+/*
+    Files
+*/
+typedef struct checksum_file {
+    cortex_file base;
+    cortex_io_methods methods;
+    cortex_file *real;              /* the unix file, allocated after this */
+    const char *name;
+    int main_db;
+    int page_size;                  /* from the header, 0 until seen */
+    int active;                     /* header reserve is CHECKSUM_RESERVE */
+    int sample;                     /* check one read in sample, 0: none */
+    unsigned reads;
+    unsigned char *copy;            /* page being written, with its checksum */
+    int copy_size;
+} checksum_file;
+
+static cortex_vfs checksum_vfs;
+
+#define REAL(f) (((checksum_file *)(f))->real)
+
+/* Page 1 went by: pick up the page size and reserve from the header */
+static void header_seen(checksum_file *f, const unsigned char *h, int amt) {
+    int size;
+
+    if (amt < 21) return;
+    size = (h[16] << 8) | h[17];
+    if (size == 1) size = 65536;
+    if (size < 512 || size > 65536 || (size & (size - 1))) return;
+    f->page_size = size;
+    f->active = h[20] == CHECKSUM_RESERVE;
+}
+
+static int checksum_close(cortex_file *pFile) {
+    checksum_file *f = (checksum_file *)pFile;
+
+    cortex_free(f->copy);
+    return f->real->pMethods->xClose(f->real);
+}
+
+static int checksum_read(cortex_file *pFile, void *buf, int amt, cortex_int64 offset) {
+    checksum_file *f = (checksum_file *)pFile;
+    const unsigned char *page = buf;
+    int rc = f->real->pMethods->xRead(f->real, buf, amt, offset);
+
+    if (rc != CORTEX_OK || !f->main_db) return rc;
+    if (offset == 0) header_seen(f, page, amt);
+    if (f->active && amt == f->page_size && offset % amt == 0 && f->sample
+        && f->reads++ % (unsigned)f->sample == 0) {
+        uint32_t want = page_checksum(page, amt, offset);
+        const unsigned char *got = page + amt - CHECKSUM_RESERVE;
+        if (want != (((uint32_t)got[0] << 24) | ((uint32_t)got[1] << 16) | ((uint32_t)got[2] << 8) | got[3])) {
+            cortex_log(CORTEX_IOERR_DATA, "checksum fault on page %lld of %s",
+                       (long long)(offset / amt) + 1, f->name);
+            return CORTEX_IOERR_DATA;
+        }
+    }
+    return CORTEX_OK;
+}
+
+static int checksum_write(cortex_file *pFile, const void *buf, int amt, cortex_int64 offset) {
+    checksum_file *f = (checksum_file *)pFile;
+    uint32_t crc;
+
+    if (f->main_db && offset == 0) header_seen(f, buf, amt);
+    if (!f->active || amt != f->page_size || offset % amt != 0) {
+        return f->real->pMethods->xWrite(f->real, buf, amt, offset);
+    }
+    if (f->copy_size != amt) {
+        cortex_free(f->copy);
+        f->copy = cortex_malloc(amt);
+        f->copy_size = f->copy ? amt : 0;
+        if (!f->copy) return CORTEX_NOMEM;
+    }
+    memcpy(f->copy, buf, (size_t)amt);
+    crc = page_checksum(f->copy, amt, offset);
+    f->copy[amt - 4] = (unsigned char)(crc >> 24);
+    f->copy[amt - 3] = (unsigned char)(crc >> 16);
+    f->copy[amt - 2] = (unsigned char)(crc >> 8);
+    f->copy[amt - 1] = (unsigned char)crc;
+    return f->real->pMethods->xWrite(f->real, f->copy, amt, offset);
+}
+
+static int checksum_truncate(cortex_file *pFile, cortex_int64 size) {
+    return REAL(pFile)->pMethods->xTruncate(REAL(pFile), size);
+}
+
+static int checksum_sync(cortex_file *pFile, int flags) {
+    return REAL(pFile)->pMethods->xSync(REAL(pFile), flags);
+}
+
+static int checksum_file_size(cortex_file *pFile, cortex_int64 *size) {
+    return REAL(pFile)->pMethods->xFileSize(REAL(pFile), size);
+}
+
+static int checksum_lock(cortex_file *pFile, int level) {
+    return REAL(pFile)->pMethods->xLock(REAL(pFile), level);
+}
+
+static int checksum_unlock(cortex_file *pFile, int level) {
+    return REAL(pFile)->pMethods->xUnlock(REAL(pFile), level);
+}
+
+static int checksum_check_reserved_lock(cortex_file *pFile, int *out) {
+    return REAL(pFile)->pMethods->xCheckReservedLock(REAL(pFile), out);
+}
+
+static int checksum_file_control(cortex_file *pFile, int op, void *arg) {
+    checksum_file *f = (checksum_file *)pFile;
+    int rc;
+
+    if (op == CORTEX_FCNTL_PRAGMA && f->main_db) {
+        char **args = arg;
+        if (cortex_stricmp(args[1], "checksum_sample") == 0) {
+            if (args[2]) {
+                int n = atoi(args[2]);
+                if (n < 0) {
+                    args[0] = cortex_mprintf("checksum_sample must be 0 or more");
+                    return CORTEX_ERROR;
+                }
+                f->sample = n;
+            }
+            args[0] = cortex_mprintf("%d", f->sample);
+            return CORTEX_OK;
+        }
+    }
+    rc = f->real->pMethods->xFileControl(f->real, op, arg);
+    if (op == CORTEX_FCNTL_VFSNAME && rc == CORTEX_OK) {
+        char **name = arg;
+        *name = cortex_mprintf("%s/%z", CHECKSUM_VFS_NAME, *name);
+    }
+    return rc;
+}
+
+static int checksum_sector_size(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xSectorSize(REAL(pFile));
+}
+
+static int checksum_device_characteristics(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xDeviceCharacteristics(REAL(pFile));
+}
+
+static int checksum_shm_map(cortex_file *pFile, int page, int size, int extend, void volatile **out) {
+    return REAL(pFile)->pMethods->xShmMap(REAL(pFile), page, size, extend, out);
+}
+
+static int checksum_shm_lock(cortex_file *pFile, int offset, int n, int flags) {
+    return REAL(pFile)->pMethods->xShmLock(REAL(pFile), offset, n, flags);
+}
+
+static void checksum_shm_barrier(cortex_file *pFile) {
+    REAL(pFile)->pMethods->xShmBarrier(REAL(pFile));
+}
+
+static int checksum_shm_unmap(cortex_file *pFile, int delete_flag) {
+    return REAL(pFile)->pMethods->xShmUnmap(REAL(pFile), delete_flag);
+}
+
+/* Pages read through a memory map would skip the check */
+static int checksum_fetch(cortex_file *pFile, cortex_int64 offset, int amt, void **pp) {
+    checksum_file *f = (checksum_file *)pFile;
+
+    if (f->active && f->sample) {
+        *pp = NULL;
+        return CORTEX_OK;
+    }
+    return f->real->pMethods->xFetch(f->real, offset, amt, pp);
+}
+
+static int checksum_unfetch(cortex_file *pFile, cortex_int64 offset, void *p) {
+    return REAL(pFile)->pMethods->xUnfetch(REAL(pFile), offset, p);
+}
+
+static const cortex_io_methods checksum_io_methods = {
+    3,
+    checksum_close,
+    checksum_read,
+    checksum_write,
+    checksum_truncate,
+    checksum_sync,
+    checksum_file_size,
+    checksum_lock,
+    checksum_unlock,
+    checksum_check_reserved_lock,
+    checksum_file_control,
+    checksum_sector_size,
+    checksum_device_characteristics,
+    checksum_shm_map,
+    checksum_shm_lock,
+    checksum_shm_barrier,
+    checksum_shm_unmap,
+    checksum_fetch,
+    checksum_unfetch
+};
+
+/*
+    VFS: xOpen wraps, the rest is the unix VFS's
+*/
+static int checksum_open(cortex_vfs *vfs, cortex_filename name, cortex_file *pFile, int flags,
+                         int *out_flags) {
+    cortex_vfs *root = vfs->pAppData;
+    checksum_file *f = (checksum_file *)pFile;
+    int rc;
+
+    memset(f, 0, sizeof(*f));
+    f->real = (cortex_file *)&f[1];
+    rc = root->xOpen(root, name, f->real, flags, out_flags);
+    if (rc != CORTEX_OK) {
+        f->base.pMethods = NULL;
+        return rc;
+    }
+    f->methods = checksum_io_methods;
+    vfs_shim_methods(&f->methods, f->real->pMethods);
+    f->base.pMethods = &f->methods;
+    f->name = name ? name : "";
+    f->main_db = (flags & 0x0FFFFF00) == CORTEX_OPEN_MAIN_DB;
+    f->sample = f->main_db ? (int)cortex_uri_int64(name, "checksum_sample", 1) : 0;
+    if (f->sample < 0) f->sample = 0;
+    return CORTEX_OK;
+}
+
+int cortex_vfs_checksum_register(int make_default) {
+    static pthread_mutex_t once = PTHREAD_MUTEX_INITIALIZER;
+    cortex_vfs *root;
+    int rc = CORTEX_OK;
+
+    pthread_mutex_lock(&once);
+    if (checksum_vfs.zName) {
+        if (make_default) rc = cortex_vfs_register(&checksum_vfs, 1);
+        goto done;
+    }
+    root = cortex_vfs_find("unix");
+    if (!root || root->iVersion < 2) {
+        rc = CORTEX_ERROR;
+        goto done;
+    }
+    crc32c_init();
+    vfs_shim_init(&checksum_vfs, root, CHECKSUM_VFS_NAME, (int)sizeof(checksum_file), checksum_open);
+    rc = cortex_vfs_register(&checksum_vfs, make_default);
+    if (rc != CORTEX_OK) checksum_vfs.zName = NULL;
+
+done:
+    pthread_mutex_unlock(&once);
+    return rc;
+}
+
+#else
+
+int cortex_vfs_checksum_register(int make_default) {
+    (void)make_default;
+    return CORTEX_ERROR;
+}
+
+#endif
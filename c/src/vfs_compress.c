@@ -0,0 +1,1233 @@
+#include "cortex_vfs.h"
+
+/*
+    Compressing VFS: the default unix VFS, with database pages stored
+    compressed (zstd or LZ4) behind a map of where each one lives.
+
+    The database file is cut into blocks of the page size it was created
+    with. Each block is compressed on its own and stored anywhere in the
+    file; the map holds, per block, its offset, stored length and codec,
+    so any logical offset is one map lookup and one pread away. Blocks
+    of zeroes are not stored at all, and a block that does not compress
+    is stored as is. Physical layout:
+
+        [0, 512)        header: magic, block size, codec and level for
+                        new blocks, logical size, where the map is, and
+                        a generation bumped every time the header is
+                        written
+        map             16 bytes per block, grown by doubling into a
+                        fresh region
+        data            blocks in COMPRESS_GRAIN units, first fit
+
+    Crash safety leans on the journal or WAL the way a plain file does:
+    after a crash, SQLite rewrites every page written since the last
+    xSync. So a block rewritten in place or a torn map entry is repaired
+    by recovery, as long as no page that was *not* written since then
+    loses its data. Space freed by moving or dropping a block is
+    therefore only reused after the map that no longer points at it has
+    reached the disk: frees wait in a pending list until the next xSync
+    (or, with synchronous=OFF, the end of the transaction). Map entries
+    are written one run of changed entries at a time, never rewriting
+    unchanged neighbours.
+
+    Connections of one process share one map per file. Other processes
+    are noticed by the header generation: it is checked whenever this
+    process starts a transaction (xLock to SHARED, or a WAL read mark)
+    or a WAL checkpoint, and a changed file is reloaded whole. Our own changes are written
+    back before the database lock or the checkpoint lock is released.
+
+    Only main database files are compressed. Journals, WAL files and
+    temporary files are the unix VFS's. Per database, the codec and
+    level for new blocks come from the URI parameters compress=zstd|lz4
+    and compress_level=N; blocks written with another codec earlier stay
+    readable.
+*/
+
+#if (defined(__unix__) || defined(__APPLE__)) && (defined(CORTEX_HAVE_ZSTD) || defined(CORTEX_HAVE_LZ4))
+#define CORTEX_HAVE_COMPRESS 1
+#endif
+
+#ifdef CORTEX_HAVE_COMPRESS
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef CORTEX_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef CORTEX_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#define COMPRESS_VFS_NAME "compress"
+#define COMPRESS_MAGIC "cortex compress"   /* 16 bytes with the terminator */
+#define COMPRESS_VERSION 1
+#define COMPRESS_HEADER 512
+#define COMPRESS_ENTRY 16                   /* bytes per map entry on disk */
+#define COMPRESS_GRAIN 64                   /* allocation unit */
+#define COMPRESS_MIN_MAP 1024               /* entries in the first map */
+#define COMPRESS_MAX_BLOCK 65536
+#define COMPRESS_RUN 256                    /* map entries per write */
+
+enum { CODEC_RAW, CODEC_ZSTD, CODEC_LZ4 };
+
+#define ENTRY_DIRTY 1                       /* changed since the last flush */
+#define ENTRY_SHARED 2                      /* overlaps another entry: never reuse */
+
+#define INFO(codec, len) (((unsigned)(codec) << 24) | (unsigned)(len))
+#define INFO_CODEC(info) ((int)((info) >> 24))
+#define INFO_LEN(info) ((int)((info) & 0xFFFFFF))
+
+typedef struct compress_entry {
+    cortex_int64 offset;            /* 0: a block of zeroes, not stored */
+    unsigned info;                  /* codec and stored length */
+    unsigned flags;                 /* in memory only */
+} compress_entry;
+
+typedef struct extent {
+    cortex_int64 offset;
+    cortex_int64 len;
+} extent;
+
+typedef struct extent_list {
+    extent *v;
+    int n;
+    int cap;
+} extent_list;
+
+/* Per file and process, shared by its connections */
+typedef struct compress_shared compress_shared;
+struct compress_shared {
+    compress_shared *next;
+    dev_t dev;
+    ino_t ino;
+    int refs;
+    pthread_mutex_t mutex;
+
+    int block;                      /* 0 until the first write */
+    int codec;                      /* for new blocks */
+    int level;
+    cortex_int64 size;              /* logical */
+    cortex_int64 map_offset;
+    cortex_int64 map_cap;           /* entries */
+    compress_entry *map;
+    cortex_int64 dirty_lo, dirty_hi;
+    int header_dirty;
+    cortex_uint64 gen;              /* of the header last read or written, 0: none */
+    cortex_uint64 epoch;            /* bumped by every block stored and every load */
+
+    cortex_int64 end;               /* end of allocated space */
+    extent_list free;               /* sorted, coalesced */
+    extent_list pending;            /* freed, reusable after the next flush */
+};
+
+typedef struct compress_file {
+    cortex_file base;
+    cortex_io_methods methods;
+    cortex_file *real;              /* the unix file, allocated after this */
+    compress_shared *shared;        /* NULL: not a main database, passed through */
+    int readonly;
+    int lock;
+    int codec;                      /* -1: the database's */
+    int level;
+
+    unsigned char *page;            /* one block, decoded */
+    unsigned char *packed;          /* one block, encoded */
+    int buf_block;                  /* block size the buffers are for */
+    cortex_int64 page_index;        /* block decoded in page, -1: none */
+    cortex_uint64 page_epoch;       /* ... and the shared epoch it was decoded at */
+    int packed_cap;
+#ifdef CORTEX_HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+} compress_file;
+
+static cortex_vfs compress_vfs;
+static pthread_mutex_t compress_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static compress_shared *compress_registry;
+
+#define REAL(f) (((compress_file *)(f))->real)
+
+#ifdef CORTEX_HAVE_ZSTD
+#define CODEC_DEFAULT CODEC_ZSTD
+#define LEVEL_DEFAULT 3
+#else
+#define CODEC_DEFAULT CODEC_LZ4
+#define LEVEL_DEFAULT 0
+#endif
+
+static cortex_int64 grains(cortex_int64 n) {
+    return (n + COMPRESS_GRAIN - 1) & ~(cortex_int64)(COMPRESS_GRAIN - 1);
+}
+
+static void put32(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static unsigned get32(const unsigned char *p) {
+    return ((unsigned)p[0] << 24) | ((unsigned)p[1] << 16) | ((unsigned)p[2] << 8) | p[3];
+}
+
+static void put64(unsigned char *p, cortex_uint64 v) {
+    put32(p, (unsigned)(v >> 32));
+    put32(p + 4, (unsigned)v);
+}
+
+static cortex_uint64 get64(const unsigned char *p) {
+    return ((cortex_uint64)get32(p) << 32) | get32(p + 4);
+}
+
+/*
+    Codecs
+*/
+static int codec_known(int codec) {
+#ifdef CORTEX_HAVE_ZSTD
+    if (codec == CODEC_ZSTD) return 1;
+#endif
+#ifdef CORTEX_HAVE_LZ4
+    if (codec == CODEC_LZ4) return 1;
+#endif
+    return codec == CODEC_RAW;
+}
+
+static int codec_bound(int block) {
+    int bound = block;
+#ifdef CORTEX_HAVE_ZSTD
+    if ((int)ZSTD_compressBound((size_t)block) > bound) bound = (int)ZSTD_compressBound((size_t)block);
+#endif
+#ifdef CORTEX_HAVE_LZ4
+    if (LZ4_compressBound(block) > bound) bound = LZ4_compressBound(block);
+#endif
+    return bound;
+}
+
+/* Sized for the file's block size; blocks only change size when the file is created */
+static int buffers_ready(compress_file *f, int block) {
+    if (f->buf_block == block) return CORTEX_OK;
+    cortex_free(f->page);
+    cortex_free(f->packed);
+    f->packed_cap = codec_bound(block);
+    f->page = cortex_malloc(block);
+    f->packed = cortex_malloc(f->packed_cap);
+    if (!f->page || !f->packed) {
+        cortex_free(f->page);
+        cortex_free(f->packed);
+        f->page = f->packed = NULL;
+        f->buf_block = 0;
+        return CORTEX_NOMEM;
+    }
+    f->buf_block = block;
+    f->page_index = -1;
+    return CORTEX_OK;
+}
+
+/*
+    Encode one block into f->packed. Sets *info; *out is what to store,
+    NULL for a block of zeroes.
+*/
+static int encode(compress_file *f, int codec, int level, const unsigned char *src, int block,
+                  const unsigned char **out, unsigned *info) {
+    int i, len = 0;
+
+    for (i = 0; i < block && !src[i]; i++) {
+    }
+    if (i == block) {
+        *out = NULL;
+        *info = 0;
+        return CORTEX_OK;
+    }
+#ifdef CORTEX_HAVE_ZSTD
+    if (codec == CODEC_ZSTD) {
+        size_t n;
+        if (!f->cctx && !(f->cctx = ZSTD_createCCtx())) return CORTEX_NOMEM;
+        n = ZSTD_compressCCtx(f->cctx, f->packed, (size_t)f->packed_cap, src, (size_t)block, level);
+        len = ZSTD_isError(n) ? 0 : (int)n;
+    }
+#endif
+#ifdef CORTEX_HAVE_LZ4
+    if (codec == CODEC_LZ4) {
+        len = level >= 3
+            ? LZ4_compress_HC((const char *)src, (char *)f->packed, block, f->packed_cap, level)
+            : LZ4_compress_default((const char *)src, (char *)f->packed, block, f->packed_cap);
+    }
+#endif
+    if (len <= 0 || len >= block) {
+        *out = src;
+        *info = INFO(CODEC_RAW, block);
+    } else {
+        *out = f->packed;
+        *info = INFO(codec, len);
+    }
+    return CORTEX_OK;
+}
+
+static int decode(compress_file *f, unsigned info, const unsigned char *src, unsigned char *dst,
+                  int block) {
+    int codec = INFO_CODEC(info), len = INFO_LEN(info);
+
+    (void)f;
+    if (codec == CODEC_RAW) {
+        if (len != block) return CORTEX_IOERR_READ;
+        if (src != dst) memcpy(dst, src, (size_t)block);
+        return CORTEX_OK;
+    }
+#ifdef CORTEX_HAVE_ZSTD
+    if (codec == CODEC_ZSTD) {
+        size_t n;
+        if (!f->dctx && !(f->dctx = ZSTD_createDCtx())) return CORTEX_NOMEM;
+        n = ZSTD_decompressDCtx(f->dctx, dst, (size_t)block, src, (size_t)len);
+        return !ZSTD_isError(n) && n == (size_t)block ? CORTEX_OK : CORTEX_IOERR_READ;
+    }
+#endif
+#ifdef CORTEX_HAVE_LZ4
+    if (codec == CODEC_LZ4) {
+        int n = LZ4_decompress_safe((const char *)src, (char *)dst, len, block);
+        return n == block ? CORTEX_OK : CORTEX_IOERR_READ;
+    }
+#endif
+    return CORTEX_IOERR_READ;
+}
+
+/*
+    Free space. Called with the shared mutex held.
+*/
+static int extent_push(extent_list *l, cortex_int64 offset, cortex_int64 len) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        extent *v = cortex_realloc(l->v, cap * (int)sizeof(extent));
+        if (!v) return CORTEX_NOMEM;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n].offset = offset;
+    l->v[l->n].len = len;
+    l->n++;
+    return CORTEX_OK;
+}
+
+/* Into the sorted free list, merged with its neighbours */
+static void free_insert(compress_shared *s, cortex_int64 offset, cortex_int64 len) {
+    extent_list *l = &s->free;
+    int lo = 0, hi = l->n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (l->v[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0 && l->v[lo - 1].offset + l->v[lo - 1].len == offset) {
+        l->v[lo - 1].len += len;
+        if (lo < l->n && offset + len == l->v[lo].offset) {
+            l->v[lo - 1].len += l->v[lo].len;
+            memmove(&l->v[lo], &l->v[lo + 1], (size_t)(l->n - lo - 1) * sizeof(extent));
+            l->n--;
+        }
+        return;
+    }
+    if (lo < l->n && offset + len == l->v[lo].offset) {
+        l->v[lo].offset = offset;
+        l->v[lo].len += len;
+        return;
+    }
+    /* out of memory only leaks the space until the file is next loaded */
+    if (extent_push(l, 0, 0) != CORTEX_OK) return;
+    memmove(&l->v[lo + 1], &l->v[lo], (size_t)(l->n - 1 - lo) * sizeof(extent));
+    l->v[lo].offset = offset;
+    l->v[lo].len = len;
+}
+
+static cortex_int64 space_alloc(compress_shared *s, cortex_int64 len) {
+    extent_list *l = &s->free;
+    cortex_int64 offset;
+    int i;
+
+    for (i = 0; i < l->n; i++) {
+        if (l->v[i].len < len) continue;
+        offset = l->v[i].offset;
+        l->v[i].offset += len;
+        l->v[i].len -= len;
+        if (l->v[i].len == 0) {
+            memmove(&l->v[i], &l->v[i + 1], (size_t)(l->n - i - 1) * sizeof(extent));
+            l->n--;
+        }
+        return offset;
+    }
+    offset = s->end;
+    s->end += len;
+    return offset;
+}
+
+static void space_free(compress_shared *s, cortex_int64 offset, cortex_int64 len) {
+    /* out of memory only leaks the space until the file is next loaded */
+    if (len > 0) extent_push(&s->pending, offset, len);
+}
+
+/* The map pointing elsewhere is on disk: pending space can be reused */
+static void space_release(compress_shared *s, cortex_file *real) {
+    extent_list *l = &s->free;
+    int i;
+
+    for (i = 0; i < s->pending.n; i++) free_insert(s, s->pending.v[i].offset, s->pending.v[i].len);
+    s->pending.n = 0;
+    if (l->n && l->v[l->n - 1].offset + l->v[l->n - 1].len == s->end) {
+        s->end = l->v[--l->n].offset;
+        real->pMethods->xTruncate(real, s->end);
+    }
+}
+
+/*
+    Header and map I/O. Called with the shared mutex held.
+*/
+
+/* The map can outgrow a single unix VFS read or write, which must stay under 128 KiB */
+#define COMPRESS_IO_MAX 65536
+
+static int real_write(cortex_file *real, const unsigned char *buf, cortex_int64 n, cortex_int64 offset) {
+    int rc = CORTEX_OK;
+
+    while (n > 0 && rc == CORTEX_OK) {
+        int chunk = n > COMPRESS_IO_MAX ? COMPRESS_IO_MAX : (int)n;
+        rc = real->pMethods->xWrite(real, buf, chunk, offset);
+        buf += chunk;
+        offset += chunk;
+        n -= chunk;
+    }
+    return rc;
+}
+
+static int real_read(cortex_file *real, unsigned char *buf, cortex_int64 n, cortex_int64 offset) {
+    int rc = CORTEX_OK;
+
+    while (n > 0 && rc == CORTEX_OK) {
+        int chunk = n > COMPRESS_IO_MAX ? COMPRESS_IO_MAX : (int)n;
+        rc = real->pMethods->xRead(real, buf, chunk, offset);
+        buf += chunk;
+        offset += chunk;
+        n -= chunk;
+    }
+    return rc;
+}
+static void entry_encode(unsigned char *p, const compress_entry *e) {
+    put64(p, (cortex_uint64)e->offset);
+    put32(p + 8, e->info);
+    put32(p + 12, 0);
+}
+
+static void mark_dirty(compress_shared *s, cortex_int64 i) {
+    s->map[i].flags |= ENTRY_DIRTY;
+    if (s->dirty_lo > i) s->dirty_lo = i;
+    if (s->dirty_hi < i + 1) s->dirty_hi = i + 1;
+}
+
+static int header_write(compress_shared *s, cortex_file *real) {
+    unsigned char h[COMPRESS_HEADER];
+    int rc;
+
+    memset(h, 0, sizeof(h));
+    memcpy(h, COMPRESS_MAGIC, sizeof(COMPRESS_MAGIC));
+    put32(h + 16, COMPRESS_VERSION);
+    put32(h + 20, (unsigned)s->block);
+    put32(h + 24, (unsigned)s->codec);
+    put32(h + 28, (unsigned)s->level);
+    put64(h + 32, (cortex_uint64)s->size);
+    put64(h + 40, (cortex_uint64)s->map_offset);
+    put64(h + 48, (cortex_uint64)s->map_cap);
+    put64(h + 56, s->gen + 1);
+    rc = real->pMethods->xWrite(real, h, sizeof(h), 0);
+    if (rc == CORTEX_OK) {
+        s->gen++;
+        s->header_dirty = 0;
+    }
+    return rc;
+}
+
+/* Write each run of changed map entries, then the header */
+static int flush(compress_shared *s, cortex_file *real) {
+    unsigned char buf[COMPRESS_RUN * COMPRESS_ENTRY];
+    cortex_int64 i = s->dirty_lo;
+    int rc;
+
+    while (i < s->dirty_hi) {
+        cortex_int64 start;
+        int n = 0;
+        if (!(s->map[i].flags & ENTRY_DIRTY)) {
+            i++;
+            continue;
+        }
+        start = i;
+        while (i < s->dirty_hi && n < COMPRESS_RUN && (s->map[i].flags & ENTRY_DIRTY)) {
+            entry_encode(buf + n * COMPRESS_ENTRY, &s->map[i]);
+            n++;
+            i++;
+        }
+        rc = real->pMethods->xWrite(real, buf, n * COMPRESS_ENTRY,
+                                    s->map_offset + start * COMPRESS_ENTRY);
+        if (rc != CORTEX_OK) return rc;
+        while (start < i) s->map[start++].flags &= ~ENTRY_DIRTY;
+    }
+    s->dirty_lo = s->map_cap;
+    s->dirty_hi = 0;
+    return s->header_dirty ? header_write(s, real) : CORTEX_OK;
+}
+
+/* Room in the map for entry i: a fresh region twice the size, written whole */
+static int map_reserve(compress_shared *s, cortex_file *real, cortex_int64 i) {
+    cortex_int64 cap = s->map_cap ? s->map_cap : COMPRESS_MIN_MAP, offset, j;
+    compress_entry *map;
+    unsigned char *buf;
+    int rc;
+
+    if (i < s->map_cap) return CORTEX_OK;
+    while (cap <= i) cap *= 2;
+    map = cortex_realloc64(s->map, (cortex_uint64)cap * sizeof(compress_entry));
+    buf = cortex_malloc64((cortex_uint64)cap * COMPRESS_ENTRY);
+    if (!map || !buf) {
+        if (map) s->map = map;
+        cortex_free(buf);
+        return CORTEX_NOMEM;
+    }
+    s->map = map;
+    memset(&map[s->map_cap], 0, (size_t)(cap - s->map_cap) * sizeof(compress_entry));
+    for (j = 0; j < cap; j++) {
+        entry_encode(buf + j * COMPRESS_ENTRY, &map[j]);
+        map[j].flags &= ~ENTRY_DIRTY;
+    }
+    offset = space_alloc(s, grains(cap * COMPRESS_ENTRY));
+    rc = real_write(real, buf, cap * COMPRESS_ENTRY, offset);
+    cortex_free(buf);
+    if (rc != CORTEX_OK) {
+        space_free(s, offset, grains(cap * COMPRESS_ENTRY));
+        return rc;
+    }
+    if (s->map_cap) space_free(s, s->map_offset, grains(s->map_cap * COMPRESS_ENTRY));
+    s->map_offset = offset;
+    s->map_cap = cap;
+    s->dirty_lo = cap;
+    s->dirty_hi = 0;
+    s->header_dirty = 1;
+    return CORTEX_OK;
+}
+
+typedef struct used_extent {
+    cortex_int64 offset;
+    cortex_int64 len;
+    cortex_int64 entry;             /* -1: the header or the map */
+} used_extent;
+
+static int cmp_used(const void *a, const void *b) {
+    const used_extent *x = a, *y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/*
+    Read the header and map, and work out the free space from what the
+    map uses. Entries that make no sense are blocks of zeroes; entries
+    that overlap (a crash between a move and its map write) are never
+    rewritten in place or freed, so recovery cannot clobber a neighbour.
+*/
+static int load(compress_shared *s, cortex_file *real) {
+    unsigned char h[COMPRESS_HEADER];
+    cortex_int64 file_size, blocks, i, last = -1;
+    unsigned char *buf = NULL;
+    used_extent *used = NULL;
+    int n_used = 0, rc;
+
+    cortex_free(s->map);
+    s->map = NULL;
+    s->map_cap = s->map_offset = 0;
+    s->free.n = s->pending.n = 0;
+    s->block = 0;
+    s->size = 0;
+    s->codec = CODEC_DEFAULT;
+    s->level = LEVEL_DEFAULT;
+    s->gen = 0;
+    s->epoch++;
+    s->header_dirty = 0;
+    s->end = COMPRESS_HEADER;
+    s->dirty_lo = s->dirty_hi = 0;
+
+    rc = real->pMethods->xFileSize(real, &file_size);
+    if (rc != CORTEX_OK) return rc;
+    if (file_size == 0) return CORTEX_OK;
+    rc = real->pMethods->xRead(real, h, sizeof(h), 0);
+    if (rc != CORTEX_OK) return rc == CORTEX_IOERR_SHORT_READ ? CORTEX_NOTADB : rc;
+    if (memcmp(h, COMPRESS_MAGIC, sizeof(COMPRESS_MAGIC)) != 0 || get32(h + 16) != COMPRESS_VERSION) {
+        return CORTEX_NOTADB;
+    }
+    s->block = (int)get32(h + 20);
+    s->codec = (int)get32(h + 24);
+    s->level = (int)get32(h + 28);
+    s->size = (cortex_int64)get64(h + 32);
+    s->map_offset = (cortex_int64)get64(h + 40);
+    s->map_cap = (cortex_int64)get64(h + 48);
+    s->gen = get64(h + 56);
+    if (s->block < 512 || s->block > COMPRESS_MAX_BLOCK || (s->block & (s->block - 1))
+        || s->size < 0 || s->map_cap < 0 || (s->map_cap && s->map_offset < COMPRESS_HEADER)
+        || s->map_offset + s->map_cap * COMPRESS_ENTRY > file_size) {
+        return CORTEX_CORRUPT;
+    }
+    if (!codec_known(s->codec)) s->codec = CODEC_DEFAULT;
+    blocks = (s->size + s->block - 1) / s->block;
+    if (blocks > s->map_cap) return CORTEX_CORRUPT;
+
+    s->map = cortex_malloc64((cortex_uint64)(s->map_cap ? s->map_cap : 1) * sizeof(compress_entry));
+    buf = cortex_malloc64((cortex_uint64)(s->map_cap ? s->map_cap : 1) * COMPRESS_ENTRY);
+    used = cortex_malloc64((cortex_uint64)(blocks + 2) * sizeof(used_extent));
+    if (!s->map || !buf || !used) {
+        rc = CORTEX_NOMEM;
+        goto done;
+    }
+    if (s->map_cap) {
+        rc = real_read(real, buf, s->map_cap * COMPRESS_ENTRY, s->map_offset);
+        if (rc != CORTEX_OK) goto done;
+    }
+    used[n_used].offset = 0;
+    used[n_used].len = COMPRESS_HEADER;
+    used[n_used++].entry = -1;
+    if (s->map_cap) {
+        used[n_used].offset = s->map_offset;
+        used[n_used].len = grains(s->map_cap * COMPRESS_ENTRY);
+        used[n_used++].entry = -1;
+    }
+    for (i = 0; i < s->map_cap; i++) {
+        compress_entry *e = &s->map[i];
+        int len;
+        e->offset = (cortex_int64)get64(buf + i * COMPRESS_ENTRY);
+        e->info = get32(buf + i * COMPRESS_ENTRY + 8);
+        e->flags = 0;
+        len = INFO_LEN(e->info);
+        if (i >= blocks || e->offset < COMPRESS_HEADER || e->offset + len > file_size || len <= 0
+            || len > s->block || !codec_known(INFO_CODEC(e->info))) {
+            e->offset = 0;
+            e->info = 0;
+            continue;
+        }
+        used[n_used].offset = e->offset;
+        used[n_used].len = grains(len);
+        used[n_used++].entry = i;
+    }
+
+    /* s->end is the furthest any extent so far reaches, last the one that does */
+    s->end = 0;
+    qsort(used, (size_t)n_used, sizeof(used_extent), cmp_used);
+    for (i = 0; i < n_used; i++) {
+        if (used[i].offset < s->end) {
+            if (used[i].entry >= 0) s->map[used[i].entry].flags |= ENTRY_SHARED;
+            if (used[last].entry >= 0) s->map[used[last].entry].flags |= ENTRY_SHARED;
+        } else if (used[i].offset > s->end) {
+            free_insert(s, s->end, used[i].offset - s->end);
+        }
+        if (used[i].offset + used[i].len > s->end) {
+            s->end = used[i].offset + used[i].len;
+            last = i;
+        }
+    }
+    s->dirty_lo = s->map_cap;
+    s->dirty_hi = 0;
+
+done:
+    cortex_free(buf);
+    cortex_free(used);
+    return rc;
+}
+
+/* Reload when another process has changed the file since we last looked */
+static int refresh(compress_shared *s, cortex_file *real) {
+    unsigned char h[COMPRESS_HEADER];
+    cortex_uint64 gen = 0;
+    int rc;
+
+    rc = real->pMethods->xRead(real, h, sizeof(h), 0);
+    if (rc == CORTEX_OK && memcmp(h, COMPRESS_MAGIC, sizeof(COMPRESS_MAGIC)) == 0) gen = get64(h + 56);
+    else if (rc != CORTEX_OK && rc != CORTEX_IOERR_SHORT_READ) return rc;
+    return gen == s->gen ? CORTEX_OK : load(s, real);
+}
+
+/*
+    Blocks
+*/
+static int block_decode(compress_file *f, const compress_entry *e, int block, unsigned char *dst) {
+    int rc, len;
+
+    if (!e->offset) {
+        memset(dst, 0, (size_t)block);
+        return CORTEX_OK;
+    }
+    rc = buffers_ready(f, block);
+    if (rc != CORTEX_OK) return rc;
+    len = INFO_LEN(e->info);
+    if (INFO_CODEC(e->info) == CODEC_RAW) {
+        rc = f->real->pMethods->xRead(f->real, dst, len, e->offset);
+        return rc == CORTEX_OK && len != block ? CORTEX_IOERR_READ : rc;
+    }
+    rc = f->real->pMethods->xRead(f->real, f->packed, len, e->offset);
+    if (rc != CORTEX_OK) return rc == CORTEX_IOERR_SHORT_READ ? CORTEX_IOERR_READ : rc;
+    return decode(f, e->info, f->packed, dst, block);
+}
+
+/*
+    Decode block i into dst. Decoding into f->page is remembered, so the
+    small reads SQLite makes of page 1 at the start of every transaction
+    do not decompress it each time.
+*/
+static int block_read(compress_file *f, cortex_int64 i, unsigned char *dst) {
+    compress_shared *s = f->shared;
+    compress_entry e = { 0, 0, 0 };
+    cortex_uint64 epoch;
+    int rc, block;
+
+    pthread_mutex_lock(&s->mutex);
+    block = s->block;
+    epoch = s->epoch;
+    if (i < s->map_cap) e = s->map[i];
+    pthread_mutex_unlock(&s->mutex);
+
+    if (dst == f->page) {
+        if (f->page_index == i && f->page_epoch == epoch) return CORTEX_OK;
+        f->page_index = -1;
+    }
+    rc = block_decode(f, &e, block, dst);
+    if (rc == CORTEX_OK && dst == f->page) {
+        f->page_index = i;
+        f->page_epoch = epoch;
+    }
+    return rc;
+}
+
+/* Store one encoded block as entry i. Called with the shared mutex held. */
+static int block_store(compress_file *f, cortex_int64 i, const unsigned char *data, unsigned info) {
+    compress_shared *s = f->shared;
+    compress_entry *e;
+    cortex_int64 need = grains(INFO_LEN(info)), have, offset = 0;
+    int rc;
+
+    rc = map_reserve(s, f->real, i);
+    if (rc != CORTEX_OK) return rc;
+    e = &s->map[i];
+    have = e->offset ? grains(INFO_LEN(e->info)) : 0;
+    if (data) {
+        if (e->offset && !(e->flags & ENTRY_SHARED) && need <= have) {
+            /* in place, as a plain file would; the tail is freed */
+            offset = e->offset;
+            space_free(s, offset + need, have - need);
+        } else {
+            offset = space_alloc(s, need);
+            if (e->offset && !(e->flags & ENTRY_SHARED)) space_free(s, e->offset, have);
+        }
+        rc = f->real->pMethods->xWrite(f->real, data, INFO_LEN(info), offset);
+        if (rc != CORTEX_OK) {
+            if (offset != e->offset) space_free(s, offset, need);
+            return rc;
+        }
+    } else if (e->offset && !(e->flags & ENTRY_SHARED)) {
+        space_free(s, e->offset, have);
+    }
+    s->epoch++;
+    if (e->offset != offset || e->info != info) {
+        e->offset = offset;
+        e->info = info;
+        e->flags &= ~ENTRY_SHARED;
+        mark_dirty(s, i);
+    }
+    return CORTEX_OK;
+}
+
+/*
+    File methods
+*/
+static int compress_close(cortex_file *pFile) {
+    compress_file *f = (compress_file *)pFile;
+    compress_shared *s = f->shared;
+
+    if (s) {
+        pthread_mutex_lock(&compress_registry_mutex);
+        if (--s->refs == 0) {
+            compress_shared **p;
+            for (p = &compress_registry; *p; p = &(*p)->next) {
+                if (*p == s) {
+                    *p = s->next;
+                    break;
+                }
+            }
+        } else {
+            s = NULL;
+        }
+        pthread_mutex_unlock(&compress_registry_mutex);
+        if (s) {
+            if (!f->readonly) flush(s, f->real);
+            pthread_mutex_destroy(&s->mutex);
+            cortex_free(s->map);
+            cortex_free(s->free.v);
+            cortex_free(s->pending.v);
+            cortex_free(s);
+        }
+        cortex_free(f->page);
+        cortex_free(f->packed);
+#ifdef CORTEX_HAVE_ZSTD
+        ZSTD_freeCCtx(f->cctx);
+        ZSTD_freeDCtx(f->dctx);
+#endif
+    }
+    return f->real->pMethods->xClose(f->real);
+}
+
+static int compress_read(cortex_file *pFile, void *buf, int amt, cortex_int64 offset) {
+    compress_file *f = (compress_file *)pFile;
+    compress_shared *s = f->shared;
+    unsigned char *out = buf;
+    cortex_int64 size;
+    int block, rc = CORTEX_OK, n = amt;
+
+    if (!s) return f->real->pMethods->xRead(f->real, buf, amt, offset);
+
+    pthread_mutex_lock(&s->mutex);
+    size = s->size;
+    block = s->block;
+    pthread_mutex_unlock(&s->mutex);
+    if (offset >= size) n = 0;
+    else if (offset + amt > size) n = (int)(size - offset);
+
+    while (n > 0 && rc == CORTEX_OK) {
+        cortex_int64 i = offset / block;
+        int skip = (int)(offset % block), take = block - skip;
+        if (take > n) take = n;
+        if (take == block) {
+            rc = block_read(f, i, out);
+        } else if ((rc = buffers_ready(f, block)) == CORTEX_OK
+                   && (rc = block_read(f, i, f->page)) == CORTEX_OK) {
+            memcpy(out, f->page + skip, (size_t)take);
+        }
+        out += take;
+        offset += take;
+        n -= take;
+    }
+    if (rc != CORTEX_OK) return rc;
+    if (out < (unsigned char *)buf + amt) {
+        memset(out, 0, (size_t)((unsigned char *)buf + amt - out));
+        return CORTEX_IOERR_SHORT_READ;
+    }
+    return CORTEX_OK;
+}
+
+static int compress_write(cortex_file *pFile, const void *buf, int amt, cortex_int64 offset) {
+    compress_file *f = (compress_file *)pFile;
+    compress_shared *s = f->shared;
+    const unsigned char *in = buf;
+    int block, codec, level, rc;
+
+    if (!s) return f->real->pMethods->xWrite(f->real, buf, amt, offset);
+
+    pthread_mutex_lock(&s->mutex);
+    if (!s->block) {
+        /* blocks are the page size the database is created with */
+        s->block = (amt >= 512 && amt <= COMPRESS_MAX_BLOCK && !(amt & (amt - 1)) && offset % amt == 0)
+            ? amt : 4096;
+        s->header_dirty = 1;
+    }
+    block = s->block;
+    codec = f->codec >= 0 ? f->codec : s->codec;
+    level = f->codec >= 0 ? f->level : s->level;
+    pthread_mutex_unlock(&s->mutex);
+
+    rc = buffers_ready(f, block);
+    while (amt > 0 && rc == CORTEX_OK) {
+        cortex_int64 i = offset / block;
+        int skip = (int)(offset % block), take = block - skip;
+        const unsigned char *src = in, *data;
+        unsigned info;
+        if (take > amt) take = amt;
+        if (take < block) {
+            /* part of a block: merge with what is there */
+            rc = block_read(f, i, f->page);
+            if (rc != CORTEX_OK) break;
+            memcpy(f->page + skip, in, (size_t)take);
+            f->page_index = -1;
+            src = f->page;
+        }
+        rc = encode(f, codec, level, src, block, &data, &info);
+        if (rc != CORTEX_OK) break;
+        pthread_mutex_lock(&s->mutex);
+        rc = block_store(f, i, data, info);
+        if (rc == CORTEX_OK && offset + take > s->size) {
+            s->size = offset + take;
+            s->header_dirty = 1;
+        }
+        pthread_mutex_unlock(&s->mutex);
+        in += take;
+        offset += take;
+        amt -= take;
+    }
+    return rc;
+}
+
+static int compress_truncate(cortex_file *pFile, cortex_int64 size) {
+    compress_file *f = (compress_file *)pFile;
+    compress_shared *s = f->shared;
+    cortex_int64 i, blocks;
+    int rc = CORTEX_OK, tail;
+
+    if (!s) return f->real->pMethods->xTruncate(f->real, size);
+
+    pthread_mutex_lock(&s->mutex);
+    if (size >= s->size || !s->block) {
+        pthread_mutex_unlock(&s->mutex);
+        return CORTEX_OK;
+    }
+    blocks = (size + s->block - 1) / s->block;
+    for (i = blocks; i < s->map_cap && i * s->block < s->size; i++) {
+        rc = block_store(f, i, NULL, 0);
+        if (rc != CORTEX_OK) break;
+    }
+    tail = (int)(size % s->block);
+    pthread_mutex_unlock(&s->mutex);
+
+    if (rc == CORTEX_OK && tail) {
+        /* what was past the end reads back as zeroes if the file grows again */
+        rc = buffers_ready(f, s->block);
+        if (rc == CORTEX_OK) rc = block_read(f, blocks - 1, f->page);
+        if (rc == CORTEX_OK) {
+            const unsigned char *data;
+            unsigned info;
+            memset(f->page + tail, 0, (size_t)(s->block - tail));
+            f->page_index = -1;
+            rc = encode(f, f->codec >= 0 ? f->codec : s->codec, f->codec >= 0 ? f->level : s->level,
+                        f->page, s->block, &data, &info);
+            pthread_mutex_lock(&s->mutex);
+            if (rc == CORTEX_OK) rc = block_store(f, blocks - 1, data, info);
+            pthread_mutex_unlock(&s->mutex);
+        }
+    }
+    if (rc == CORTEX_OK) {
+        pthread_mutex_lock(&s->mutex);
+        s->size = size;
+        s->header_dirty = 1;
+        pthread_mutex_unlock(&s->mutex);
+    }
+    return rc;
+}
+
+static int compress_sync(cortex_file *pFile, int flags) {
+    compress_file *f = (compress_file *)pFile;
+    compress_shared *s = f->shared;
+    int rc = CORTEX_OK;
+
+    if (s && !f->readonly) {
+        pthread_mutex_lock(&s->mutex);
+        rc = flush(s, f->real);
+        pthread_mutex_unlock(&s->mutex);
+    }
+    if (rc == CORTEX_OK) rc = f->real->pMethods->xSync(f->real, flags);
+    if (s && !f->readonly && rc == CORTEX_OK) {
+        pthread_mutex_lock(&s->mutex);
+        space_release(s, f->real);
+        pthread_mutex_unlock(&s->mutex);
+    }
+    return rc;
+}
+
+static int compress_file_size(cortex_file *pFile, cortex_int64 *size) {
+    compress_file *f = (compress_file *)pFile;
+
+    if (!f->shared) return f->real->pMethods->xFileSize(f->real, size);
+    pthread_mutex_lock(&f->shared->mutex);
+    *size = f->shared->size;
+    pthread_mutex_unlock(&f->shared->mutex);
+    return CORTEX_OK;
+}
+
+/* End of a write: make our changes visible to other processes */
+static int publish(compress_file *f) {
+    compress_shared *s = f->shared;
+    int rc;
+
+    if (f->readonly) return CORTEX_OK;
+    pthread_mutex_lock(&s->mutex);
+    rc = flush(s, f->real);
+    /* without xSync (synchronous=OFF) this is the only chance to reuse space */
+    if (rc == CORTEX_OK) space_release(s, f->real);
+    pthread_mutex_unlock(&s->mutex);
+    return rc;
+}
+
+static int compress_lock(cortex_file *pFile, int level) {
+    compress_file *f = (compress_file *)pFile;
+    int rc = f->real->pMethods->xLock(f->real, level);
+
+    if (rc != CORTEX_OK || !f->shared) return rc;
+    if (f->lock == CORTEX_LOCK_NONE && level >= CORTEX_LOCK_SHARED) {
+        pthread_mutex_lock(&f->shared->mutex);
+        rc = refresh(f->shared, f->real);
+        pthread_mutex_unlock(&f->shared->mutex);
+        if (rc != CORTEX_OK) {
+            f->real->pMethods->xUnlock(f->real, CORTEX_LOCK_NONE);
+            return rc == CORTEX_NOMEM ? rc : CORTEX_IOERR_LOCK;
+        }
+    }
+    f->lock = level;
+    return CORTEX_OK;
+}
+
+static int compress_unlock(cortex_file *pFile, int level) {
+    compress_file *f = (compress_file *)pFile;
+    int rc = CORTEX_OK;
+
+    if (f->shared && f->lock > CORTEX_LOCK_SHARED && level <= CORTEX_LOCK_SHARED) rc = publish(f);
+    if (f->shared) f->lock = level;
+    if (rc == CORTEX_OK) rc = f->real->pMethods->xUnlock(f->real, level);
+    return rc;
+}
+
+static int compress_check_reserved_lock(cortex_file *pFile, int *out) {
+    return REAL(pFile)->pMethods->xCheckReservedLock(REAL(pFile), out);
+}
+
+static int compress_file_control(cortex_file *pFile, int op, void *arg) {
+    compress_file *f = (compress_file *)pFile;
+    int rc;
+
+    /* sizes are logical here: do not let the unix VFS preallocate */
+    if (f->shared && (op == CORTEX_FCNTL_SIZE_HINT || op == CORTEX_FCNTL_CHUNK_SIZE)) return CORTEX_OK;
+    rc = f->real->pMethods->xFileControl(f->real, op, arg);
+    if (op == CORTEX_FCNTL_VFSNAME && rc == CORTEX_OK) {
+        char **name = arg;
+        *name = cortex_mprintf("%s/%z", COMPRESS_VFS_NAME, *name);
+    }
+    return rc;
+}
+
+static int compress_sector_size(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xSectorSize(REAL(pFile));
+}
+
+static int compress_device_characteristics(cortex_file *pFile) {
+    compress_file *f = (compress_file *)pFile;
+    int caps = f->real->pMethods->xDeviceCharacteristics(f->real);
+
+    if (!f->shared) return caps;
+    return caps & ~(CORTEX_IOCAP_ATOMIC | CORTEX_IOCAP_ATOMIC512 | CORTEX_IOCAP_ATOMIC1K
+                    | CORTEX_IOCAP_ATOMIC2K | CORTEX_IOCAP_ATOMIC4K | CORTEX_IOCAP_ATOMIC8K
+                    | CORTEX_IOCAP_ATOMIC16K | CORTEX_IOCAP_ATOMIC32K | CORTEX_IOCAP_ATOMIC64K
+                    | CORTEX_IOCAP_SAFE_APPEND | CORTEX_IOCAP_BATCH_ATOMIC);
+}
+
+static int compress_shm_map(cortex_file *pFile, int page, int size, int extend, void volatile **out) {
+    return REAL(pFile)->pMethods->xShmMap(REAL(pFile), page, size, extend, out);
+}
+
+/*
+    In WAL mode the database lock is held for as long as the connection
+    is open. Transactions start with a read mark (locks 3 and up), and a
+    checkpoint writes the database under the checkpoint lock (1): look
+    for other processes' changes when either is taken, publish ours when
+    the checkpoint lock is released.
+*/
+static int compress_shm_lock(cortex_file *pFile, int offset, int n, int flags) {
+    compress_file *f = (compress_file *)pFile;
+    int ckpt = f->shared && offset <= 1 && offset + n > 1 && (flags & CORTEX_SHM_EXCLUSIVE);
+    int read = f->shared && offset >= 3 && (flags & CORTEX_SHM_SHARED);
+    int rc;
+
+    if (ckpt && (flags & CORTEX_SHM_UNLOCK)) publish(f);
+    rc = f->real->pMethods->xShmLock(f->real, offset, n, flags);
+    if ((ckpt || read) && (flags & CORTEX_SHM_LOCK) && rc == CORTEX_OK) {
+        pthread_mutex_lock(&f->shared->mutex);
+        rc = refresh(f->shared, f->real);
+        pthread_mutex_unlock(&f->shared->mutex);
+        if (rc != CORTEX_OK) {
+            f->real->pMethods->xShmLock(f->real, offset, n, (flags & ~CORTEX_SHM_LOCK) | CORTEX_SHM_UNLOCK);
+            rc = CORTEX_IOERR_SHMLOCK;
+        }
+    }
+    return rc;
+}
+
+static void compress_shm_barrier(cortex_file *pFile) {
+    REAL(pFile)->pMethods->xShmBarrier(REAL(pFile));
+}
+
+static int compress_shm_unmap(cortex_file *pFile, int delete_flag) {
+    return REAL(pFile)->pMethods->xShmUnmap(REAL(pFile), delete_flag);
+}
+
+/* Pages are never where their offset says: no memory mapping */
+static int compress_fetch(cortex_file *pFile, cortex_int64 offset, int amt, void **pp) {
+    compress_file *f = (compress_file *)pFile;
+
+    if (!f->shared) return f->real->pMethods->xFetch(f->real, offset, amt, pp);
+    *pp = NULL;
+    return CORTEX_OK;
+}
+
+static int compress_unfetch(cortex_file *pFile, cortex_int64 offset, void *p) {
+    compress_file *f = (compress_file *)pFile;
+
+    if (!f->shared) return f->real->pMethods->xUnfetch(f->real, offset, p);
+    return CORTEX_OK;
+}
+
+static const cortex_io_methods compress_io_methods = {
+    3,
+    compress_close,
+    compress_read,
+    compress_write,
+    compress_truncate,
+    compress_sync,
+    compress_file_size,
+    compress_lock,
+    compress_unlock,
+    compress_check_reserved_lock,
+    compress_file_control,
+    compress_sector_size,
+    compress_device_characteristics,
+    compress_shm_map,
+    compress_shm_lock,
+    compress_shm_barrier,
+    compress_shm_unmap,
+    compress_fetch,
+    compress_unfetch
+};
+
+/*
+    VFS: xOpen wraps, the rest is the unix VFS's
+*/
+
+/* compress= and compress_level= of a database URI; codec is -1 without them */
+static int uri_codec(cortex_filename name, int *codec, int *level) {
+    const char *algo = cortex_uri_parameter(name, "compress");
+
+    *codec = -1;
+    *level = 0;
+    if (!algo) return CORTEX_OK;
+    if (strcmp(algo, "zstd") == 0) {
+        *codec = CODEC_ZSTD;
+        *level = 3;
+    } else if (strcmp(algo, "lz4") == 0) {
+        *codec = CODEC_LZ4;
+    } else if (strcmp(algo, "none") == 0) {
+        *codec = CODEC_RAW;
+    }
+    if (*codec < 0 || !codec_known(*codec)) return CORTEX_ERROR;
+    *level = (int)cortex_uri_int64(name, "compress_level", *level);
+    return CORTEX_OK;
+}
+
+/* The file's shared state, loaded by its first connection in this process */
+static int shared_attach(compress_file *f, const char *path) {
+    compress_shared *s;
+    struct stat st;
+    int rc = CORTEX_OK;
+
+    if (stat(path, &st) != 0) return CORTEX_CANTOPEN;
+    pthread_mutex_lock(&compress_registry_mutex);
+    for (s = compress_registry; s; s = s->next) {
+        if (s->dev == st.st_dev && s->ino == st.st_ino) break;
+    }
+    if (s) {
+        s->refs++;
+    } else {
+        s = cortex_malloc(sizeof(*s));
+        if (!s) {
+            rc = CORTEX_NOMEM;
+        } else {
+            memset(s, 0, sizeof(*s));
+            s->dev = st.st_dev;
+            s->ino = st.st_ino;
+            pthread_mutex_init(&s->mutex, NULL);
+            rc = load(s, f->real);
+            if (rc == CORTEX_OK) {
+                s->refs = 1;
+                s->next = compress_registry;
+                compress_registry = s;
+            } else {
+                pthread_mutex_destroy(&s->mutex);
+                cortex_free(s->map);
+                cortex_free(s->free.v);
+                cortex_free(s->pending.v);
+                cortex_free(s);
+                s = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&compress_registry_mutex);
+    f->shared = s;
+    return rc;
+}
+
+static int compress_open(cortex_vfs *vfs, cortex_filename name, cortex_file *pFile, int flags,
+                         int *out_flags) {
+    cortex_vfs *root = vfs->pAppData;
+    compress_file *f = (compress_file *)pFile;
+    int rc;
+
+    memset(f, 0, sizeof(*f));
+    f->real = (cortex_file *)&f[1];
+    f->page_index = -1;
+    rc = root->xOpen(root, name, f->real, flags, out_flags);
+    if (rc != CORTEX_OK) {
+        f->base.pMethods = NULL;
+        return rc;
+    }
+    f->methods = compress_io_methods;
+    vfs_shim_methods(&f->methods, f->real->pMethods);
+    f->base.pMethods = &f->methods;
+
+    if ((flags & 0x0FFFFF00) != CORTEX_OPEN_MAIN_DB || !name) return CORTEX_OK;
+    f->readonly = (flags & CORTEX_OPEN_READONLY) != 0
+        || (out_flags && (*out_flags & CORTEX_OPEN_READONLY));
+    rc = uri_codec(name, &f->codec, &f->level);
+    if (rc == CORTEX_OK) rc = shared_attach(f, name);
+    if (rc == CORTEX_OK && f->codec >= 0 && !f->readonly) {
+        /* the URI's choice becomes the database's for blocks written from now on */
+        pthread_mutex_lock(&f->shared->mutex);
+        if (f->shared->codec != f->codec || f->shared->level != f->level) {
+            f->shared->codec = f->codec;
+            f->shared->level = f->level;
+            f->shared->header_dirty = f->shared->block != 0;
+        }
+        pthread_mutex_unlock(&f->shared->mutex);
+    }
+    if (rc != CORTEX_OK) {
+        f->real->pMethods->xClose(f->real);
+        f->base.pMethods = NULL;
+    }
+    return rc;
+}
+
+int cortex_vfs_compress_register(int make_default) {
+    static pthread_mutex_t once = PTHREAD_MUTEX_INITIALIZER;
+    cortex_vfs *root;
+    int rc = CORTEX_OK;
+
+    pthread_mutex_lock(&once);
+    if (compress_vfs.zName) {
+        if (make_default) rc = cortex_vfs_register(&compress_vfs, 1);
+        goto done;
+    }
+    root = cortex_vfs_find("unix");
+    if (!root || root->iVersion < 2) {
+        rc = CORTEX_ERROR;
+        goto done;
+    }
+    vfs_shim_init(&compress_vfs, root, COMPRESS_VFS_NAME, (int)sizeof(compress_file), compress_open);
+    rc = cortex_vfs_register(&compress_vfs, make_default);
+    if (rc != CORTEX_OK) compress_vfs.zName = NULL;
+
+done:
+    pthread_mutex_unlock(&once);
+    return rc;
+}
+
+#else
+
+int cortex_vfs_compress_register(int make_default) {
+    (void)make_default;
+    return CORTEX_ERROR;
+}
+
+#endif
@@ -0,0 +1,459 @@
+#include "cortex_vfs.h"
+
+/*
+    Read-ahead VFS: the default unix VFS, with sequential and strided
+    page reads of database files served from background read-ahead.
+
+    SQLite reads one page per xRead. On a cold file a table or index
+    scan is then a string of 4 KiB preads, each waiting on the device
+    while the CPU idles. This layer watches the offsets each database
+    file is read at. After PREFETCH_RUN reads in a row that advance by
+    the same stride (at most PREFETCH_MAX_STRIDE reads apart, so index
+    scans that skip a few pages count too), it asks the file's worker
+    thread to read the window that follows into a private buffer. There
+    are two windows: while one is being consumed, the next is read, so
+    the device and the scan run side by side. Each window that is used
+    up doubles the next, up to PREFETCH_MAX_WINDOW.
+
+    A window is only valid under the snapshot it was read in. Any lock
+    change (xLock, xUnlock, or a WAL read mark taken or dropped through
+    xShmLock), write or truncate through this file drops both windows
+    and bumps a generation, so reads still in flight are thrown away.
+    Within one read transaction the pages SQLite takes from the database
+    file cannot change under it: rollback mode holds a SHARED lock, and
+    a WAL checkpoint only copies back pages a reader finds in the WAL.
+
+    The worker reads with pread() on the unix VFS's own descriptor, so
+    only database files whose descriptor can be recovered take part;
+    everything else, and every method but xRead, is the unix VFS as is.
+    PRAGMA prefetch_windows reports how many windows the database file
+    has queued for its worker.
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CORTEX_HAVE_PREFETCH 1
+#endif
+
+#ifdef CORTEX_HAVE_PREFETCH
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PREFETCH_VFS_NAME "prefetch"
+#define PREFETCH_RUN 2                      /* equal strides before reading ahead */
+#define PREFETCH_MAX_STRIDE 8               /* in reads: index scans skip pages */
+#define PREFETCH_MIN_WINDOW (128 * 1024)
+#define PREFETCH_MAX_WINDOW (1024 * 1024)
+
+enum { WINDOW_EMPTY, WINDOW_QUEUED, WINDOW_READING, WINDOW_READY };
+
+typedef struct prefetch_window {
+    unsigned char *data;            /* PREFETCH_MAX_WINDOW bytes */
+    cortex_int64 start;             /* file offset of data[0] */
+    int want;                       /* bytes asked for */
+    int len;                        /* bytes read, short at end of file */
+    int state;
+    unsigned gen;
+} prefetch_window;
+
+typedef struct prefetch_file {
+    cortex_file base;
+    cortex_io_methods methods;
+    cortex_file *real;              /* the unix file, allocated after this */
+    int fd;                         /* real's descriptor, or -1 */
+
+    cortex_int64 last_offset;       /* stride detection */
+    cortex_int64 stride;
+    int run;
+    int window;                     /* size of the next window */
+
+    pthread_mutex_t mutex;          /* guards the windows and gen */
+    pthread_cond_t cond;
+    pthread_t worker;
+    int started;
+    int stop;
+    unsigned gen;
+    cortex_int64 issued;            /* windows queued for the worker */
+    prefetch_window windows[2];
+} prefetch_file;
+
+static cortex_vfs prefetch_vfs;
+
+#define REAL(f) (((prefetch_file *)(f))->real)
+
+static void *prefetch_worker(void *arg) {
+    prefetch_file *f = arg;
+
+    pthread_mutex_lock(&f->mutex);
+    for (;;) {
+        prefetch_window *w = NULL;
+        cortex_int64 start;
+        int i, want, got = 0;
+
+        while (!f->stop) {
+            for (i = 0; i < 2 && !w; i++) {
+                if (f->windows[i].state == WINDOW_QUEUED) w = &f->windows[i];
+            }
+            if (w) break;
+            pthread_cond_wait(&f->cond, &f->mutex);
+        }
+        if (f->stop) break;
+        w->state = WINDOW_READING;
+        start = w->start;
+        want = w->want;
+        pthread_mutex_unlock(&f->mutex);
+
+        while (got < want) {
+            ssize_t n = pread(f->fd, w->data + got, (size_t)(want - got), (off_t)(start + got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += (int)n;
+        }
+
+        pthread_mutex_lock(&f->mutex);
+        /* a read error just leaves the pages to xRead */
+        if (w->gen == f->gen && got > 0) {
+            w->len = got;
+            w->state = WINDOW_READY;
+        } else {
+            w->state = WINDOW_EMPTY;
+        }
+        pthread_cond_broadcast(&f->cond);
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return NULL;
+}
+
+static int worker_start(prefetch_file *f) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        f->windows[i].data = malloc(PREFETCH_MAX_WINDOW);
+        if (!f->windows[i].data) goto fail;
+    }
+    if (pthread_create(&f->worker, NULL, prefetch_worker, f) != 0) goto fail;
+    f->started = 1;
+    return CORTEX_OK;
+
+fail:
+    for (i = 0; i < 2; i++) {
+        free(f->windows[i].data);
+        f->windows[i].data = NULL;
+    }
+    f->fd = -1;                     /* do not try again */
+    return CORTEX_NOMEM;
+}
+
+static void worker_stop(prefetch_file *f) {
+    int i;
+
+    if (!f->started) return;
+    pthread_mutex_lock(&f->mutex);
+    f->stop = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+    pthread_join(f->worker, NULL);
+    for (i = 0; i < 2; i++) free(f->windows[i].data);
+    f->started = 0;
+}
+
+/* Forget the pattern and every window; reads in flight are discarded */
+static void invalidate(prefetch_file *f) {
+    int i;
+
+    f->run = 0;
+    f->window = PREFETCH_MIN_WINDOW;
+    if (!f->started) return;
+    pthread_mutex_lock(&f->mutex);
+    f->gen++;
+    for (i = 0; i < 2; i++) {
+        if (f->windows[i].state == WINDOW_READY || f->windows[i].state == WINDOW_QUEUED) {
+            f->windows[i].state = WINDOW_EMPTY;
+        }
+    }
+    pthread_mutex_unlock(&f->mutex);
+}
+
+static int covers(const prefetch_window *w, cortex_int64 offset, cortex_int64 end, int data) {
+    cortex_int64 limit = w->start + (data ? w->len : w->want);
+    return offset >= w->start && end <= limit;
+}
+
+/* Queue [start, start + size) in a free window. Called with the mutex held. */
+static void schedule(prefetch_file *f, cortex_int64 start, int size) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        prefetch_window *w = &f->windows[i];
+        if (w->state != WINDOW_EMPTY && w->gen == f->gen && covers(w, start, start + 1, 0)) return;
+    }
+    for (i = 0; i < 2; i++) {
+        prefetch_window *w = &f->windows[i];
+        if (w->state == WINDOW_EMPTY) {
+            w->start = start;
+            w->want = size;
+            w->len = 0;
+            w->gen = f->gen;
+            w->state = WINDOW_QUEUED;
+            f->issued++;
+            pthread_cond_signal(&f->cond);
+            return;
+        }
+    }
+}
+
+/*
+    Serve [offset, offset + amt) from a window, waiting for one that is
+    still being read. Returns 1 when buf was filled.
+*/
+static int window_read(prefetch_file *f, void *buf, int amt, cortex_int64 offset) {
+    cortex_int64 end = offset + amt;
+    int i, found = 0;
+
+    pthread_mutex_lock(&f->mutex);
+    for (i = 0; i < 2; i++) {
+        prefetch_window *w = &f->windows[i];
+        if (w->state == WINDOW_EMPTY || w->gen != f->gen || !covers(w, offset, end, 0)) continue;
+        while (w->state == WINDOW_QUEUED || w->state == WINDOW_READING) {
+            pthread_cond_wait(&f->cond, &f->mutex);
+        }
+        if (w->state != WINDOW_READY || !covers(w, offset, end, 1)) break;
+
+        /* the worker only writes windows it is reading: copying needs no lock */
+        pthread_mutex_unlock(&f->mutex);
+        memcpy(buf, w->data + (offset - w->start), (size_t)amt);
+        pthread_mutex_lock(&f->mutex);
+        found = 1;
+        /* half way through a full window: start on the one after it */
+        if (w->len == w->want && end >= w->start + w->len / 2) {
+            if (f->window < PREFETCH_MAX_WINDOW) f->window *= 2;
+            schedule(f, w->start + w->len, f->window);
+        }
+        /* a window the scan has moved past is free for the next one */
+        if (end == w->start + w->len) w->state = WINDOW_EMPTY;
+        if (f->windows[!i].state == WINDOW_READY
+            && f->windows[!i].start + f->windows[!i].len <= offset) {
+            f->windows[!i].state = WINDOW_EMPTY;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return found;
+}
+
+/*
+    File methods
+*/
+static int prefetch_close(cortex_file *pFile) {
+    prefetch_file *f = (prefetch_file *)pFile;
+
+    worker_stop(f);
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->mutex);
+    return f->real->pMethods->xClose(f->real);
+}
+
+static int prefetch_read(cortex_file *pFile, void *buf, int amt, cortex_int64 offset) {
+    prefetch_file *f = (prefetch_file *)pFile;
+    cortex_int64 stride;
+    int rc;
+
+    if (f->fd < 0) return f->real->pMethods->xRead(f->real, buf, amt, offset);
+
+    stride = offset - f->last_offset;
+    if (stride == f->stride && stride > 0 && stride <= (cortex_int64)amt * PREFETCH_MAX_STRIDE) {
+        f->run++;
+    } else {
+        f->run = 0;
+    }
+    f->stride = stride;
+    f->last_offset = offset;
+
+    if (f->started && window_read(f, buf, amt, offset)) return CORTEX_OK;
+    rc = f->real->pMethods->xRead(f->real, buf, amt, offset);
+    if (rc == CORTEX_OK && f->run >= PREFETCH_RUN) {
+        if (!f->started && worker_start(f) != CORTEX_OK) return rc;
+        pthread_mutex_lock(&f->mutex);
+        schedule(f, offset + amt, f->window);
+        pthread_mutex_unlock(&f->mutex);
+    }
+    return rc;
+}
+
+static int prefetch_write(cortex_file *pFile, const void *buf, int amt, cortex_int64 offset) {
+    invalidate((prefetch_file *)pFile);
+    return REAL(pFile)->pMethods->xWrite(REAL(pFile), buf, amt, offset);
+}
+
+static int prefetch_truncate(cortex_file *pFile, cortex_int64 size) {
+    invalidate((prefetch_file *)pFile);
+    return REAL(pFile)->pMethods->xTruncate(REAL(pFile), size);
+}
+
+static int prefetch_sync(cortex_file *pFile, int flags) {
+    return REAL(pFile)->pMethods->xSync(REAL(pFile), flags);
+}
+
+static int prefetch_file_size(cortex_file *pFile, cortex_int64 *size) {
+    return REAL(pFile)->pMethods->xFileSize(REAL(pFile), size);
+}
+
+static int prefetch_lock(cortex_file *pFile, int level) {
+    invalidate((prefetch_file *)pFile);
+    return REAL(pFile)->pMethods->xLock(REAL(pFile), level);
+}
+
+static int prefetch_unlock(cortex_file *pFile, int level) {
+    invalidate((prefetch_file *)pFile);
+    return REAL(pFile)->pMethods->xUnlock(REAL(pFile), level);
+}
+
+static int prefetch_check_reserved_lock(cortex_file *pFile, int *out) {
+    return REAL(pFile)->pMethods->xCheckReservedLock(REAL(pFile), out);
+}
+
+static int prefetch_file_control(cortex_file *pFile, int op, void *arg) {
+    prefetch_file *f = (prefetch_file *)pFile;
+    int rc;
+
+    if (op == CORTEX_FCNTL_PRAGMA) {
+        char **args = arg;
+        if (args[1] && cortex_stricmp(args[1], "prefetch_windows") == 0 && !args[2]) {
+            cortex_int64 n;
+            pthread_mutex_lock(&f->mutex);
+            n = f->issued;
+            pthread_mutex_unlock(&f->mutex);
+            args[0] = cortex_mprintf("%lld", n);
+            return CORTEX_OK;
+        }
+    }
+    rc = f->real->pMethods->xFileControl(f->real, op, arg);
+    if (op == CORTEX_FCNTL_VFSNAME && rc == CORTEX_OK) {
+        char **name = arg;
+        *name = cortex_mprintf("%s/%z", PREFETCH_VFS_NAME, *name);
+    }
+    return rc;
+}
+
+static int prefetch_sector_size(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xSectorSize(REAL(pFile));
+}
+
+static int prefetch_device_characteristics(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xDeviceCharacteristics(REAL(pFile));
+}
+
+static int prefetch_shm_map(cortex_file *pFile, int page, int size, int extend, void volatile **out) {
+    return REAL(pFile)->pMethods->xShmMap(REAL(pFile), page, size, extend, out);
+}
+
+static int prefetch_shm_lock(cortex_file *pFile, int offset, int n, int flags) {
+    invalidate((prefetch_file *)pFile);
+    return REAL(pFile)->pMethods->xShmLock(REAL(pFile), offset, n, flags);
+}
+
+static void prefetch_shm_barrier(cortex_file *pFile) {
+    REAL(pFile)->pMethods->xShmBarrier(REAL(pFile));
+}
+
+static int prefetch_shm_unmap(cortex_file *pFile, int delete_flag) {
+    return REAL(pFile)->pMethods->xShmUnmap(REAL(pFile), delete_flag);
+}
+
+static int prefetch_fetch(cortex_file *pFile, cortex_int64 offset, int amt, void **pp) {
+    return REAL(pFile)->pMethods->xFetch(REAL(pFile), offset, amt, pp);
+}
+
+static int prefetch_unfetch(cortex_file *pFile, cortex_int64 offset, void *p) {
+    return REAL(pFile)->pMethods->xUnfetch(REAL(pFile), offset, p);
+}
+
+static const cortex_io_methods prefetch_io_methods = {
+    3,
+    prefetch_close,
+    prefetch_read,
+    prefetch_write,
+    prefetch_truncate,
+    prefetch_sync,
+    prefetch_file_size,
+    prefetch_lock,
+    prefetch_unlock,
+    prefetch_check_reserved_lock,
+    prefetch_file_control,
+    prefetch_sector_size,
+    prefetch_device_characteristics,
+    prefetch_shm_map,
+    prefetch_shm_lock,
+    prefetch_shm_barrier,
+    prefetch_shm_unmap,
+    prefetch_fetch,
+    prefetch_unfetch
+};
+
+/*
+    VFS: xOpen wraps, the rest is the unix VFS's
+*/
+static int prefetch_open(cortex_vfs *vfs, cortex_filename name, cortex_file *pFile, int flags,
+                         int *out_flags) {
+    cortex_vfs *root = vfs->pAppData;
+    prefetch_file *f = (prefetch_file *)pFile;
+    int rc;
+
+    memset(f, 0, sizeof(*f));
+    f->real = (cortex_file *)&f[1];
+    f->fd = -1;
+    if ((flags & 0x0FFFFF00) == CORTEX_OPEN_MAIN_DB) {
+        rc = vfs_open_unix(root, name, f->real, flags, out_flags, &f->fd);
+    } else {
+        rc = root->xOpen(root, name, f->real, flags, out_flags);
+    }
+    if (rc != CORTEX_OK) {
+        f->base.pMethods = NULL;
+        return rc;
+    }
+    f->methods = prefetch_io_methods;
+    vfs_shim_methods(&f->methods, f->real->pMethods);
+    f->base.pMethods = &f->methods;
+
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    f->window = PREFETCH_MIN_WINDOW;
+    f->last_offset = -1;
+    return CORTEX_OK;
+}
+
+int cortex_vfs_prefetch_register(int make_default) {
+    static pthread_mutex_t once = PTHREAD_MUTEX_INITIALIZER;
+    cortex_vfs *root;
+    int rc = CORTEX_OK;
+
+    pthread_mutex_lock(&once);
+    if (prefetch_vfs.zName) {
+        if (make_default) rc = cortex_vfs_register(&prefetch_vfs, 1);
+        goto done;
+    }
+    root = cortex_vfs_find("unix");
+    if (!root || root->iVersion < 2) {
+        rc = CORTEX_ERROR;
+        goto done;
+    }
+    vfs_shim_init(&prefetch_vfs, root, PREFETCH_VFS_NAME, (int)sizeof(prefetch_file), prefetch_open);
+    rc = cortex_vfs_register(&prefetch_vfs, make_default);
+    if (rc != CORTEX_OK) prefetch_vfs.zName = NULL;
+
+done:
+    pthread_mutex_unlock(&once);
+    return rc;
+}
+
+#else
+
+int cortex_vfs_prefetch_register(int make_default) {
+    (void)make_default;
+    return CORTEX_ERROR;
+}
+
+#endif
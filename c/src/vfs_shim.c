@@ -0,0 +1,202 @@
+#include "cortex_vfs.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#define VFS_FD_DIR "/proc/self/fd"
+#elif defined(__APPLE__)
+#define VFS_FD_DIR "/dev/fd"
+#endif
+
+#ifdef VFS_FD_DIR
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+/*
+    Plumbing shared by the VFS layers: forwarding of the methods a layer
+    leaves alone, and access to the unix VFS's file descriptor.
+*/
+
+#define ROOT(vfs) ((cortex_vfs *)(vfs)->pAppData)
+
+static int shim_delete(cortex_vfs *vfs, const char *name, int dirsync) {
+    return ROOT(vfs)->xDelete(ROOT(vfs), name, dirsync);
+}
+
+static int shim_access(cortex_vfs *vfs, const char *name, int flags, int *out) {
+    return ROOT(vfs)->xAccess(ROOT(vfs), name, flags, out);
+}
+
+static int shim_full_pathname(cortex_vfs *vfs, const char *name, int n, char *out) {
+    return ROOT(vfs)->xFullPathname(ROOT(vfs), name, n, out);
+}
+
+static void *shim_dl_open(cortex_vfs *vfs, const char *path) {
+    return ROOT(vfs)->xDlOpen(ROOT(vfs), path);
+}
+
+static void shim_dl_error(cortex_vfs *vfs, int n, char *msg) {
+    ROOT(vfs)->xDlError(ROOT(vfs), n, msg);
+}
+
+static void (*shim_dl_sym(cortex_vfs *vfs, void *handle, const char *sym))(void) {
+    return ROOT(vfs)->xDlSym(ROOT(vfs), handle, sym);
+}
+
+static void shim_dl_close(cortex_vfs *vfs, void *handle) {
+    ROOT(vfs)->xDlClose(ROOT(vfs), handle);
+}
+
+static int shim_randomness(cortex_vfs *vfs, int n, char *out) {
+    return ROOT(vfs)->xRandomness(ROOT(vfs), n, out);
+}
+
+static int shim_sleep(cortex_vfs *vfs, int us) {
+    return ROOT(vfs)->xSleep(ROOT(vfs), us);
+}
+
+static int shim_current_time(cortex_vfs *vfs, double *out) {
+    return ROOT(vfs)->xCurrentTime(ROOT(vfs), out);
+}
+
+static int shim_get_last_error(cortex_vfs *vfs, int n, char *out) {
+    return ROOT(vfs)->xGetLastError(ROOT(vfs), n, out);
+}
+
+static int shim_current_time_int64(cortex_vfs *vfs, cortex_int64 *out) {
+    return ROOT(vfs)->xCurrentTimeInt64(ROOT(vfs), out);
+}
+
+void vfs_shim_init(cortex_vfs *vfs, cortex_vfs *root, const char *name, int file_size,
+                   int (*open)(cortex_vfs *, cortex_filename, cortex_file *, int, int *)) {
+    memset(vfs, 0, sizeof(*vfs));
+    vfs->iVersion = 2;
+    vfs->szOsFile = file_size + root->szOsFile;
+    vfs->mxPathname = root->mxPathname;
+    vfs->zName = name;
+    vfs->pAppData = root;
+    vfs->xOpen = open;
+    vfs->xDelete = shim_delete;
+    vfs->xAccess = shim_access;
+    vfs->xFullPathname = shim_full_pathname;
+    vfs->xDlOpen = shim_dl_open;
+    vfs->xDlError = shim_dl_error;
+    vfs->xDlSym = shim_dl_sym;
+    vfs->xDlClose = shim_dl_close;
+    vfs->xRandomness = shim_randomness;
+    vfs->xSleep = shim_sleep;
+    vfs->xCurrentTime = shim_current_time;
+    vfs->xGetLastError = shim_get_last_error;
+    vfs->xCurrentTimeInt64 = shim_current_time_int64;
+}
+
+void vfs_shim_methods(cortex_io_methods *methods, const cortex_io_methods *real) {
+    if (real->iVersion < methods->iVersion) methods->iVersion = real->iVersion;
+    if (real->iVersion < 2 || !real->xShmMap) {
+        methods->xShmMap = NULL;
+        methods->xShmLock = NULL;
+        methods->xShmBarrier = NULL;
+        methods->xShmUnmap = NULL;
+    }
+    if (real->iVersion < 3 || !real->xFetch) {
+        methods->xFetch = NULL;
+        methods->xUnfetch = NULL;
+    }
+}
+
+/*
+    I/O on the side has to use the unix VFS's own descriptor: POSIX
+    locks belong to the process and inode, so closing a second
+    descriptor of ours would drop every lock held on the file. The unix
+    VFS does not hand its descriptor out, so it is found by listing the
+    process's descriptors around the open: the one that appears and
+    refers to the same file as name is the file's. Opens through the
+    layers are serialized so two of them cannot mix; if another thread
+    opens the same file at the same moment there are two candidates,
+    and, like a descriptor the unix VFS reused instead of opening one,
+    that is reported as -1.
+*/
+#ifdef VFS_FD_DIR
+
+typedef struct fd_list {
+    int *fd;
+    int n, cap;
+} fd_list;
+
+static pthread_mutex_t fd_open_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* The process's open descriptors, sorted. Returns 0 on failure. */
+static int fd_list_read(fd_list *l) {
+    DIR *dir = opendir(VFS_FD_DIR);
+    struct dirent *e;
+    int self;
+
+    l->n = 0;
+    if (!dir) return 0;
+    self = dirfd(dir);
+    while ((e = readdir(dir)) != NULL) {
+        char *end;
+        long fd = strtol(e->d_name, &end, 10);
+        if (end == e->d_name || *end || fd == self) continue;
+        if (l->n == l->cap) {
+            int cap = l->cap ? l->cap * 2 : 64;
+            int *grown = cortex_realloc(l->fd, cap * (int)sizeof(int));
+            if (!grown) {
+                closedir(dir);
+                return 0;
+            }
+            l->fd = grown;
+            l->cap = cap;
+        }
+        l->fd[l->n++] = (int)fd;
+    }
+    closedir(dir);
+    qsort(l->fd, (size_t)l->n, sizeof(int), cmp_int);
+    return 1;
+}
+
+int vfs_open_unix(cortex_vfs *root, cortex_filename name, cortex_file *file, int flags,
+                  int *out_flags, int *fd) {
+    fd_list before = { NULL, 0, 0 }, after = { NULL, 0, 0 };
+    struct stat want, st;
+    int rc, i, listed;
+
+    *fd = -1;
+    if (!name) return root->xOpen(root, name, file, flags, out_flags);
+    pthread_mutex_lock(&fd_open_mutex);
+    listed = fd_list_read(&before);
+    rc = root->xOpen(root, name, file, flags, out_flags);
+    if (rc == CORTEX_OK && listed && fd_list_read(&after) && stat(name, &want) == 0) {
+        for (i = 0; i < after.n; i++) {
+            int cand = after.fd[i];
+            if (bsearch(&cand, before.fd, (size_t)before.n, sizeof(int), cmp_int)) continue;
+            if (fstat(cand, &st) != 0 || st.st_dev != want.st_dev || st.st_ino != want.st_ino) continue;
+            if (*fd >= 0) {
+                *fd = -1;
+                break;
+            }
+            *fd = cand;
+        }
+    }
+    pthread_mutex_unlock(&fd_open_mutex);
+    cortex_free(before.fd);
+    cortex_free(after.fd);
+    return rc;
+}
+
+#else
+
+int vfs_open_unix(cortex_vfs *root, cortex_filename name, cortex_file *file, int flags,
+                  int *out_flags, int *fd) {
+    *fd = -1;
+    return root->xOpen(root, name, file, flags, out_flags);
+}
+
+#endif
@@ -0,0 +1,781 @@
+#include "cortex_vfs.h"
+
+/*
+    io_uring VFS: the default unix VFS with its page writes batched.
+
+    Everything but writing is the unix VFS itself: opening, locking,
+    reads, shared memory and deletes go straight through, so files
+    written here are ordinary .ctx files any other VFS can open. What
+    changes is xWrite. A write is copied into a per-file arena that is
+    registered with the ring and recorded as pending; adjacent writes
+    (a WAL frame header and its page, consecutive frames) merge into one
+    run. At xSync every pending run goes into the submission queue with
+    the fsync drained behind them (linked when there is a single run),
+    and one io_uring_enter() both issues and waits for the lot. A WAL
+    commit of n frames becomes one syscall instead of 2n pwrite()s and
+    an fsync.
+
+    Pending writes must reach the file before anything can observe it:
+    a read, xFileSize or xTruncate on the same file, an unlock, close or
+    mmap fetch, and, for the WAL, the WAL index update that publishes a
+    commit to other connections (xShmBarrier on the main database file).
+    A WAL file finds the main database file of its pager through
+    cortex_filename_database(), which hands back the exact name pointer
+    the pager opened the database with.
+
+    Only a write that fails before the commit is published can fail the
+    commit. With synchronous=OFF (or NORMAL in WAL mode) no xSync comes,
+    so the writes go out at the last call the commit still checks: the
+    CORTEX_FCNTL_SYNC file control on the database, or the page of the
+    WAL commit frame (a frame header with a nonzero database size). A
+    file learns whether its commits are followed by xSync and holds the
+    writes for it only then; PRAGMA synchronous starts the learning over.
+
+    A file gets a ring on its first write, so read-only handles never
+    pay for one. Without a usable ring (the arena cannot be registered,
+    the descriptor cannot be recovered, io_uring is disabled), the file
+    falls back to the unix xWrite and xSync. PRAGMA uring_submitted
+    reports how many SQEs the database file and its WAL have put through
+    their rings, 0 when every write took the fallback.
+*/
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CORTEX_HAVE_URING 1
+#endif
+#endif
+
+#ifdef CORTEX_HAVE_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_VFS_NAME "io_uring"
+#define URING_ENTRIES 64                    /* submission slots per file */
+#define URING_ARENA (1024 * 1024)           /* staged write bytes per file */
+#define URING_SYNC_TAG UINT64_MAX           /* user_data of the fsync */
+#define WAL_HEADER 32
+#define WAL_FRAME_HEADER 24
+
+/*
+    Raw io_uring, no liburing: one ring, used by one file at a time.
+*/
+typedef struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+} uring;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static void uring_close(uring *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_size);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int uring_open(uring *r, unsigned entries) {
+    struct io_uring_params p;
+    unsigned char *sq, *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = uring_setup(entries, &p);
+    if (r->fd < 0) {
+        r->fd = -1;
+        return CORTEX_ERROR;
+    }
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = r->sq_map_size;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+    sq = r->sq_map;
+    cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return CORTEX_OK;
+
+fail:
+    uring_close(r);
+    return CORTEX_ERROR;
+}
+
+/* Next free SQE, zeroed. The caller never queues more than the ring holds. */
+static struct io_uring_sqe *uring_sqe(uring *r, unsigned *queued) {
+    unsigned tail = *r->sq_tail + *queued;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    (*queued)++;
+    return sqe;
+}
+
+/*
+    Publish queued SQEs, then wait for all of them. done(arg, cqe) sees
+    every completion.
+*/
+static int uring_run(uring *r, unsigned queued,
+                     void (*done)(void *arg, const struct io_uring_cqe *cqe), void *arg) {
+    unsigned seen = 0, submit = queued;
+
+    __atomic_store_n(r->sq_tail, *r->sq_tail + queued, __ATOMIC_RELEASE);
+    while (seen < queued) {
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            done(arg, &r->cqes[head & *r->cq_mask]);
+            head++;
+            seen++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        if (seen < queued) {
+            int n = uring_enter(r->fd, submit, queued - seen);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+                return CORTEX_IOERR;
+            }
+            submit -= (unsigned)n < submit ? (unsigned)n : submit;
+        }
+    }
+    return CORTEX_OK;
+}
+
+typedef struct staged_run {
+    cortex_int64 offset;
+    unsigned pos;                   /* in the arena */
+    unsigned len;
+} staged_run;
+
+enum { RING_NONE, RING_READY, RING_FAILED };
+
+/*
+    A ring and its arena. Journals come and go with every transaction
+    in rollback mode, so closed files leave theirs on an idle list for
+    the next file instead of paying for setup and pinning again.
+*/
+typedef struct uring_io uring_io;
+struct uring_io {
+    uring ring;
+    unsigned char *arena;
+    int fixed;                      /* arena registered as buffer 0 */
+    uring_io *next;
+};
+
+#define URING_IDLE 4
+
+typedef struct uring_file uring_file;
+struct uring_file {
+    cortex_file base;
+    cortex_io_methods methods;      /* ours, trimmed to what real supports */
+    cortex_file *real;              /* the unix file, allocated after this */
+    int fd;                         /* real's descriptor, or -1 */
+    int type;                       /* CORTEX_OPEN_MAIN_DB, _WAL, ... */
+    int dirsync;                    /* first sync is real's: it syncs the directory */
+    const char *name;
+    uring_file *wal;                /* main db: its pager's open WAL file */
+    uring_file *main;               /* WAL: the main db file linking to it */
+    uring_file *next;               /* registry of main db files */
+
+    int ring_state;
+    uring_io *io;
+    unsigned arena_used;
+    staged_run pending[URING_ENTRIES - 1];     /* one slot left for the fsync */
+    int n_pending;
+    int err;                        /* first error of the current flush */
+    int resync;                     /* a write was finished by pwrite(), fsync again */
+    int sticky;                     /* failed flush at a barrier, for the next call */
+
+    int syncs;                      /* commits here are followed by xSync */
+    int committed;                  /* a commit is staged, its xSync not yet seen */
+    int commit_frame;               /* WAL: the next write is a commit frame's page */
+    cortex_int64 submitted;         /* SQEs put through the ring */
+};
+
+static cortex_vfs uring_vfs;
+static pthread_mutex_t uring_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uring_file *uring_registry;
+static uring_io *uring_idle;
+static int uring_n_idle;
+
+#define REAL(f) (((uring_file *)(f))->real)
+
+static int write_error(int e) {
+    return (e == ENOSPC || e == EDQUOT) ? CORTEX_FULL : CORTEX_IOERR_WRITE;
+}
+
+static uring_io *io_new(void) {
+    uring_io *io = cortex_malloc(sizeof(*io));
+    struct iovec iov;
+
+    if (!io) return NULL;
+    memset(io, 0, sizeof(*io));
+    io->arena = mmap(NULL, URING_ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io->arena == MAP_FAILED) {
+        cortex_free(io);
+        return NULL;
+    }
+    if (uring_open(&io->ring, URING_ENTRIES) != CORTEX_OK) {
+        munmap(io->arena, URING_ARENA);
+        cortex_free(io);
+        return NULL;
+    }
+    /* pinned once, so the kernel skips the page walk on every write;
+       RLIMIT_MEMLOCK can refuse it, plain writes still work then */
+    iov.iov_base = io->arena;
+    iov.iov_len = URING_ARENA;
+    io->fixed = uring_register(io->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return io;
+}
+
+static void ring_start(uring_file *f) {
+    pthread_mutex_lock(&uring_registry_mutex);
+    f->io = uring_idle;
+    if (f->io) {
+        uring_idle = f->io->next;
+        uring_n_idle--;
+    }
+    pthread_mutex_unlock(&uring_registry_mutex);
+    if (!f->io) f->io = io_new();
+    f->ring_state = f->io ? RING_READY : RING_FAILED;
+}
+
+static void ring_stop(uring_file *f) {
+    uring_io *io = f->io;
+
+    f->io = NULL;
+    f->ring_state = RING_NONE;
+    if (!io) return;
+    pthread_mutex_lock(&uring_registry_mutex);
+    if (uring_n_idle < URING_IDLE) {
+        io->next = uring_idle;
+        uring_idle = io;
+        uring_n_idle++;
+        io = NULL;
+    }
+    pthread_mutex_unlock(&uring_registry_mutex);
+    if (io) {
+        uring_close(&io->ring);
+        munmap(io->arena, URING_ARENA);
+        cortex_free(io);
+    }
+}
+
+/* Finish a short write synchronously */
+static int write_rest(uring_file *f, const staged_run *w, unsigned done) {
+    while (done < w->len) {
+        ssize_t n = pwrite(f->fd, f->io->arena + w->pos + done, w->len - done,
+                           (off_t)(w->offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return write_error(errno);
+        }
+        if (n == 0) return CORTEX_IOERR_WRITE;
+        done += (unsigned)n;
+    }
+    return CORTEX_OK;
+}
+
+static void flush_done(void *arg, const struct io_uring_cqe *cqe) {
+    uring_file *f = arg;
+    int rc = CORTEX_OK;
+
+    if (cqe->user_data == URING_SYNC_TAG) {
+        /* cancelled when a linked write came up short; synced below */
+        if (cqe->res == -ECANCELED) f->resync = 1;
+        else if (cqe->res < 0) rc = CORTEX_IOERR_FSYNC;
+    } else {
+        const staged_run *w = &f->pending[cqe->user_data];
+        if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+            rc = write_error(-cqe->res);
+        } else if ((unsigned)(cqe->res < 0 ? 0 : cqe->res) < w->len) {
+            rc = write_rest(f, w, (unsigned)(cqe->res < 0 ? 0 : cqe->res));
+            f->resync = 1;
+        }
+    }
+    if (rc != CORTEX_OK && f->err == CORTEX_OK) f->err = rc;
+}
+
+/*
+    Write out everything pending; with sync_flags, fsync behind it in
+    the same submission.
+*/
+static int flush(uring_file *f, int sync_flags) {
+    unsigned queued = 0;
+    int i, rc;
+
+    if (f->n_pending == 0 && !sync_flags) return CORTEX_OK;
+    if (f->n_pending == 1 && !sync_flags) {
+        /* nothing to batch: a ring round trip only costs more */
+        rc = write_rest(f, &f->pending[0], 0);
+        f->n_pending = 0;
+        f->arena_used = 0;
+        return rc;
+    }
+    for (i = 0; i < f->n_pending; i++) {
+        const staged_run *w = &f->pending[i];
+        struct io_uring_sqe *sqe = uring_sqe(&f->io->ring, &queued);
+        sqe->opcode = f->io->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = f->fd;
+        sqe->off = (uint64_t)w->offset;
+        sqe->addr = (uint64_t)(uintptr_t)(f->io->arena + w->pos);
+        sqe->len = w->len;
+        sqe->buf_index = 0;
+        sqe->user_data = (uint64_t)i;
+        /* a lone run is linked to the fsync; several are drained behind
+           it instead, so they still go to the device side by side */
+        if (sync_flags && f->n_pending == 1) sqe->flags |= IOSQE_IO_LINK;
+    }
+    if (sync_flags) {
+        struct io_uring_sqe *sqe = uring_sqe(&f->io->ring, &queued);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = f->fd;
+        sqe->fsync_flags = (sync_flags & CORTEX_SYNC_DATAONLY) ? IORING_FSYNC_DATASYNC : 0;
+        sqe->user_data = URING_SYNC_TAG;
+        if (f->n_pending > 1) sqe->flags |= IOSQE_IO_DRAIN;
+    }
+    f->err = CORTEX_OK;
+    f->resync = 0;
+    rc = uring_run(&f->io->ring, queued, flush_done, f);
+    f->submitted += queued;
+    if (rc == CORTEX_OK) rc = f->err;
+    if (rc == CORTEX_OK && sync_flags && f->resync) {
+        int e = (sync_flags & CORTEX_SYNC_DATAONLY) ? fdatasync(f->fd) : fsync(f->fd);
+        if (e != 0) rc = CORTEX_IOERR_FSYNC;
+    }
+    f->n_pending = 0;
+    f->arena_used = 0;
+    return rc;
+}
+
+static int flush_pending(uring_file *f) {
+    int rc = f->sticky;
+
+    f->sticky = CORTEX_OK;
+    if (rc == CORTEX_OK && f->n_pending) rc = flush(f, 0);
+    return rc;
+}
+
+/*
+    A commit's writes are all staged. Keep them for the xSync this file
+    has been getting, otherwise write them now, while an error still
+    fails the commit.
+*/
+static int commit_staged(uring_file *f) {
+    f->committed = 1;
+    return f->syncs ? CORTEX_OK : flush_pending(f);
+}
+
+/* The commit went on without an xSync: stop waiting for one */
+static int commit_unsynced(uring_file *f) {
+    int rc = CORTEX_OK;
+
+    if (f->committed) {
+        f->committed = 0;
+        f->syncs = 0;
+    }
+    if (f->n_pending || f->sticky) rc = flush_pending(f);
+    return rc;
+}
+
+/*
+    File methods
+*/
+static void registry_remove(uring_file *f) {
+    pthread_mutex_lock(&uring_registry_mutex);
+    if (f->type == CORTEX_OPEN_MAIN_DB) {
+        uring_file **p;
+        for (p = &uring_registry; *p; p = &(*p)->next) {
+            if (*p == f) {
+                *p = f->next;
+                break;
+            }
+        }
+        if (f->wal) f->wal->main = NULL;
+    } else if (f->main) {
+        f->main->wal = NULL;
+    }
+    f->wal = f->main = NULL;
+    pthread_mutex_unlock(&uring_registry_mutex);
+}
+
+static int uring_close_file(cortex_file *pFile) {
+    uring_file *f = (uring_file *)pFile;
+    int rc = flush_pending(f), rc2;
+
+    registry_remove(f);
+    ring_stop(f);
+    rc2 = f->real->pMethods->xClose(f->real);
+    return rc != CORTEX_OK ? rc : rc2;
+}
+
+static int uring_read(cortex_file *pFile, void *buf, int amt, cortex_int64 offset) {
+    int rc = flush_pending((uring_file *)pFile);
+    if (rc != CORTEX_OK) return rc;
+    return REAL(pFile)->pMethods->xRead(REAL(pFile), buf, amt, offset);
+}
+
+static int stage(uring_file *f, const void *buf, int amt, cortex_int64 offset) {
+    cortex_int64 end = offset + amt;
+    staged_run *last;
+    int i, rc;
+
+    /* runs in a batch complete in any order, so they must not overlap;
+       a write inside a pending run (a WAL frame rewritten in the same
+       transaction) just updates the staged bytes */
+    for (i = 0; i < f->n_pending; i++) {
+        staged_run *w = &f->pending[i];
+        if (offset < w->offset + w->len && end > w->offset) {
+            if (offset >= w->offset && end <= w->offset + w->len) {
+                memcpy(f->io->arena + w->pos + (offset - w->offset), buf, (size_t)amt);
+                return CORTEX_OK;
+            }
+            if ((rc = flush(f, 0)) != CORTEX_OK) return rc;
+            break;
+        }
+    }
+    if (f->arena_used + (unsigned)amt > URING_ARENA) {
+        if ((rc = flush(f, 0)) != CORTEX_OK) return rc;
+    }
+    last = f->n_pending ? &f->pending[f->n_pending - 1] : NULL;
+    if (last && last->offset + last->len == offset && last->pos + last->len == f->arena_used) {
+        last->len += (unsigned)amt;
+    } else {
+        if (f->n_pending == URING_ENTRIES - 1 && (rc = flush(f, 0)) != CORTEX_OK) return rc;
+        last = &f->pending[f->n_pending++];
+        last->offset = offset;
+        last->pos = f->arena_used;
+        last->len = (unsigned)amt;
+    }
+    memcpy(f->io->arena + f->arena_used, buf, (size_t)amt);
+    f->arena_used += (unsigned)amt;
+    return CORTEX_OK;
+}
+
+static int uring_write(cortex_file *pFile, const void *buf, int amt, cortex_int64 offset) {
+    uring_file *f = (uring_file *)pFile;
+    int rc;
+
+    if (f->ring_state == RING_NONE && f->fd >= 0) ring_start(f);
+    if (f->ring_state != RING_READY || amt > URING_ARENA) {
+        if ((rc = flush_pending(f)) != CORTEX_OK) return rc;
+        return f->real->pMethods->xWrite(f->real, buf, amt, offset);
+    }
+    if (f->sticky) return flush_pending(f);
+    if ((rc = stage(f, buf, amt, offset)) != CORTEX_OK) return rc;
+
+    if (f->type == CORTEX_OPEN_WAL) {
+        const unsigned char *b = buf;
+        if (f->commit_frame) {
+            f->commit_frame = 0;
+            return commit_staged(f);
+        }
+        f->commit_frame = amt == WAL_FRAME_HEADER && offset >= WAL_HEADER
+                          && (b[4] | b[5] | b[6] | b[7]) != 0;
+    }
+    return CORTEX_OK;
+}
+
+static int uring_truncate(cortex_file *pFile, cortex_int64 size) {
+    int rc = flush_pending((uring_file *)pFile);
+    if (rc != CORTEX_OK) return rc;
+    return REAL(pFile)->pMethods->xTruncate(REAL(pFile), size);
+}
+
+static int uring_sync(cortex_file *pFile, int flags) {
+    uring_file *f = (uring_file *)pFile;
+    int rc;
+
+    if (f->committed) {
+        f->committed = 0;
+        f->syncs = 1;
+    }
+    if (f->ring_state != RING_READY || f->dirsync || f->sticky) {
+        f->dirsync = 0;
+        if ((rc = flush_pending(f)) != CORTEX_OK) return rc;
+        return f->real->pMethods->xSync(f->real, flags);
+    }
+    return flush(f, flags | CORTEX_SYNC_NORMAL);
+}
+
+static int uring_file_size(cortex_file *pFile, cortex_int64 *size) {
+    int rc = flush_pending((uring_file *)pFile);
+    if (rc != CORTEX_OK) return rc;
+    return REAL(pFile)->pMethods->xFileSize(REAL(pFile), size);
+}
+
+static int uring_lock(cortex_file *pFile, int level) {
+    return REAL(pFile)->pMethods->xLock(REAL(pFile), level);
+}
+
+static int uring_unlock(cortex_file *pFile, int level) {
+    uring_file *f = (uring_file *)pFile;
+    int rc = commit_unsynced(f), rc2;
+
+    if (rc == CORTEX_OK && f->wal) rc = flush_pending(f->wal);
+    rc2 = f->real->pMethods->xUnlock(f->real, level);
+    return rc != CORTEX_OK ? rc : rc2;
+}
+
+static int uring_check_reserved_lock(cortex_file *pFile, int *out) {
+    return REAL(pFile)->pMethods->xCheckReservedLock(REAL(pFile), out);
+}
+
+static int uring_file_control(cortex_file *pFile, int op, void *arg) {
+    uring_file *f = (uring_file *)pFile;
+    int rc;
+
+    if (op == CORTEX_FCNTL_SYNC) {
+        /* sent at every commit, also when no xSync follows */
+        if ((rc = commit_staged(f)) != CORTEX_OK) return rc;
+    } else if (op == CORTEX_FCNTL_PRAGMA) {
+        char **args = arg;
+        if (args[1] && cortex_stricmp(args[1], "synchronous") == 0) {
+            f->syncs = 0;
+            if (f->wal) f->wal->syncs = 0;
+        } else if (args[1] && cortex_stricmp(args[1], "uring_submitted") == 0 && !args[2]) {
+            cortex_int64 n = f->submitted;
+            pthread_mutex_lock(&uring_registry_mutex);
+            if (f->wal) n += f->wal->submitted;
+            pthread_mutex_unlock(&uring_registry_mutex);
+            args[0] = cortex_mprintf("%lld", n);
+            return CORTEX_OK;
+        }
+    }
+    rc = f->real->pMethods->xFileControl(f->real, op, arg);
+    if (op == CORTEX_FCNTL_VFSNAME && rc == CORTEX_OK) {
+        char **name = arg;
+        *name = cortex_mprintf("%s/%z", URING_VFS_NAME, *name);
+    }
+    return rc;
+}
+
+static int uring_sector_size(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xSectorSize(REAL(pFile));
+}
+
+static int uring_device_characteristics(cortex_file *pFile) {
+    return REAL(pFile)->pMethods->xDeviceCharacteristics(REAL(pFile));
+}
+
+static int uring_shm_map(cortex_file *pFile, int page, int size, int extend, void volatile **out) {
+    return REAL(pFile)->pMethods->xShmMap(REAL(pFile), page, size, extend, out);
+}
+
+static int uring_shm_lock(cortex_file *pFile, int offset, int n, int flags) {
+    uring_file *f = (uring_file *)pFile;
+
+    if (f->wal && (flags & CORTEX_SHM_UNLOCK)) {
+        int rc = flush_pending(f->wal);
+        if (rc != CORTEX_OK) return rc;
+    }
+    return f->real->pMethods->xShmLock(f->real, offset, n, flags);
+}
+
+static void uring_shm_barrier(cortex_file *pFile) {
+    uring_file *f = (uring_file *)pFile;
+
+    /* the WAL index is about to point at the new frames. Normally they
+       went out at the commit frame or xSync already; a write that fails
+       only here is kept for the WAL's next call to report */
+    if (f->wal) {
+        uring_file *w = f->wal;
+        int rc = commit_unsynced(w);
+        if (rc != CORTEX_OK) w->sticky = rc;
+    }
+    f->real->pMethods->xShmBarrier(f->real);
+}
+
+static int uring_shm_unmap(cortex_file *pFile, int delete_flag) {
+    return REAL(pFile)->pMethods->xShmUnmap(REAL(pFile), delete_flag);
+}
+
+static int uring_fetch(cortex_file *pFile, cortex_int64 offset, int amt, void **pp) {
+    int rc = flush_pending((uring_file *)pFile);
+    if (rc != CORTEX_OK) return rc;
+    return REAL(pFile)->pMethods->xFetch(REAL(pFile), offset, amt, pp);
+}
+
+static int uring_unfetch(cortex_file *pFile, cortex_int64 offset, void *p) {
+    return REAL(pFile)->pMethods->xUnfetch(REAL(pFile), offset, p);
+}
+
+static const cortex_io_methods uring_io_methods = {
+    3,
+    uring_close_file,
+    uring_read,
+    uring_write,
+    uring_truncate,
+    uring_sync,
+    uring_file_size,
+    uring_lock,
+    uring_unlock,
+    uring_check_reserved_lock,
+    uring_file_control,
+    uring_sector_size,
+    uring_device_characteristics,
+    uring_shm_map,
+    uring_shm_lock,
+    uring_shm_barrier,
+    uring_shm_unmap,
+    uring_fetch,
+    uring_unfetch
+};
+
+/*
+    VFS: xOpen wraps, the rest is the unix VFS's
+*/
+static int uring_open_file(cortex_vfs *vfs, cortex_filename name, cortex_file *pFile, int flags,
+                           int *out_flags) {
+    cortex_vfs *root = vfs->pAppData;
+    uring_file *f = (uring_file *)pFile;
+    int rc, type = flags & 0x0FFFFF00;
+
+    memset(f, 0, sizeof(*f));
+    f->real = (cortex_file *)&f[1];
+    f->fd = -1;
+    if (!(flags & CORTEX_OPEN_READONLY)
+        && (type == CORTEX_OPEN_MAIN_DB || type == CORTEX_OPEN_MAIN_JOURNAL
+            || type == CORTEX_OPEN_WAL)) {
+        rc = vfs_open_unix(root, name, f->real, flags, out_flags, &f->fd);
+    } else {
+        rc = root->xOpen(root, name, f->real, flags, out_flags);
+    }
+    if (rc != CORTEX_OK) {
+        /* nothing to close: the unix VFS cleans up a failed open */
+        f->base.pMethods = NULL;
+        return rc;
+    }
+    f->methods = uring_io_methods;
+    vfs_shim_methods(&f->methods, f->real->pMethods);
+    f->base.pMethods = &f->methods;
+    f->type = type;
+    f->name = name;
+
+    f->dirsync = (flags & CORTEX_OPEN_CREATE)
+                 && (type == CORTEX_OPEN_MAIN_JOURNAL || type == CORTEX_OPEN_WAL);
+
+    if (type == CORTEX_OPEN_MAIN_DB) {
+        pthread_mutex_lock(&uring_registry_mutex);
+        f->next = uring_registry;
+        uring_registry = f;
+        pthread_mutex_unlock(&uring_registry_mutex);
+    } else if (type == CORTEX_OPEN_WAL && name) {
+        const char *db_name = cortex_filename_database(name);
+        uring_file *m;
+        pthread_mutex_lock(&uring_registry_mutex);
+        for (m = uring_registry; m; m = m->next) {
+            if (m->name == db_name) {
+                m->wal = f;
+                f->main = m;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&uring_registry_mutex);
+        /* no main file to publish through: write the WAL unbatched */
+        if (!f->main) f->fd = -1;
+    }
+    return CORTEX_OK;
+}
+
+int cortex_vfs_uring_register(int make_default) {
+    static pthread_mutex_t once = PTHREAD_MUTEX_INITIALIZER;
+    struct io_uring_params p;
+    cortex_vfs *root;
+    int probe, rc = CORTEX_OK;
+
+    pthread_mutex_lock(&once);
+    if (uring_vfs.zName) {
+        if (make_default) rc = cortex_vfs_register(&uring_vfs, 1);
+        goto done;
+    }
+    root = cortex_vfs_find("unix");
+    if (!root || root->iVersion < 2) {
+        rc = CORTEX_ERROR;
+        goto done;
+    }
+    /* io_uring can be compiled out, disabled by sysctl or filtered by
+       seccomp; only offer the VFS when a ring can really be made */
+    memset(&p, 0, sizeof(p));
+    probe = uring_setup(2, &p);
+    if (probe < 0) {
+        rc = CORTEX_ERROR;
+        goto done;
+    }
+    close(probe);
+
+    vfs_shim_init(&uring_vfs, root, URING_VFS_NAME, (int)sizeof(uring_file), uring_open_file);
+    rc = cortex_vfs_register(&uring_vfs, make_default);
+    if (rc != CORTEX_OK) uring_vfs.zName = NULL;
+
+done:
+    pthread_mutex_unlock(&once);
+    return rc;
+}
+
+#else
+
+int cortex_vfs_uring_register(int make_default) {
+    (void)make_default;
+    return CORTEX_ERROR;
+}
+
+#endif
@@ -1,14 +1,18 @@
 from .connection import CortexConnection
+from .cursor import CortexCursor
+from .limits import QueryInterrupted
+from .pool import use_page_cache
 
 
 def connect(
     path: str,
     transport: str = "stdio",
     port: int = 5173,
-    api_key: str = None
+    api_key: str = None,
+    **options
 ) -> CortexConnection:
-    return CortexConnection(path, transport=transport, port=port, api_key=api_key)
+    return CortexConnection(path, transport=transport, port=port, api_key=api_key, **options)
 
 
 __version__ = "0.1.0"
-__all__ = ["connect", "CortexConnection"]
\ No newline at end of file
+__all__ = ["connect", "use_page_cache", "CortexConnection", "CortexCursor", "QueryInterrupted"]
\ No newline at end of file
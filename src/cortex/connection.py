@@ -1,15 +1,23 @@
+import contextlib
+import itertools
+from array import array
 import threading
-from .core.bindings import ffi, lib
+import weakref
+from .core import ffi, lib, _rows
+from .cursor import (
+    CortexCursor,
+    CORTEX_INTEGER, CORTEX_FLOAT, CORTEX_TEXT, CORTEX_BLOB, CORTEX_NULL,
+    CORTEX_ROW, CORTEX_DONE,
+)
+from .statements import StatementCache, SCRIPT, bind_params, may_change_schema
+from .pool import (
+    ReaderPool, open_handle,
+    CORTEX_OPEN_READWRITE, CORTEX_OPEN_CREATE, CORTEX_OPEN_FULLMUTEX,
+)
+from .writer import WriteQueue
+from .limits import QueryInterrupted, new_budget, handle_addr
 from .mcp import start_mcp
 
-CORTEX_INTEGER = 1
-CORTEX_FLOAT   = 2
-CORTEX_TEXT    = 3
-CORTEX_BLOB    = 4
-CORTEX_NULL    = 5
-CORTEX_ROW     = 100
-CORTEX_DONE    = 101
-
 
 class CortexConnection:
     def __init__(
@@ -17,107 +25,303 @@ class CortexConnection:
             path: str,
             transport: str = "stdio",
             port: int = 5173,
-            api_key: str = None
+            api_key: str = None,
+            statement_cache_size: int = 128,
+            readers: int = 0,
+            write_queue: bool = False,
+            write_batch_size: int = 256,
+            write_window: float = 0.002,
+            query_timeout: float = None,
+            max_instructions: int = None,
+            vfs: str = None
     ):
         if not path.endswith(".ctx"):
             raise ValueError("Cortex database file must have .ctx extension")
 
-        self._db = ffi.new("cortex **")
+        self.path = path
         self._lock = threading.Lock()
+        self._cursors = weakref.WeakSet()
 
-        # CORTEX_OPEN_READWRITE | CORTEX_OPEN_CREATE | CORTEX_OPEN_FULLMUTEX
-        # FULLMUTEX makes it safe to use across multiple threads
-        CORTEX_OPEN_READWRITE = 0x00000002
-        CORTEX_OPEN_CREATE = 0x00000004
-        CORTEX_OPEN_FULLMUTEX = 0x00010000
+        # Default per-call limits for every statement, enforced by a
+        # progress handler so one runaway query cannot hold _lock forever.
+        self.query_timeout = query_timeout
+        self.max_instructions = max_instructions
 
+        # FULLMUTEX makes the writer handle safe to use across threads
         flags = CORTEX_OPEN_READWRITE | CORTEX_OPEN_CREATE | CORTEX_OPEN_FULLMUTEX
+        self._conn = open_handle(path, flags, vfs)
+        self._statements = StatementCache(self._conn, statement_cache_size)
 
-        # Use cortex_open_v2 for flags support
-        rc = lib.cortex_open_v2(path.encode(), self._db, flags, ffi.NULL)
+        # With readers, fetch() runs on a pool of read-only NOMUTEX handles
+        # while execute() stays on this writer; WAL lets them run together.
+        self._pool = None
+        if readers > 0:
+            self.execute("PRAGMA journal_mode=WAL")
+            self._pool = ReaderPool(path, readers, statement_cache_size, vfs)
 
-        if rc != 0:
-            raise ConnectionError(f"Failed to open database: {path}")
+        # Group commit: submit() and the cortex_execute tool share one
+        # writer thread that commits a batch of statements at a time.
+        self.write_queue = None
+        if write_queue:
+            self.write_queue = WriteQueue(self, write_batch_size, write_window)
 
-        self._conn = self._db[0]
         print(f"\nCortex connected to {path}")
         start_mcp(self, transport=transport, port=port, api_key=api_key)
 
-    def execute(self, sql: str):
+    def execute(self, sql: str, params=None):
+        """
+        Run a statement. params binds ? placeholders from a sequence or
+        :name placeholders from a dict. Single statements come from the
+        prepared-statement cache; multi-statement scripts use cortex_exec.
+        """
         with self._lock:
-            errmsg = ffi.new("char **")
-            rc = lib.cortex_exec(
-                self._conn,
-                sql.encode(),
-                ffi.NULL,
-                ffi.NULL,
-                errmsg
-            )
-            if rc != 0:
-                error = ffi.string(errmsg[0]).decode()
-                lib.cortex_free(errmsg[0])
-                raise Exception(f"SQL Error: {error}")
-            return rc
+            return self._execute_locked(sql, params)
 
-    def fetch(self, sql: str):
-        with self._lock:
-            stmt_ptr = ffi.new("cortex_stmt **")
-            rc = lib.cortex_prepare_v2(
-                self._conn,
-                sql.encode(),
-                -1,
-                stmt_ptr,
-                ffi.NULL
-            )
-            if rc != 0:
-                raise Exception(f"Failed to prepare statement: {sql}")
+    def _execute_locked(self, sql: str, params=None):
+        stmt = self._statements.acquire(sql)
+        budget = None
+        if self.query_timeout is not None or self.max_instructions is not None:
+            budget = new_budget(self.query_timeout, self.max_instructions)
+            budget.install(handle_addr(self._conn))
+        try:
+            if stmt is SCRIPT:
+                if params:
+                    raise ValueError("parameters need a single SQL statement")
+                rc = self._exec_script(sql)
+            else:
+                try:
+                    rc = self._step_to_end(stmt, params)
+                finally:
+                    self._statements.release(sql, stmt)
+        except Exception:
+            if budget is not None and budget.reason:
+                raise QueryInterrupted(budget.reason) from None
+            raise
+        finally:
+            if budget is not None:
+                budget.uninstall(handle_addr(self._conn))
+        if may_change_schema(sql):
+            self._statements.check_schema()
+            if self._pool is not None:
+                self._pool.schema_changed()
+        return rc
+
+    def submit(self, sql: str, params=None):
+        """
+        Queue a write for the group-commit writer thread and return a
+        concurrent.futures.Future resolving to a WriteResult(changes,
+        last_insert_rowid). Needs connect(..., write_queue=True).
+        """
+        if self.write_queue is None:
+            raise RuntimeError("connect with write_queue=True to use submit()")
+        return self.write_queue.submit(sql, params)
 
-            stmt = stmt_ptr[0]
-            col_count = lib.cortex_column_count(stmt)
+    def _step_to_end(self, stmt, params):
+        if stmt == ffi.NULL:
+            return 0
+        bind_params(stmt, params)
+        rc = lib.cortex_step(stmt)
+        while rc == CORTEX_ROW:
+            rc = lib.cortex_step(stmt)
+        if rc != CORTEX_DONE:
+            error = ffi.string(lib.cortex_errmsg(self._conn)).decode()
+            raise Exception(f"SQL Error: {error}")
+        return 0
+
+    def _exec_script(self, sql: str):
+        errmsg = ffi.new("char **")
+        rc = lib.cortex_exec(
+            self._conn,
+            sql.encode(),
+            ffi.NULL,
+            ffi.NULL,
+            errmsg
+        )
+        if rc != 0:
+            error = ffi.string(errmsg[0]).decode()
+            lib.cortex_free(errmsg[0])
+            raise Exception(f"SQL Error: {error}")
+        return rc
 
-            columns = []
-            for i in range(col_count):
-                name = ffi.string(lib.cortex_column_name(stmt, i)).decode()
-                columns.append(name)
+    def executemany(self, sql: str, rows, batch_size: int = 10000) -> int:
+        """
+        Prepare sql once and run it for every row in rows (sequences for ?,
+        dicts for :name). Rows are committed in transactions of batch_size;
+        if a transaction is already open the caller owns it and no commits
+        are issued. On error the failing batch is rolled back and earlier
+        batches stay committed. Returns the number of rows applied.
+        """
+        if batch_size < 1:
+            raise ValueError("batch_size must be at least 1")
+        total = 0
+        rows = iter(rows)
+        while True:
+            batch = list(itertools.islice(rows, batch_size))
+            if not batch:
+                return total
+            with self._lock:
+                stmt = self._statements.acquire(sql)
+                if stmt is SCRIPT or stmt == ffi.NULL:
+                    self._statements.release(sql, stmt)
+                    raise ValueError("executemany() takes a single SQL statement")
+                own_txn = lib.cortex_get_autocommit(self._conn) != 0
+                try:
+                    if own_txn:
+                        self._exec_script("BEGIN")
+                    total += self._apply_batch(stmt, batch)
+                    if own_txn:
+                        self._exec_script("COMMIT")
+                except BaseException:
+                    if own_txn and not lib.cortex_get_autocommit(self._conn):
+                        self._exec_script("ROLLBACK")
+                    raise
+                finally:
+                    self._statements.release(sql, stmt)
 
-            rows = []
-            while True:
+    def _apply_batch(self, stmt, batch) -> int:
+        if _rows is not None and not isinstance(batch[0], dict):
+            count, rc = _rows.execute_many(int(ffi.cast("uintptr_t", stmt)), batch)
+        else:
+            count, rc = 0, CORTEX_DONE
+            for row in batch:
+                bind_params(stmt, row)
                 rc = lib.cortex_step(stmt)
-                if rc == CORTEX_DONE:
+                while rc == CORTEX_ROW:
+                    rc = lib.cortex_step(stmt)
+                lib.cortex_reset(stmt)
+                if rc != CORTEX_DONE:
                     break
-                if rc != CORTEX_ROW:
-                    lib.cortex_finalize(stmt)
-                    raise Exception(f"Error fetching row: {rc}")
+                count += 1
+        if rc != CORTEX_DONE:
+            error = ffi.string(lib.cortex_errmsg(self._conn)).decode()
+            raise Exception(f"SQL Error: {error} (row {count})")
+        return count
 
-                row = {}
-                for i in range(col_count):
-                    col_type = lib.cortex_column_type(stmt, i)
-                    col_name = columns[i]
+    def bulk_insert(self, table: str, rows, columns=None, batch_size: int = 10000,
+                    fast: bool = False) -> int:
+        """
+        Insert an iterable of rows (dicts or sequences) into table through
+        executemany(). Dict rows take their column list from the first row
+        unless columns is given. fast=True wraps the load in ingest_profile().
+        """
+        rows = iter(rows)
+        first = next(rows, None)
+        if first is None:
+            return 0
+        if isinstance(first, dict):
+            columns = list(columns or first)
+            data = (tuple(row[c] for c in columns) for row in itertools.chain([first], rows))
+        else:
+            data = itertools.chain([first], rows)
 
-                    if col_type == CORTEX_INTEGER:
-                        row[col_name] = lib.cortex_column_int(stmt, i)
-                    elif col_type == CORTEX_FLOAT:
-                        row[col_name] = lib.cortex_column_double(stmt, i)
-                    elif col_type == CORTEX_TEXT:
-                        val = lib.cortex_column_text(stmt, i)
-                        row[col_name] = ffi.string(val).decode() if val != ffi.NULL else None
-                    elif col_type == CORTEX_NULL:
-                        row[col_name] = None
-                    else:
-                        row[col_name] = None
+        width = len(columns) if columns else len(first)
+        column_sql = f" ({', '.join(_quote(c) for c in columns)})" if columns else ""
+        sql = f"INSERT INTO {_quote(table)}{column_sql} VALUES ({', '.join('?' * width)})"
 
-                rows.append(row)
+        if not fast:
+            return self.executemany(sql, data, batch_size)
+        with self.ingest_profile():
+            return self.executemany(sql, data, batch_size)
 
-            lib.cortex_finalize(stmt)
-            return rows
+    def build_index(self, table: str, column: str, options: str = "", progress=None):
+        """
+        Create a vec_hnsw index over the embeddings already in table.column
+        and fill it on the index's build threads. options takes name=
+        (default <table>_<column>_idx) and any vec_hnsw option, e.g.
+        "name=notes_vec, dim=768, threads=16". progress(done, total) is
+        called after every shard of rows; a true return cancels the build.
+        The index then follows the table through triggers (content=).
+        """
+        errmsg = ffi.new("char **")
+        raised = []
+        callback = ffi.NULL
+        if progress is not None:
+            def report(arg, done, total):
+                try:
+                    return 1 if progress(done, total if total >= 0 else None) else 0
+                except BaseException as e:
+                    raised.append(e)
+                    return 1
+            callback = ffi.callback("int(void *, long long, long long)", report)
+        with self._lock:
+            rc = lib.vec_index_build(
+                self._conn, table.encode(), column.encode(), options.encode(),
+                callback, ffi.NULL, errmsg,
+            )
+            self._statements.check_schema()
+        if self._pool is not None:
+            self._pool.schema_changed()
+        if raised:
+            lib.cortex_free(errmsg[0])
+            raise raised[0]
+        if rc != 0:
+            error = ffi.string(errmsg[0]).decode() if errmsg[0] != ffi.NULL else "build failed"
+            lib.cortex_free(errmsg[0])
+            raise Exception(f"SQL Error: {error}")
+
+    def search_many(self, table: str, queries, k: int = 10):
+        """
+        k nearest neighbours of every vector in queries (float sequences
+        or float32 bytes) from one vec_hnsw table, in one statement
+        through vec_search_many(). Returns one list per query, in order,
+        of {"id", "distance"} rows nearest first.
+        """
+        queries = list(queries)
+        packed = b"".join(
+            bytes(q) if isinstance(q, (bytes, bytearray, memoryview)) else array("f", q).tobytes()
+            for q in queries
+        )
+        results = [[] for _ in queries]
+        rows = self.fetch(
+            "SELECT query, id, distance FROM vec_search_many(?, ?, ?)", (table, packed, k)
+        )
+        for row in rows:
+            results[row["query"]].append({"id": row["id"], "distance": row["distance"]})
+        return results
 
+    @contextlib.contextmanager
+    def ingest_profile(self, synchronous: str = "NORMAL"):
+        """
+        Switch to WAL with relaxed fsync for a bulk load, then restore the
+        previous journal_mode and synchronous settings.
+        """
+        synchronous = str(synchronous).upper()
+        if synchronous not in ("OFF", "NORMAL", "FULL", "EXTRA"):
+            raise ValueError(f"invalid synchronous level: {synchronous}")
+        # Per-connection settings: read them on the writer, not a pooled reader
+        with CortexCursor(self) as cur:
+            journal = cur.execute("PRAGMA journal_mode").fetchone()["journal_mode"]
+            previous_sync = cur.execute("PRAGMA synchronous").fetchone()["synchronous"]
+        self.execute("PRAGMA journal_mode=WAL")
+        self.execute(f"PRAGMA synchronous={synchronous}")
+        try:
+            yield self
+        finally:
+            self.execute(f"PRAGMA synchronous={int(previous_sync)}")
+            if journal.lower() != "wal":
+                self.execute(f"PRAGMA journal_mode={journal}")
 
-    def fetchone(self, sql: str):
-        results = self.fetch(sql)
-        return results[0] if results else None
+    def cursor(self) -> CortexCursor:
+        """Streaming cursor; see CortexCursor. Reads use the reader pool if any."""
+        return CortexCursor(self, self._pool)
+
+    def fetch(self, sql: str, params=None, timeout=None, max_instructions=None):
+        with self.cursor() as cur:
+            return cur.execute(sql, params, timeout, max_instructions).fetchall()
+
+    def fetchone(self, sql: str, params=None, timeout=None, max_instructions=None):
+        with self.cursor() as cur:
+            return cur.execute(sql, params, timeout, max_instructions).fetchone()
 
     def close(self):
+        if self.write_queue is not None:
+            self.write_queue.close()
+        for cur in list(self._cursors):
+            cur.close()
+        if self._pool is not None:
+            self._pool.close()
         if self._conn:
+            self._statements.close()
             lib.cortex_close(self._conn)
             self._conn = None
             print("Cortex connection closed")
@@ -130,3 +334,6 @@ class CortexConnection:
     def __exit__(self, exc_type, exc_val, exc_tb):
         self.close()
 
+
+def _quote(identifier: str) -> str:
+    return '"' + identifier.replace('"', '""') + '"'
@@ -1 +1,7 @@
-from .bindings import ffi, lib
\ No newline at end of file
+from .bindings import ffi, lib
+
+try:
+    # Optional native row materializer, built by c/src/CMakeLists.txt
+    from . import _rows
+except ImportError:
+    _rows = None
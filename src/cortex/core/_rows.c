@@ -0,0 +1,365 @@
+/*
+    cortex.core._rows — native row materialization for CortexConnection.
+
+    The cffi path in connection.py makes one foreign call per column per
+    row (type, value, then a string conversion). This module steps the
+    prepared statement and builds the dict rows directly in C, releasing
+    the GIL while cortex_step() runs.
+
+    execute_many() is the write-side counterpart used by executemany():
+    it binds and steps a whole batch of rows in one call.
+
+    Budget is the per-call deadline / VM instruction limit. Its progress
+    handler runs inside cortex_step() without the GIL.
+
+    The statement is passed in as the integer address of the cortex_stmt
+    that cffi prepared, so both sides share the same libcortex instance.
+*/
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <time.h>
+#include "libcortex.h"
+
+/* VM instructions between progress handler calls */
+#define BUDGET_PERIOD 1000
+
+static PyObject *column_value(cortex_stmt *stmt, int i) {
+    switch (cortex_column_type(stmt, i)) {
+        case CORTEX_INTEGER:
+            return PyLong_FromLongLong(cortex_column_int64(stmt, i));
+        case CORTEX_FLOAT:
+            return PyFloat_FromDouble(cortex_column_double(stmt, i));
+        case CORTEX_TEXT: {
+            const char *text = (const char *)cortex_column_text(stmt, i);
+            if (text == NULL) Py_RETURN_NONE;
+            return PyUnicode_DecodeUTF8(text, cortex_column_bytes(stmt, i), NULL);
+        }
+        case CORTEX_BLOB: {
+            const void *blob = cortex_column_blob(stmt, i);
+            return PyBytes_FromStringAndSize(blob ? blob : "", cortex_column_bytes(stmt, i));
+        }
+        default:
+            Py_RETURN_NONE;
+    }
+}
+
+/*
+    step(stmt_addr, columns, max_rows=-1) -> (rows, rc)
+
+    Steps until the statement is done, an error occurs, or max_rows rows
+    have been collected (max_rows < 0 means no limit). rc is the last
+    cortex_step() result: CORTEX_DONE when exhausted, CORTEX_ROW when the
+    row limit was hit with more rows pending, anything else is an error.
+*/
+static PyObject *rows_step(PyObject *self, PyObject *args) {
+    unsigned long long addr;
+    PyObject *columns;
+    Py_ssize_t max_rows = -1, n_cols, count = 0;
+    cortex_stmt *stmt;
+    PyObject *rows;
+    int rc = CORTEX_ROW;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "KO!|n", &addr, &PyTuple_Type, &columns, &max_rows)) {
+        return NULL;
+    }
+    stmt = (cortex_stmt *)(uintptr_t)addr;
+    n_cols = PyTuple_GET_SIZE(columns);
+    if (stmt == NULL || n_cols != cortex_column_count(stmt)) {
+        PyErr_SetString(PyExc_ValueError, "columns do not match the statement");
+        return NULL;
+    }
+
+    rows = PyList_New(0);
+    if (rows == NULL) return NULL;
+
+    while (max_rows < 0 || count < max_rows) {
+        PyObject *row;
+        Py_ssize_t i;
+
+        Py_BEGIN_ALLOW_THREADS
+        rc = cortex_step(stmt);
+        Py_END_ALLOW_THREADS
+        if (rc != CORTEX_ROW) break;
+
+        row = PyDict_New();
+        if (row == NULL) goto error;
+        for (i = 0; i < n_cols; i++) {
+            PyObject *value = column_value(stmt, (int)i);
+            if (value == NULL || PyDict_SetItem(row, PyTuple_GET_ITEM(columns, i), value) < 0) {
+                Py_XDECREF(value);
+                Py_DECREF(row);
+                goto error;
+            }
+            Py_DECREF(value);
+        }
+        if (PyList_Append(rows, row) < 0) {
+            Py_DECREF(row);
+            goto error;
+        }
+        Py_DECREF(row);
+        count++;
+    }
+
+    return Py_BuildValue("(Ni)", rows, rc);
+
+error:
+    Py_DECREF(rows);
+    return NULL;
+}
+
+static int bind_value(cortex_stmt *stmt, int i, PyObject *value) {
+    /*
+        Text and blobs are bound CORTEX_STATIC: every parameter is rebound
+        for each row before the next step, and execute_many() clears the
+        bindings before it returns, while the row objects are still alive.
+    */
+    if (value == Py_None) {
+        return cortex_bind_null(stmt, i);
+    }
+    if (PyLong_Check(value)) {
+        long long v = PyLong_AsLongLong(value);
+        if (v == -1 && PyErr_Occurred()) return -1;
+        return cortex_bind_int64(stmt, i, v);
+    }
+    if (PyFloat_Check(value)) {
+        return cortex_bind_double(stmt, i, PyFloat_AS_DOUBLE(value));
+    }
+    if (PyUnicode_Check(value)) {
+        Py_ssize_t n;
+        const char *text = PyUnicode_AsUTF8AndSize(value, &n);
+        if (text == NULL) return -1;
+        return cortex_bind_text(stmt, i, text, (int)n, CORTEX_STATIC);
+    }
+    if (PyBytes_Check(value)) {
+        return cortex_bind_blob(stmt, i, PyBytes_AS_STRING(value),
+                                (int)PyBytes_GET_SIZE(value), CORTEX_STATIC);
+    }
+    if (PyObject_CheckBuffer(value)) {
+        Py_buffer view;
+        int rc;
+        if (PyObject_GetBuffer(value, &view, PyBUF_CONTIG_RO) < 0) return -1;
+        rc = cortex_bind_blob(stmt, i, view.buf, (int)view.len, CORTEX_TRANSIENT);
+        PyBuffer_Release(&view);
+        return rc;
+    }
+    PyErr_Format(PyExc_TypeError, "unsupported parameter type: %s", Py_TYPE(value)->tp_name);
+    return -1;
+}
+
+/*
+    execute_many(stmt_addr, rows) -> (count, rc)
+
+    Binds each row (a sequence with one value per parameter), steps the
+    statement to completion and resets it. Stops at the first failing row:
+    count is the number of rows applied and rc the failing cortex_step()
+    result, or CORTEX_DONE when every row went through. The statement is
+    left with no bindings: they point into the rows' objects.
+*/
+static PyObject *rows_execute_many(PyObject *self, PyObject *args) {
+    unsigned long long addr;
+    PyObject *rows, *seq;
+    cortex_stmt *stmt;
+    Py_ssize_t n_rows, r;
+    int n_params, rc = CORTEX_DONE;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "KO", &addr, &rows)) return NULL;
+    stmt = (cortex_stmt *)(uintptr_t)addr;
+    if (stmt == NULL) {
+        PyErr_SetString(PyExc_ValueError, "no statement");
+        return NULL;
+    }
+    seq = PySequence_Fast(rows, "rows must be a sequence");
+    if (seq == NULL) return NULL;
+
+    n_params = cortex_bind_parameter_count(stmt);
+    n_rows = PySequence_Fast_GET_SIZE(seq);
+    for (r = 0; r < n_rows; r++) {
+        PyObject *row = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, r), "each row must be a sequence");
+        Py_ssize_t i;
+
+        if (row == NULL) goto error;
+        if (PySequence_Fast_GET_SIZE(row) != n_params) {
+            PyErr_Format(PyExc_ValueError, "statement takes %d parameters, %zd given",
+                         n_params, PySequence_Fast_GET_SIZE(row));
+            Py_DECREF(row);
+            goto error;
+        }
+        for (i = 0; i < n_params; i++) {
+            int brc = bind_value(stmt, (int)i + 1, PySequence_Fast_GET_ITEM(row, i));
+            if (brc != CORTEX_OK) {
+                if (!PyErr_Occurred()) {
+                    PyErr_Format(PyExc_ValueError, "failed to bind parameter %zd: %d", i + 1, brc);
+                }
+                Py_DECREF(row);
+                goto error;
+            }
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        do {
+            rc = cortex_step(stmt);
+        } while (rc == CORTEX_ROW);
+        cortex_reset(stmt);
+        Py_END_ALLOW_THREADS
+        Py_DECREF(row);
+        if (rc != CORTEX_DONE) break;
+    }
+
+    cortex_clear_bindings(stmt);
+    Py_DECREF(seq);
+    return Py_BuildValue("(ni)", r, rc);
+
+error:
+    cortex_clear_bindings(stmt);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/*
+    Budget(timeout=None, max_instructions=None)
+
+    install(db_addr) registers the progress handler on a connection for
+    the duration of a step; uninstall(db_addr) removes it. The handler
+    makes cortex_step() return CORTEX_INTERRUPT once the deadline passes,
+    the instruction budget runs out, or cancel() is called (from any
+    thread). reason reports which of the three tripped.
+*/
+typedef struct {
+    PyObject_HEAD
+    long long deadline_ns;      /* 0 = no deadline */
+    long long remaining;        /* instructions left when limited */
+    int limited;
+    volatile int cancelled;
+    int tripped;                /* 0, or one of the BUDGET_* reasons */
+} BudgetObject;
+
+enum { BUDGET_TIMEOUT = 1, BUDGET_INSTRUCTIONS, BUDGET_CANCELLED };
+
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int budget_progress(void *arg) {
+    BudgetObject *b = (BudgetObject *)arg;
+    if (b->cancelled) {
+        b->tripped = BUDGET_CANCELLED;
+    } else if (b->limited && (b->remaining -= BUDGET_PERIOD) < 0) {
+        b->tripped = BUDGET_INSTRUCTIONS;
+    } else if (b->deadline_ns && monotonic_ns() >= b->deadline_ns) {
+        b->tripped = BUDGET_TIMEOUT;
+    }
+    return b->tripped;
+}
+
+static int budget_init(BudgetObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", "max_instructions", NULL};
+    PyObject *timeout = Py_None, *max_instructions = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO", kwlist, &timeout, &max_instructions)) {
+        return -1;
+    }
+    self->deadline_ns = 0;
+    self->remaining = 0;
+    self->limited = 0;
+    self->cancelled = 0;
+    self->tripped = 0;
+    if (timeout != Py_None) {
+        double seconds = PyFloat_AsDouble(timeout);
+        if (seconds == -1.0 && PyErr_Occurred()) return -1;
+        self->deadline_ns = monotonic_ns() + (long long)(seconds * 1e9);
+        if (self->deadline_ns == 0) self->deadline_ns = 1;
+    }
+    if (max_instructions != Py_None) {
+        self->remaining = PyLong_AsLongLong(max_instructions);
+        if (self->remaining == -1 && PyErr_Occurred()) return -1;
+        self->limited = 1;
+    }
+    return 0;
+}
+
+static PyObject *budget_install(BudgetObject *self, PyObject *arg) {
+    cortex *db = (cortex *)(uintptr_t)PyLong_AsUnsignedLongLong(arg);
+    if (PyErr_Occurred()) return NULL;
+    cortex_progress_handler(db, BUDGET_PERIOD, budget_progress, self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *budget_uninstall(BudgetObject *self, PyObject *arg) {
+    cortex *db = (cortex *)(uintptr_t)PyLong_AsUnsignedLongLong(arg);
+    (void)self;
+    if (PyErr_Occurred()) return NULL;
+    cortex_progress_handler(db, 0, NULL, NULL);
+    Py_RETURN_NONE;
+}
+
+static PyObject *budget_cancel(BudgetObject *self, PyObject *unused) {
+    (void)unused;
+    self->cancelled = 1;
+    Py_RETURN_NONE;
+}
+
+static PyObject *budget_reason(BudgetObject *self, void *closure) {
+    (void)closure;
+    switch (self->tripped) {
+        case BUDGET_TIMEOUT:      return PyUnicode_FromString("timeout");
+        case BUDGET_INSTRUCTIONS: return PyUnicode_FromString("instructions");
+        case BUDGET_CANCELLED:    return PyUnicode_FromString("cancelled");
+        default:                  Py_RETURN_NONE;
+    }
+}
+
+static PyMethodDef budget_methods[] = {
+    {"install", (PyCFunction)budget_install, METH_O, "install(db_addr)"},
+    {"uninstall", (PyCFunction)budget_uninstall, METH_O, "uninstall(db_addr)"},
+    {"cancel", (PyCFunction)budget_cancel, METH_NOARGS, "cancel()"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef budget_getset[] = {
+    {"reason", (getter)budget_reason, NULL, "why the budget tripped, or None", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject BudgetType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "cortex.core._rows.Budget",
+    .tp_basicsize = sizeof(BudgetObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Budget(timeout=None, max_instructions=None)",
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)budget_init,
+    .tp_methods = budget_methods,
+    .tp_getset = budget_getset,
+};
+
+static PyMethodDef rows_methods[] = {
+    {"step", rows_step, METH_VARARGS,
+     "step(stmt_addr, columns, max_rows=-1) -> (rows, rc)"},
+    {"execute_many", rows_execute_many, METH_VARARGS,
+     "execute_many(stmt_addr, rows) -> (count, rc)"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef rows_module = {
+    PyModuleDef_HEAD_INIT, "_rows", "Native row materialization for Cortex.", -1,
+    rows_methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__rows(void) {
+    PyObject *module;
+
+    if (PyType_Ready(&BudgetType) < 0) return NULL;
+    module = PyModule_Create(&rows_module);
+    if (module == NULL) return NULL;
+    Py_INCREF(&BudgetType);
+    if (PyModule_AddObject(module, "Budget", (PyObject *)&BudgetType) < 0) {
+        Py_DECREF(&BudgetType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
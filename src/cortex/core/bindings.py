@@ -31,17 +31,71 @@ ffi.cdef("""
         cortex_stmt **ppStmt,
         const char **pzTail
     );
+    int cortex_prepare_v3(
+        cortex *db,
+        const char *sql,
+        int nByte,
+        unsigned int prepFlags,
+        cortex_stmt **ppStmt,
+        const char **pzTail
+    );
     int cortex_step(cortex_stmt *stmt);
     int cortex_finalize(cortex_stmt *stmt);
+    int cortex_reset(cortex_stmt *stmt);
+    int cortex_clear_bindings(cortex_stmt *stmt);
+    int cortex_stmt_readonly(cortex_stmt *stmt);
+
+    int cortex_bind_parameter_count(cortex_stmt *stmt);
+    const char *cortex_bind_parameter_name(cortex_stmt *stmt, int i);
+    int cortex_bind_null(cortex_stmt *stmt, int i);
+    int cortex_bind_int64(cortex_stmt *stmt, int i, long long value);
+    int cortex_bind_double(cortex_stmt *stmt, int i, double value);
+    int cortex_bind_text(
+        cortex_stmt *stmt, int i, const char *value, int n, void (*destructor)(void*)
+    );
+    int cortex_bind_blob(
+        cortex_stmt *stmt, int i, const void *value, int n, void (*destructor)(void*)
+    );
 
     int cortex_column_count(cortex_stmt *stmt);
     const char *cortex_column_name(cortex_stmt *stmt, int iCol);
     int cortex_column_type(cortex_stmt *stmt, int iCol);
     int cortex_column_int(cortex_stmt *stmt, int iCol);
+    long long cortex_column_int64(cortex_stmt *stmt, int iCol);
     double cortex_column_double(cortex_stmt *stmt, int iCol);
     const char *cortex_column_text(cortex_stmt *stmt, int iCol);
+    const void *cortex_column_blob(cortex_stmt *stmt, int iCol);
+    int cortex_column_bytes(cortex_stmt *stmt, int iCol);
+
+    const char *cortex_errmsg(cortex *db);
+    int cortex_get_autocommit(cortex *db);
+    int cortex_changes(cortex *db);
+    long long cortex_last_insert_rowid(cortex *db);
+    void cortex_progress_handler(cortex *db, int nOps, int (*xProgress)(void *), void *pArg);
+    void cortex_interrupt(cortex *db);
+    int cortex_status64(int op, long long *pCurrent, long long *pHighwater, int resetFlag);
+    int cortex_db_status(cortex *db, int op, int *pCur, int *pHiwtr, int resetFlg);
+    int cortex_libversion_number(void);
+    int cortex_file_control(cortex *db, const char *zDbName, int op, void *arg);
 
+    int cortex_vec_init(cortex *db);
+    int vec_index_build(
+        cortex *db,
+        const char *table,
+        const char *column,
+        const char *options,
+        int (*progress)(void *, long long, long long),
+        void *arg,
+        char **errmsg
+    );
     void cortex_free(void *ptr);
+
+    int cortex_vfs_uring_register(int make_default);
+    int cortex_vfs_prefetch_register(int make_default);
+    int cortex_vfs_compress_register(int make_default);
+    int cortex_vfs_checksum_register(int make_default);
+
+    int cortex_pcache_sharded_install(int hugepages);
 """)
 
 
@@ -0,0 +1,228 @@
+import threading
+from .core import ffi, lib, _rows
+from .statements import SCRIPT, bind_params
+from .limits import CORTEX_INTERRUPT, QueryInterrupted, new_budget, handle_addr
+
+CORTEX_INTEGER = 1
+CORTEX_FLOAT   = 2
+CORTEX_TEXT    = 3
+CORTEX_BLOB    = 4
+CORTEX_NULL    = 5
+CORTEX_ROW     = 100
+CORTEX_DONE    = 101
+
+
+def step_rows(stmt, columns, max_rows: int = -1):
+    """
+    Step up to max_rows rows (all when negative) into dicts.
+    Returns (rows, rc) where rc is the last cortex_step() result.
+    """
+    if _rows is not None:
+        return _rows.step(int(ffi.cast("uintptr_t", stmt)), columns, max_rows)
+
+    col_count = len(columns)
+    rows = []
+    rc = CORTEX_ROW
+    while max_rows < 0 or len(rows) < max_rows:
+        rc = lib.cortex_step(stmt)
+        if rc != CORTEX_ROW:
+            break
+
+        row = {}
+        for i in range(col_count):
+            col_type = lib.cortex_column_type(stmt, i)
+            col_name = columns[i]
+
+            if col_type == CORTEX_INTEGER:
+                row[col_name] = lib.cortex_column_int64(stmt, i)
+            elif col_type == CORTEX_FLOAT:
+                row[col_name] = lib.cortex_column_double(stmt, i)
+            elif col_type == CORTEX_TEXT:
+                val = lib.cortex_column_text(stmt, i)
+                row[col_name] = ffi.string(val).decode() if val != ffi.NULL else None
+            elif col_type == CORTEX_BLOB:
+                size = lib.cortex_column_bytes(stmt, i)
+                row[col_name] = ffi.buffer(lib.cortex_column_blob(stmt, i), size)[:]
+            else:
+                row[col_name] = None
+
+        rows.append(row)
+    return rows, rc
+
+
+class CortexCursor:
+    """
+    Server-side cursor: keeps the prepared cortex_stmt open and steps it
+    lazily, so memory stays flat and the first row comes back without
+    waiting for the whole result.
+
+    execute(timeout=, max_instructions=) bounds the whole call (defaults
+    come from the connection); cancel() stops it from another thread.
+    Either raises QueryInterrupted from the fetch that was running.
+
+        with db.cursor() as cur:
+            cur.execute("SELECT * FROM events")
+            for row in cur:
+                ...
+    """
+
+    arraysize = 100
+
+    def __init__(self, connection, pool=None):
+        self._connection = connection
+        self._pool = pool
+        self._handle = None
+        self._sql = None
+        self._stmt = None
+        self._done = True
+        self._budget = None
+        self._cancelled = False
+        self._cancel_lock = threading.Lock()
+        self.description = None
+
+    def execute(self, sql: str, params=None, timeout=None, max_instructions=None):
+        self.close()
+        if timeout is None:
+            timeout = self._connection.query_timeout
+        if max_instructions is None:
+            max_instructions = self._connection.max_instructions
+        self._budget = new_budget(timeout, max_instructions)
+        if self._cancelled:
+            self._budget.cancel()
+        handle = self._connection
+        if self._pool is not None and lib.cortex_get_autocommit(self._connection._conn):
+            # Outside a writer transaction reads go to the pool. With every
+            # reader held by open cursors the writer takes the read instead
+            # of waiting, and SQL a reader cannot run (writes, TEMP objects)
+            # is moved back to the writer below. Vector queries only ever
+            # get the pool's one vector reader (see ReaderPool).
+            handle = self._pool.acquire(sql) or self._connection
+        try:
+            stmt = self._prepare(handle, sql, params)
+        except Exception:
+            if handle is self._connection:
+                raise
+            stmt = None
+        if stmt is None:
+            self._release_handle(handle)
+            handle = self._connection
+            stmt = self._prepare(handle, sql, params)
+
+        with self._cancel_lock:
+            self._handle = handle
+        with handle._lock:
+            self._sql = sql
+            self._stmt = stmt
+            self._done = stmt == ffi.NULL  # blank or comment-only SQL
+            count = 0 if self._done else lib.cortex_column_count(stmt)
+            self.description = tuple(
+                ffi.string(lib.cortex_column_name(stmt, i)).decode()
+                for i in range(count)
+            )
+        handle._cursors.add(self)
+        return self
+
+    def _prepare(self, handle, sql: str, params):
+        """Prepared and bound statement, or None when a reader got a write."""
+        with handle._lock:
+            stmt = handle._statements.acquire(sql)
+            if stmt is SCRIPT:
+                raise ValueError("cursor.execute() takes a single SQL statement")
+            if handle is not self._connection and stmt != ffi.NULL \
+                    and not lib.cortex_stmt_readonly(stmt):
+                handle._statements.release(sql, stmt)
+                return None
+            try:
+                if stmt != ffi.NULL:
+                    bind_params(stmt, params)
+            except Exception:
+                handle._statements.release(sql, stmt)
+                raise
+            return stmt
+
+    def _release_handle(self, handle):
+        if handle is not self._connection:
+            self._pool.release(handle)
+
+    def fetchmany(self, size: int = None):
+        if self._done:
+            return []
+        size = self.arraysize if size is None else size
+        addr = handle_addr(self._handle._conn)
+        with self._handle._lock:
+            self._budget.install(addr)
+            try:
+                rows, rc = step_rows(self._stmt, self.description, size)
+            finally:
+                self._budget.uninstall(addr)
+        if rc == CORTEX_ROW:
+            return rows
+        self.close()
+        if rc == CORTEX_INTERRUPT:
+            raise QueryInterrupted(self._budget.reason or "cancelled")
+        if rc != CORTEX_DONE:
+            raise Exception(f"Error fetching row: {rc}")
+        return rows
+
+    def cancel(self):
+        """
+        Stop the running statement; safe from any thread. A pooled reader
+        belongs to this cursor alone, so it is also cortex_interrupt()ed.
+        The shared writer only gets the progress-handler flag, since an
+        interrupt there would hit other cursors' statements too; when the
+        budget installs no handler (the cffi fallback without limits) the
+        writer is interrupted only while this is its one open cursor, and
+        otherwise the cancel takes effect on the next fetch. A cancelled
+        cursor stays cancelled.
+        """
+        self._cancelled = True
+        if self._budget is not None:
+            self._budget.cancel()
+        with self._cancel_lock:
+            handle = self._handle
+            if handle is None or not handle._conn:
+                return
+            if handle is not self._connection:
+                lib.cortex_interrupt(handle._conn)
+            elif not getattr(self._budget, "watching", True) and set(handle._cursors) <= {self}:
+                lib.cortex_interrupt(handle._conn)
+
+    def fetchone(self):
+        rows = self.fetchmany(1)
+        return rows[0] if rows else None
+
+    def fetchall(self):
+        return self.fetchmany(-1)
+
+    def __iter__(self):
+        while True:
+            rows = self.fetchmany()
+            if not rows:
+                return
+            yield from rows
+
+    def close(self):
+        """Reset the statement back into the cache; releases its read snapshot."""
+        if self._stmt is not None:
+            with self._handle._lock:
+                self._handle._statements.release(self._sql, self._stmt)
+            self._stmt = None
+            self._handle._cursors.discard(self)
+        with self._cancel_lock:
+            if self._handle is not None:
+                self._release_handle(self._handle)
+                self._handle = None
+        self._done = True
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def __del__(self):
+        try:
+            if self._stmt is not None and self._handle._conn is not None:
+                self.close()
+        except Exception:
+            pass  # interpreter shutdown
@@ -0,0 +1,75 @@
+import time
+from .core import ffi, lib, _rows
+
+CORTEX_INTERRUPT = 9
+
+# VM instructions between progress handler calls (BUDGET_PERIOD in _rows.c)
+PROGRESS_PERIOD = 1000
+
+
+class QueryInterrupted(Exception):
+    """A statement was stopped by its timeout, instruction budget or cancel()."""
+
+    def __init__(self, reason: str):
+        super().__init__(f"Query interrupted: {reason}")
+        self.reason = reason
+
+
+class _PyBudget:
+    """
+    cffi fallback for _rows.Budget; same interface, handler runs in Python.
+
+    Without a timeout or instruction limit no handler is installed: a
+    Python call every PROGRESS_PERIOD instructions would cost more than
+    the checks are worth. Such a budget only trips on a cancel() that came
+    before install(); the cursor interrupts a running statement itself
+    (watching is False).
+    """
+
+    def __init__(self, timeout=None, max_instructions=None):
+        self._deadline = time.monotonic() + timeout if timeout is not None else None
+        self._remaining = max_instructions
+        self._cancelled = False
+        self._installed = False
+        self.reason = None
+        self.watching = timeout is not None or max_instructions is not None
+        self._handler = ffi.callback("int(void *)", self._progress) if self.watching else None
+
+    def _progress(self, _):
+        if self._cancelled:
+            self.reason = "cancelled"
+        elif self._remaining is not None and self._remaining < PROGRESS_PERIOD:
+            self.reason = "instructions"
+        elif self._deadline is not None and time.monotonic() >= self._deadline:
+            self.reason = "timeout"
+        if self._remaining is not None:
+            self._remaining -= PROGRESS_PERIOD
+        return 1 if self.reason else 0
+
+    def install(self, db_addr: int):
+        if not self.watching and not self._cancelled:
+            return
+        if self._handler is None:
+            self._handler = ffi.callback("int(void *)", self._progress)
+        lib.cortex_progress_handler(ffi.cast("cortex *", db_addr), PROGRESS_PERIOD,
+                                    self._handler, ffi.NULL)
+        self._installed = True
+
+    def uninstall(self, db_addr: int):
+        if not self._installed:
+            return
+        lib.cortex_progress_handler(ffi.cast("cortex *", db_addr), 0, ffi.NULL, ffi.NULL)
+        self._installed = False
+
+    def cancel(self):
+        self._cancelled = True
+
+
+def new_budget(timeout=None, max_instructions=None):
+    if _rows is not None:
+        return _rows.Budget(timeout, max_instructions)
+    return _PyBudget(timeout, max_instructions)
+
+
+def handle_addr(conn) -> int:
+    return int(ffi.cast("uintptr_t", conn))
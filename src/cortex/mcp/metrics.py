@@ -0,0 +1,140 @@
+import bisect
+import os
+import threading
+from ..core import ffi, lib
+
+# cortex_status64() counters, library-wide
+_STATUS = [
+    ("memory_used_bytes", 0, "gauge", "Memory currently allocated by libcortex"),
+    ("pagecache_overflow_bytes", 2, "gauge", "Page cache bytes that spilled to malloc"),
+    ("malloc_count", 9, "gauge", "Outstanding libcortex allocations"),
+]
+
+# cortex_db_status() counters, per connection
+_DB_STATUS = [
+    ("cache_used_bytes", 1, "gauge", "Page cache memory in use"),
+    ("cache_hit_total", 7, "counter", "Page cache hits"),
+    ("cache_miss_total", 8, "counter", "Page cache misses"),
+    ("cache_write_total", 9, "counter", "Dirty pages written"),
+    ("cache_spill_total", 12, "counter", "Dirty pages spilled mid-transaction"),
+    ("lookaside_used", 0, "gauge", "Lookaside slots in use"),
+    ("lookaside_hit_total", 4, "counter", "Allocations served from lookaside"),
+    ("lookaside_miss_size_total", 5, "counter", "Lookaside misses: request too large"),
+    ("lookaside_miss_full_total", 6, "counter", "Lookaside misses: all slots in use"),
+    ("schema_used_bytes", 2, "gauge", "Memory holding the parsed schema"),
+    ("stmt_used_bytes", 3, "gauge", "Memory held by prepared statements"),
+]
+
+# Latency buckets in seconds
+BUCKETS = (0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0)
+
+
+class ToolMetrics:
+    """Per-tool request counters and latency histograms."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._requests = {}     # (tool, status) -> count
+        self._histograms = {}   # tool -> [bucket counts..., overflow, sum, count]
+
+    def observe(self, tool: str, seconds: float, status: str = "ok"):
+        with self._lock:
+            key = (tool, status)
+            self._requests[key] = self._requests.get(key, 0) + 1
+            hist = self._histograms.get(tool)
+            if hist is None:
+                hist = self._histograms[tool] = [0] * (len(BUCKETS) + 3)
+            hist[bisect.bisect_left(BUCKETS, seconds)] += 1
+            hist[-2] += seconds
+            hist[-1] += 1
+
+    def render(self, out: list):
+        with self._lock:
+            requests = sorted(self._requests.items())
+            histograms = sorted((tool, list(hist)) for tool, hist in self._histograms.items())
+
+        _header(out, "cortex_tool_requests_total", "counter", "MCP tool calls by result")
+        for (tool, status), count in requests:
+            out.append(f'cortex_tool_requests_total{{tool="{_label(tool)}",status="{_label(status)}"}} {count}')
+
+        _header(out, "cortex_tool_duration_seconds", "histogram", "MCP tool call latency")
+        for tool, hist in histograms:
+            tool = _label(tool)
+            cumulative = 0
+            for bound, count in zip(BUCKETS, hist):
+                cumulative += count
+                out.append(f'cortex_tool_duration_seconds_bucket{{tool="{tool}",le="{bound}"}} {cumulative}')
+            out.append(f'cortex_tool_duration_seconds_bucket{{tool="{tool}",le="+Inf"}} {hist[-1]}')
+            out.append(f'cortex_tool_duration_seconds_sum{{tool="{tool}"}} {hist[-2]:.6f}')
+            out.append(f'cortex_tool_duration_seconds_count{{tool="{tool}"}} {hist[-1]}')
+
+
+tool_metrics = ToolMetrics()
+
+
+def _label(value: str) -> str:
+    """Escape a label value for the text exposition format."""
+    return value.replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+
+def _header(out: list, name: str, kind: str, help_text: str):
+    out.append(f"# HELP {name} {help_text}")
+    out.append(f"# TYPE {name} {kind}")
+
+
+def _db_status(conn, op: int) -> int:
+    cur = ffi.new("int *")
+    high = ffi.new("int *")
+    lib.cortex_db_status(conn, op, cur, high, 0)
+    return cur[0]
+
+
+def _sample(handle, samples: dict):
+    for name, op, _, _ in _DB_STATUS:
+        samples[name].append(_db_status(handle._conn, op))
+
+
+def render_metrics(db) -> str:
+    """Prometheus text exposition for the library, the connection and the tools."""
+    out = []
+    cur = ffi.new("long long *")
+    high = ffi.new("long long *")
+    for name, op, kind, help_text in _STATUS:
+        lib.cortex_status64(op, cur, high, 0)
+        _header(out, f"cortex_{name}", kind, help_text)
+        out.append(f"cortex_{name} {cur[0]}")
+
+    if db is not None:
+        samples = {name: [] for name, *_ in _DB_STATUS}
+        labels = []
+        # The writer is FULLMUTEX, so its status can be read at any time.
+        if db._conn:
+            labels.append("writer")
+            _sample(db, samples)
+        # Readers are NOMUTEX: sample only the ones no cursor is stepping.
+        for i, reader in enumerate(db._pool.readers if db._pool is not None else ()):
+            if not reader._lock.acquire(timeout=0.05):
+                continue
+            try:
+                if reader._conn:
+                    labels.append(f"reader-{i}")
+                    _sample(reader, samples)
+            finally:
+                reader._lock.release()
+        for name, _, kind, help_text in _DB_STATUS:
+            _header(out, f"cortex_db_{name}", kind, help_text)
+            for label, value in zip(labels, samples[name]):
+                out.append(f'cortex_db_{name}{{connection="{label}"}} {value}')
+
+        wal = db.path + "-wal"
+        _header(out, "cortex_wal_size_bytes", "gauge", "Size of the write-ahead log file")
+        out.append(f"cortex_wal_size_bytes {os.path.getsize(wal) if os.path.exists(wal) else 0}")
+
+        if db.write_queue is not None:
+            _header(out, "cortex_write_queue_commits_total", "counter", "Group-commit transactions")
+            out.append(f"cortex_write_queue_commits_total {db.write_queue.commits}")
+            _header(out, "cortex_write_queue_statements_total", "counter", "Statements applied by the write queue")
+            out.append(f"cortex_write_queue_statements_total {db.write_queue.statements}")
+
+    tool_metrics.render(out)
+    return "\n".join(out) + "\n"
@@ -1,5 +1,9 @@
+import asyncio
+import time
 from mcp.server import Server
 from mcp.types import Tool, TextContent
+from .metrics import tool_metrics
+from . import tools
 
 app = Server("cortex")
 _db = None
@@ -10,8 +14,11 @@ def set_connection(db):
     _db = db
 
 
-@app.list_tools()
-async def list_tools() -> list[Tool]:
+def get_connection():
+    return _db
+
+
+def _tool_list() -> list[Tool]:
     return [
         Tool(
             name="cortex_query",
@@ -22,6 +29,15 @@ async def list_tools() -> list[Tool]:
                     "sql": {
                         "type": "string",
                         "description": "SELECT SQL statement"
+                    },
+                    "max_rows": {
+                        "type": "integer",
+                        "description": "Stop after this many rows (optional)"
+                    },
+                    "timeout": {
+                        "type": "number",
+                        "description": "Seconds before the query is cancelled (optional, "
+                                       "can only shorten the server limit)"
                     }
                 },
                 "required": ["sql"]
@@ -62,9 +78,34 @@ async def list_tools() -> list[Tool]:
                 }
             }
         ),
+        *tools.MEMORY_TOOLS,
     ]
 
 
+# Metrics label names outside this set as "unknown" so callers cannot grow the series
+_TOOL_NAMES = frozenset(tool.name for tool in _tool_list())
+
+
+@app.list_tools()
+async def list_tools() -> list[Tool]:
+    return _tool_list()
+
+
+def _query_text(cur, sql: str, max_rows: int = None, timeout: float = None) -> str:
+    """Render rows incrementally from a streaming cursor, stopping at max_rows."""
+    lines = []
+    if timeout is not None and _db.query_timeout is not None:
+        timeout = min(timeout, _db.query_timeout)
+    with cur:
+        cur.execute(sql, timeout=timeout)
+        for row in cur:
+            if max_rows is not None and len(lines) >= max_rows:
+                lines.append(f"... truncated after {max_rows} rows")
+                break
+            lines.append(str(row))
+    return "\n".join(lines)
+
+
 @app.call_tool()
 async def call_tool(name: str, arguments: dict) -> list[TextContent]:
     global _db
@@ -76,18 +117,32 @@ async def call_tool(name: str, arguments: dict) -> list[TextContent]:
         print("[DEBUG] ERROR: No database connected")
         return [TextContent(type="text", text="Error: No database connected")]
 
+    start = time.perf_counter()
+    status = "ok"
     try:
         if name == "cortex_query":
-            rows = _db.fetch(arguments.get("sql", ""))
-            if not rows:
+            # Run off the event loop so one slow query does not stall other
+            # clients; if the caller goes away, stop the statement too.
+            cur = _db.cursor()
+            try:
+                result = await asyncio.to_thread(
+                    _query_text, cur, arguments.get("sql", ""),
+                    arguments.get("max_rows"), arguments.get("timeout"),
+                )
+            except asyncio.CancelledError:
+                cur.cancel()
+                raise
+            if not result:
                 return [TextContent(type="text", text="No results found")]
-            result = "\n".join(str(row) for row in rows)
             return [TextContent(type="text", text=result)]
 
         elif name == "cortex_execute":
             sql = arguments.get("sql", "")
             print(f"[DEBUG] Executing SQL: {sql}")
-            _db.execute(sql)
+            if _db.write_queue is not None:
+                await asyncio.wrap_future(_db.submit(sql))
+            else:
+                _db.execute(sql)
             print(f"[DEBUG] SQL executed successfully")
             return [TextContent(type="text", text="Executed successfully")]
 
@@ -113,11 +168,30 @@ async def call_tool(name: str, arguments: dict) -> list[TextContent]:
             result = "\n".join(str(row) for row in rows)
             return [TextContent(type="text", text=result)]
 
+        elif name == "cortex_remember":
+            return [TextContent(type="text", text=await tools.remember(_db, arguments))]
+
+        elif name == "cortex_recall":
+            result = await tools.recall(_db, arguments)
+            if result == "[]":
+                return [TextContent(type="text", text="No memories found")]
+            return [TextContent(type="text", text=result)]
+
         else:
+            status = "error"
             return [TextContent(type="text", text=f"Unknown tool: {name}")]
 
+    except asyncio.CancelledError:
+        status = "cancelled"
+        raise
+
     except Exception as e:
+        status = "error"
         print(f"[DEBUG] Exception: {str(e)}")
         import traceback
         traceback.print_exc()
-        return [TextContent(type="text", text=f"Error: {str(e)}")]
\ No newline at end of file
+        return [TextContent(type="text", text=f"Error: {str(e)}")]
+
+    finally:
+        tool = name if name in _TOOL_NAMES else "unknown"
+        tool_metrics.observe(tool, time.perf_counter() - start, status)
\ No newline at end of file
@@ -0,0 +1,207 @@
+"""
+Agent memory tools: cortex_remember stores a memory, cortex_recall
+returns the memories nearest to a query embedding.
+
+A collection is a plain table plus a vec_hnsw index that follows it
+through triggers (content=). Both are created by the first remember,
+with that embedding's dimension:
+
+    <collection>(id, text, agent, kind, metadata, created_at, embedding)
+    <collection>_vec  USING vec_hnsw(dim, metric=cosine, content=<collection>,
+                                     agent TEXT, kind TEXT, created_at INTEGER)
+
+agent, kind and created_at are metadata columns of the index, so recall
+filters on them run inside the search and k hits still come back.
+metadata is free-form JSON that is stored and returned, not filtered on.
+Recall answers with one compact JSON array, nearest first: text is cut
+at max_chars and fields that are not set are left out.
+"""
+import asyncio
+import json
+import re
+import time
+import weakref
+from array import array
+from mcp.types import Tool
+from ..core import lib
+
+DEFAULT_COLLECTION = "memories"
+DEFAULT_K = 5
+MAX_K = 50
+DEFAULT_MAX_CHARS = 400
+
+_NAME = re.compile(r"[A-Za-z_][A-Za-z0-9_]{0,62}")
+
+# collections known to exist, per connection
+_collections = weakref.WeakKeyDictionary()
+
+_FILTERS = {
+    "agent": {"type": "string", "description": "Only memories stored by this agent"},
+    "kind": {"type": "string", "description": "Only memories of this kind"},
+    "after": {"type": "integer", "description": "Only memories created at or after this Unix time"},
+    "before": {"type": "integer", "description": "Only memories created before this Unix time"},
+}
+
+_COLLECTION = {
+    "type": "string",
+    "description": f"Collection name (optional, default {DEFAULT_COLLECTION})",
+}
+
+_EMBEDDING = {"type": "array", "items": {"type": "number"}}
+
+MEMORY_TOOLS = [
+    Tool(
+        name="cortex_remember",
+        description="Store a memory: its text, embedding and optional agent, kind and metadata. "
+                    "Returns the memory id",
+        inputSchema={
+            "type": "object",
+            "properties": {
+                "text": {"type": "string", "description": "What to remember"},
+                "embedding": {**_EMBEDDING, "description": "Embedding of the text"},
+                "agent": {"type": "string", "description": "Agent storing the memory (optional)"},
+                "kind": {"type": "string", "description": "Kind of memory, e.g. fact or event (optional)"},
+                "metadata": {"type": "object", "description": "Extra JSON returned with the memory (optional)"},
+                "collection": _COLLECTION,
+            },
+            "required": ["text", "embedding"]
+        }
+    ),
+    Tool(
+        name="cortex_recall",
+        description="Find the memories most similar to an embedding, nearest first, "
+                    "optionally filtered by agent, kind or creation time",
+        inputSchema={
+            "type": "object",
+            "properties": {
+                "embedding": {**_EMBEDDING, "description": "Query embedding"},
+                "k": {"type": "integer", "description": f"Memories to return (default {DEFAULT_K}, "
+                                                        f"at most {MAX_K})"},
+                **_FILTERS,
+                "max_chars": {"type": "integer", "description": "Cut each memory's text at this "
+                                                                f"length (default {DEFAULT_MAX_CHARS})"},
+                "collection": _COLLECTION,
+            },
+            "required": ["embedding"]
+        }
+    ),
+]
+
+
+def _collection(arguments) -> str:
+    name = arguments.get("collection") or DEFAULT_COLLECTION
+    if not isinstance(name, str) or not _NAME.fullmatch(name):
+        raise ValueError(f"invalid collection name: {name!r}")
+    return name
+
+
+def _embedding(arguments) -> bytes:
+    values = arguments.get("embedding")
+    if not isinstance(values, list) or not values \
+            or not all(isinstance(v, (int, float)) and not isinstance(v, bool) for v in values):
+        raise ValueError("embedding must be a non-empty array of numbers")
+    return array("f", values).tobytes()
+
+
+def _known(db) -> set:
+    return _collections.setdefault(db, set())
+
+
+def _create(db, name: str, dim: int):
+    db.execute(
+        f'CREATE TABLE IF NOT EXISTS "{name}"(id INTEGER PRIMARY KEY, text TEXT NOT NULL,'
+        f' agent TEXT, kind TEXT, metadata TEXT, created_at INTEGER NOT NULL, embedding BLOB);'
+        f'CREATE VIRTUAL TABLE IF NOT EXISTS "{name}_vec" USING vec_hnsw(dim={dim}, metric=cosine,'
+        f' content={name}, agent TEXT, kind TEXT, created_at INTEGER)'
+    )
+    _known(db).add(name)
+
+
+def _insert(db, sql: str, params) -> int:
+    with db._lock:
+        db._execute_locked(sql, params)
+        return lib.cortex_last_insert_rowid(db._conn)
+
+
+async def remember(db, arguments) -> str:
+    text = arguments.get("text")
+    if not isinstance(text, str) or not text:
+        raise ValueError("text must be a non-empty string")
+    name = _collection(arguments)
+    blob = _embedding(arguments)
+    metadata = arguments.get("metadata")
+    if metadata is not None and not isinstance(metadata, dict):
+        raise ValueError("metadata must be an object")
+
+    if name not in _known(db):
+        await asyncio.to_thread(_create, db, name, len(blob) // 4)
+    sql = (f'INSERT INTO "{name}"(text, agent, kind, metadata, created_at, embedding)'
+           f' VALUES (?, ?, ?, ?, ?, ?)')
+    params = (
+        text, arguments.get("agent"), arguments.get("kind"),
+        json.dumps(metadata, separators=(",", ":")) if metadata else None,
+        int(time.time()), blob,
+    )
+    if db.write_queue is not None:
+        result = await asyncio.wrap_future(db.submit(sql, params))
+        memory_id = result.last_insert_rowid
+    else:
+        memory_id = await asyncio.to_thread(_insert, db, sql, params)
+    return json.dumps({"id": memory_id})
+
+
+def _recall_rows(db, name: str, arguments):
+    k = arguments.get("k", DEFAULT_K)
+    if not isinstance(k, int) or isinstance(k, bool) or not 1 <= k <= MAX_K:
+        raise ValueError(f"k must be an integer between 1 and {MAX_K}")
+    where = ["v.embedding MATCH ?", "v.k = ?"]
+    params = [_embedding(arguments), k]
+    for key, condition in (("agent", "v.agent = ?"), ("kind", "v.kind = ?"),
+                           ("after", "v.created_at >= ?"), ("before", "v.created_at < ?")):
+        if arguments.get(key) is not None:
+            where.append(condition)
+            params.append(arguments[key])
+    return db.fetch(
+        f'SELECT m.id, m.text, m.agent, m.kind, m.metadata, m.created_at, v.distance'
+        f' FROM "{name}_vec" v JOIN "{name}" m ON m.id = v.rowid'
+        f' WHERE {" AND ".join(where)} ORDER BY v.distance',
+        params,
+    )
+
+
+def _exists(db, name: str) -> bool:
+    if name in _known(db):
+        return True
+    if not db.fetch(f'PRAGMA table_info("{name}_vec")'):
+        return False
+    _known(db).add(name)
+    return True
+
+
+def _hit(row, max_chars: int) -> dict:
+    text = row["text"]
+    hit = {
+        "id": row["id"],
+        "distance": round(row["distance"], 4),
+        "text": text if len(text) <= max_chars else text[:max_chars] + "…",
+    }
+    for key in ("agent", "kind", "created_at"):
+        if row[key] is not None:
+            hit[key] = row[key]
+    if row["metadata"]:
+        hit["metadata"] = json.loads(row["metadata"])
+    return hit
+
+
+async def recall(db, arguments) -> str:
+    name = _collection(arguments)
+    max_chars = arguments.get("max_chars", DEFAULT_MAX_CHARS)
+    if not isinstance(max_chars, int) or isinstance(max_chars, bool) or max_chars < 1:
+        raise ValueError("max_chars must be a positive integer")
+
+    def run():
+        return _recall_rows(db, name, arguments) if _exists(db, name) else []
+
+    rows = await asyncio.to_thread(run)
+    return json.dumps([_hit(row, max_chars) for row in rows], ensure_ascii=False,
+                      separators=(",", ":"))
@@ -5,10 +5,12 @@ from mcp.server import Server
 from mcp.server.sse import SseServerTransport
 from starlette.applications import Starlette
 from starlette.requests import Request
-from starlette.responses import JSONResponse, Response
+from starlette.responses import JSONResponse, PlainTextResponse, Response
 from starlette.routing import Route
 from starlette.middleware.base import BaseHTTPMiddleware
 from ..auth.apikey import APIKeyAuth
+from ..metrics import render_metrics
+from ..server import get_connection
 
 
 class AuthMiddleware(BaseHTTPMiddleware):
@@ -54,12 +56,17 @@ def create_http_app(mcp_server: Server, auth: APIKeyAuth):
     async def health(request: Request):
         return JSONResponse({"status": "ok", "server": "cortex"})
 
+    async def metrics(request: Request):
+        text = await asyncio.to_thread(render_metrics, get_connection())
+        return PlainTextResponse(text, media_type="text/plain; version=0.0.4")
+
     async def root(request: Request):
         return JSONResponse({
             "server": "cortex",
             "version": "0.1.0",
             "endpoints": {
                 "health": "/health",
+                "metrics": "/metrics",
                 "sse": "/sse",
                 "messages": "/messages/"
             }
@@ -68,6 +75,7 @@ def create_http_app(mcp_server: Server, auth: APIKeyAuth):
     routes = [
         Route("/", root, methods=["GET"]),
         Route("/health", health, methods=["GET"]),
+        Route("/metrics", metrics, methods=["GET"]),
         Route("/sse", handle_sse, methods=["GET"]),
         Route("/messages/", handle_messages, methods=["POST"]),
     ]
@@ -1,11 +1,14 @@
 import asyncio
 import threading
 import json
+import anyio
+import mcp.types as types
 from starlette.applications import Starlette
 from starlette.routing import WebSocketRoute
-from starlette.websockets import WebSocket
+from starlette.websockets import WebSocket, WebSocketDisconnect
 import uvicorn
 from mcp.server import Server
+from mcp.shared.message import SessionMessage
 from ..auth.apikey import APIKeyAuth
 
 
@@ -25,12 +28,40 @@ def create_websocket_app(mcp_server: Server, auth: APIKeyAuth):
             "data": {"status": "Cortex MCP Server connected"}
         })
 
+        # Bridge the socket into an MCP session, the same way the SSE
+        # transport does. Stateless, so clients may call tools without
+        # the initialize handshake.
+        read_writer, read_stream = anyio.create_memory_object_stream(0)
+        write_stream, write_reader = anyio.create_memory_object_stream(0)
+
+        async def ws_reader():
+            async with read_writer:
+                try:
+                    while True:
+                        data = await websocket.receive_text()
+                        message = types.JSONRPCMessage.model_validate(json.loads(data))
+                        await read_writer.send(SessionMessage(message))
+                except WebSocketDisconnect:
+                    pass
+
+        async def ws_writer():
+            async with write_reader:
+                async for session_message in write_reader:
+                    await websocket.send_json(session_message.message.model_dump(
+                        by_alias=True, mode="json", exclude_none=True
+                    ))
+
         try:
-            while True:
-                data = await websocket.receive_text()
-                body = json.loads(data)
-                response = await mcp_server.handle_request(body)
-                await websocket.send_json(response)
+            async with anyio.create_task_group() as tg:
+                tg.start_soon(ws_reader)
+                tg.start_soon(ws_writer)
+                await mcp_server.run(
+                    read_stream,
+                    write_stream,
+                    mcp_server.create_initialization_options(),
+                    stateless=True,
+                )
+                tg.cancel_scope.cancel()
         except Exception:
             await websocket.close()
 
@@ -49,4 +80,4 @@ def start_websocket(mcp_server: Server, port: int, auth: APIKeyAuth):
 
     thread = threading.Thread(target=run_in_thread, daemon=True)
     thread.start()
-    return thread
\ No newline at end of file
+    return thread
@@ -0,0 +1,235 @@
+import queue
+import re
+import threading
+import weakref
+from .core import ffi, lib
+from .statements import StatementCache
+
+CORTEX_OPEN_READONLY  = 0x00000001
+CORTEX_OPEN_READWRITE = 0x00000002
+CORTEX_OPEN_CREATE    = 0x00000004
+CORTEX_OPEN_NOMUTEX   = 0x00008000
+CORTEX_OPEN_FULLMUTEX = 0x00010000
+
+CORTEX_FCNTL_RESERVE_BYTES = 38
+
+
+# VFS layers built into libcortex, registered the first time they are asked for
+_VFS_REGISTER = {
+    "io_uring": "cortex_vfs_uring_register",
+    "prefetch": "cortex_vfs_prefetch_register",
+    "compress": "cortex_vfs_compress_register",
+    "checksum": "cortex_vfs_checksum_register",
+}
+
+# Bytes at the end of each page a layer keeps for itself. Asked for on every
+# writable open: it takes on a new database, or at the next VACUUM.
+_VFS_RESERVE = {
+    "checksum": 4,
+}
+
+
+def _register_vfs(name: str):
+    register = _VFS_REGISTER.get(name)
+    if register is None:
+        return  # the unix VFS variants are always registered
+    try:
+        rc = getattr(lib, register)(0)
+    except AttributeError:
+        rc = 1  # libcortex built without it
+    if rc != 0:
+        raise ConnectionError(f"VFS {name!r} is not available on this system")
+
+
+# Page caches built into libcortex; installed process-wide with cortex_config
+_PAGE_CACHES = {
+    "sharded": "cortex_pcache_sharded_install",
+}
+
+
+def use_page_cache(name: str, hugepages: bool = False):
+    """
+    Switch every connection of the process to a built-in page cache. Has to
+    run before the first connection is opened.
+    """
+    install = _PAGE_CACHES.get(name)
+    if install is None:
+        raise ValueError(f"unknown page cache {name!r}")
+    try:
+        rc = getattr(lib, install)(1 if hugepages else 0)
+    except AttributeError:
+        rc = 1  # libcortex built without it
+    if rc == 21:  # CORTEX_MISUSE: the library is already initialised
+        raise RuntimeError("use_page_cache() must be called before the first connection is opened")
+    if rc != 0:
+        raise RuntimeError(f"page cache {name!r} is not available on this system")
+
+
+def open_handle(path: str, flags: int, vfs: str = None):
+    """Open a raw cortex* handle or raise ConnectionError."""
+    db = ffi.new("cortex **")
+    if vfs is not None:
+        _register_vfs(vfs)
+    rc = lib.cortex_open_v2(path.encode(), db, flags, vfs.encode() if vfs else ffi.NULL)
+    if rc != 0:
+        lib.cortex_close(db[0])
+        raise ConnectionError(f"Failed to open database: {path}")
+    reserve = _VFS_RESERVE.get(vfs)
+    if reserve and not flags & CORTEX_OPEN_READONLY:
+        lib.cortex_file_control(db[0], b"main", CORTEX_FCNTL_RESERVE_BYTES, ffi.new("int *", reserve))
+    _init_extensions(db[0])
+    return db[0]
+
+
+def _init_extensions(conn):
+    """Register the native vector modules (vec_hnsw, ...) on a new handle."""
+    try:
+        init = lib.cortex_vec_init
+    except AttributeError:
+        return  # libcortex built without the vector extension
+    if init(conn) != 0:
+        lib.cortex_close(conn)
+        raise ConnectionError("Failed to initialise the vector extension")
+
+
+# Tables and views in the schema; vec_hnsw tables and the views over them
+# are the ones a reader has to load a graph for
+_SCHEMA_OBJECTS = "SELECT type, name, sql FROM sqlite_schema WHERE type IN ('table', 'view') AND sql IS NOT NULL"
+_VEC_HNSW = re.compile(r"CREATE\s+VIRTUAL\s+TABLE\b.*\bUSING\s+vec_hnsw\b", re.IGNORECASE | re.DOTALL)
+
+# Distinct SQL strings whose route is remembered before the memo starts over
+_ROUTES_MAX = 4096
+
+
+def _names_pattern(names):
+    if not names:
+        return None
+    return re.compile(r"\b(?:%s)\b" % "|".join(map(re.escape, sorted(names))), re.IGNORECASE)
+
+
+class ReaderConnection:
+    """
+    One read-only handle of a ReaderPool. Opened NOMUTEX: the pool hands
+    it to a single thread at a time. Has the same _conn / _lock /
+    _statements / _cursors shape that CortexCursor works against.
+
+    Like any handle, a reader keeps its own in-memory copy of the graph of
+    every vec_hnsw table it queries, about as large as the index itself.
+    """
+
+    def __init__(self, path: str, statement_cache_size: int, vfs: str = None):
+        self._conn = open_handle(path, CORTEX_OPEN_READONLY | CORTEX_OPEN_NOMUTEX, vfs)
+        self._lock = threading.Lock()
+        self._cursors = weakref.WeakSet()
+        self._statements = StatementCache(self._conn, statement_cache_size)
+
+    def close(self):
+        for cur in list(self._cursors):
+            cur.close()
+        if self._conn:
+            self._statements.close()
+            lib.cortex_close(self._conn)
+            self._conn = None
+
+
+class ReaderPool:
+    """
+    Fixed-size pool of ReaderConnections for WAL-mode concurrent reads.
+
+    A vec_hnsw graph is loaded per handle, so spreading vector queries over
+    every reader would keep `size` copies of each index in memory. SQL that
+    names a vec_hnsw table (or a view over one) only ever runs on
+    `vector_reader`, and on the writer while that reader is taken: at most
+    two copies, whatever the pool size. Other reads use the remaining
+    readers first and `vector_reader` last.
+    """
+
+    def __init__(self, path: str, size: int, statement_cache_size: int = 128, vfs: str = None):
+        self.size = size
+        self._idle = queue.LifoQueue()
+        self._closed = False
+        self.readers = [ReaderConnection(path, statement_cache_size, vfs) for _ in range(size)]
+        self.vector_reader = self.readers[0]
+        self._vector_taken = threading.Lock()
+        for reader in self.readers[1:]:
+            self._idle.put(reader)
+        # SQL text -> whether it touches a vec_hnsw table
+        self._routes = {}
+
+    def acquire(self, sql: str = None):
+        """
+        An idle reader for sql, or None when none may take it (the caller
+        uses the writer).
+        """
+        if self._closed:
+            raise ConnectionError("reader pool is closed")
+        vector = self._routes.get(sql) if sql is not None else False
+        if not vector:
+            try:
+                reader = self._idle.get_nowait()
+            except queue.Empty:
+                reader = None
+            if reader is not None:
+                if vector is None:
+                    vector = self._route(reader, sql)
+                if not vector:
+                    return reader
+                self._idle.put(reader)
+        if self._vector_taken.acquire(blocking=False):
+            return self.vector_reader
+        return None
+
+    def release(self, reader: ReaderConnection):
+        if reader is self.vector_reader:
+            if self._closed:
+                reader.close()
+            self._vector_taken.release()
+        elif self._closed:
+            reader.close()
+        else:
+            self._idle.put(reader)
+
+    def idle(self) -> int:
+        """Readers not handed out at the moment."""
+        return self._idle.qsize() + (not self._vector_taken.locked())
+
+    def schema_changed(self):
+        """Forget every route; a vec_hnsw table may have come or gone."""
+        self._routes = {}
+
+    def _route(self, reader: ReaderConnection, sql: str) -> bool:
+        """Whether sql touches a vec_hnsw table, read from reader's schema."""
+        with reader._lock:
+            stmt = reader._statements.acquire(_SCHEMA_OBJECTS)
+            try:
+                objects = []
+                while lib.cortex_step(stmt) == 100:
+                    objects.append(tuple(
+                        ffi.string(lib.cortex_column_text(stmt, i)).decode() for i in range(3)
+                    ))
+            finally:
+                reader._statements.release(_SCHEMA_OBJECTS, stmt)
+        names = {name for kind, name, text in objects if kind == "table" and _VEC_HNSW.match(text)}
+        views = [(name, text) for kind, name, text in objects if kind == "view"]
+        while True:
+            pattern = _names_pattern(names)
+            more = {name for name, text in views
+                    if name not in names and pattern is not None and pattern.search(text)}
+            if not more:
+                break
+            names |= more
+        vector = pattern is not None and pattern.search(sql) is not None
+        if len(self._routes) >= _ROUTES_MAX:
+            self._routes = {}
+        self._routes[sql] = vector
+        return vector
+
+    def close(self):
+        self._closed = True
+        while True:
+            try:
+                self._idle.get_nowait().close()
+            except queue.Empty:
+                break
+        if self._vector_taken.acquire(blocking=False):
+            self.vector_reader.close()
@@ -0,0 +1,151 @@
+from collections import OrderedDict
+from .core import ffi, lib
+
+CORTEX_PREPARE_PERSISTENT = 0x01
+CORTEX_TRANSIENT = ffi.cast("void(*)(void*)", -1)
+
+# Cache value for SQL that holds several statements; it goes through cortex_exec
+SCRIPT = object()
+
+# Statements that never change the schema, so they skip the schema check
+_DML_KEYWORDS = (
+    "INSERT", "UPDATE", "DELETE", "REPLACE", "SELECT", "WITH", "VALUES",
+    "BEGIN", "COMMIT", "END", "ROLLBACK", "SAVEPOINT", "RELEASE",
+)
+
+
+def may_change_schema(sql: str) -> bool:
+    return not sql.lstrip().upper().startswith(_DML_KEYWORDS)
+
+
+def bind_params(stmt, params):
+    """Bind a sequence (for ?) or a mapping (for :name, @name, $name)."""
+    count = lib.cortex_bind_parameter_count(stmt)
+    if params is None:
+        params = ()
+    if isinstance(params, dict):
+        values = []
+        for i in range(1, count + 1):
+            name = lib.cortex_bind_parameter_name(stmt, i)
+            if name == ffi.NULL:
+                raise ValueError(f"parameter {i} is positional; pass a sequence")
+            key = ffi.string(name).decode()[1:]
+            if key not in params:
+                raise ValueError(f"missing value for parameter :{key}")
+            values.append(params[key])
+    else:
+        values = list(params)
+        if len(values) != count:
+            raise ValueError(f"statement takes {count} parameters, {len(values)} given")
+
+    for i, value in enumerate(values, 1):
+        if value is None:
+            rc = lib.cortex_bind_null(stmt, i)
+        elif isinstance(value, (bool, int)):
+            rc = lib.cortex_bind_int64(stmt, i, int(value))
+        elif isinstance(value, float):
+            rc = lib.cortex_bind_double(stmt, i, value)
+        elif isinstance(value, str):
+            data = value.encode()
+            rc = lib.cortex_bind_text(stmt, i, data, len(data), CORTEX_TRANSIENT)
+        elif isinstance(value, (bytes, bytearray, memoryview)):
+            data = bytes(value)
+            rc = lib.cortex_bind_blob(stmt, i, data, len(data), CORTEX_TRANSIENT)
+        else:
+            raise TypeError(f"unsupported parameter type: {type(value).__name__}")
+        if rc != 0:
+            raise Exception(f"Failed to bind parameter {i}: {rc}")
+
+
+class StatementCache:
+    """
+    Per-connection LRU of prepared statements keyed by SQL text.
+
+    acquire() hands a statement out of the cache so an open cursor owns it
+    exclusively; release() resets it, clears its bindings and puts it back.
+    Callers must hold the connection lock.
+    """
+
+    def __init__(self, conn, capacity: int = 128):
+        self._conn = conn
+        self.capacity = capacity
+        self._cache = OrderedDict()
+        self._schema_stmt = None
+        self._schema_version = None
+        self.check_schema()
+
+    def acquire(self, sql: str):
+        """Return a ready statement, ffi.NULL for empty SQL, or SCRIPT."""
+        stmt = self._cache.get(sql)
+        if stmt is SCRIPT:
+            self._cache.move_to_end(sql)
+            return SCRIPT
+        if stmt is not None:
+            del self._cache[sql]
+            return stmt
+
+        sql_bytes = sql.encode()
+        stmt_ptr = ffi.new("cortex_stmt **")
+        tail = ffi.new("const char **")
+        rc = lib.cortex_prepare_v3(
+            self._conn, sql_bytes, len(sql_bytes), CORTEX_PREPARE_PERSISTENT, stmt_ptr, tail
+        )
+        if rc != 0:
+            error = ffi.string(lib.cortex_errmsg(self._conn)).decode()
+            raise Exception(f"Failed to prepare statement: {error} ({sql})")
+
+        stmt = stmt_ptr[0]
+        if tail[0] != ffi.NULL and ffi.string(tail[0]).strip(b" \t\r\n;"):
+            lib.cortex_finalize(stmt)
+            self._store(sql, SCRIPT)
+            return SCRIPT
+        return stmt
+
+    def release(self, sql: str, stmt):
+        if stmt is SCRIPT or stmt == ffi.NULL:
+            return
+        lib.cortex_reset(stmt)
+        lib.cortex_clear_bindings(stmt)
+        if self.capacity <= 0 or sql in self._cache:
+            lib.cortex_finalize(stmt)
+            return
+        self._store(sql, stmt)
+
+    def _store(self, sql: str, stmt):
+        self._cache[sql] = stmt
+        while len(self._cache) > self.capacity:
+            _, old = self._cache.popitem(last=False)
+            if old is not SCRIPT:
+                lib.cortex_finalize(old)
+
+    def check_schema(self):
+        """Drop every cached statement if the schema cookie moved."""
+        if self._schema_stmt is None:
+            stmt_ptr = ffi.new("cortex_stmt **")
+            lib.cortex_prepare_v3(
+                self._conn, b"PRAGMA schema_version", -1,
+                CORTEX_PREPARE_PERSISTENT, stmt_ptr, ffi.NULL
+            )
+            self._schema_stmt = stmt_ptr[0]
+        version = None
+        if lib.cortex_step(self._schema_stmt) == 100:
+            version = lib.cortex_column_int64(self._schema_stmt, 0)
+        lib.cortex_reset(self._schema_stmt)
+        if self._schema_version is not None and version != self._schema_version:
+            self.clear()
+        self._schema_version = version
+
+    def clear(self):
+        for stmt in self._cache.values():
+            if stmt is not SCRIPT:
+                lib.cortex_finalize(stmt)
+        self._cache.clear()
+
+    def close(self):
+        self.clear()
+        if self._schema_stmt is not None:
+            lib.cortex_finalize(self._schema_stmt)
+            self._schema_stmt = None
+
+    def __len__(self):
+        return len(self._cache)
@@ -0,0 +1,140 @@
+import queue
+import re
+import threading
+import time
+from collections import namedtuple
+from concurrent.futures import Future
+from .core import lib
+from .statements import SCRIPT
+
+WriteResult = namedtuple("WriteResult", ["changes", "last_insert_rowid"])
+
+# Statements that would break the batch transaction the queue manages
+_TXN_KEYWORDS = ("BEGIN", "COMMIT", "END", "ROLLBACK", "SAVEPOINT", "RELEASE")
+
+# Whitespace and comments ahead of the first keyword
+_LEADING = re.compile(r"(?:\s+|--[^\n]*(?:\n|$)|/\*.*?(?:\*/|$))*", re.DOTALL)
+
+_STOP = object()
+
+
+class WriteQueue:
+    """
+    Group commit for small writes. Callers submit() statements and get a
+    Future; one writer thread drains the queue and applies everything that
+    arrived within window seconds (up to batch_size statements) in a
+    single transaction, so a batch pays for one commit instead of one
+    per statement.
+
+    Each statement runs inside its own SAVEPOINT: a failing statement is
+    rolled back alone and only its Future gets the exception. Futures are
+    completed after COMMIT succeeds. A submit() holds one statement; SQL
+    with several fails its Future rather than run outside the savepoint.
+    """
+
+    def __init__(self, connection, batch_size: int = 256, window: float = 0.002):
+        self._connection = connection
+        self.batch_size = batch_size
+        self.window = window
+        self._queue = queue.Queue()
+        self._lock = threading.Lock()   # orders submit() against close()
+        self._closed = False
+        self.commits = 0
+        self.statements = 0
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.name = "cortex-writer"
+        self._thread.start()
+
+    def submit(self, sql: str, params=None) -> Future:
+        future = Future()
+        if sql[_LEADING.match(sql).end():].upper().startswith(_TXN_KEYWORDS):
+            future.set_exception(ValueError("the write queue manages transactions itself"))
+            return future
+        with self._lock:
+            if self._closed or not self._thread.is_alive():
+                future.set_exception(ConnectionError("write queue is closed"))
+            else:
+                self._queue.put((sql, params, future))
+        return future
+
+    def close(self):
+        """Apply everything already queued, then stop the writer thread."""
+        with self._lock:
+            if self._closed:
+                return
+            self._closed = True
+            self._queue.put(_STOP)
+        self._thread.join()
+
+    def _run(self):
+        while True:
+            item = self._queue.get()
+            if item is _STOP:
+                return
+            batch = [item]
+            deadline = time.monotonic() + self.window
+            stop = False
+            while len(batch) < self.batch_size:
+                remaining = deadline - time.monotonic()
+                try:
+                    item = self._queue.get(timeout=remaining) if remaining > 0 \
+                        else self._queue.get_nowait()
+                except queue.Empty:
+                    break
+                if item is _STOP:
+                    stop = True
+                    break
+                batch.append(item)
+            try:
+                self._apply(batch)
+            except BaseException as exc:
+                # never leave a caller waiting on a dead writer thread
+                for _, _, future in batch:
+                    if not future.done():
+                        future.set_exception(exc)
+            if stop:
+                return
+
+    def _apply(self, batch):
+        conn = self._connection
+        outcomes = []
+        with conn._lock:
+            try:
+                conn._exec_script("BEGIN IMMEDIATE")
+            except Exception as exc:
+                for _, _, future in batch:
+                    future.set_exception(exc)
+                return
+
+            try:
+                for sql, params, future in batch:
+                    conn._exec_script("SAVEPOINT cortex_write")
+                    try:
+                        stmt = conn._statements.acquire(sql)
+                        conn._statements.release(sql, stmt)
+                        if stmt is SCRIPT:
+                            raise ValueError("submit() takes a single statement")
+                        conn._execute_locked(sql, params)
+                        outcomes.append((future, WriteResult(
+                            lib.cortex_changes(conn._conn),
+                            lib.cortex_last_insert_rowid(conn._conn),
+                        ), None))
+                    except Exception as exc:
+                        conn._exec_script("ROLLBACK TO cortex_write")
+                        outcomes.append((future, None, exc))
+                    conn._exec_script("RELEASE cortex_write")
+                conn._exec_script("COMMIT")
+            except BaseException as exc:
+                if not lib.cortex_get_autocommit(conn._conn):
+                    conn._exec_script("ROLLBACK")
+                for _, _, future in batch:
+                    future.set_exception(exc)
+                return
+            self.commits += 1
+            self.statements += len(batch)
+
+        for future, result, exc in outcomes:
+            if exc is None:
+                future.set_result(result)
+            else:
+                future.set_exception(exc)
@@ -0,0 +1,751 @@
+import os
+import pytest
+import cortex
+from cortex import connection
+
+TEST_DB = "./test_connection.ctx"
+
+
+def cleanup():
+    for suffix in ("", "-wal", "-shm", "-journal"):
+        if os.path.exists(TEST_DB + suffix):
+            os.remove(TEST_DB + suffix)
+
+
+@pytest.fixture
+def db():
+    cleanup()
+    db = cortex.connect(TEST_DB)
+    db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT, score REAL)")
+    yield db
+    db.close()
+    cleanup()
+
+
+# ─────────────────────────────────────────
+# Bulk ingest
+# ─────────────────────────────────────────
+
+class TestExecuteMany:
+
+    def test_positional_rows(self, db):
+        n = db.executemany(
+            "INSERT INTO events VALUES (?, ?, ?)",
+            ((i, f"agent-{i % 3}", i / 2) for i in range(2500)),
+            batch_size=1000,
+        )
+        assert n == 2500
+        assert db.fetchone("SELECT count(*) AS n FROM events")["n"] == 2500
+
+    def test_named_rows(self, db):
+        n = db.executemany(
+            "INSERT INTO events(agent, score) VALUES (:agent, :score)",
+            [{"agent": "a", "score": 1.0}, {"agent": "b", "score": 2.0}],
+        )
+        assert n == 2
+        assert db.fetch("SELECT agent FROM events ORDER BY id") == [{"agent": "a"}, {"agent": "b"}]
+
+    def test_failing_batch_rolled_back(self, db):
+        rows = [(1, "a", 1.0), (2, "b", 2.0), (3, "c", 3.0), (3, "dup", 4.0)]
+        with pytest.raises(Exception):
+            db.executemany("INSERT INTO events VALUES (?, ?, ?)", rows, batch_size=2)
+        # first batch committed, second batch rolled back
+        assert [r["id"] for r in db.fetch("SELECT id FROM events ORDER BY id")] == [1, 2]
+
+    def test_caller_transaction_respected(self, db):
+        db.execute("BEGIN")
+        db.executemany("INSERT INTO events(agent) VALUES (?)", [("a",), ("b",)], batch_size=1)
+        db.execute("ROLLBACK")
+        assert db.fetch("SELECT * FROM events") == []
+
+    def test_cffi_fallback(self, db, monkeypatch):
+        monkeypatch.setattr(connection, "_rows", None)
+        assert db.executemany("INSERT INTO events(agent) VALUES (?)", [("a",), ("b",)]) == 2
+
+
+class TestBulkInsert:
+
+    def test_dict_rows(self, db):
+        rows = ({"agent": f"agent-{i}", "score": float(i)} for i in range(100))
+        assert db.bulk_insert("events", rows) == 100
+        assert db.fetchone("SELECT max(score) AS m FROM events")["m"] == 99.0
+
+    def test_tuple_rows(self, db):
+        assert db.bulk_insert("events", [(1, "a", 0.5), (2, "b", 1.5)]) == 2
+
+    def test_empty(self, db):
+        assert db.bulk_insert("events", []) == 0
+
+    def test_fast_profile_restores_settings(self, db):
+        assert db.bulk_insert("events", [(i, "x", 0.0) for i in range(10)], fast=True) == 10
+        assert db.fetchone("PRAGMA journal_mode")["journal_mode"] == "delete"
+        assert db.fetchone("PRAGMA synchronous")["synchronous"] == 2
+
+    def test_fast_profile_restores_writer_settings_with_pool(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, readers=2)
+        try:
+            db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT, score REAL)")
+            db.execute("PRAGMA synchronous=NORMAL")
+            with db.ingest_profile("OFF"):
+                with cortex.CortexCursor(db) as cur:
+                    assert cur.execute("PRAGMA synchronous").fetchone()["synchronous"] == 0
+            with cortex.CortexCursor(db) as cur:
+                assert cur.execute("PRAGMA synchronous").fetchone()["synchronous"] == 1
+                assert cur.execute("PRAGMA journal_mode").fetchone()["journal_mode"] == "wal"
+        finally:
+            db.close()
+            cleanup()
+
+
+# ─────────────────────────────────────────
+# Reader pool
+# ─────────────────────────────────────────
+
+class TestReaderPool:
+
+    @pytest.fixture
+    def pooled(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, readers=3)
+        db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT, score REAL)")
+        db.executemany("INSERT INTO events(agent) VALUES (?)", [(f"a{i}",) for i in range(100)])
+        yield db
+        db.close()
+        cleanup()
+
+    def test_wal_enabled(self, pooled):
+        assert pooled.fetchone("PRAGMA journal_mode")["journal_mode"] == "wal"
+
+    def test_reads_use_pool(self, pooled):
+        cur = pooled.cursor().execute("SELECT id FROM events")
+        assert cur._handle is not pooled
+        cur.close()
+        assert pooled._pool.idle() == 3
+
+    def test_committed_writes_visible(self, pooled):
+        pooled.execute("INSERT INTO events(agent) VALUES ('new')")
+        assert pooled.fetchone("SELECT count(*) AS n FROM events")["n"] == 101
+
+    def test_open_transaction_reads_from_writer(self, pooled):
+        pooled.execute("BEGIN")
+        pooled.execute("INSERT INTO events(agent) VALUES ('pending')")
+        assert pooled.fetchone("SELECT count(*) AS n FROM events")["n"] == 101
+        pooled.execute("ROLLBACK")
+        assert pooled.fetchone("SELECT count(*) AS n FROM events")["n"] == 100
+
+    def test_write_through_cursor_goes_to_writer(self, pooled):
+        rows = pooled.fetch("INSERT INTO events(agent) VALUES ('ret') RETURNING agent")
+        assert rows == [{"agent": "ret"}]
+
+    def test_nested_read_with_pool_taken(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, readers=1)
+        try:
+            db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT)")
+            db.executemany("INSERT INTO events(agent) VALUES (?)", [(f"a{i}",) for i in range(500)])
+            seen = 0
+            with db.cursor() as cur:
+                for row in cur.execute("SELECT id FROM events"):
+                    seen += db.fetchone("SELECT count(*) AS n FROM events WHERE id = ?", (row["id"],))["n"]
+            assert seen == 500
+            assert db._pool.idle() == 1
+        finally:
+            db.close()
+            cleanup()
+
+    def test_temp_table_read_goes_to_writer(self, pooled):
+        pooled.execute("CREATE TEMP TABLE scratch AS SELECT id FROM events WHERE id <= 10")
+        assert pooled.fetchone("SELECT count(*) AS n FROM scratch")["n"] == 10
+        assert pooled._pool.idle() == 3
+
+    def test_concurrent_readers(self, pooled):
+        import threading
+        results, errors = [], []
+
+        def worker():
+            try:
+                for _ in range(50):
+                    results.append(pooled.fetchone("SELECT count(*) AS n FROM events")["n"])
+            except Exception as exc:
+                errors.append(exc)
+
+        threads = [threading.Thread(target=worker) for _ in range(6)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert not errors
+        assert results == [100] * 300
+
+    def test_vector_queries_use_one_reader(self, pooled):
+        from array import array
+        pooled.execute("CREATE VIRTUAL TABLE mem USING vec_hnsw(dim=4)")
+        pooled.executemany("INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+                           [(i, array("f", [i, 1, 0, 0]).tobytes()) for i in range(1, 51)])
+        pooled.execute("CREATE VIEW near AS SELECT rowid FROM mem")
+        query = array("f", [3, 1, 0, 0]).tobytes()
+        pool = pooled._pool
+
+        plain = pooled.cursor().execute("SELECT id FROM events")
+        assert plain._handle not in (pool.vector_reader, pooled)
+        cursors = [pooled.cursor().execute("SELECT rowid FROM mem WHERE embedding MATCH ? AND k = 1", (query,)),
+                   pooled.cursor().execute("SELECT count(*) AS n FROM near")]
+        assert cursors[0]._handle is pool.vector_reader
+        assert cursors[1]._handle is pooled  # the vector reader is taken
+        assert cursors[0].fetchall() == [{"rowid": 3}]
+        assert cursors[1].fetchall() == [{"n": 50}]
+        plain.close()
+        assert pool.idle() == 3
+
+    def test_vector_route_follows_schema(self, pooled):
+        sql = "SELECT count(*) AS n FROM items"
+        pooled.execute("CREATE TABLE items (x)")
+        cur = pooled.cursor().execute(sql)
+        assert cur._handle is not pooled._pool.vector_reader
+        cur.close()
+        pooled.execute("DROP TABLE items")
+        pooled.execute("CREATE VIRTUAL TABLE items USING vec_hnsw(dim=4)")
+        cur = pooled.cursor().execute(sql)
+        assert cur._handle is pooled._pool.vector_reader
+        cur.close()
+
+
+# ─────────────────────────────────────────
+# Write queue
+# ─────────────────────────────────────────
+
+class TestWriteQueue:
+
+    @pytest.fixture
+    def queued(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, write_queue=True, write_window=0.05)
+        db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT UNIQUE, score REAL)")
+        yield db
+        db.close()
+        cleanup()
+
+    def test_results_per_future(self, queued):
+        futures = [queued.submit("INSERT INTO events(agent) VALUES (?)", (f"a{i}",)) for i in range(20)]
+        results = [f.result(timeout=5) for f in futures]
+        assert [r.last_insert_rowid for r in results] == list(range(1, 21))
+        assert all(r.changes == 1 for r in results)
+
+    def test_group_commit(self, queued):
+        futures = [queued.submit("INSERT INTO events(agent) VALUES (?)", (f"a{i}",)) for i in range(50)]
+        for f in futures:
+            f.result(timeout=5)
+        assert queued.write_queue.statements == 50
+        assert queued.write_queue.commits < 50
+
+    def test_failure_isolated(self, queued):
+        ok = queued.submit("INSERT INTO events(agent) VALUES ('x')")
+        dup = queued.submit("INSERT INTO events(agent) VALUES ('x')")
+        after = queued.submit("INSERT INTO events(agent) VALUES ('y')")
+        assert ok.result(timeout=5).changes == 1
+        with pytest.raises(Exception, match="UNIQUE"):
+            dup.result(timeout=5)
+        assert after.result(timeout=5).changes == 1
+        assert [r["agent"] for r in queued.fetch("SELECT agent FROM events ORDER BY id")] == ["x", "y"]
+
+    def test_rejects_transaction_control(self, queued):
+        with pytest.raises(ValueError):
+            queued.submit("BEGIN").result(timeout=5)
+        with pytest.raises(ValueError):
+            queued.submit("/* batch */ -- end it\n  COMMIT").result(timeout=5)
+
+    def test_rejects_several_statements(self, queued):
+        bad = queued.submit("INSERT INTO events(agent) VALUES ('a'); COMMIT; BEGIN")
+        with pytest.raises(ValueError, match="single statement"):
+            bad.result(timeout=5)
+        assert queued.submit("INSERT INTO events(agent) VALUES ('b');").result(timeout=5).changes == 1
+        assert [r["agent"] for r in queued.fetch("SELECT agent FROM events")] == ["b"]
+
+    def test_submit_racing_close(self):
+        import threading
+        cleanup()
+        db = cortex.connect(TEST_DB, write_queue=True, write_window=0.001)
+        db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT)")
+        futures = []
+
+        def submitter():
+            for _ in range(200):
+                futures.append(db.submit("INSERT INTO events(agent) VALUES ('a')"))
+
+        threads = [threading.Thread(target=submitter) for _ in range(4)]
+        for t in threads:
+            t.start()
+        db.write_queue.close()
+        for t in threads:
+            t.join()
+        try:
+            applied = 0
+            for f in futures:
+                try:
+                    f.result(timeout=5)
+                    applied += 1
+                except ConnectionError:
+                    pass
+            assert db.fetchone("SELECT count(*) AS n FROM events")["n"] == applied
+        finally:
+            db.close()
+            cleanup()
+
+    def test_close_drains_queue(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, write_queue=True, write_window=0.05)
+        db.execute("CREATE TABLE events (id INTEGER PRIMARY KEY, agent TEXT)")
+        futures = [db.submit("INSERT INTO events(agent) VALUES ('a')") for _ in range(10)]
+        db.write_queue.close()
+        assert all(f.done() for f in futures)
+        assert db.fetchone("SELECT count(*) AS n FROM events")["n"] == 10
+        db.close()
+        cleanup()
+
+    def test_submit_needs_queue(self, db):
+        with pytest.raises(RuntimeError):
+            db.submit("INSERT INTO events(agent) VALUES ('a')")
+
+
+# ─────────────────────────────────────────
+# VFS layers
+# ─────────────────────────────────────────
+
+def require_vfs(vfs):
+    try:
+        cortex.pool._register_vfs(vfs)
+    except ConnectionError as e:
+        pytest.skip(str(e))
+
+
+def vfs_connect(vfs, **kwargs):
+    cleanup()
+    try:
+        return cortex.connect(TEST_DB, vfs=vfs, **kwargs)
+    except ConnectionError as e:
+        pytest.skip(str(e))
+
+
+def churn(db, transactions=20, rows=400, seed=7):
+    """Random inserts and rewrites, some transactions larger than a staging arena."""
+    import random
+    rng = random.Random(seed)
+    expected = {}
+    db.execute("CREATE TABLE IF NOT EXISTS blobs (id INTEGER PRIMARY KEY, body BLOB)")
+    for t in range(transactions):
+        db.execute("BEGIN")
+        for _ in range(rows * (8 if t % 5 == 0 else 1)):
+            key, body = rng.randrange(3000), rng.randbytes(rng.randrange(10, 2000))
+            db.execute("INSERT OR REPLACE INTO blobs VALUES (?, ?)", (key, body))
+            expected[key] = body
+        db.execute("COMMIT")
+        key, body = rng.randrange(3000), rng.randbytes(100)
+        db.execute("INSERT OR REPLACE INTO blobs VALUES (?, ?)", (key, body))
+        expected[key] = body
+    return expected
+
+
+def reopened_rows(vfs=None):
+    db = cortex.connect(TEST_DB, vfs=vfs)
+    try:
+        assert db.fetchone("PRAGMA integrity_check")["integrity_check"] == "ok"
+        return {r["id"]: r["body"] for r in db.fetch("SELECT id, body FROM blobs")}
+    finally:
+        db.close()
+
+
+def pragma_count(db, name):
+    return int(next(iter(db.fetchone(f"PRAGMA {name}").values())))
+
+
+class TestUringVfs:
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE", "TRUNCATE"])
+    @pytest.mark.parametrize("synchronous", ["OFF", "NORMAL", "FULL"])
+    def test_round_trip(self, journal, synchronous):
+        db = vfs_connect("io_uring")
+        try:
+            db.execute(f"PRAGMA journal_mode={journal}")
+            db.execute(f"PRAGMA synchronous={synchronous}")
+            expected = churn(db)
+            assert db.fetchone("SELECT count(*) AS n FROM blobs")["n"] == len(expected)
+            # the writes went through the ring, not the unix fallback
+            assert pragma_count(db, "uring_submitted") > 0
+        finally:
+            db.close()
+        assert reopened_rows() == expected
+        cleanup()
+
+    def test_readers_see_commits(self):
+        db = vfs_connect("io_uring", readers=2)
+        try:
+            for synchronous in ("NORMAL", "FULL", "OFF"):
+                db.execute(f"PRAGMA synchronous={synchronous}")
+                db.execute("CREATE TABLE IF NOT EXISTS events (id INTEGER PRIMARY KEY, agent TEXT)")
+                for i in range(50):
+                    db.execute("INSERT INTO events(agent) VALUES (?)", (f"{synchronous}{i}",))
+                    last = db.fetchone("SELECT agent FROM events ORDER BY id DESC LIMIT 1")
+                    assert last["agent"] == f"{synchronous}{i}"
+            db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+            assert db.fetchone("SELECT count(*) AS n FROM events")["n"] == 150
+        finally:
+            db.close()
+            cleanup()
+
+    def test_switching_synchronous(self):
+        db = vfs_connect("io_uring")
+        try:
+            db.execute("PRAGMA journal_mode=WAL")
+            expected = {}
+            for synchronous in ("FULL", "OFF", "FULL", "NORMAL"):
+                db.execute(f"PRAGMA synchronous={synchronous}")
+                expected.update(churn(db, transactions=4, rows=100, seed=len(expected)))
+        finally:
+            db.close()
+        assert reopened_rows() == expected
+        cleanup()
+
+    def test_unknown_vfs(self):
+        cleanup()
+        with pytest.raises(ConnectionError):
+            cortex.connect(TEST_DB, vfs="no-such-vfs")
+
+
+def seed_blobs(rows=4000, seed=3):
+    import random
+    rng = random.Random(seed)
+    db = cortex.connect(TEST_DB)
+    try:
+        db.execute("CREATE TABLE blobs (id INTEGER PRIMARY KEY, body BLOB)")
+        db.execute("BEGIN")
+        for i in range(rows):
+            db.execute("INSERT INTO blobs VALUES (?, ?)", (i, rng.randbytes(rng.randrange(10, 3000))))
+        db.execute("COMMIT")
+        db.execute("CREATE INDEX blobs_len ON blobs(length(body))")
+    finally:
+        db.close()
+
+
+def scan(db):
+    return [tuple(r.values()) for r in db.fetch("SELECT id, length(body), hex(substr(body, 1, 8)) FROM blobs")]
+
+
+class TestPrefetchVfs:
+
+    @pytest.fixture(autouse=True)
+    def available(self):
+        require_vfs("prefetch")
+
+    def test_scans_match(self):
+        cleanup()
+        seed_blobs()
+        db = cortex.connect(TEST_DB)
+        expected = scan(db)
+        by_length = db.fetch("SELECT id FROM blobs ORDER BY length(body), id")
+        db.close()
+        db = cortex.connect(TEST_DB, vfs="prefetch")
+        try:
+            assert pragma_count(db, "prefetch_windows") == 0
+            for _ in range(3):
+                assert scan(db) == expected
+                assert db.fetch("SELECT id FROM blobs ORDER BY length(body), id") == by_length
+            # the scans were served by read-ahead, not only by xRead
+            assert pragma_count(db, "prefetch_windows") > 0
+        finally:
+            db.close()
+            cleanup()
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE"])
+    def test_sees_writes(self, journal):
+        cleanup()
+        seed_blobs()
+        db = cortex.connect(TEST_DB, vfs="prefetch")
+        other = cortex.connect(TEST_DB)
+        try:
+            db.execute(f"PRAGMA journal_mode={journal}")
+            for i in range(6):
+                writer = db if i % 2 else other
+                writer.execute("UPDATE blobs SET body = zeroblob(?) WHERE id % 7 = ?", (100 + i, i))
+                expected = scan(other)
+                assert scan(db) == expected
+                db.execute("BEGIN")
+                db.execute("DELETE FROM blobs WHERE id % 50 = ?", (i,))
+                partial = scan(db)
+                db.execute("ROLLBACK")
+                assert len(partial) < len(expected)
+                assert scan(db) == expected
+        finally:
+            other.close()
+            db.close()
+            cleanup()
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE", "TRUNCATE"])
+    def test_round_trip(self, journal):
+        db = vfs_connect("prefetch")
+        try:
+            db.execute(f"PRAGMA journal_mode={journal}")
+            expected = churn(db, transactions=10)
+            rows = {r["id"]: r["body"] for r in db.fetch("SELECT id, body FROM blobs")}
+            assert rows == expected
+        finally:
+            db.close()
+        assert reopened_rows() == expected
+        cleanup()
+
+
+# Runs in a second process against TEST_DB; argv[1] picks what it does
+COMPRESS_CHILD = """
+import os, sys
+import cortex
+from cortex import connection
+connection.start_mcp = lambda *args, **kwargs: None
+db = cortex.connect(sys.argv[2], vfs="compress")
+n = int(sys.argv[3])
+db.execute("PRAGMA cache_size=10")  # spill to the database file mid-transaction
+db.execute("BEGIN")
+db.execute("INSERT INTO t SELECT id + ?, v || ? FROM t WHERE id < 1000", (n * 1000, str(n)))
+db.execute("UPDATE t SET v = upper(v) WHERE id % 10 = ?", (n,))
+if sys.argv[1] == "crash":
+    os._exit(0)
+db.execute("COMMIT")
+db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+db.close()
+"""
+
+
+def compress_child(action, n):
+    import subprocess
+    import sys
+    env = dict(os.environ, PYTHONPATH=os.path.dirname(os.path.dirname(cortex.__file__)))
+    subprocess.run([sys.executable, "-c", COMPRESS_CHILD, action, TEST_DB, str(n)],
+                   check=True, capture_output=True, env=env)
+
+
+def compress_seed(journal):
+    db = vfs_connect("compress")
+    db.execute(f"PRAGMA journal_mode={journal}")
+    db.execute("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT)")
+    db.execute("BEGIN")
+    for i in range(1000):
+        db.execute("INSERT INTO t VALUES (?, ?)", (i, f"agent-{i % 7} said: " + "tool result ok " * 40))
+    db.execute("COMMIT")
+    return db
+
+
+class TestCompressVfs:
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE", "TRUNCATE"])
+    def test_round_trip(self, journal):
+        db = vfs_connect("compress")
+        try:
+            db.execute(f"PRAGMA journal_mode={journal}")
+            expected = churn(db, transactions=10)
+            db.execute("DELETE FROM blobs WHERE id % 3 = 0")
+            expected = {k: v for k, v in expected.items() if k % 3}
+            db.execute("VACUUM")
+        finally:
+            db.close()
+        assert reopened_rows("compress") == expected
+        cleanup()
+
+    def test_compresses(self):
+        db = compress_seed("DELETE")
+        try:
+            logical = db.fetchone("SELECT page_count * page_size AS n FROM pragma_page_count, pragma_page_size")["n"]
+        finally:
+            db.close()
+        assert os.path.getsize(TEST_DB) * 4 < logical
+        cleanup()
+
+    def test_readers_see_commits(self):
+        db = compress_seed("WAL")
+        db.close()
+        db = cortex.connect(TEST_DB, vfs="compress", readers=2)
+        try:
+            for i in range(50):
+                db.execute("UPDATE t SET v = ? WHERE id = ?", (f"update {i}", i))
+                assert db.fetchone("SELECT v FROM t WHERE id = ?", (i,))["v"] == f"update {i}"
+                if i % 10 == 9:
+                    db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+        finally:
+            db.close()
+            cleanup()
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE"])
+    def test_other_process(self, journal):
+        db = compress_seed(journal)
+        try:
+            for n in range(1, 4):
+                compress_child("commit", n)
+                assert db.fetchone("SELECT count(*) AS n FROM t")["n"] == 1000 * (n + 1)
+                db.execute("UPDATE t SET v = v || '!' WHERE id % 5 = 0")
+                db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+                assert db.fetchone("PRAGMA integrity_check")["integrity_check"] == "ok"
+        finally:
+            db.close()
+            cleanup()
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE"])
+    def test_crash_recovery(self, journal):
+        db = compress_seed(journal)
+        db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+        before = db.fetch("SELECT * FROM t")
+        db.close()
+        try:
+            compress_child("crash", 1)
+            db = cortex.connect(TEST_DB, vfs="compress")
+            assert db.fetchone("PRAGMA integrity_check")["integrity_check"] == "ok"
+            assert db.fetch("SELECT * FROM t") == before
+            db.close()
+        finally:
+            cleanup()
+
+    def test_only_opens_compressed(self):
+        db = compress_seed("DELETE")
+        db.close()
+        db = cortex.connect(TEST_DB)
+        try:
+            with pytest.raises(Exception):
+                db.fetch("SELECT * FROM t")
+        finally:
+            db.close()
+            cleanup()
+        db = cortex.connect(TEST_DB)
+        db.execute("CREATE TABLE t (id INTEGER PRIMARY KEY)")
+        db.close()
+        try:
+            with pytest.raises(ConnectionError):
+                cortex.connect(TEST_DB, vfs="compress")
+        finally:
+            cleanup()
+
+
+def reserve_bytes():
+    with open(TEST_DB, "rb") as f:
+        return f.read(100)[20]
+
+
+def flip_byte(page, at=2000):
+    """Corrupt one byte of a database page behind the connection's back."""
+    with open(TEST_DB, "r+b") as f:
+        size = int.from_bytes(f.read(18)[16:18], "big")
+        f.seek((page - 1) * size + at)
+        byte = f.read(1)[0]
+        f.seek(-1, os.SEEK_CUR)
+        f.write(bytes([byte ^ 0x40]))
+
+
+class TestChecksumVfs:
+
+    @pytest.fixture(autouse=True)
+    def available(self):
+        require_vfs("checksum")
+
+    @pytest.mark.parametrize("journal", ["WAL", "DELETE", "TRUNCATE"])
+    def test_round_trip(self, journal):
+        db = vfs_connect("checksum")
+        try:
+            db.execute(f"PRAGMA journal_mode={journal}")
+            expected = churn(db, transactions=10)
+            db.execute("DELETE FROM blobs WHERE id % 3 = 0")
+            expected = {k: v for k, v in expected.items() if k % 3}
+            db.execute("VACUUM")
+        finally:
+            db.close()
+        assert reserve_bytes() == 4
+        assert reopened_rows("checksum") == expected
+        assert reopened_rows() == expected  # still an ordinary database file
+        cleanup()
+
+    def test_detects_corruption(self):
+        db = vfs_connect("checksum")
+        db.execute("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT)")
+        db.execute("INSERT INTO t SELECT value, printf('row %08d', value) FROM json_each(?)",
+                   (str(list(range(2000))),))
+        db.close()
+        flip_byte(3)
+        db = cortex.connect(TEST_DB, vfs="checksum")
+        try:
+            with pytest.raises(Exception):
+                db.fetch("SELECT * FROM t")
+            db.execute("PRAGMA checksum_sample=0")
+            assert list(db.fetchone("PRAGMA checksum_sample").values()) == ["0"]
+            assert len(db.fetch("SELECT * FROM t")) == 2000
+        finally:
+            db.close()
+            cleanup()
+
+    def test_vacuum_adds_checksums(self):
+        cleanup()
+        seed_blobs(rows=500)
+        assert reserve_bytes() == 0
+        db = cortex.connect(TEST_DB, vfs="checksum")
+        try:
+            expected = scan(db)
+            db.execute("VACUUM")
+            assert scan(db) == expected
+        finally:
+            db.close()
+        assert reserve_bytes() == 4
+        flip_byte(5)
+        db = cortex.connect(TEST_DB, vfs="checksum")
+        try:
+            with pytest.raises(Exception):
+                scan(db)
+        finally:
+            db.close()
+            cleanup()
+
+
+# Installs the sharded page cache in a fresh process, then reads and writes
+# through a writer and two readers with caches small enough to evict
+PCACHE_CHILD = """
+import sys
+import cortex
+from cortex import connection
+connection.start_mcp = lambda *args, **kwargs: None
+try:
+    cortex.use_page_cache("sharded", hugepages=sys.argv[2] == "huge")
+except RuntimeError:
+    sys.exit(77)  # not available in this build
+db = cortex.connect(sys.argv[1], readers=2)
+db.execute("PRAGMA cache_size=20")
+db.execute("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT)")
+db.execute("CREATE INDEX t_v ON t(v)")
+for n in range(5):
+    db.execute("BEGIN")
+    for i in range(2000):
+        db.execute("INSERT OR REPLACE INTO t VALUES (?, ?)", (i + n * 500, f"{n}-{i}" * 20))
+    db.execute("ROLLBACK" if n == 3 else "COMMIT")
+assert db.fetchone("PRAGMA integrity_check")["integrity_check"] == "ok"
+assert db.fetchone("SELECT count(*) AS n FROM t")["n"] == 4000
+assert db.fetchone("SELECT v FROM t WHERE id = 3500")["v"] == "4-1500" * 20
+db.close()
+"""
+
+
+class TestShardedPageCache:
+
+    @pytest.mark.parametrize("hugepages", ["small", "huge"])
+    def test_round_trip(self, hugepages):
+        import subprocess
+        import sys
+        cleanup()
+        env = dict(os.environ, PYTHONPATH=os.path.dirname(os.path.dirname(cortex.__file__)))
+        try:
+            child = subprocess.run([sys.executable, "-c", PCACHE_CHILD, TEST_DB, hugepages],
+                                   capture_output=True, env=env)
+        finally:
+            cleanup()
+        if child.returncode == 77:
+            pytest.skip("sharded page cache is not available on this system")
+        assert child.returncode == 0, child.stderr.decode()
+
+    def test_after_first_connection(self, db):
+        with pytest.raises(RuntimeError):
+            cortex.use_page_cache("sharded")
+
+    def test_unknown(self):
+        with pytest.raises(ValueError):
+            cortex.use_page_cache("no-such-cache")
@@ -162,6 +162,22 @@ class TestHTTPServerHealth:
         with httpx.stream("GET", f"http://localhost:{HTTP_PORT}/sse", timeout=3) as r:
             assert r.status_code == 200
 
+    def test_metrics_endpoint(self, http_db):
+        response = httpx.get(f"http://localhost:{HTTP_PORT}/metrics")
+        assert response.status_code == 200
+        assert response.headers["content-type"].startswith("text/plain")
+        body = response.text
+        assert "cortex_memory_used_bytes " in body
+        assert 'cortex_db_cache_hit_total{connection="writer"}' in body
+        assert "cortex_wal_size_bytes " in body
+
+    def test_metrics_count_tool_calls(self, http_db):
+        from cortex.mcp import metrics
+        metrics.tool_metrics.observe("cortex_query", 0.003)
+        body = httpx.get(f"http://localhost:{HTTP_PORT}/metrics").text
+        assert 'cortex_tool_requests_total{tool="cortex_query",status="ok"}' in body
+        assert 'cortex_tool_duration_seconds_bucket{tool="cortex_query",le="+Inf"}' in body
+
 
 # ─────────────────────────────────────────
 # FLOW 2 — Session ID
@@ -301,6 +317,9 @@ class TestHTTPAuth:
         r = httpx.get("http://localhost:5183/health")
         assert r.status_code == 200
 
+    def test_metrics_requires_key(self, auth_db):
+        assert httpx.get("http://localhost:5183/metrics").status_code == 401
+
 
 # ─────────────────────────────────────────
 # FLOW 5 — Complete Agent Simulation
@@ -0,0 +1,173 @@
+import asyncio
+import json
+import os
+import pytest
+import cortex
+from cortex.core import lib
+from cortex.mcp import server, tools
+
+TEST_DB = "./test_mcp.ctx"
+
+
+def cleanup():
+    for suffix in ("", "-wal", "-shm", "-journal"):
+        if os.path.exists(TEST_DB + suffix):
+            os.remove(TEST_DB + suffix)
+
+
+def open_db(**kwargs):
+    cleanup()
+    db = cortex.connect(TEST_DB, **kwargs)
+    server.set_connection(db)
+    return db
+
+
+@pytest.fixture
+def db():
+    db = open_db()
+    yield db
+    server.set_connection(None)
+    db.close()
+    cleanup()
+
+
+def call(name, **arguments):
+    return asyncio.run(server.call_tool(name, arguments))[0].text
+
+
+def remember(text, embedding, **arguments):
+    return json.loads(call("cortex_remember", text=text, embedding=embedding, **arguments))["id"]
+
+
+def recall(embedding, **arguments):
+    return json.loads(call("cortex_recall", embedding=embedding, **arguments))
+
+
+# ─────────────────────────────────────────
+# Agent memory
+# ─────────────────────────────────────────
+
+@pytest.mark.skipif(not hasattr(lib, "cortex_vec_init"),
+                    reason="libcortex built without the vector extension")
+class TestMemory:
+
+    def test_tools_listed(self):
+        names = [tool.name for tool in asyncio.run(server.list_tools())]
+        assert "cortex_remember" in names and "cortex_recall" in names
+
+    def test_recall_ranked(self, db):
+        ids = [remember(f"memory {i}", [1.0, i / 10, 0.0]) for i in range(10)]
+        hits = recall([1.0, 0.0, 0.0], k=3)
+        assert [hit["id"] for hit in hits] == ids[:3]
+        assert hits[0]["text"] == "memory 0"
+        distances = [hit["distance"] for hit in hits]
+        assert distances == sorted(distances)
+        assert distances[0] == 0
+
+    def test_filters(self, db):
+        remember("alpha fact", [1.0, 0.0], agent="a", kind="fact")
+        remember("alpha event", [1.0, 0.1], agent="a", kind="event")
+        remember("beta fact", [1.0, 0.0], agent="b", kind="fact")
+        hits = recall([1.0, 0.0], k=5, agent="a")
+        assert [hit["text"] for hit in hits] == ["alpha fact", "alpha event"]
+        hits = recall([1.0, 0.0], k=5, kind="fact")
+        assert {hit["text"] for hit in hits} == {"alpha fact", "beta fact"}
+        hits = recall([1.0, 0.0], k=5, agent="a", kind="event")
+        assert [hit["text"] for hit in hits] == ["alpha event"]
+
+    def test_time_filters(self, db):
+        first = remember("old", [1.0, 0.0])
+        second = remember("new", [1.0, 0.0])
+        db.execute("UPDATE memories SET created_at = 100 WHERE id = ?", (first,))
+        db.execute("UPDATE memories SET created_at = 200 WHERE id = ?", (second,))
+        assert [hit["id"] for hit in recall([1.0, 0.0], after=150)] == [second]
+        assert [hit["id"] for hit in recall([1.0, 0.0], before=150)] == [first]
+
+    def test_filter_keeps_k(self, db):
+        for i in range(200):
+            remember(f"noise {i}", [1.0, 0.0, i / 200], agent="noise")
+        for i in range(5):
+            remember(f"mine {i}", [0.0, 1.0, i / 5], agent="me")
+        hits = recall([1.0, 0.0, 0.0], k=5, agent="me")
+        assert len(hits) == 5
+        assert all(hit["agent"] == "me" for hit in hits)
+
+    def test_compact_payload(self, db):
+        remember("x" * 1000, [1.0, 0.0], metadata={"source": "chat", "turn": 3})
+        remember("plain", [0.0, 1.0])
+        text = call("cortex_recall", embedding=[1.0, 0.0], max_chars=10)
+        assert ", " not in text and ": " not in text
+        first, second = json.loads(text)
+        assert first["text"] == "x" * 10 + "…"
+        assert first["metadata"] == {"source": "chat", "turn": 3}
+        assert set(second) == {"id", "distance", "text", "created_at"}
+
+    def test_collections(self, db):
+        remember("in notes", [1.0, 0.0, 0.0, 0.0], collection="notes")
+        remember("in memories", [1.0, 0.0])
+        assert [hit["text"] for hit in recall([1.0, 0.0, 0.0, 0.0], collection="notes")] == ["in notes"]
+        assert [hit["text"] for hit in recall([1.0, 0.0])] == ["in memories"]
+
+    def test_empty(self, db):
+        assert call("cortex_recall", embedding=[1.0, 0.0]) == "No memories found"
+        assert call("cortex_recall", embedding=[1.0, 0.0], collection="other") == "No memories found"
+
+    def test_searchable_from_sql(self, db):
+        memory_id = remember("sql view", [0.5, 0.5], agent="a")
+        row = db.fetchone("SELECT text, agent FROM memories WHERE id = ?", (memory_id,))
+        assert row == {"text": "sql view", "agent": "a"}
+
+    def test_write_queue(self):
+        db = open_db(write_queue=True)
+        try:
+            ids = [remember(f"queued {i}", [1.0, i / 10]) for i in range(5)]
+            assert ids == sorted(ids) and len(set(ids)) == 5
+            assert recall([1.0, 0.0], k=1)[0]["id"] == ids[0]
+        finally:
+            server.set_connection(None)
+            db.close()
+            cleanup()
+
+    @pytest.mark.parametrize("name, arguments, message", [
+        ("cortex_remember", {"embedding": [1.0]}, "text must be"),
+        ("cortex_remember", {"text": "t", "embedding": []}, "embedding must be"),
+        ("cortex_remember", {"text": "t", "embedding": ["a"]}, "embedding must be"),
+        ("cortex_remember", {"text": "t", "embedding": [1.0], "collection": 'x"; DROP'}, "invalid collection"),
+        ("cortex_remember", {"text": "t", "embedding": [1.0], "metadata": [1]}, "metadata must be"),
+        ("cortex_recall", {"embedding": [1.0, 0.0], "k": 0}, "k must be"),
+        ("cortex_recall", {"embedding": [1.0, 0.0], "k": tools.MAX_K + 1}, "k must be"),
+        ("cortex_recall", {"embedding": [1.0, 0.0], "max_chars": 0}, "max_chars must be"),
+    ])
+    def test_bad_arguments(self, db, name, arguments, message):
+        remember("seed", [1.0, 0.0])
+        assert call(name, **arguments).startswith(f"Error: {message}")
+
+    def test_dimension_mismatch(self, db):
+        remember("two", [1.0, 0.0])
+        assert call("cortex_remember", text="three", embedding=[1.0, 0.0, 0.0]).startswith("Error:")
+        assert call("cortex_recall", embedding=[1.0, 0.0, 0.0]).startswith("Error:")
+
+
+# ─────────────────────────────────────────
+# Tool metrics
+# ─────────────────────────────────────────
+
+class TestToolMetrics:
+
+    def test_unknown_tools_share_one_series(self, db):
+        from cortex.mcp.metrics import tool_metrics
+        before = tool_metrics._requests.get(("unknown", "error"), 0)
+        for name in ("no_such_tool", "another\nmade-up tool"):
+            assert call(name).startswith("Unknown tool")
+        assert tool_metrics._requests.get(("unknown", "error"), 0) == before + 2
+        out = []
+        tool_metrics.render(out)
+        assert not any("no_such_tool" in line or "made-up" in line for line in out)
+
+    def test_label_values_escaped(self):
+        from cortex.mcp.metrics import ToolMetrics
+        metrics = ToolMetrics()
+        metrics.observe('a\\b"c\nd', 0.001)
+        out = []
+        metrics.render(out)
+        assert 'cortex_tool_requests_total{tool="a\\\\b\\"c\\nd",status="ok"} 1' in out
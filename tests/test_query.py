@@ -0,0 +1,261 @@
+import os
+import threading
+import time
+import pytest
+import cortex
+from cortex import cursor, limits
+from cortex.core import ffi, lib
+
+TEST_DB = "./test_query.ctx"
+
+
+@pytest.fixture
+def db():
+    if os.path.exists(TEST_DB):
+        os.remove(TEST_DB)
+    db = cortex.connect(TEST_DB)
+    db.execute("CREATE TABLE items (id INTEGER, big INTEGER, price REAL, name TEXT, data BLOB)")
+    db.execute("INSERT INTO items VALUES (1, 9007199254740993, 2.5, 'Alice', x'00ff10')")
+    db.execute("INSERT INTO items VALUES (2, -5, NULL, NULL, NULL)")
+    yield db
+    db.close()
+    if os.path.exists(TEST_DB):
+        os.remove(TEST_DB)
+
+
+# ─────────────────────────────────────────
+# Row materialization
+# ─────────────────────────────────────────
+
+class TestFetchTypes:
+
+    def test_column_types(self, db):
+        rows = db.fetch("SELECT * FROM items ORDER BY id")
+        assert rows[0] == {
+            "id": 1, "big": 9007199254740993, "price": 2.5,
+            "name": "Alice", "data": b"\x00\xff\x10",
+        }
+        assert rows[1] == {"id": 2, "big": -5, "price": None, "name": None, "data": None}
+
+    def test_empty_result(self, db):
+        assert db.fetch("SELECT * FROM items WHERE id = 42") == []
+
+    def test_native_matches_fallback(self, db, monkeypatch):
+        if cursor._rows is None:
+            pytest.skip("cortex.core._rows extension not built")
+        db.execute("INSERT INTO items SELECT id + 10, big, price, name || id, data FROM items")
+        native = db.fetch("SELECT * FROM items ORDER BY id")
+        monkeypatch.setattr(cursor, "_rows", None)
+        assert db.fetch("SELECT * FROM items ORDER BY id") == native
+
+    def test_bad_sql_raises(self, db):
+        with pytest.raises(Exception):
+            db.fetch("SELEC nothing")
+
+
+# ─────────────────────────────────────────
+# Streaming cursor
+# ─────────────────────────────────────────
+
+class TestCursor:
+
+    @pytest.fixture
+    def numbers(self, db):
+        db.execute("CREATE TABLE numbers (n INTEGER)")
+        db.execute(
+            "WITH RECURSIVE seq(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM seq WHERE n < 1000) "
+            "INSERT INTO numbers SELECT n FROM seq"
+        )
+        return db
+
+    def test_fetchone_and_fetchmany(self, numbers):
+        with numbers.cursor() as cur:
+            cur.execute("SELECT n FROM numbers ORDER BY n")
+            assert cur.description == ("n",)
+            assert cur.fetchone() == {"n": 1}
+            assert [r["n"] for r in cur.fetchmany(3)] == [2, 3, 4]
+            assert len(cur.fetchall()) == 996
+            assert cur.fetchone() is None
+
+    def test_iteration(self, numbers):
+        cur = numbers.cursor().execute("SELECT n FROM numbers")
+        assert sum(row["n"] for row in cur) == 500500
+
+    def test_partial_read_then_close(self, numbers):
+        cur = numbers.cursor().execute("SELECT n FROM numbers ORDER BY n")
+        assert cur.fetchmany(2) == [{"n": 1}, {"n": 2}]
+        cur.close()
+        assert cur.fetchmany(2) == []
+        # statement is finalized, so writes are not blocked
+        numbers.execute("DROP TABLE numbers")
+
+    def test_connection_close_finalizes_cursors(self, numbers):
+        cur = numbers.cursor().execute("SELECT n FROM numbers")
+        cur.fetchone()
+        numbers.close()
+        assert cur.fetchone() is None
+
+    def test_mcp_query_max_rows(self, numbers):
+        from cortex.mcp import server
+        server.set_connection(numbers)
+        text = server._query_text(numbers.cursor(), "SELECT n FROM numbers ORDER BY n", max_rows=3)
+        assert text.splitlines() == ["{'n': 1}", "{'n': 2}", "{'n': 3}", "... truncated after 3 rows"]
+
+
+# ─────────────────────────────────────────
+# Parameter binding and statement cache
+# ─────────────────────────────────────────
+
+class TestParams:
+
+    def test_positional(self, db):
+        db.execute("INSERT INTO items VALUES (?, ?, ?, ?, ?)", (3, 7, 1.25, "it's", b"\x01"))
+        row = db.fetchone("SELECT * FROM items WHERE id = ?", [3])
+        assert row == {"id": 3, "big": 7, "price": 1.25, "name": "it's", "data": b"\x01"}
+
+    def test_named(self, db):
+        rows = db.fetch(
+            "SELECT name FROM items WHERE id = :id OR name = :name",
+            {"id": 2, "name": "Alice"},
+        )
+        assert len(rows) == 2
+
+    def test_wrong_param_count(self, db):
+        with pytest.raises(ValueError):
+            db.fetch("SELECT * FROM items WHERE id = ?", (1, 2))
+
+    def test_missing_named_param(self, db):
+        with pytest.raises(ValueError):
+            db.fetch("SELECT * FROM items WHERE id = :id", {"other": 1})
+
+    def test_script_with_params_rejected(self, db):
+        with pytest.raises(ValueError):
+            db.execute("INSERT INTO items(id) VALUES (?); SELECT 1", (5,))
+
+
+class TestStatementCache:
+
+    def test_hot_query_reuses_statement(self, db):
+        db.fetch("SELECT * FROM items WHERE id = ?", (1,))
+        cached = len(db._statements)
+        for i in range(10):
+            assert db.fetchone("SELECT * FROM items WHERE id = ?", (1,))["id"] == 1
+        assert len(db._statements) == cached
+
+    def test_bindings_cleared_on_reuse(self, db):
+        assert db.fetchone("SELECT ?1 AS a", (5,)) == {"a": 5}
+        with db._lock:
+            stmt = db._statements.acquire("SELECT ?1 AS a")
+            rows, _ = cursor.step_rows(stmt, ("a",))
+            db._statements.release("SELECT ?1 AS a", stmt)
+        assert rows == [{"a": None}]
+
+    def test_execute_many_leaves_no_bindings(self, db):
+        if cursor._rows is None:
+            pytest.skip("cortex.core._rows extension not built")
+        sql = "INSERT INTO items(id, name, data) VALUES (?, ?, ?)"
+        with db._lock:
+            stmt = db._statements.acquire(sql)
+            try:
+                rows = [(7, "x" * 100, b"\x01" * 100)]
+                assert cursor._rows.execute_many(int(ffi.cast("uintptr_t", stmt)), rows)[0] == 1
+                del rows
+                # stepped again without rebinding: nothing may point into the freed rows
+                lib.cortex_step(stmt)
+                lib.cortex_reset(stmt)
+            finally:
+                db._statements.release(sql, stmt)
+        assert db.fetch("SELECT name, data FROM items WHERE id IS NULL") == [{"name": None, "data": None}]
+
+    def test_lru_eviction(self, db):
+        db._statements.capacity = 4
+        for i in range(10):
+            db.fetch(f"SELECT {i} AS n")
+        assert len(db._statements) == 4
+
+    def test_schema_change_invalidates(self, db):
+        assert "big" in db.fetchone("SELECT * FROM items")
+        assert len(db._statements) > 0
+        db.execute("ALTER TABLE items ADD COLUMN extra TEXT")
+        assert len(db._statements) == 0
+        assert "extra" in db.fetchone("SELECT * FROM items")
+
+    def test_prepare_error_has_engine_message(self, db):
+        with pytest.raises(Exception, match="no such column: missing") as exc:
+            db.fetch("SELECT missing FROM items")
+        assert "SELECT missing FROM items" in str(exc.value)
+
+    def test_scripts_still_run(self, db):
+        db.execute("INSERT INTO items(id) VALUES (10); INSERT INTO items(id) VALUES (11);")
+        assert len(db.fetch("SELECT id FROM items WHERE id >= 10")) == 2
+
+
+# ─────────────────────────────────────────
+# Timeouts and cancellation
+# ─────────────────────────────────────────
+
+RUNAWAY = "WITH RECURSIVE r(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM r) SELECT count(*) FROM r"
+
+
+class TestLimits:
+
+    @pytest.fixture(params=["native", "fallback"])
+    def budget_impl(self, request, monkeypatch):
+        if request.param == "fallback":
+            monkeypatch.setattr(limits, "_rows", None)
+        elif limits._rows is None:
+            pytest.skip("native extension not built")
+
+    def test_timeout(self, db, budget_impl):
+        start = time.monotonic()
+        with pytest.raises(cortex.QueryInterrupted) as exc:
+            db.fetch(RUNAWAY, timeout=0.2)
+        assert exc.value.reason == "timeout"
+        assert time.monotonic() - start < 2
+
+    def test_instruction_budget(self, db, budget_impl):
+        with pytest.raises(cortex.QueryInterrupted) as exc:
+            db.fetch(RUNAWAY, max_instructions=100000)
+        assert exc.value.reason == "instructions"
+
+    def test_small_query_within_budget(self, db, budget_impl):
+        assert len(db.fetch("SELECT * FROM items", timeout=5, max_instructions=100000)) == 2
+
+    def test_cancel_from_other_thread(self, db, budget_impl):
+        cur = db.cursor()
+        timer = threading.Timer(0.2, cur.cancel)
+        timer.start()
+        with pytest.raises(cortex.QueryInterrupted) as exc:
+            cur.execute(RUNAWAY).fetchall()
+        timer.join()
+        assert exc.value.reason == "cancelled"
+
+    def test_fallback_without_limits_installs_no_handler(self):
+        assert limits._PyBudget().watching is False
+        assert limits._PyBudget()._handler is None
+        assert limits._PyBudget(timeout=1).watching is True
+
+    def test_cancel_with_other_cursor_open(self, db, budget_impl):
+        db.execute("INSERT INTO items(id) SELECT value FROM json_each('[3, 4, 5, 6]')")
+        other = db.cursor().execute("SELECT id FROM items ORDER BY id")
+        assert other.fetchone()["id"] == 1
+        cur = db.cursor().execute(RUNAWAY)
+        cur.cancel()
+        with pytest.raises(cortex.QueryInterrupted) as exc:
+            cur.fetchall()
+        assert exc.value.reason == "cancelled"
+        assert [row["id"] for row in other.fetchall()] == [2, 3, 4, 5, 6]
+
+    def test_connection_default_applies_to_execute(self, db):
+        db.query_timeout = 0.2
+        with pytest.raises(cortex.QueryInterrupted):
+            db.execute("CREATE TABLE big AS " + RUNAWAY)
+        db.query_timeout = None
+        # the connection is usable again afterwards
+        assert db.fetchone("SELECT count(*) AS n FROM items")["n"] == 2
+
+    def test_lock_released_after_timeout(self, db):
+        with pytest.raises(cortex.QueryInterrupted):
+            db.fetch(RUNAWAY, timeout=0.1)
+        assert db._lock.acquire(timeout=1)
+        db._lock.release()
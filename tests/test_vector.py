@@ -0,0 +1,1171 @@
+import os
+import random
+from array import array
+import pytest
+import cortex
+from cortex.core import lib
+
+if not hasattr(lib, "cortex_vec_init"):
+    pytest.skip("libcortex built without the vector extension", allow_module_level=True)
+
+TEST_DB = "./test_vector.ctx"
+DIM = 16
+
+
+def cleanup():
+    for suffix in ("", "-wal", "-shm", "-journal"):
+        if os.path.exists(TEST_DB + suffix):
+            os.remove(TEST_DB + suffix)
+
+
+def vec(values) -> bytes:
+    return array("f", values).tobytes()
+
+
+def random_vectors(n, dim=DIM, seed=7):
+    rng = random.Random(seed)
+    return [[rng.uniform(-1, 1) for _ in range(dim)] for _ in range(n)]
+
+
+def brute_force(vectors, query, k):
+    def l2(v):
+        return sum((a - b) ** 2 for a, b in zip(v, query))
+    return sorted(range(len(vectors)), key=lambda i: l2(vectors[i]))[:k]
+
+
+@pytest.fixture
+def db():
+    cleanup()
+    db = cortex.connect(TEST_DB)
+    db.execute(f"CREATE VIRTUAL TABLE mem USING vec_hnsw(dim={DIM}, metric=l2)")
+    yield db
+    db.close()
+    cleanup()
+
+
+@pytest.fixture
+def filled(db):
+    vectors = random_vectors(500)
+    db.executemany(
+        "INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+        [(i, vec(v)) for i, v in enumerate(vectors)],
+    )
+    return db, vectors
+
+
+def knn(db, query, k):
+    return db.fetch(
+        "SELECT rowid, distance FROM mem WHERE embedding MATCH ? AND k = ?",
+        (vec(query), k),
+    )
+
+
+def table_names(db):
+    return {row["name"] for row in db.fetch("SELECT name FROM pragma_table_list")}
+
+
+# ─────────────────────────────────────────
+# KNN queries
+# ─────────────────────────────────────────
+
+class TestHnswSearch:
+
+    def test_recall_against_brute_force(self, filled):
+        db, vectors = filled
+        hits = 0
+        for query in random_vectors(20, seed=11):
+            expected = set(brute_force(vectors, query, 10))
+            got = {row["rowid"] for row in knn(db, query, 10)}
+            hits += len(expected & got)
+        assert hits / 200 >= 0.95
+
+    def test_distances_sorted_and_exact(self, filled):
+        db, vectors = filled
+        query = random_vectors(1, seed=3)[0]
+        rows = knn(db, query, 5)
+        assert len(rows) == 5
+        distances = [row["distance"] for row in rows]
+        assert distances == sorted(distances)
+        exact = sum((a - b) ** 2 for a, b in zip(vectors[rows[0]["rowid"]], query)) ** 0.5
+        assert distances[0] == pytest.approx(exact, rel=1e-4)
+
+    def test_json_query(self, filled):
+        db, vectors = filled
+        json = "[" + ",".join(repr(x) for x in vectors[42]) + "]"
+        rows = db.fetch("SELECT rowid FROM mem WHERE embedding MATCH ? AND k = 1", (json,))
+        assert rows == [{"rowid": 42}]
+
+    def test_limit_pushdown(self, filled):
+        if lib.cortex_libversion_number() < 3041000:
+            pytest.skip("LIMIT is not passed to virtual tables with MATCH before 3.41")
+        db, vectors = filled
+        rows = db.fetch(
+            "SELECT rowid FROM mem WHERE embedding MATCH ? ORDER BY distance LIMIT 3",
+            (vec(vectors[7]),),
+        )
+        assert len(rows) == 3 and rows[0]["rowid"] == 7
+
+    def test_rowid_lookup(self, filled):
+        db, vectors = filled
+        row = db.fetchone("SELECT embedding FROM mem WHERE rowid = 9")
+        assert row["embedding"] == vec(vectors[9])
+
+    def test_k_larger_than_table(self, db):
+        db.execute("INSERT INTO mem(rowid, embedding) VALUES (1, ?)", (vec([0.5] * DIM),))
+        assert len(knn(db, [0.0] * DIM, 10)) == 1
+
+    def test_wrong_dimension_rejected(self, db):
+        with pytest.raises(Exception):
+            db.execute("INSERT INTO mem(rowid, embedding) VALUES (1, ?)", (vec([1.0] * 3),))
+
+
+# ─────────────────────────────────────────
+# Writes, transactions and persistence
+# ─────────────────────────────────────────
+
+class TestHnswWrites:
+
+    def test_delete_hides_row(self, filled):
+        db, vectors = filled
+        db.execute("DELETE FROM mem WHERE rowid = 42")
+        rows = knn(db, vectors[42], 10)
+        assert 42 not in {row["rowid"] for row in rows}
+        assert len(rows) == 10
+
+    def test_update_moves_vector(self, filled):
+        db, vectors = filled
+        db.execute("UPDATE mem SET embedding = ? WHERE rowid = 5", (vec(vectors[77]),))
+        rows = knn(db, vectors[77], 2)
+        assert {row["rowid"] for row in rows} == {5, 77}
+
+    def test_rollback_discards_inserts(self, filled):
+        db, _ = filled
+        db.execute("BEGIN")
+        db.execute("INSERT INTO mem(rowid, embedding) VALUES (1000, ?)", (vec([9.0] * DIM),))
+        assert knn(db, [9.0] * DIM, 1)[0]["rowid"] == 1000
+        db.execute("ROLLBACK")
+        assert knn(db, [9.0] * DIM, 1)[0]["rowid"] != 1000
+
+    def test_persists_across_reopen(self, filled):
+        db, vectors = filled
+        db.close()
+        reopened = cortex.connect(TEST_DB)
+        try:
+            assert knn(reopened, vectors[123], 1)[0]["rowid"] == 123
+        finally:
+            reopened.close()
+
+    def test_reader_pool_sees_commits(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, readers=2)
+        try:
+            db.execute(f"CREATE VIRTUAL TABLE mem USING vec_hnsw(dim={DIM})")
+            db.execute("INSERT INTO mem(rowid, embedding) VALUES (1, ?)", (vec([1.0] * DIM),))
+            assert knn(db, [1.0] * DIM, 1)[0]["rowid"] == 1
+            db.execute("INSERT INTO mem(rowid, embedding) VALUES (2, ?)", (vec([2.0] * DIM),))
+            assert knn(db, [2.0] * DIM, 1)[0]["rowid"] == 2
+        finally:
+            db.close()
+            cleanup()
+
+    def test_other_connection_follows_writes(self):
+        cleanup()
+        db = cortex.connect(TEST_DB)
+        other = cortex.connect(TEST_DB)
+        queries = random_vectors(20, seed=9)
+        try:
+            db.execute(f"CREATE VIRTUAL TABLE mem USING vec_hnsw(dim={DIM}, compact=5)")
+            db.executemany(
+                "INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+                [(i, vec(v)) for i, v in enumerate(random_vectors(2000))],
+            )
+            knn(other, queries[0], 10)  # other now holds the graph
+            extra = iter(random_vectors(400, seed=11))
+            for step in range(12):
+                if step % 3 == 0:
+                    db.execute("DELETE FROM mem WHERE rowid % 40 = ?", (step,))
+                elif step % 3 == 1:
+                    db.execute("UPDATE mem SET embedding = ? WHERE rowid = ?", (vec(next(extra)), step * 7))
+                else:
+                    db.executemany(
+                        "INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+                        [(5000 + step * 10 + i, vec(next(extra))) for i in range(10)],
+                    )
+                fresh = cortex.connect(TEST_DB)
+                try:
+                    for query in queries:
+                        assert knn(other, query, 10) == knn(fresh, query, 10)
+                finally:
+                    fresh.close()
+            logs = db.fetchone("SELECT count(*) AS n FROM mem_config WHERE key LIKE 'log.%'")["n"]
+            assert 0 < logs <= 64
+        finally:
+            other.close()
+            db.close()
+            cleanup()
+
+    def test_rename_and_drop(self, filled):
+        db, vectors = filled
+        db.execute("ALTER TABLE mem RENAME TO recall")
+        assert {"recall", "recall_config", "recall_nodes"} <= table_names(db)
+        rows = db.fetch(
+            "SELECT rowid FROM recall WHERE embedding MATCH ? AND k = 1", (vec(vectors[3]),)
+        )
+        assert rows == [{"rowid": 3}]
+        db.execute("DROP TABLE recall")
+        assert not {"recall", "recall_config", "recall_nodes"} & table_names(db)
+
+
+class TestHnswOptions:
+
+    @pytest.mark.parametrize("args", [
+        "metric=cosine",
+        "dim=0",
+        "dim=8, metric=manhattan",
+        "dim=8, colour=blue",
+        "dim=8, m=1",
+    ])
+    def test_bad_options(self, db, args):
+        with pytest.raises(Exception):
+            db.execute(f"CREATE VIRTUAL TABLE bad USING vec_hnsw({args})")
+
+    def test_knn_needs_k(self, filled):
+        db, vectors = filled
+        with pytest.raises(Exception):
+            db.fetch("SELECT rowid FROM mem WHERE embedding MATCH ?", (vec(vectors[0]),))
+
+
+# ─────────────────────────────────────────
+# Distance functions
+# ─────────────────────────────────────────
+
+class TestDistanceFunctions:
+
+    @pytest.fixture(params=["scalar", "avx2", "avx512"])
+    def isa_db(self, request, monkeypatch):
+        # Kernels are selected process-wide on every open; unsupported
+        # sets fall back to the widest available one.
+        monkeypatch.setenv("CORTEX_VEC_ISA", request.param)
+        cleanup()
+        db = cortex.connect(TEST_DB)
+        yield db
+        db.close()
+        cleanup()
+
+    def distances(self, db, a, b, type_arg=""):
+        return db.fetchone(
+            f"SELECT vec_l2(?1, ?2{type_arg}) AS l2, vec_cosine(?1, ?2{type_arg}) AS cos,"
+            f" vec_dot(?1, ?2{type_arg}) AS dot",
+            (a, b),
+        )
+
+    def test_float32(self, isa_db):
+        # 37 dimensions exercises both the vector loops and the tails
+        a, b = random_vectors(2, dim=37)
+        dot = sum(x * y for x, y in zip(a, b))
+        norm = (sum(x * x for x in a) ** 0.5) * (sum(y * y for y in b) ** 0.5)
+        row = self.distances(isa_db, vec(a), vec(b))
+        assert row["l2"] == pytest.approx(sum((x - y) ** 2 for x, y in zip(a, b)) ** 0.5, rel=1e-5)
+        assert row["dot"] == pytest.approx(dot, rel=1e-5, abs=1e-5)
+        assert row["cos"] == pytest.approx(1 - dot / norm, rel=1e-5, abs=1e-6)
+
+    def test_int8(self, isa_db):
+        rng = random.Random(5)
+        a = [rng.randint(-128, 127) for _ in range(67)]
+        b = [rng.randint(-128, 127) for _ in range(67)]
+        row = self.distances(isa_db, array("b", a).tobytes(), array("b", b).tobytes(), ", 'int8'")
+        assert row["dot"] == sum(x * y for x, y in zip(a, b))
+        assert row["l2"] == pytest.approx(sum((x - y) ** 2 for x, y in zip(a, b)) ** 0.5)
+
+    def test_hamming(self, isa_db):
+        rng = random.Random(9)
+        a = bytes(rng.randrange(256) for _ in range(100))
+        b = bytes(rng.randrange(256) for _ in range(100))
+        expected = sum(bin(x ^ y).count("1") for x, y in zip(a, b))
+        assert isa_db.fetchone("SELECT vec_hamming(?, ?) AS d", (a, b))["d"] == expected
+
+    def test_json_and_null(self, isa_db):
+        row = isa_db.fetchone("SELECT vec_l2('[0, 0]', '[3, 4]') AS d, vec_dot(NULL, '[1]') AS n")
+        assert row == {"d": 5.0, "n": None}
+
+    def test_exact_search_over_table(self, isa_db):
+        vectors = random_vectors(50)
+        isa_db.execute("CREATE TABLE docs (id INTEGER PRIMARY KEY, embedding BLOB)")
+        isa_db.executemany("INSERT INTO docs VALUES (?, ?)", [(i, vec(v)) for i, v in enumerate(vectors)])
+        rows = isa_db.fetch(
+            "SELECT id FROM docs ORDER BY vec_l2(embedding, ?) LIMIT 3", (vec(vectors[20]),)
+        )
+        assert [row["id"] for row in rows] == brute_force(vectors, vectors[20], 3)
+
+    @pytest.mark.parametrize("sql", [
+        "SELECT vec_l2(x'0000803f', x'0000803f00000000')",
+        "SELECT vec_l2(x'000080', x'000080')",
+        "SELECT vec_dot('[1, 2', '[1, 2]')",
+        "SELECT vec_cosine(x'01', x'01', 'int4')",
+        "SELECT vec_l2(1, 2)",
+    ])
+    def test_errors(self, isa_db, sql):
+        with pytest.raises(Exception):
+            isa_db.fetch(sql)
+
+
+# ─────────────────────────────────────────
+# Quantization
+# ─────────────────────────────────────────
+
+class TestQuantization:
+
+    @pytest.fixture(params=["int8", "binary"])
+    def quantized(self, request):
+        cleanup()
+        db = cortex.connect(TEST_DB)
+        db.execute(f"CREATE VIRTUAL TABLE mem USING vec_hnsw(dim={DIM}, metric=cosine, quantize={request.param})")
+        vectors = random_vectors(500)
+        db.executemany(
+            "INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(vectors)],
+        )
+        yield db, vectors
+        db.close()
+        cleanup()
+
+    def test_rescored_distances_are_exact(self, quantized):
+        db, vectors = quantized
+        query = random_vectors(1, seed=3)[0]
+        rows = knn(db, query, 5)
+        distances = [row["distance"] for row in rows]
+        assert distances == sorted(distances)
+        for row in rows:
+            exact = db.fetchone(
+                "SELECT vec_cosine(embedding, ?) AS d FROM mem WHERE rowid = ?",
+                (vec(query), row["rowid"]),
+            )["d"]
+            assert row["distance"] == pytest.approx(exact, abs=1e-5)
+
+    def test_self_query(self, quantized):
+        db, vectors = quantized
+        for i in (0, 99, 250):
+            assert knn(db, vectors[i], 1)[0]["rowid"] == i
+
+    def test_embedding_is_full_precision(self, quantized):
+        db, vectors = quantized
+        assert db.fetchone("SELECT embedding FROM mem WHERE rowid = 7")["embedding"] == vec(vectors[7])
+
+    def test_codes_are_compact(self, quantized):
+        db, _ = quantized
+        code = db.fetchone("SELECT length(vector) AS n FROM mem_nodes LIMIT 1")["n"]
+        assert code < DIM * 4
+        assert db.fetchone("SELECT count(*) AS n FROM mem_vectors")["n"] == 500
+
+    def test_uncommitted_rows_rescored(self, quantized):
+        db, _ = quantized
+        db.execute("BEGIN")
+        db.execute("INSERT INTO mem(rowid, embedding) VALUES (1000, ?)", (vec([5.0] * DIM),))
+        assert knn(db, [5.0] * DIM, 1)[0]["rowid"] == 1000
+        db.execute("ROLLBACK")
+        assert db.fetchone("SELECT count(*) AS n FROM mem_vectors")["n"] == 500
+
+    def test_rename_and_drop(self, quantized):
+        db, _ = quantized
+        db.execute("ALTER TABLE mem RENAME TO recall")
+        assert "recall_vectors" in table_names(db)
+        db.execute("DROP TABLE recall")
+        assert not {"recall", "recall_nodes", "recall_vectors"} & table_names(db)
+
+    def test_bad_options(self, db):
+        for args in (f"dim={DIM}, quantize=int4", f"dim={DIM}, quantize=int8, rescore=0"):
+            with pytest.raises(Exception):
+                db.execute(f"CREATE VIRTUAL TABLE bad USING vec_hnsw({args})")
+
+    def test_quantize_functions(self, db):
+        row = db.fetchone(
+            "SELECT vec_quantize_binary('[1, -1, 2, 0, 3, -3, 1, 1, 1]') AS b,"
+            " vec_quantize_int8('[1, -0.5, 0.25]') AS i, vec_quantize_int8('[1, -2]', 1) AS c"
+        )
+        assert row["b"] == bytes([0b11010101, 0b00000001])
+        assert array("b", row["i"]).tolist() == [127, -64, 32]
+        assert array("b", row["c"]).tolist() == [127, -127]
+        hamming = db.fetchone(
+            "SELECT vec_hamming(vec_quantize_binary('[1, 1, 1]'), vec_quantize_binary('[1, -1, -1]')) AS d"
+        )
+        assert hamming["d"] == 2
+
+
+# ─────────────────────────────────────────
+# IVF-PQ index
+# ─────────────────────────────────────────
+
+def clustered_vectors(n, dim=DIM, centers=8, seed=5):
+    rng = random.Random(seed)
+    middles = [[rng.uniform(-1, 1) for _ in range(dim)] for _ in range(centers)]
+    return [[c + rng.gauss(0, 0.15) for c in middles[i % centers]] for i in range(n)]
+
+
+def ivf_table(db, options="", rows=600):
+    db.execute(
+        f"CREATE VIRTUAL TABLE docs USING vec_ivf(dim={DIM}, lists=8, pq_m=8, train_rows=400{options})"
+    )
+    vectors = clustered_vectors(rows)
+    db.executemany(
+        "INSERT INTO docs(rowid, embedding) VALUES (?, ?)",
+        [(i, vec(v)) for i, v in enumerate(vectors)],
+    )
+    return vectors
+
+
+def ivf_knn(db, query, k, nprobe=None):
+    sql = "SELECT rowid, distance FROM docs WHERE embedding MATCH ? AND k = ?"
+    params = [vec(query), k]
+    if nprobe is not None:
+        sql += " AND nprobe = ?"
+        params.append(nprobe)
+    return db.fetch(sql, params)
+
+
+def listed_rows(db):
+    return sum(row["n"] for row in db.fetch("SELECT length(ids) / 8 AS n FROM docs_lists"))
+
+
+class TestIvf:
+
+    def test_exact_until_trained(self, db):
+        vectors = ivf_table(db, rows=300)
+        assert db.fetchone("SELECT value FROM docs_config WHERE key = 'trained'")["value"] == 0
+        query = random_vectors(1, seed=3)[0]
+        rows = ivf_knn(db, query, 5)
+        assert [row["rowid"] for row in rows] == brute_force(vectors, query, 5)
+        exact = sum((a - b) ** 2 for a, b in zip(vectors[rows[0]["rowid"]], query)) ** 0.5
+        assert rows[0]["distance"] == pytest.approx(exact, rel=1e-4)
+
+    def test_trains_at_train_rows(self, db):
+        ivf_table(db)
+        assert db.fetchone("SELECT value FROM docs_config WHERE key = 'trained'")["value"] == 1
+        assert listed_rows(db) == 600
+        assert db.fetchone("SELECT count(*) AS n FROM docs_vectors WHERE list IS NULL")["n"] == 0
+        code = db.fetchone("SELECT length(codes) / (length(ids) / 8) AS n FROM docs_lists LIMIT 1")["n"]
+        assert code == 8
+
+    def test_pq_recall_without_rescore(self, db):
+        vectors = ivf_table(db, ", rescore=0")
+        hits = 0
+        for query in clustered_vectors(20, seed=11):
+            expected = set(brute_force(vectors, query, 10))
+            got = {row["rowid"] for row in ivf_knn(db, query, 10, nprobe=8)}
+            hits += len(expected & got)
+        assert hits / 200 >= 0.6
+
+    def test_rescore_gives_exact_distances(self, db):
+        vectors = ivf_table(db)
+        query = clustered_vectors(1, seed=3)[0]
+        rows = ivf_knn(db, query, 5, nprobe=8)
+        assert [row["rowid"] for row in rows] == brute_force(vectors, query, 5)
+        exact = sum((a - b) ** 2 for a, b in zip(vectors[rows[0]["rowid"]], query)) ** 0.5
+        assert rows[0]["distance"] == pytest.approx(exact, rel=1e-4)
+
+    def test_nprobe_column(self, db):
+        vectors = ivf_table(db)
+        rows = db.fetch(
+            "SELECT rowid, nprobe FROM docs WHERE embedding MATCH ? AND k = 3 AND nprobe = 2",
+            (vec(vectors[9]),),
+        )
+        assert rows[0] == {"rowid": 9, "nprobe": 2}
+        default = db.fetchone(
+            "SELECT nprobe FROM docs WHERE embedding MATCH ? AND k = 1", (vec(vectors[9]),)
+        )
+        assert default["nprobe"] == 8
+        with pytest.raises(Exception):
+            ivf_knn(db, vectors[9], 1, nprobe=0)
+
+    def test_writes_after_training(self, db):
+        vectors = ivf_table(db)
+        db.execute("DELETE FROM docs WHERE rowid = 42")
+        assert 42 not in {row["rowid"] for row in ivf_knn(db, vectors[42], 10, nprobe=8)}
+        db.execute("UPDATE docs SET embedding = ? WHERE rowid = 5", (vec(vectors[77]),))
+        assert {row["rowid"] for row in ivf_knn(db, vectors[77], 2, nprobe=8)} == {5, 77}
+        db.execute("INSERT INTO docs(embedding) VALUES (?)", (vec([3.0] * DIM),))
+        assert ivf_knn(db, [3.0] * DIM, 1, nprobe=8)[0]["rowid"] == 600
+        assert listed_rows(db) == 600
+
+    def test_rollback_and_reopen(self, db):
+        vectors = ivf_table(db, rows=300)
+        db.execute("BEGIN")
+        db.executemany(
+            "INSERT INTO docs(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(clustered_vectors(200, seed=9), start=300)],
+        )
+        assert listed_rows(db) == 500
+        db.execute("ROLLBACK")
+        assert listed_rows(db) == 0
+        db.close()
+        reopened = cortex.connect(TEST_DB)
+        try:
+            assert ivf_knn(reopened, vectors[123], 1)[0]["rowid"] == 123
+            assert reopened.fetchone("SELECT count(*) AS n FROM docs")["n"] == 300
+        finally:
+            reopened.close()
+
+    def test_train_command(self, db):
+        vectors = ivf_table(db, rows=100)
+        db.execute("INSERT INTO docs(command) VALUES ('train')")
+        assert listed_rows(db) == 100
+        assert ivf_knn(db, vectors[50], 1, nprobe=8)[0]["rowid"] == 50
+        with pytest.raises(Exception):
+            db.execute("INSERT INTO docs(command) VALUES ('defragment')")
+
+    def test_training_is_independent_of_threads(self, db):
+        ivf_table(db, ", threads=1", rows=500)
+        single = db.fetch("SELECT id, data FROM docs_codebooks ORDER BY id")
+        db.execute("DROP TABLE docs")
+        ivf_table(db, ", threads=4", rows=500)
+        assert db.fetch("SELECT id, data FROM docs_codebooks ORDER BY id") == single
+
+    @pytest.mark.parametrize("metric", ["cosine", "dot"])
+    def test_metrics(self, db, metric):
+        vectors = ivf_table(db, f", metric={metric}")
+        query = clustered_vectors(1, seed=4)[0]
+        fn = "vec_cosine" if metric == "cosine" else "vec_dot"
+        order = "" if metric == "cosine" else " DESC"
+        expected = db.fetch(
+            f"SELECT rowid FROM docs ORDER BY {fn}(embedding, ?){order} LIMIT 3", (vec(query),)
+        )
+        rows = ivf_knn(db, query, 3, nprobe=8)
+        assert [row["rowid"] for row in rows] == [row["rowid"] for row in expected]
+
+    def test_full_scan_and_rowid_lookup(self, db):
+        vectors = ivf_table(db, rows=50)
+        assert db.fetchone("SELECT count(*) AS n FROM docs")["n"] == 50
+        assert db.fetchone("SELECT embedding FROM docs WHERE rowid = 7")["embedding"] == vec(vectors[7])
+        assert db.fetchone("SELECT embedding FROM docs WHERE rowid = 999") is None
+
+    def test_rename_and_drop(self, db):
+        ivf_table(db)
+        db.execute("ALTER TABLE docs RENAME TO archive")
+        names = {"archive_config", "archive_codebooks", "archive_lists", "archive_vectors"}
+        assert names <= table_names(db)
+        db.execute("DROP TABLE archive")
+        assert not names & table_names(db)
+
+    @pytest.mark.parametrize("args", [
+        "lists=8",
+        f"dim={DIM}, pq_m=5",
+        f"dim={DIM}, lists=0",
+        f"dim={DIM}, nprobe=0",
+        f"dim={DIM}, threads=0",
+        f"dim={DIM}, rescore=101",
+        f"dim={DIM}, shards=2",
+    ])
+    def test_bad_options(self, db, args):
+        with pytest.raises(Exception):
+            db.execute(f"CREATE VIRTUAL TABLE bad USING vec_ivf({args})")
+
+
+# ─────────────────────────────────────────
+# Filtered search
+# ─────────────────────────────────────────
+
+def tagged_table(db, options="", rows=1000):
+    db.execute(
+        f"CREATE VIRTUAL TABLE notes USING vec_hnsw(dim={DIM}, m=4, ef_search=4,"
+        f" agent_id INTEGER, created_at INTEGER, kind TEXT{options})"
+    )
+    vectors = random_vectors(rows, seed=21)
+    db.executemany(
+        "INSERT INTO notes(rowid, embedding, agent_id, created_at, kind) VALUES (?, ?, ?, ?, ?)",
+        [(i, vec(v), i % 10, i, "fact" if i % 3 else "event") for i, v in enumerate(vectors)],
+    )
+    return vectors
+
+
+def filtered_brute_force(vectors, query, k, keep):
+    ids = [i for i in range(len(vectors)) if keep(i)]
+    return [ids[i] for i in brute_force([vectors[i] for i in ids], query, k)]
+
+
+class TestFilteredSearch:
+
+    def test_selective_filter_is_exact(self, db):
+        # 100 of 1000 rows match: small enough for the exact scan
+        vectors = tagged_table(db)
+        query = random_vectors(1, seed=3)[0]
+        rows = db.fetch(
+            "SELECT rowid, agent_id FROM notes WHERE embedding MATCH ? AND k = 10 AND agent_id = 3",
+            (vec(query),),
+        )
+        assert [row["rowid"] for row in rows] == filtered_brute_force(
+            vectors, query, 10, lambda i: i % 10 == 3)
+        assert {row["agent_id"] for row in rows} == {3}
+
+    def test_broad_filter_returns_k_matches(self, db):
+        # 600 of 1000 rows match: searched by traversing the graph. m and
+        # ef_search are tiny, so unfiltered recall is only about 0.65 here.
+        vectors = tagged_table(db)
+        hits = 0
+        for query in random_vectors(10, seed=12):
+            rows = db.fetch(
+                "SELECT rowid FROM notes WHERE embedding MATCH ? AND k = 10 AND agent_id < 6",
+                (vec(query),),
+            )
+            assert len(rows) == 10
+            assert all(row["rowid"] % 10 < 6 for row in rows)
+            expected = set(filtered_brute_force(vectors, query, 10, lambda i: i % 10 < 6))
+            hits += len(expected & {row["rowid"] for row in rows})
+        assert hits / 100 >= 0.7
+
+    def test_in_list_and_range(self, db):
+        vectors = tagged_table(db)
+        query = random_vectors(1, seed=4)[0]
+        rows = db.fetch(
+            "SELECT rowid FROM notes WHERE embedding MATCH ? AND k = 5"
+            " AND agent_id IN (1, 7) AND created_at >= 500 AND kind = 'fact'",
+            (vec(query),),
+        )
+        keep = lambda i: i % 10 in (1, 7) and i >= 500 and i % 3 != 0  # noqa: E731
+        assert [row["rowid"] for row in rows] == filtered_brute_force(vectors, query, 5, keep)
+        assert db.fetch(
+            "SELECT rowid FROM notes WHERE embedding MATCH ? AND k = 5 AND agent_id IN (42, 43)",
+            (vec(query),),
+        ) == []
+
+    def test_long_and_mixed_in_lists(self, db):
+        tagged_table(db, rows=100)
+        # more values than the statement could take as variables
+        agents = ", ".join(str(i) for i in range(1000, 41000))
+        rows = db.fetch(f"SELECT rowid FROM notes WHERE agent_id IN ({agents}, 4) AND created_at > 50")
+        assert sorted(row["rowid"] for row in rows) == [54, 64, 74, 84, 94]
+        odd = 'a "quoted" \\ kind\nwith\ta break'
+        db.execute("UPDATE notes SET kind = ? WHERE rowid = 7", (odd,))
+        rows = db.fetch("SELECT rowid FROM notes WHERE kind IN (?, 'missing', NULL, x'00')", (odd,))
+        assert rows == [{"rowid": 7}]
+        rows = db.fetch("SELECT rowid FROM notes WHERE created_at IN (5.0, 7.5, ?)", (9,))
+        assert sorted(row["rowid"] for row in rows) == [5, 9]
+        assert db.fetch("SELECT rowid FROM notes WHERE agent_id IN (SELECT 1 WHERE 0)") == []
+
+    def test_k_capped_by_matches(self, db):
+        tagged_table(db)
+        rows = db.fetch(
+            "SELECT rowid FROM notes WHERE embedding MATCH ? AND k = 50 AND created_at < 20"
+            " AND agent_id = 2",
+            (vec([0.0] * DIM),),
+        )
+        assert sorted(row["rowid"] for row in rows) == [2, 12]
+
+    def test_unpushed_filter_keeps_k_semantics(self, db):
+        vectors = tagged_table(db)
+        rows = db.fetch(
+            "SELECT rowid FROM notes WHERE embedding MATCH ? AND k = 10 AND kind LIKE 'ev%'",
+            (vec(vectors[0]),),
+        )
+        assert all(row["rowid"] % 3 == 0 for row in rows)
+
+    def test_filter_without_match(self, db):
+        tagged_table(db, rows=100)
+        rows = db.fetch("SELECT rowid FROM notes WHERE agent_id = 4 AND created_at > 50")
+        assert sorted(row["rowid"] for row in rows) == [54, 64, 74, 84, 94]
+
+    def test_quantized(self, db):
+        db.execute(
+            f"CREATE VIRTUAL TABLE q USING vec_hnsw(dim={DIM}, quantize=int8, team TEXT)"
+        )
+        vectors = random_vectors(300, seed=8)
+        db.executemany(
+            "INSERT INTO q(rowid, embedding, team) VALUES (?, ?, ?)",
+            [(i, vec(v), "red" if i % 2 else "blue") for i, v in enumerate(vectors)],
+        )
+        query = random_vectors(1, seed=9)[0]
+        rows = db.fetch(
+            "SELECT rowid FROM q WHERE embedding MATCH ? AND k = 5 AND team = 'red'", (vec(query),)
+        )
+        assert [row["rowid"] for row in rows] == filtered_brute_force(
+            vectors, query, 5, lambda i: i % 2 == 1)
+
+    def test_writes_keep_metadata(self, db):
+        tagged_table(db, rows=50)
+        db.execute("UPDATE notes SET agent_id = 99 WHERE rowid = 5")
+        db.execute("DELETE FROM notes WHERE rowid = 15")
+        assert db.fetchone("SELECT agent_id, kind FROM notes WHERE rowid = 5") == {
+            "agent_id": 99, "kind": "fact"}
+        assert db.fetchone("SELECT count(*) AS n FROM notes_meta")["n"] == 49
+        assert db.fetch("SELECT rowid FROM notes WHERE agent_id = 5") == [{"rowid": 25},
+                                                                           {"rowid": 35},
+                                                                           {"rowid": 45}]
+        db.execute("BEGIN")
+        db.execute("INSERT INTO notes(rowid, embedding, agent_id) VALUES (500, ?, 5)",
+                   (vec([1.0] * DIM),))
+        db.execute("ROLLBACK")
+        assert db.fetchone("SELECT count(*) AS n FROM notes WHERE agent_id = 5")["n"] == 3
+
+    def test_rename_and_drop(self, db):
+        vectors = tagged_table(db, rows=50)
+        db.execute("ALTER TABLE notes RENAME TO journal")
+        assert "journal_meta" in table_names(db)
+        rows = db.fetch(
+            "SELECT rowid FROM journal WHERE embedding MATCH ? AND k = 1 AND agent_id = 3",
+            (vec(vectors[13]),),
+        )
+        assert rows == [{"rowid": 13}]
+        db.execute("DROP TABLE journal")
+        assert "journal_meta" not in table_names(db)
+        # the renamed table kept its index names; a new table must not clash
+        tagged_table(db, rows=10)
+        db.execute("ALTER TABLE notes RENAME TO diary")
+        tagged_table(db, rows=10)
+
+    @pytest.mark.parametrize("args", [
+        f"dim={DIM}, agent_id",
+        f"dim={DIM}, agent_id BLOB",
+        f"dim={DIM}, distance REAL",
+        f"dim={DIM}, a INTEGER, a TEXT",
+        f"dim={DIM}, 1x INTEGER",
+    ])
+    def test_bad_columns(self, db, args):
+        with pytest.raises(Exception):
+            db.execute(f"CREATE VIRTUAL TABLE bad USING vec_hnsw({args})")
+
+
+# ─────────────────────────────────────────
+# Hybrid search
+# ─────────────────────────────────────────
+
+WORDS = ["apple", "river", "engine", "forest", "copper", "signal", "harbor", "violet"]
+
+
+@pytest.fixture
+def hybrid(db):
+    rng = random.Random(31)
+    vectors = random_vectors(200, seed=32)
+    bodies = [" ".join(rng.choice(WORDS) for _ in range(6)) for _ in range(200)]
+    db.execute("CREATE VIRTUAL TABLE docs_fts USING fts5(body)")
+    db.executemany("INSERT INTO docs_fts(rowid, body) VALUES (?, ?)", list(enumerate(bodies)))
+    db.executemany(
+        "INSERT INTO mem(rowid, embedding) VALUES (?, ?)",
+        [(i, vec(v)) for i, v in enumerate(vectors)],
+    )
+    return db, vectors
+
+
+def rrf(db, text, query, k, alpha=0.5):
+    depth = 4 * k
+    scores = {}
+    for rank, row in enumerate(db.fetch(
+            "SELECT rowid FROM docs_fts WHERE docs_fts MATCH ? ORDER BY rank LIMIT ?",
+            (text, depth)), start=1):
+        scores[row["rowid"]] = (1 - alpha) / (60 + rank)
+    for rank, row in enumerate(knn(db, query, depth), start=1):
+        scores[row["rowid"]] = scores.get(row["rowid"], 0) + alpha / (60 + rank)
+    return sorted(scores.items(), key=lambda item: (-item[1], item[0]))[:k]
+
+
+class TestHybridSearch:
+
+    def test_matches_reciprocal_rank_fusion(self, hybrid):
+        db, vectors = hybrid
+        query = random_vectors(1, seed=33)[0]
+        rows = db.fetch(
+            "SELECT id, score FROM hybrid_search('docs_fts', 'mem', 'copper', ?, 10)", (vec(query),)
+        )
+        expected = rrf(db, "copper", query, 10)
+        assert [row["id"] for row in rows] == [rowid for rowid, _ in expected]
+        assert [row["score"] for row in rows] == pytest.approx([score for _, score in expected])
+
+    def test_single_sided(self, hybrid):
+        db, vectors = hybrid
+        text_only = db.fetch(
+            "SELECT id, text_rank, vec_rank FROM hybrid_search('docs_fts', 'mem', 'violet', NULL, 5)"
+        )
+        fts = db.fetch(
+            "SELECT rowid FROM docs_fts WHERE docs_fts MATCH 'violet' ORDER BY rank LIMIT 5"
+        )
+        assert [row["id"] for row in text_only] == [row["rowid"] for row in fts]
+        assert [row["text_rank"] for row in text_only] == [1, 2, 3, 4, 5]
+        assert {row["vec_rank"] for row in text_only} == {None}
+
+        vec_only = db.fetch(
+            "SELECT id, distance FROM hybrid_search('docs_fts', 'mem', NULL, ?, 5)", (vec(vectors[8]),)
+        )
+        assert [row["id"] for row in vec_only] == [row["rowid"] for row in knn(db, vectors[8], 5)]
+        assert vec_only[0]["distance"] == pytest.approx(0.0, abs=1e-5)
+
+    def test_alpha_weights_the_sides(self, hybrid):
+        db, vectors = hybrid
+        sql = "SELECT id FROM hybrid_search('docs_fts', 'mem', 'harbor', ?, 5, ?)"
+        assert db.fetch(sql, (vec(vectors[3]), 1.0))[0]["id"] == 3
+        text_first = db.fetch(
+            "SELECT rowid AS id FROM docs_fts WHERE docs_fts MATCH 'harbor' ORDER BY rank LIMIT 5"
+        )
+        assert db.fetch(sql, (vec(vectors[3]), 0.0)) == text_first
+
+    def test_join_with_content(self, hybrid):
+        db, vectors = hybrid
+        rows = db.fetch(
+            "SELECT d.body FROM hybrid_search('docs_fts', 'mem', 'river', ?, 3) h"
+            " JOIN docs_fts d ON d.rowid = h.id ORDER BY h.score DESC",
+            (vec(vectors[0]),),
+        )
+        assert len(rows) == 3
+
+    @pytest.mark.parametrize("args", [
+        "'docs_fts', 'mem', 'apple', NULL, 0",
+        "'docs_fts', 'mem', 'apple', NULL, 5, 1.5",
+        "'missing', 'mem', 'apple', NULL, 5",
+        "'docs_fts', 'mem', 'apple'",
+    ])
+    def test_errors(self, hybrid, args):
+        db, _ = hybrid
+        with pytest.raises(Exception):
+            db.fetch(f"SELECT id FROM hybrid_search({args})")
+
+
+# ─────────────────────────────────────────
+# External content and compaction
+# ─────────────────────────────────────────
+
+def content_table(db, rows=300, options=""):
+    db.execute("CREATE TABLE notes(id INTEGER PRIMARY KEY, body TEXT, embedding BLOB, agent_id INTEGER)")
+    vectors = random_vectors(rows, seed=41)
+    db.executemany(
+        "INSERT INTO notes(id, body, embedding, agent_id) VALUES (?, ?, ?, ?)",
+        [(i, f"note {i}", vec(v), i % 4) for i, v in enumerate(vectors)],
+    )
+    db.execute(
+        f"CREATE VIRTUAL TABLE notes_vec USING vec_hnsw(dim={DIM}, content=notes, agent_id INTEGER{options})"
+    )
+    return vectors
+
+
+def nearest(db, query, k=1, table="notes_vec"):
+    return [row["rowid"] for row in db.fetch(
+        f"SELECT rowid FROM {table} WHERE embedding MATCH ? AND k = ?", (vec(query), k))]
+
+
+class TestContentSync:
+
+    def test_backfills_existing_rows(self, db):
+        vectors = content_table(db)
+        assert nearest(db, vectors[17]) == [17]
+        assert db.fetchone("SELECT agent_id FROM notes_vec WHERE rowid = 17")["agent_id"] == 1
+
+    def test_base_writes_reach_the_index(self, db):
+        vectors = content_table(db)
+        db.execute("INSERT INTO notes(id, embedding, agent_id) VALUES (1000, ?, 2)", (vec([4.0] * DIM),))
+        assert nearest(db, [4.0] * DIM) == [1000]
+        db.execute("UPDATE notes SET embedding = ? WHERE id = 5", (vec(vectors[77]),))
+        assert set(nearest(db, vectors[77], 2)) == {5, 77}
+        db.execute("DELETE FROM notes WHERE id = 77")
+        assert nearest(db, vectors[77]) == [5]
+        db.execute("UPDATE notes SET id = 2000 WHERE id = 5")
+        assert nearest(db, vectors[77]) == [2000]
+
+    def test_metadata_update_keeps_the_node(self, db):
+        content_table(db)
+        nodes = db.fetchone("SELECT count(*) AS n FROM notes_vec_nodes")["n"]
+        db.execute("UPDATE notes SET agent_id = 9, body = 'edited' WHERE id = 3")
+        assert db.fetchone("SELECT agent_id FROM notes_vec WHERE rowid = 3")["agent_id"] == 9
+        assert db.fetchone("SELECT count(*) AS n FROM notes_vec_nodes")["n"] == nodes
+        db.execute("UPDATE notes SET body = 'again' WHERE id = 4")
+        assert db.fetchone("SELECT count(*) AS n FROM notes_vec_nodes")["n"] == nodes
+
+    def test_transactional(self, db):
+        vectors = content_table(db)
+        db.execute("BEGIN")
+        db.execute("INSERT INTO notes(id, embedding) VALUES (1000, ?)", (vec([4.0] * DIM),))
+        assert nearest(db, [4.0] * DIM) == [1000]
+        db.execute("ROLLBACK")
+        assert nearest(db, [4.0] * DIM) != [1000]
+        with pytest.raises(Exception):
+            db.execute("INSERT INTO notes(id, embedding) VALUES (1001, ?)", (vec([1.0] * 3),))
+        assert db.fetchone("SELECT count(*) AS n FROM notes WHERE id = 1001")["n"] == 0
+        db.execute("INSERT INTO notes(id, body) VALUES (1002, 'no embedding yet')")
+        assert db.fetchone("SELECT count(*) AS n FROM notes_vec")["n"] == len(vectors)
+
+    def test_last_insert_rowid(self, db):
+        content_table(db, rows=50)
+        db.execute("INSERT INTO notes(embedding) VALUES (?)", (vec([4.0] * DIM),))
+        assert db.fetchone("SELECT last_insert_rowid() AS id")["id"] == \
+            db.fetchone("SELECT max(id) AS id FROM notes")["id"]
+
+    def test_other_connections_see_commits(self):
+        cleanup()
+        db = cortex.connect(TEST_DB, readers=2)
+        try:
+            content_table(db, rows=50)
+            db.execute("INSERT INTO notes(id, embedding) VALUES (500, ?)", (vec([4.0] * DIM),))
+            assert nearest(db, [4.0] * DIM) == [500]
+        finally:
+            db.close()
+            cleanup()
+
+    def test_rename_and_drop(self, db):
+        vectors = content_table(db, rows=50)
+        db.execute("ALTER TABLE notes_vec RENAME TO recall")
+        db.execute("INSERT INTO notes(id, embedding) VALUES (500, ?)", (vec([4.0] * DIM),))
+        assert nearest(db, [4.0] * DIM, table="recall") == [500]
+        db.execute("DROP TABLE recall")
+        triggers = db.fetch("SELECT name FROM pragma_table_list WHERE type = 'trigger'")
+        assert triggers == []
+        db.execute("INSERT INTO notes(id, embedding) VALUES (501, ?)", (vec(vectors[0]),))
+
+    def test_bad_content(self, db):
+        db.execute("CREATE TABLE plain(body TEXT)")
+        for args in ("content=missing", "content=plain", "content_column=body"):
+            with pytest.raises(Exception):
+                db.execute(f"CREATE VIRTUAL TABLE bad USING vec_hnsw(dim={DIM}, {args})")
+
+
+class TestCompaction:
+
+    def fill(self, db, options="", rows=400):
+        db.execute(f"CREATE VIRTUAL TABLE t USING vec_hnsw(dim={DIM}{options})")
+        vectors = random_vectors(rows, seed=51)
+        db.executemany(
+            "INSERT INTO t(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(vectors)],
+        )
+        return vectors
+
+    def recall(self, db, vectors, live):
+        hits = 0
+        for query in random_vectors(10, seed=52):
+            expected = set(filtered_brute_force(vectors, query, 10, lambda i: i in live))
+            hits += len(expected & set(nearest(db, query, 10, table="t")))
+        return hits / 100
+
+    def test_tombstones_compacted_and_reused(self, db):
+        vectors = self.fill(db)
+        db.execute("DELETE FROM t WHERE rowid % 2 = 0")
+        assert db.fetchone("SELECT count(*) AS n FROM t_nodes")["n"] == 200
+        assert db.fetchone("SELECT count(*) AS n FROM t_nodes WHERE rid IS NULL")["n"] == 0
+        assert self.recall(db, vectors, set(range(1, 400, 2))) >= 0.9
+
+        db.executemany(
+            "INSERT INTO t(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(random_vectors(100, seed=53), start=1000)],
+        )
+        assert db.fetchone("SELECT max(id) AS n FROM t_nodes")["n"] < 400
+        db.close()
+        reopened = cortex.connect(TEST_DB)
+        try:
+            assert nearest(reopened, vectors[101], table="t") == [101]
+            reopened.execute("INSERT INTO t(rowid, embedding) VALUES (5000, ?)", (vec([4.0] * DIM),))
+            assert nearest(reopened, [4.0] * DIM, table="t") == [5000]
+            assert reopened.fetchone("SELECT count(*) AS n FROM t")["n"] == 301
+        finally:
+            reopened.close()
+
+    def test_below_threshold_keeps_tombstones(self, db):
+        self.fill(db)
+        db.execute("DELETE FROM t WHERE rowid < 40")
+        assert db.fetchone("SELECT count(*) AS n FROM t_nodes WHERE rid IS NULL")["n"] == 40
+
+    def test_disabled(self, db):
+        self.fill(db, ", compact=0")
+        db.execute("DELETE FROM t WHERE rowid % 2 = 0")
+        assert db.fetchone("SELECT count(*) AS n FROM t_nodes")["n"] == 400
+
+    def test_quantized_vectors_follow(self, db):
+        vectors = self.fill(db, ", quantize=int8")
+        db.execute("DELETE FROM t WHERE rowid % 2 = 0")
+        assert db.fetchone("SELECT count(*) AS n FROM t_vectors")["n"] == 200
+        db.execute("INSERT INTO t(rowid, embedding) VALUES (999, ?)", (vec(vectors[0]),))
+        assert nearest(db, vectors[0], table="t") == [999]
+
+
+# ─────────────────────────────────────────
+# Bulk builds
+# ─────────────────────────────────────────
+
+def docs_table(db, rows):
+    db.execute("CREATE TABLE docs(id INTEGER PRIMARY KEY, embedding BLOB, agent_id INTEGER)")
+    vectors = random_vectors(rows, seed=61)
+    db.executemany(
+        "INSERT INTO docs(id, embedding, agent_id) VALUES (?, ?, ?)",
+        [(i, vec(v), i % 3) for i, v in enumerate(vectors)],
+    )
+    return vectors
+
+
+def build(db, options):
+    return db.fetchone("SELECT vec_index_build('docs', 'embedding', ?) AS n", (options,))["n"]
+
+
+class TestBulkBuild:
+
+    def recall(self, db, vectors, table):
+        hits = 0
+        for query in random_vectors(20, seed=62):
+            expected = set(brute_force(vectors, query, 10))
+            hits += len(expected & set(nearest(db, query, 10, table=table)))
+        return hits / 200
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    def test_build_over_several_shards(self, db, threads):
+        vectors = docs_table(db, 9000)
+        assert build(db, f"dim={DIM}, threads={threads}") == 9000
+        assert db.fetchone("SELECT count(*) AS n FROM docs_embedding_idx_nodes")["n"] == 9000
+        assert self.recall(db, vectors, "docs_embedding_idx") >= 0.9
+        found = sum(nearest(db, vectors[i], table="docs_embedding_idx") == [i] for i in range(0, 9000, 90))
+        assert found >= 98
+
+    def test_graph_persists(self, db):
+        vectors = docs_table(db, 2000)
+        build(db, f"name=docs_vec, dim={DIM}, threads=4")
+        db.close()
+        reopened = cortex.connect(TEST_DB)
+        try:
+            assert self.recall(reopened, vectors, "docs_vec") >= 0.9
+            reopened.execute("INSERT INTO docs(id, embedding) VALUES (5000, ?)", (vec([4.0] * DIM),))
+            assert nearest(reopened, [4.0] * DIM, table="docs_vec") == [5000]
+        finally:
+            reopened.close()
+
+    def test_metadata_and_quantized(self, db):
+        vectors = docs_table(db, 1000)
+        build(db, f"name=docs_vec, dim={DIM}, quantize=int8, threads=4, agent_id INTEGER")
+        rows = db.fetch(
+            "SELECT rowid FROM docs_vec WHERE embedding MATCH ? AND agent_id = 2 AND k = 5",
+            (vec(vectors[8]),),
+        )
+        assert rows[0]["rowid"] == 8
+        assert all(row["rowid"] % 3 == 2 for row in rows)
+
+    def test_progress(self, db):
+        docs_table(db, 9000)
+        calls = []
+        db.build_index("docs", "embedding", f"name=docs_vec, dim={DIM}, threads=2",
+                       progress=lambda done, total: calls.append((done, total)))
+        assert calls == [(8192, 9000), (9000, 9000)]
+        assert nearest(db, [0.0] * DIM, table="docs_vec") != []
+
+    def test_cancel(self, db):
+        docs_table(db, 100)
+        with pytest.raises(Exception, match="cancelled"):
+            db.build_index("docs", "embedding", f"dim={DIM}", progress=lambda done, total: True)
+        assert "docs_embedding_idx" not in table_names(db)
+
+        def fail(done, total):
+            raise KeyError("stop")
+        with pytest.raises(KeyError):
+            db.build_index("docs", "embedding", f"dim={DIM}", progress=fail)
+        assert "docs_embedding_idx" not in table_names(db)
+        db.build_index("docs", "embedding", f"dim={DIM}")
+        assert "docs_embedding_idx" in table_names(db)
+
+    @pytest.mark.parametrize("table, column, options", [
+        ("missing", "embedding", f"dim={DIM}"),
+        ("docs", "missing", f"dim={DIM}"),
+        ("docs", "embedding", ""),
+        ("docs", "embedding", f"name=, dim={DIM}"),
+        ("docs", "embedding", f"dim={DIM}, threads=0"),
+    ])
+    def test_errors(self, db, table, column, options):
+        docs_table(db, 10)
+        with pytest.raises(Exception):
+            db.fetchone("SELECT vec_index_build(?, ?, ?)", (table, column, options))
+
+
+# ─────────────────────────────────────────
+# Batched search
+# ─────────────────────────────────────────
+
+def singles(db, queries, k, table="mem", where=""):
+    return [
+        [(row["rowid"], row["distance"]) for row in db.fetch(
+            f"SELECT rowid, distance FROM {table} WHERE embedding MATCH ? AND k = ?{where}",
+            (vec(query), k),
+        )]
+        for query in queries
+    ]
+
+
+def batched(db, queries, k, table="mem", where=""):
+    rows = db.fetch(
+        f"SELECT query, rowid, distance FROM {table} WHERE queries MATCH ? AND k = ?{where}",
+        (b"".join(vec(query) for query in queries), k),
+    )
+    results = [[] for _ in queries]
+    for row in rows:
+        results[row["query"]].append((row["rowid"], row["distance"]))
+    return results
+
+
+class TestBatchSearch:
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    def test_matches_single_queries(self, db, threads):
+        db.execute(f"CREATE VIRTUAL TABLE many USING vec_hnsw(dim={DIM}, threads={threads})")
+        vectors = random_vectors(1000, seed=71)
+        db.executemany(
+            "INSERT INTO many(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(vectors)],
+        )
+        queries = random_vectors(25, seed=72)
+        assert batched(db, queries, 10, "many") == singles(db, queries, 10, "many")
+
+    @pytest.mark.parametrize("quantize", ["int8", "binary"])
+    def test_quantized_rescore(self, db, quantize):
+        db.execute(f"CREATE VIRTUAL TABLE many USING vec_hnsw(dim={DIM}, metric=cosine,"
+                   f" quantize={quantize}, threads=3)")
+        vectors = random_vectors(500)
+        db.executemany(
+            "INSERT INTO many(rowid, embedding) VALUES (?, ?)",
+            [(i, vec(v)) for i, v in enumerate(vectors)],
+        )
+        # repeated queries share candidates, which are read once
+        queries = vectors[:6] + vectors[:6]
+        results = batched(db, queries, 5, "many")
+        assert results == singles(db, queries, 5, "many")
+        assert [result[0][0] for result in results] == list(range(6)) * 2
+
+    @pytest.mark.parametrize("where", [" AND agent_id = 3", " AND agent_id < 6"])
+    def test_filtered(self, db, where):
+        # the first filter is exact-scanned a block at a time, the second traversed
+        tagged_table(db, ", threads=2")
+        queries = random_vectors(9, seed=73)
+        results = batched(db, queries, 10, "notes", where)
+        assert results == singles(db, queries, 10, "notes", where)
+        assert all(len(result) == 10 for result in results)
+
+    def test_search_many(self, filled):
+        db, vectors = filled
+        queries = [vectors[4], vec(vectors[9]), random_vectors(1, seed=74)[0]]
+        results = db.search_many("mem", queries, k=3)
+        assert [[row["id"] for row in result] for result in results] == [
+            [row["rowid"] for row in knn(db, vectors[4], 3)],
+            [row["rowid"] for row in knn(db, vectors[9], 3)],
+            [row["rowid"] for row in knn(db, queries[2], 3)],
+        ]
+        assert db.search_many("mem", [], k=3) == []
+
+    def test_table_function(self, filled):
+        db, vectors = filled
+        rows = db.fetch(
+            "SELECT query, id, rank FROM vec_search_many('mem', ?, 2)",
+            (f"[{vectors[1]}, {vectors[2]}]",),
+        )
+        assert [(row["query"], row["rank"]) for row in rows] == [(0, 1), (0, 2), (1, 1), (1, 2)]
+        assert rows[0]["id"] == 1 and rows[2]["id"] == 2
+        assert db.fetch("SELECT id FROM vec_search_many('mem', '[]', 2)") == []
+
+    @pytest.mark.parametrize("as_json", [True, False])
+    def test_batch_limit(self, filled, as_json):
+        db, _ = filled
+        n = 100001
+        if as_json:
+            zero = "[" + ", ".join(["0"] * DIM) + "]"
+            queries = "[" + ", ".join([zero] * n) + "]"
+        else:
+            queries = vec([0.0] * DIM) * n
+        with pytest.raises(Exception):
+            db.fetch("SELECT rowid FROM mem WHERE queries MATCH ? AND k = 1", (queries,))
+
+    @pytest.mark.parametrize("sql, params", [
+        ("SELECT rowid FROM mem WHERE queries MATCH ?", (vec([0.0] * DIM),)),
+        ("SELECT rowid FROM mem WHERE queries MATCH ? AND k = 3", (vec([0.0] * (DIM + 1)),)),
+        ("SELECT rowid FROM mem WHERE queries MATCH ? AND k = 3", ("[[1, 2]]",)),
+        ("SELECT rowid FROM mem WHERE queries MATCH ? AND k = 3", ("[1, 2]",)),
+        ("SELECT id FROM vec_search_many('mem', ?)", (vec([0.0] * DIM),)),
+        ("SELECT id FROM vec_search_many('missing', ?, 3)", (vec([0.0] * DIM),)),
+    ])
+    def test_errors(self, filled, sql, params):
+        db, _ = filled
+        with pytest.raises(Exception):
+            db.fetch(sql, params)